@@ -17,11 +17,6 @@
 #include "fa_state_set_hash.h"
 #include "fa_state_group.h"
 
-static fa_trans_t *fa_trans_create_range(fa_state_t *fs,
-                                         fa_symbol_t symfrom,
-                                         fa_symbol_t symto,
-                                         fa_state_t *dest);
-
 static void *fa_t_pool;
 static void *fa_state_t_pool;
 static void *fa_trans_t_pool;
@@ -53,6 +48,7 @@ fa_t *fa_create(void) {
   fa->start = NULL;
   fa->states_n = 0;
   LIST_INIT(&fa->states);
+  LIST_INIT(&fa->accepting);
   fa->trans_n = 0;
 
   return fa;
@@ -82,7 +78,8 @@ fa_t *fa_clone(fa_t *fa) {
       fa_trans_create_range(fsn, ft->symfrom, ft->symto,
                             ft->state->opaque_temp);
 
-    fsn->flags = fs->flags;
+    fsn->flags = fs->flags & ~FA_STATE_F_ACCEPTING;
+    fa_state_accepting(fsn, fs->flags & FA_STATE_F_ACCEPTING);
   }
 
   cfa->start = fa->start->opaque_temp;
@@ -100,6 +97,12 @@ void fa_move(fa_t *fa, fa_t *src) {
     fs->fa = fa;
   }
 
+  while (!LIST_EMPTY(&src->accepting)) {
+    fs = LIST_FIRST(&src->accepting);
+    LIST_REMOVE(fs, alink);
+    LIST_INSERT_HEAD(&fa->accepting, fs, alink);
+  }
+
   fa->states_n += src->states_n;
   fa->trans_n += src->trans_n;
   src->states_n = 0;
@@ -127,24 +130,42 @@ void fa_state_destroy(fa_state_t *fs) {
 
   fs->fa->states_n--;
   LIST_REMOVE(fs, link);
+  if (fs->flags & FA_STATE_F_ACCEPTING)
+    LIST_REMOVE(fs, alink);
 
   fa_mempool_free(fa_state_t_pool, fs);
 }
 
+// set or clear accepting flag and keep fa accepting list in sync
+void fa_state_accepting(fa_state_t *fs, int accepting) {
+  if (accepting) {
+    if (fs->flags & FA_STATE_F_ACCEPTING)
+      return;
+
+    fs->flags |= FA_STATE_F_ACCEPTING;
+    LIST_INSERT_HEAD(&fs->fa->accepting, fs, alink);
+  } else {
+    if (!(fs->flags & FA_STATE_F_ACCEPTING))
+      return;
+
+    // an any end state is only one while accepting
+    fs->flags &= ~(FA_STATE_F_ACCEPTING | FA_STATE_F_ANY_END);
+    LIST_REMOVE(fs, alink);
+  }
+}
+
 void fa_set_accepting_opaque(fa_t *fa, void *opaque) {
   fa_state_t *fs;
 
-  LIST_FOREACH(fs, &fa->states, link)
-    if (fs->flags & FA_STATE_F_ACCEPTING)
-      fs->opaque = opaque;
+  LIST_FOREACH(fs, &fa->accepting, alink)
+    fs->opaque = opaque;
 }
 
 void fa_foreach_accepting(fa_t *fa, fa_foreach_accepting_f cb) {
   fa_state_t *fs;
 
-  LIST_FOREACH(fs, &fa->states, link)
-    if (fs->flags & FA_STATE_F_ACCEPTING)
-      cb(fs->opaque);
+  LIST_FOREACH(fs, &fa->accepting, alink)
+    cb(fs->opaque);
 }
 
 int fa_count_symtrans(fa_t *fa) {
@@ -181,11 +202,11 @@ static fa_trans_t *fa_trans_create_ex(fa_state_t *fs,
   return ft;
 }
 
-// used by fa_clone
-static fa_trans_t *fa_trans_create_range(fa_state_t *fs,
-                                         fa_symbol_t symfrom,
-                                         fa_symbol_t symto,
-                                         fa_state_t *dest) {
+// insert range as is, no merging with existing ranges. used by fa_clone
+fa_trans_t *fa_trans_create_range(fa_state_t *fs,
+                                  fa_symbol_t symfrom,
+                                  fa_symbol_t symto,
+                                  fa_state_t *dest) {
   fa_trans_t *ft;
 
   ft = fa_trans_create_ex(fs, symfrom, symto, dest);
@@ -252,6 +273,70 @@ fa_trans_t *fa_trans_create(fa_state_t *fs,
   return ft;
 }
 
+// insert list of ranges sorted on symfrom in one pass. ranges are merged
+// into the already sorted transition list, then touching or overlapping
+// ranges going to the same state are joined
+void fa_trans_create_list(fa_state_t *fs, fa_trans_range_t *ranges, int n) {
+  fa_trans_t *ft, *cur, *next;
+  int i;
+
+  cur = LIST_FIRST(&fs->trans);
+  for (i = 0; i < n; i++) {
+    ft = fa_trans_create_ex(fs, ranges[i].symfrom, ranges[i].symto,
+                            ranges[i].state);
+
+    while (cur && cur->symfrom < ft->symfrom &&
+           LIST_NEXT(cur, link) &&
+           LIST_NEXT(cur, link)->symfrom < ft->symfrom)
+      cur = LIST_NEXT(cur, link);
+
+    if (!cur)
+      LIST_INSERT_HEAD(&fs->trans, ft, link);
+    else if (cur->symfrom < ft->symfrom)
+      LIST_INSERT_AFTER(cur, ft, link);
+    else
+      LIST_INSERT_BEFORE(cur, ft, link);
+
+    cur = ft;
+  }
+
+  for (ft = LIST_FIRST(&fs->trans); ft; ft = next) {
+    next = LIST_NEXT(ft, link);
+
+    while (next && next->state == ft->state &&
+           (ft->symfrom == FA_SYMBOL_E) == (next->symfrom == FA_SYMBOL_E) &&
+           next->symfrom <= ft->symto + 1) {
+      ft->symto = MMAX(ft->symto, next->symto);
+      fa_trans_destroy(next);
+      next = LIST_NEXT(ft, link);
+    }
+  }
+}
+
+// insert transitions for all symbols set in a 256 bit map
+void fa_trans_create_map(fa_state_t *fs, uint8_t *map, fa_state_t *dest) {
+  fa_trans_range_t ranges[128];
+  int i, n;
+
+  n = 0;
+  for (i = 0; i < 256; i++) {
+    if (!BITFIELD_TEST(map, i))
+      continue;
+
+    if (n > 0 && ranges[n - 1].symto == i - 1) {
+      ranges[n - 1].symto = i;
+      continue;
+    }
+
+    ranges[n].symfrom = i;
+    ranges[n].symto = i;
+    ranges[n].state = dest;
+    n++;
+  }
+
+  fa_trans_create_list(fs, ranges, n);
+}
+
 void fa_trans_destroy(fa_trans_t *ft) {
   LIST_REMOVE(ft, link);
   ft->src->fa->trans_n--;
@@ -289,7 +374,7 @@ fa_t *fa_string_ex(uint8_t *str, int len, int icase) {
     prev = cur;
   }
 
-  prev->flags |= FA_STATE_F_ACCEPTING;
+  fa_state_accepting(prev, 1);
 
   return fa;
 }
@@ -304,6 +389,168 @@ static int fa_trans_has_only_symbol(fa_state_t *fa, fa_symbol_t symbol) {
   return 1;
 }
 
+// state has a 0-255 self loop and otherwise only epsilon transitions, or
+// no other transitions at all if only is set
+static int fa_state_is_any(fa_state_t *fs, int only) {
+  fa_trans_t *ft;
+  int any = 0;
+
+  LIST_FOREACH(ft, &fs->trans, link) {
+    if (ft->symfrom == 0 && ft->symto == 255 && ft->state == fs)
+      any = 1;
+    else if (only || ft->symfrom != FA_SYMBOL_E)
+      return 0;
+  }
+
+  return any;
+}
+
+// unanchored FAs start with an any state, replace them with one shared
+// any state with epsilon transitions to each original start
+static void fa_union_any_start(fa_t **fa, int n) {
+  fa_trans_range_t *ranges = NULL;
+  int ranges_n = 0;
+  int ranges_alloc_n = 0;
+  fa_state_t *any = NULL;
+  fa_state_t *fs;
+  fa_trans_t *ft;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    fs = fa[i]->start;
+    if (!(fs->flags & FA_STATE_F_ANY_START) ||
+        fs->flags & FA_STATE_F_ACCEPTING ||
+        !fa_state_is_any(fs, 0))
+      continue;
+
+    if (!any) {
+      any = fs;
+      continue;
+    }
+
+    while (!LIST_EMPTY(&fs->trans)) {
+      ft = LIST_FIRST(&fs->trans);
+      if (ft->symfrom == FA_SYMBOL_E) {
+        if (ranges_n == ranges_alloc_n) {
+          ranges_alloc_n = ranges_alloc_n ? ranges_alloc_n * 2 : 64;
+          ranges = realloc(ranges, sizeof(ranges[0]) * ranges_alloc_n);
+        }
+        ranges[ranges_n].symfrom = FA_SYMBOL_E;
+        ranges[ranges_n].symto = FA_SYMBOL_E;
+        ranges[ranges_n].state = ft->state;
+        ranges_n++;
+      }
+      fa_trans_destroy(ft);
+    }
+    fa_state_destroy(fs);
+    fa[i]->start = any;
+  }
+
+  if (ranges_n > 0)
+    fa_trans_create_list(any, ranges, ranges_n);
+  free(ranges);
+}
+
+static int fa_state_opaque_cmp(const void *a, const void *b) {
+  uintptr_t oa = (uintptr_t)(*(fa_state_t **)a)->opaque;
+  uintptr_t ob = (uintptr_t)(*(fa_state_t **)b)->opaque;
+
+  return oa < ob ? -1 : oa > ob;
+}
+
+// unanchored FAs end in an accepting any state, any end states with the
+// same opaque are merged and transitions to them redirected
+static void fa_union_any_end(fa_t **fa, int n) {
+  fa_trans_range_t *ranges = NULL;
+  int ranges_alloc_n = 0;
+  fa_state_t **ends = NULL;
+  int ends_n = 0;
+  int ends_alloc_n = 0;
+  int merged = 0;
+  fa_state_t *fs;
+  fa_trans_t *ft;
+  int i, j, k;
+
+  for (i = 0; i < n; i++) {
+    LIST_FOREACH(fs, &fa[i]->accepting, alink) {
+      if (!(fs->flags & FA_STATE_F_ANY_END) || !fa_state_is_any(fs, 1))
+        continue;
+
+      if (ends_n == ends_alloc_n) {
+        ends_alloc_n = ends_alloc_n ? ends_alloc_n * 2 : 64;
+        ends = realloc(ends, sizeof(ends[0]) * ends_alloc_n);
+      }
+      ends[ends_n++] = fs;
+    }
+  }
+
+  if (ends_n < 2) {
+    free(ends);
+    return;
+  }
+
+  qsort(ends, ends_n, sizeof(ends[0]), fa_state_opaque_cmp);
+  for (i = 1, j = 0; i < ends_n; i++) {
+    if (ends[i]->opaque != ends[j]->opaque) {
+      j = i;
+      continue;
+    }
+
+    ends[i]->opaque_temp = ends[j];
+    ends[i]->flags |= FA_STATE_F_MARKED;
+    merged = 1;
+  }
+
+  if (!merged) {
+    free(ends);
+    return;
+  }
+
+  for (i = 0; i < n; i++) {
+    LIST_FOREACH(fs, &fa[i]->states, link) {
+      int redirected = 0;
+
+      if (fs->flags & FA_STATE_F_MARKED)
+        continue;
+
+      k = 0;
+      LIST_FOREACH(ft, &fs->trans, link) {
+        if (ft->state->flags & FA_STATE_F_MARKED) {
+          ft->state = ft->state->opaque_temp;
+          redirected = 1;
+        }
+        k++;
+      }
+
+      if (!redirected)
+        continue;
+
+      // reinsert to join ranges and epsilon transitions to same state
+      if (k > ranges_alloc_n) {
+        ranges_alloc_n = k;
+        ranges = realloc(ranges, sizeof(ranges[0]) * ranges_alloc_n);
+      }
+      k = 0;
+      while (!LIST_EMPTY(&fs->trans)) {
+        ft = LIST_FIRST(&fs->trans);
+        ranges[k].symfrom = ft->symfrom;
+        ranges[k].symto = ft->symto;
+        ranges[k].state = ft->state;
+        k++;
+        fa_trans_destroy(ft);
+      }
+      fa_trans_create_list(fs, ranges, k);
+    }
+  }
+
+  for (i = 0; i < ends_n; i++)
+    if (ends[i]->flags & FA_STATE_F_MARKED)
+      fa_state_destroy(ends[i]);
+
+  free(ranges);
+  free(ends);
+}
+
 // build the union FA from list of FAs
 //
 // ->..1..             /->..1..
@@ -312,13 +559,25 @@ static int fa_trans_has_only_symbol(fa_state_t *fa, fa_symbol_t symbol) {
 //
 fa_t *fa_union_list(fa_t **fa, int n) {
   fa_t *ufa = fa_create();
+  fa_trans_range_t *ranges;
+  int ranges_n;
   int i;
 
   assert(n > 0);
 
+  fa_union_any_start(fa, n);
+  fa_union_any_end(fa, n);
+
+  // all unanchored, shared any state is the new start
+  for (i = 1; i < n; i++)
+    if (fa[i]->start != fa[0]->start)
+      break;
+  if (i == n)
+    ufa->start = fa[0]->start;
+
   // reuses a start state from one of the union fa:s if it only has
   // epsilon transitions
-  for (i = 0; i < n; i++) {
+  for (i = 0; !ufa->start && i < n; i++) {
     if (!fa_trans_has_only_symbol(fa[i]->start, FA_SYMBOL_E))
       continue;
 
@@ -329,13 +588,28 @@ fa_t *fa_union_list(fa_t **fa, int n) {
   if (!ufa->start)
     ufa->start = fa_state_create(ufa);
 
+  // epsilon fan-out is inserted in one go as large unions would make
+  // fa_trans_create quadratic
+  ranges = malloc(sizeof(ranges[0]) * n);
+  ranges_n = 0;
   for (i = 0; i < n; i++) {
-    // don't add transition if we reused start state
-    if (ufa->start != fa[i]->start)
-      fa_trans_create(ufa->start, FA_SYMBOL_E, fa[i]->start);
+    // don't add transition if we reused start state or to shared any
+    // start state more than once
+    if (ufa->start != fa[i]->start &&
+        !(fa[i]->start->flags & FA_STATE_F_MARKED)) {
+      fa[i]->start->flags |= FA_STATE_F_MARKED;
+      ranges[ranges_n].symfrom = FA_SYMBOL_E;
+      ranges[ranges_n].symto = FA_SYMBOL_E;
+      ranges[ranges_n].state = fa[i]->start;
+      ranges_n++;
+    }
     fa_move(ufa, fa[i]);
     fa_destroy(fa[i]);
   }
+  for (i = 0; i < ranges_n; i++)
+    ranges[i].state->flags &= ~FA_STATE_F_MARKED;
+  fa_trans_create_list(ufa->start, ranges, ranges_n);
+  free(ranges);
 
   return ufa;
 }
@@ -350,36 +624,49 @@ fa_t *fa_union(fa_t *a, fa_t *b) {
 // ->..2..  becomes: ->..1..->()->..2..->()->..n..->(o)
 // ->..b..
 //
+// only accepting states are visited and states are moved into the FA with
+// most states, so chained concatenations stay linear
+//
 fa_t *fa_concat_list(fa_t **fa, int n) {
   fa_t *cfa;
-  int i;
+  fa_state_t *start;
+  int i, big;
 
   assert(n > 0);
 
   if (n == 1)
     return fa[0];
 
-  cfa = fa_create();
-  cfa->start = fa[0]->start;
+  start = fa[0]->start;
+  big = 0;
 
   for (i = 0; i < n - 1; i++) {
     fa_state_t *fs;
 
-    LIST_FOREACH(fs, &fa[i]->states, link) {
-      if (!(fs->flags & FA_STATE_F_ACCEPTING))
-        continue;
+    // no longer a start state
+    fa[i + 1]->start->flags &= ~FA_STATE_F_ANY_START;
 
+    while (!LIST_EMPTY(&fa[i]->accepting)) {
+      fs = LIST_FIRST(&fa[i]->accepting);
       fa_trans_create(fs, FA_SYMBOL_E, fa[i+1]->start);
-      fs->flags &= ~FA_STATE_F_ACCEPTING;
+      fa_state_accepting(fs, 0);
     }
 
+    if (fa[i + 1]->states_n > fa[big]->states_n)
+      big = i + 1;
+  }
+
+  cfa = fa[big];
+  cfa->start = start;
+
+  for (i = 0; i < n; i++) {
+    if (i == big)
+      continue;
+
     fa_move(cfa, fa[i]);
     fa_destroy(fa[i]);
   }
 
-  fa_move(cfa, fa[n - 1]);
-  fa_destroy(fa[n - 1]);
-
   return cfa;
 }
 
@@ -422,7 +709,7 @@ fa_t *fa_repeat(fa_t *fa, int min, int max) {
     fal = malloc(sizeof(fal[0]) * (diff + 1));
     fal[diff] = fa_create();
     fal[diff]->start = fa_state_create(fal[diff]);
-    fal[diff]->start->flags |= FA_STATE_F_ACCEPTING;
+    fa_state_accepting(fal[diff]->start, 1);
     for (i = 0; i < diff; i++) {
       fal[i] = fa_clone(fa);
       fa_trans_create(fal[i]->start, FA_SYMBOL_E, fal[diff]->start);
@@ -439,19 +726,29 @@ fa_t *fa_repeat(fa_t *fa, int min, int max) {
 }
 
 // build kleene star FA, match zero or more times
+//
+// loops go back to the old start and a new accepting start matches zero
+// times. making the old start accepting would also accept after a loop back
+// from inside, like "a" for (a*b)*, and fa_union_list and fa_repeat expects
+// a start without incoming transitions
 fa_t *fa_kstar(fa_t *fa) {
-  fa_state_t *fs;
+  fa_state_t *fs, *start;
 
-  // match zero times
-  fa->start->flags |= FA_STATE_F_ACCEPTING;
+  fa->start->flags &= ~FA_STATE_F_ANY_START;
 
-  LIST_FOREACH(fs, &fa->states, link) {
-    if (fs == fa->start || !(fs->flags & FA_STATE_F_ACCEPTING))
+  LIST_FOREACH(fs, &fa->accepting, alink) {
+    if (fs == fa->start)
       continue;
 
     fa_trans_create(fs, FA_SYMBOL_E, fa->start);
+    fs->flags &= ~FA_STATE_F_ANY_END;
   }
 
+  start = fa_state_create(fa);
+  fa_state_accepting(start, 1);
+  fa_trans_create(start, FA_SYMBOL_E, fa->start);
+  fa->start = start;
+
   return fa;
 }
 
@@ -496,12 +793,10 @@ fa_t *fa_remove_unreachable(fa_t *fa) {
 fa_t *fa_remove_accepting_trans(fa_t *fa) {
   fa_state_t *fs;
 
-  LIST_FOREACH(fs, &fa->states, link) {
-    if (!(fs->flags & FA_STATE_F_ACCEPTING))
-      continue;
-
+  LIST_FOREACH(fs, &fa->accepting, alink) {
     while (!LIST_EMPTY(&fs->trans))
       fa_trans_destroy(LIST_FIRST(&fs->trans));
+    fs->flags &= ~FA_STATE_F_ANY_END;
   }
 
   return fa_remove_unreachable(fa);
@@ -580,9 +875,19 @@ fa_t *fa_determinize_ex(fa_t *fa, fa_state_pri_f pri_cb,
   fa_state_tqhead_t unmarked = TAILQ_HEAD_INITIALIZER(unmarked);
   fa_state_t *fs;
   fa_state_set_hash_t *fssh;
+  fa_trans_range_t ranges[256];
+  int ranges_n;
+  int eps;
   int i;
   int cancel;
 
+  // epsilon transitions are sorted first
+  eps = 0;
+  LIST_FOREACH(fs, &fa->states, link)
+    if (!LIST_EMPTY(&fs->trans) &&
+        LIST_FIRST(&fs->trans)->symfrom == FA_SYMBOL_E)
+      eps = 1;
+
   cancel = 0;
   fssh = fa_state_set_hash_create(FA_DETERMINIZE_HASH_SIZE);
   dfa = fa_create();
@@ -605,6 +910,7 @@ fa_t *fa_determinize_ex(fa_t *fa, fa_state_pri_f pri_cb,
 
     fa_state_set_syms(ts);
 
+    ranges_n = 0;
     for (i = 0; i < 256; i++) {
       fa_state_t *u;
       fa_state_set_t *reachable;
@@ -615,8 +921,14 @@ fa_t *fa_determinize_ex(fa_t *fa, fa_state_pri_f pri_cb,
       // build set of states reachable with symbol followed by epsilon
       // transition from current state set
       reachable = fa_reachable(ts, i);
-      eclosure = fa_eclosure(reachable);
-      fa_state_set_destroy(reachable);
+      if (eps) {
+        eclosure = fa_eclosure(reachable);
+        fa_state_set_destroy(reachable);
+      } else {
+        // epsilon free, eclosure would be the same set
+        fa_state_set_sort(reachable);
+        eclosure = reachable;
+      }
 
       // state for state set already exist?
       u = fa_state_set_hash_find(fssh, eclosure);
@@ -629,9 +941,20 @@ fa_t *fa_determinize_ex(fa_t *fa, fa_state_pri_f pri_cb,
         TAILQ_INSERT_TAIL(&unmarked, u, tempq);
       }
 
-      fa_trans_create(t, i, u);
+      if (ranges_n > 0 &&
+         ranges[ranges_n - 1].state == u &&
+         ranges[ranges_n - 1].symto == i - 1) {
+        ranges[ranges_n - 1].symto = i;
+      } else {
+        ranges[ranges_n].symfrom = i;
+        ranges[ranges_n].symto = i;
+        ranges[ranges_n].state = u;
+        ranges_n++;
+      }
     }
 
+    fa_trans_create_list(t, ranges, ranges_n);
+
     if ((timeout && *timeout) ||
        (limit && (fa->states_n > limit->states ||
                   fa->trans_n > limit->trans)))
@@ -687,7 +1010,7 @@ fa_t *fa_determinize_ex(fa_t *fa, fa_state_pri_f pri_cb,
 
     // some original state in set was accepting
     if (s->flags & FA_STATE_F_ACCEPTING)
-      fs->flags |= FA_STATE_F_ACCEPTING;
+      fa_state_accepting(fs, 1);
 
     fa_state_set_destroy(s);
   }
@@ -825,7 +1148,8 @@ fa_t *fa_minimize_ex(fa_t *fa, fa_state_cmp_f cmp_cb, int *timeout) {
   fa_state_group_t *group, *next;
   fa_state_t *fs;
   fa_t *mdfa;
-  int i;
+  fa_trans_range_t ranges[256];
+  int ranges_n;
   int change;
   int cancel;
 
@@ -886,10 +1210,16 @@ fa_t *fa_minimize_ex(fa_t *fa, fa_state_cmp_f cmp_cb, int *timeout) {
       c = TAILQ_FIRST(&group->states);
       fs = c->opaque_temp;
 
-      // create transitions between groups
-      LIST_FOREACH(ft, &c->trans, link)
-        for (i = ft->symfrom; i <= ft->symto; i++)
-          fa_trans_create(fs, i, ft->state->opaque_temp);
+      // create transitions between groups, candidate transitions are
+      // already sorted
+      ranges_n = 0;
+      LIST_FOREACH(ft, &c->trans, link) {
+        ranges[ranges_n].symfrom = ft->symfrom;
+        ranges[ranges_n].symto = ft->symto;
+        ranges[ranges_n].state = ft->state->opaque_temp;
+        ranges_n++;
+      }
+      fa_trans_create_list(fs, ranges, ranges_n);
 
       // group has original start state
       if (fa_state_group_has_state(group, fa->start))
@@ -897,7 +1227,7 @@ fa_t *fa_minimize_ex(fa_t *fa, fa_state_cmp_f cmp_cb, int *timeout) {
 
       // candidate is accepting
       if (c->flags & FA_STATE_F_ACCEPTING)
-        fs->flags |= FA_STATE_F_ACCEPTING;
+        fa_state_accepting(fs, 1);
 
       fs->opaque = c->opaque;
     }
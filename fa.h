@@ -42,12 +42,17 @@ extern fa_mempool_free_f *fa_mempool_free;
 
 typedef struct fa_state_s {
   LIST_ENTRY(fa_state_s) link; // fa_s.states list
+  LIST_ENTRY(fa_state_s) alink; // fa_s.accepting list
   TAILQ_ENTRY(fa_state_s) tempq; // fa_determinize, fa_minimize groups
   STAILQ_ENTRY(fa_state_s) tempsq; // fa_eclosure, fa_remove_unreachable
 
   struct fa_s *fa;
+  // use fa_state_accepting to change, keeps fa_s.accepting in sync
 #define FA_STATE_F_ACCEPTING (1 << 0)
 #define FA_STATE_F_MARKED    (1 << 1) // fa_remove_unreachable
+// 0-255 self loop state added when unanchoring, see fa_union_list
+#define FA_STATE_F_ANY_START (1 << 2)
+#define FA_STATE_F_ANY_END   (1 << 3)
   uint32_t flags;
   fa_trans_head_t trans;
   void *opaque_temp; // used internally for various temp extra state info
@@ -64,9 +69,18 @@ typedef struct fa_trans_s {
 } fa_trans_t;
 
 
+// used by fa_trans_create_list
+typedef struct fa_trans_range_s {
+  fa_symbol_t symfrom;
+  fa_symbol_t symto;
+  fa_state_t *state;
+} fa_trans_range_t;
+
+
 typedef struct fa_s {
   fa_state_t *start;
   fa_state_head_t states;
+  fa_state_head_t accepting;
   int states_n;
   int trans_n;
 } fa_t;
@@ -84,11 +98,18 @@ fa_t *fa_clone(fa_t *fa);
 void fa_move(fa_t *fa, fa_t *src);
 fa_state_t *fa_state_create(fa_t *fa);
 void fa_state_destroy(fa_state_t *fs);
+void fa_state_accepting(fa_state_t *fs, int accepting);
 void fa_set_accepting_opaque(fa_t *fa, void *opaque);
 void fa_foreach_accepting(fa_t *fa, fa_foreach_accepting_f cb);
 int fa_count_symtrans(fa_t *fa);
 fa_trans_t *fa_trans_create(fa_state_t *fs, fa_symbol_t symbol,
                             fa_state_t *dest);
+fa_trans_t *fa_trans_create_range(fa_state_t *fs,
+                                  fa_symbol_t symfrom,
+                                  fa_symbol_t symto,
+                                  fa_state_t *dest);
+void fa_trans_create_list(fa_state_t *fs, fa_trans_range_t *ranges, int n);
+void fa_trans_create_map(fa_state_t *fs, uint8_t *map, fa_state_t *dest);
 void fa_trans_destroy(fa_trans_t *ft);
 
 // reuses input fa:s, no need to free them
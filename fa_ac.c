@@ -0,0 +1,367 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+// Aho-Corasick multi string matcher. the trie is first built with sorted
+// sibling lists and then renumbered breadth first into index arrays, which
+// makes failure links point to lower node ids and lets them be computed in
+// one pass in node order
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "fa.h"
+#include "fa_misc.h"
+#include "fa_sim.h"
+#include "fa_ac.h"
+
+// trie while inserting strings
+typedef struct fa_ac_trie_s {
+  uint32_t *child; // first child, 0 is none as root is never a child
+  uint32_t *sibling; // next sibling with higher symbol
+  uint8_t *sym;
+  int32_t *match; // index into match or -1
+  uint32_t n;
+  uint32_t alloc_n;
+  uint32_t root[256];
+} fa_ac_trie_t;
+
+
+static uint32_t fa_ac_trie_node(fa_ac_trie_t *t, uint8_t sym) {
+  if (t->n == t->alloc_n) {
+    t->alloc_n = t->alloc_n ? t->alloc_n * 2 : 256;
+    t->child = realloc(t->child, sizeof(t->child[0]) * t->alloc_n);
+    t->sibling = realloc(t->sibling, sizeof(t->sibling[0]) * t->alloc_n);
+    t->sym = realloc(t->sym, sizeof(t->sym[0]) * t->alloc_n);
+    t->match = realloc(t->match, sizeof(t->match[0]) * t->alloc_n);
+  }
+
+  t->child[t->n] = 0;
+  t->sibling[t->n] = 0;
+  t->sym[t->n] = sym;
+  t->match[t->n] = -1;
+
+  return t->n++;
+}
+
+// find or insert child of node, siblings are kept sorted on symbol
+static uint32_t fa_ac_trie_child(fa_ac_trie_t *t, uint32_t node,
+                                 uint8_t sym) {
+  uint32_t prev, c, n;
+
+  if (node == 0) {
+    if (!t->root[sym])
+      t->root[sym] = fa_ac_trie_node(t, sym);
+    return t->root[sym];
+  }
+
+  prev = 0;
+  for (c = t->child[node]; c && t->sym[c] < sym; c = t->sibling[c])
+    prev = c;
+  if (c && t->sym[c] == sym)
+    return c;
+
+  n = fa_ac_trie_node(t, sym);
+  t->sibling[n] = c;
+  if (prev)
+    t->sibling[prev] = n;
+  else
+    t->child[node] = n;
+
+  return n;
+}
+
+static void fa_ac_trie_free(fa_ac_trie_t *t) {
+  free(t->child);
+  free(t->sibling);
+  free(t->sym);
+  free(t->match);
+}
+
+// goto transition of a non-root node, 0 if none
+static uint32_t fa_ac_goto(fa_ac_t *ac, uint32_t node, uint8_t sym) {
+  uint32_t l = ac->index[node];
+  uint32_t h = ac->index[node + 1];
+
+  while (l < h) {
+    uint32_t m = l + (h - l) / 2;
+
+    if (ac->syms[m] == sym)
+      return ac->next[m];
+    if (ac->syms[m] < sym)
+      l = m + 1;
+    else
+      h = m;
+  }
+
+  return 0;
+}
+
+static uint32_t fa_ac_step(fa_ac_t *ac, uint32_t node, uint8_t sym) {
+  uint32_t n;
+
+  while (node != 0) {
+    n = fa_ac_goto(ac, node, sym);
+    if (n)
+      return n;
+    node = ac->fail[node];
+  }
+
+  return ac->root[sym];
+}
+
+fa_ac_t *fa_ac_create(uint8_t **strs, int *lens, int n, void **opaques,
+                      uint32_t flags) {
+  fa_ac_trie_t t;
+  fa_ac_t *ac;
+  uint32_t *order; // bfs order to trie node
+  uint32_t *renum; // trie node to bfs order
+  uint32_t i, k, e, c, q;
+  int j;
+
+  ac = calloc(1, sizeof(*ac));
+  for (i = 0; i < 256; i++)
+    ac->fold[i] = flags & FA_AC_F_ICASE ? tolower(i) : i;
+
+  memset(&t, 0, sizeof(t));
+  fa_ac_trie_node(&t, 0); // root
+
+  ac->match = malloc(sizeof(ac->match[0]) * (n > 0 ? n : 1));
+  for (j = 0; j < n; j++) {
+    int len = lens ? lens[j] : (int)strlen((char *)strs[j]);
+    uint32_t node = 0;
+    int l;
+
+    if (len == 0)
+      continue;
+
+    for (l = 0; l < len; l++)
+      node = fa_ac_trie_child(&t, node, ac->fold[strs[j][l]]);
+
+    // duplicate, first one wins
+    if (t.match[node] != -1)
+      continue;
+
+    t.match[node] = ac->match_n;
+    ac->match[ac->match_n].opaque = opaques ? opaques[j] : NULL;
+    ac->match[ac->match_n].len = len;
+    ac->match[ac->match_n].next = NULL;
+    ac->match_n++;
+  }
+
+  // renumber breadth first, children are appended in symbol order so the
+  // goto transitions of each node end up sorted
+  ac->nodes_n = t.n;
+  ac->index = malloc(sizeof(ac->index[0]) * (t.n + 1));
+  ac->syms = malloc(sizeof(ac->syms[0]) * t.n);
+  ac->next = malloc(sizeof(ac->next[0]) * t.n);
+  ac->fail = malloc(sizeof(ac->fail[0]) * t.n);
+  ac->matches = malloc(sizeof(ac->matches[0]) * t.n);
+  order = malloc(sizeof(order[0]) * t.n);
+  renum = malloc(sizeof(renum[0]) * t.n);
+
+  order[0] = 0;
+  renum[0] = 0;
+  q = 1;
+  e = 0;
+  for (k = 0; k < t.n; k++) {
+    uint32_t tn = order[k];
+
+    ac->index[k] = e;
+    if (tn == 0) {
+      for (i = 0; i < 256; i++) {
+        if (!t.root[i])
+          continue;
+        renum[t.root[i]] = q;
+        order[q++] = t.root[i];
+        ac->syms[e] = i;
+        ac->next[e] = renum[t.root[i]];
+        e++;
+      }
+    } else {
+      for (c = t.child[tn]; c; c = t.sibling[c]) {
+        renum[c] = q;
+        order[q++] = c;
+        ac->syms[e] = t.sym[c];
+        ac->next[e] = renum[c];
+        e++;
+      }
+    }
+  }
+  ac->index[t.n] = e;
+
+  for (i = 0; i < 256; i++)
+    ac->root[i] = t.root[i] ? renum[t.root[i]] : 0;
+
+  // failure links and match chains, parents and failure nodes always have
+  // lower ids so they are done before their children
+  ac->fail[0] = 0;
+  ac->matches[0] = NULL;
+  for (k = 0; k < t.n; k++) {
+    for (e = ac->index[k]; e < ac->index[k + 1]; e++) {
+      uint32_t w = ac->next[e];
+      int32_t m = t.match[order[w]];
+
+      ac->fail[w] = k == 0 ? 0 : fa_ac_step(ac, ac->fail[k], ac->syms[e]);
+
+      if (m != -1) {
+        ac->match[m].next = ac->matches[ac->fail[w]];
+        ac->matches[w] = &ac->match[m];
+      } else
+        ac->matches[w] = ac->matches[ac->fail[w]];
+    }
+  }
+
+  free(order);
+  free(renum);
+  fa_ac_trie_free(&t);
+
+  return ac;
+}
+
+void fa_ac_destroy(fa_ac_t *ac) {
+  free(ac->index);
+  free(ac->syms);
+  free(ac->next);
+  free(ac->fail);
+  free(ac->matches);
+  free(ac->match);
+  free(ac);
+}
+
+fa_t *fa_ac_fa(fa_ac_t *ac) {
+  fa_trans_range_t ranges[256];
+  uint32_t row[256];
+  uint32_t *chain = NULL;
+  uint32_t chain_alloc_n = 0;
+  uint32_t chain_n;
+  fa_state_t **fss;
+  fa_t *fa;
+  uint32_t i, u, e;
+  int s, n;
+
+  fa = fa_create();
+  fss = malloc(sizeof(fss[0]) * ac->nodes_n);
+
+  for (i = 0; i < ac->nodes_n; i++) {
+    fss[i] = fa_state_create(fa);
+    if (ac->matches[i]) {
+      fa_state_accepting(fss[i], 1);
+      fss[i]->opaque = ac->matches[i];
+    }
+    if (i == 0)
+      fa->start = fss[i];
+  }
+
+  for (i = 0; i < ac->nodes_n; i++) {
+    // collect failure chain, apply goto transitions from the root and down
+    // so that deeper nodes override
+    chain_n = 0;
+    for (u = i; u != 0; u = ac->fail[u]) {
+      if (chain_n == chain_alloc_n) {
+        chain_alloc_n = chain_alloc_n ? chain_alloc_n * 2 : 64;
+        chain = realloc(chain, sizeof(chain[0]) * chain_alloc_n);
+      }
+      chain[chain_n++] = u;
+    }
+
+    memcpy(row, ac->root, sizeof(row));
+    while (chain_n > 0) {
+      u = chain[--chain_n];
+      for (e = ac->index[u]; e < ac->index[u + 1]; e++)
+        row[ac->syms[e]] = ac->next[e];
+    }
+
+    n = 0;
+    for (s = 0; s < 256; s++) {
+      fa_state_t *dest = fss[row[ac->fold[s]]];
+
+      if (n > 0 && ranges[n - 1].state == dest) {
+        ranges[n - 1].symto = s;
+        continue;
+      }
+
+      ranges[n].symfrom = s;
+      ranges[n].symto = s;
+      ranges[n].state = dest;
+      n++;
+    }
+
+    fa_trans_create_list(fss[i], ranges, n);
+  }
+
+  free(chain);
+  free(fss);
+
+  return fa;
+}
+
+void fa_ac_run_init(fa_ac_t *ac, fa_ac_run_t *run) {
+  run->current = 0;
+  run->offset = 0;
+}
+
+static void fa_ac_report(fa_ac_match_t *m, size_t offset,
+                         fa_ac_match_f *cb, void *ctx) {
+  for (; m; m = m->next)
+    cb(offset, m, ctx);
+}
+
+void fa_ac_run(fa_ac_t *ac, fa_ac_run_t *run, uint8_t *bytes, int len,
+               fa_ac_match_f *cb, void *ctx) {
+  uint32_t current = run->current;
+  int i;
+
+  for (i = 0; i < len; i++) {
+    current = fa_ac_step(ac, current, ac->fold[bytes[i]]);
+    if (ac->matches[current])
+      fa_ac_report(ac->matches[current], run->offset + i + 1, cb, ctx);
+  }
+
+  run->current = current;
+  run->offset += len;
+}
+
+void fa_ac_sim_run(fa_sim_t *sim, fa_sim_run_t *fsr, size_t offset,
+                   uint8_t *bytes, int len, fa_ac_match_f *cb, void *ctx) {
+  uint32_t current = fsr->current;
+  int i;
+
+  for (i = 0; i < len; i++) {
+    current = sim->nodes[current].table[bytes[i]];
+    if (sim->nodes[current].flags & FA_SIM_NODE_F_ACCEPTING)
+      fa_ac_report(sim->nodes[current].opaque, offset + i + 1, cb, ctx);
+  }
+
+  fsr->current = current;
+}
+
+void fa_ac_sim_runv(fa_sim_t *sim, fa_sim_run_t *fsr, size_t offset,
+                    const struct iovec *iov, int iovcnt,
+                    fa_ac_match_f *cb, void *ctx) {
+  uint32_t current = fsr->current;
+  uint8_t *bytes;
+  size_t len, j;
+  int i;
+
+  for (i = 0; i < iovcnt; i++) {
+    if (i + 1 < iovcnt)
+      __builtin_prefetch(iov[i + 1].iov_base);
+
+    bytes = iov[i].iov_base;
+    len = iov[i].iov_len;
+    for (j = 0; j < len; j++) {
+      current = sim->nodes[current].table[bytes[j]];
+      if (sim->nodes[current].flags & FA_SIM_NODE_F_ACCEPTING)
+        fa_ac_report(sim->nodes[current].opaque, offset + j + 1, cb, ctx);
+    }
+    offset += len;
+  }
+
+  fsr->current = current;
+}
@@ -0,0 +1,75 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_AC_H__
+#define __FA_AC_H__
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "fa.h"
+#include "fa_sim.h"
+
+// Aho-Corasick automaton for finding all occurrences of a set of strings,
+// including overlapping ones. nodes are numbered in breadth first order,
+// node 0 is the root. goto transitions for node i are
+// syms/next[index[i]] up to syms/next[index[i+1]] sorted on symbol
+
+typedef struct fa_ac_match_s {
+  void *opaque;
+  int len; // string length
+  struct fa_ac_match_s *next; // longest string that is a suffix or NULL
+} fa_ac_match_t;
+
+typedef struct fa_ac_s {
+  uint32_t nodes_n;
+  uint32_t *index; // nodes_n + 1 offsets into syms and next
+  uint8_t *syms;
+  uint32_t *next;
+  uint32_t *fail; // failure link per node
+  fa_ac_match_t **matches; // strings matching when at node or NULL
+  fa_ac_match_t *match; // one per unique string
+  uint32_t match_n;
+  uint32_t root[256]; // root goto, 0 stays at root
+  uint8_t fold[256]; // input symbol to trie symbol
+} fa_ac_t;
+
+typedef struct fa_ac_run_s {
+  uint32_t current;
+  size_t offset;
+} fa_ac_run_t;
+
+// offset is the stream offset just after the last byte of the occurrence
+typedef void (fa_ac_match_f)(size_t offset, fa_ac_match_t *match,
+                             void *ctx);
+
+#define FA_AC_F_ICASE (1 << 0)
+
+// empty strings are ignored. if a string occurs more than once the opaque
+// of the first one is used
+fa_ac_t *fa_ac_create(uint8_t **strs, int *lens, int n, void **opaques,
+                      uint32_t flags);
+void fa_ac_destroy(fa_ac_t *ac);
+// full DFA with all failure transitions resolved, accepting states have
+// the fa_ac_match_t chain as opaque. only valid while ac exists
+fa_t *fa_ac_fa(fa_ac_t *ac);
+
+void fa_ac_run_init(fa_ac_t *ac, fa_ac_run_t *run);
+// scan bytes using failure links, cb is called for each occurrence
+void fa_ac_run(fa_ac_t *ac, fa_ac_run_t *run, uint8_t *bytes, int len,
+               fa_ac_match_f *cb, void *ctx);
+// scan bytes with sim of fa_ac_fa, offset is stream offset of bytes[0]
+void fa_ac_sim_run(fa_sim_t *sim, fa_sim_run_t *fsr, size_t offset,
+                   uint8_t *bytes, int len, fa_ac_match_f *cb, void *ctx);
+// same as fa_ac_sim_run over the segments one after another, offset is of
+// the first byte of the first segment
+void fa_ac_sim_runv(fa_sim_t *sim, fa_sim_run_t *fsr, size_t offset,
+                    const struct iovec *iov, int iovcnt,
+                    fa_ac_match_f *cb, void *ctx);
+
+#endif
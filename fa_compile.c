@@ -0,0 +1,164 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+// divide and conquer compile. level 0 determinizes and minimizes every
+// input, each following level unions pairs from the previous level until
+// one DFA is left. jobs within a level are independent and are taken by
+// worker threads from a shared counter. determinize and minimize is done
+// on the csr representation
+
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "fa.h"
+#include "fa_csr.h"
+#include "fa_dfa.h"
+#include "fa_compile.h"
+
+typedef struct fa_compile_s {
+  fa_t **in;
+  fa_t **out;
+  int in_n;
+  int jobs_n;
+  int level; // 0 determinizes inputs, others union pairs
+  int next; // next job, protected by lock
+  pthread_mutex_t lock;
+  fa_state_pri_f *pri_cb;
+  fa_state_cmp_f *cmp_cb;
+  int *timeout;
+} fa_compile_t;
+
+
+// reuses fa, returns NULL on timeout
+static fa_t *fa_compile_min(fa_compile_t *c, fa_t *fa, int determinize) {
+  fa_csr_t *csr, *tcsr;
+
+  csr = fa_csr_create(fa);
+  fa_destroy(fa);
+
+  if (determinize) {
+    tcsr = fa_csr_determinize_ex(csr, c->pri_cb, NULL, c->timeout);
+    fa_csr_destroy(csr);
+    csr = tcsr;
+    if (!csr)
+      return NULL;
+  }
+
+  tcsr = fa_csr_minimize_ex(csr, c->cmp_cb, c->timeout);
+  fa_csr_destroy(csr);
+  csr = tcsr;
+  if (!csr)
+    return NULL;
+
+  fa = fa_csr_fa(csr);
+  fa_csr_destroy(csr);
+
+  return fa;
+}
+
+static fa_t *fa_compile_job(fa_compile_t *c, int job) {
+  fa_t *a, *b, *u;
+
+  if (c->level == 0)
+    return fa_compile_min(c, c->in[job], 1);
+
+  a = c->in[job * 2];
+  // odd one out is passed on as is
+  if (job * 2 + 1 == c->in_n)
+    return a;
+  b = c->in[job * 2 + 1];
+
+  u = NULL;
+  if (a && b && !(c->timeout && *c->timeout))
+    u = fa_dfa_union(a, b, c->pri_cb, NULL, c->timeout);
+  if (a)
+    fa_destroy(a);
+  if (b)
+    fa_destroy(b);
+
+  return u ? fa_compile_min(c, u, 0) : NULL;
+}
+
+static void *fa_compile_worker(void *arg) {
+  fa_compile_t *c = arg;
+  int job;
+
+  while (1) {
+    pthread_mutex_lock(&c->lock);
+    job = c->next++;
+    pthread_mutex_unlock(&c->lock);
+
+    if (job >= c->jobs_n)
+      break;
+
+    c->out[job] = fa_compile_job(c, job);
+  }
+
+  return NULL;
+}
+
+static void fa_compile_level(fa_compile_t *c, int threads) {
+  pthread_t *tids;
+  int i, n;
+
+  c->next = 0;
+
+  n = threads < c->jobs_n ? threads : c->jobs_n;
+  // calling thread is one of the workers
+  n = n > 1 ? n - 1 : 0;
+  tids = malloc(sizeof(tids[0]) * (n > 0 ? n : 1));
+  for (i = 0; i < n; i++)
+    pthread_create(&tids[i], NULL, fa_compile_worker, c);
+  fa_compile_worker(c);
+  for (i = 0; i < n; i++)
+    pthread_join(tids[i], NULL);
+  free(tids);
+}
+
+fa_t *fa_compile_list(fa_t **fa, int n, fa_state_pri_f pri_cb,
+                      fa_state_cmp_f cmp_cb, int threads, int *timeout) {
+  fa_compile_t c;
+  fa_t **tmp;
+  fa_t *result;
+
+  assert(n > 0);
+
+  c.in = malloc(sizeof(c.in[0]) * n);
+  c.out = malloc(sizeof(c.out[0]) * n);
+  for (c.in_n = 0; c.in_n < n; c.in_n++)
+    c.in[c.in_n] = fa[c.in_n];
+  c.jobs_n = n;
+  c.level = 0;
+  c.pri_cb = pri_cb;
+  c.cmp_cb = cmp_cb;
+  c.timeout = timeout;
+  pthread_mutex_init(&c.lock, NULL);
+
+  while (1) {
+    fa_compile_level(&c, threads);
+
+    tmp = c.in;
+    c.in = c.out;
+    c.out = tmp;
+    c.in_n = c.jobs_n;
+
+    if (c.in_n == 1)
+      break;
+    c.jobs_n = (c.in_n + 1) / 2;
+    c.level++;
+  }
+
+  result = c.in[0];
+
+  pthread_mutex_destroy(&c.lock);
+  free(c.in);
+  free(c.out);
+
+  return result;
+}
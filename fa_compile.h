@@ -0,0 +1,30 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_COMPILE_H__
+#define __FA_COMPILE_H__
+
+#include "fa.h"
+
+// compile a list of FAs into one minimal DFA. each FA is determinized and
+// minimized on its own, the DFAs are then merged pairwise in a balanced
+// tree using fa_dfa_union and minimized after each merge. the work at each
+// level of the tree is spread over threads threads, 0 or 1 compiles using
+// only the calling thread
+//
+// pri_cb is only given opaques from two DFAs at a time while merging so it
+// has to choose using a fixed order over the opaques, like lowest pattern
+// number, to give the same result as determinizing the union. with
+// threads > 1 pri_cb, cmp_cb and the fa_mempool callbacks has to be thread
+// safe
+//
+// reuses input fa:s, no need to free them. returns NULL on timeout
+fa_t *fa_compile_list(fa_t **fa, int n, fa_state_pri_f pri_cb,
+                      fa_state_cmp_f cmp_cb, int threads, int *timeout);
+
+#endif
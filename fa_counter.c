@@ -0,0 +1,761 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+// the nfa is built left to right from the regexp tree like a thompson
+// construction, each sub expression gives a start state and a list of
+// dangling edges that are patched to the start of what follows
+//
+// a counter state has no edges of its own except the exit edge. while
+// running each counter keeps the times (byte offsets) a count was started
+// that are still in range. a byte not in the counted chars clears the
+// counter, otherwise the value of a start is the number of bytes since it.
+// starts with a value above max can not exit and are dropped, without max
+// a start reaching min marks the counter as saturated and is dropped. so at
+// most max or min starts are kept and each byte is constant work per
+// counter
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "fa.h"
+#include "fa_misc.h"
+#include "fa_regexp.h"
+#include "fa_regexp_class.h"
+#include "fa_regexp_bin.h"
+#include "fa_sim.h"
+#include "fa_counter.h"
+
+#define FA_COUNTER_MAP_N (256 / 8)
+#define FA_COUNTER_PENDING UINT32_MAX
+
+// edge with its from state, sorted into fa_counter_t edges when done
+typedef struct fa_counter_build_edge_s {
+  uint32_t from;
+  fa_counter_edge_t edge;
+} fa_counter_build_edge_t;
+
+typedef struct fa_counter_build_s {
+  fa_counter_t *fc;
+  fa_counter_build_edge_t *edges;
+  uint32_t edges_n;
+  uint32_t edges_alloc_n;
+  uint32_t states_alloc_n;
+  uint32_t maps_alloc_n;
+  uint32_t counters_alloc_n;
+  char **errstr;
+  int *errpos;
+} fa_counter_build_t;
+
+// sub expression, start state and edges still to be patched
+typedef struct fa_counter_frag_s {
+  uint32_t start;
+  uint32_t *outs;
+  uint32_t outs_n;
+} fa_counter_frag_t;
+
+
+static uint32_t fa_counter_state(fa_counter_build_t *b) {
+  fa_counter_t *fc = b->fc;
+  fa_counter_state_t *s;
+
+  if (fc->states_n == b->states_alloc_n) {
+    b->states_alloc_n = MMAX(64, b->states_alloc_n * 2);
+    fc->states = realloc(fc->states,
+                         sizeof(fc->states[0]) * b->states_alloc_n);
+  }
+
+  s = &fc->states[fc->states_n];
+  s->edges = 0;
+  s->edges_n = 0;
+  s->counter = -1;
+  s->accepting = 0;
+
+  return fc->states_n++;
+}
+
+static uint32_t fa_counter_edge(fa_counter_build_t *b, uint32_t from,
+                                int32_t map, uint32_t next) {
+  fa_counter_build_edge_t *e;
+
+  if (b->edges_n == b->edges_alloc_n) {
+    b->edges_alloc_n = MMAX(64, b->edges_alloc_n * 2);
+    b->edges = realloc(b->edges, sizeof(b->edges[0]) * b->edges_alloc_n);
+  }
+
+  e = &b->edges[b->edges_n];
+  e->from = from;
+  e->edge.map = map;
+  e->edge.next = next;
+
+  return b->edges_n++;
+}
+
+static int32_t fa_counter_map(fa_counter_build_t *b, uint8_t *map) {
+  fa_counter_t *fc = b->fc;
+
+  if (fc->maps_n == b->maps_alloc_n) {
+    b->maps_alloc_n = MMAX(16, b->maps_alloc_n * 2);
+    fc->maps = realloc(fc->maps, sizeof(fc->maps[0]) * b->maps_alloc_n);
+  }
+  memcpy(fc->maps[fc->maps_n], map, FA_COUNTER_MAP_N);
+
+  return fc->maps_n++;
+}
+
+static void fa_counter_out(fa_counter_frag_t *f, uint32_t e) {
+  // grow on power of 2
+  if ((f->outs_n & (f->outs_n - 1)) == 0)
+    f->outs = realloc(f->outs,
+                      sizeof(f->outs[0]) * (MMAX(4, f->outs_n * 2)));
+  f->outs[f->outs_n++] = e;
+}
+
+// move outs of b to a
+static void fa_counter_outs(fa_counter_frag_t *a, fa_counter_frag_t *b) {
+  uint32_t i;
+
+  for (i = 0; i < b->outs_n; i++)
+    fa_counter_out(a, b->outs[i]);
+  free(b->outs);
+  b->outs = NULL;
+  b->outs_n = 0;
+}
+
+static void fa_counter_patch(fa_counter_build_t *b, fa_counter_frag_t *f,
+                             uint32_t next) {
+  uint32_t i;
+
+  for (i = 0; i < f->outs_n; i++)
+    b->edges[f->outs[i]].edge.next = next;
+  free(f->outs);
+  f->outs = NULL;
+  f->outs_n = 0;
+}
+
+// state with one dangling epsilon edge
+static void fa_counter_empty(fa_counter_build_t *b, fa_counter_frag_t *f) {
+  f->start = fa_counter_state(b);
+  fa_counter_out(f, fa_counter_edge(b, f->start, FA_COUNTER_EDGE_EPSILON,
+                                    FA_COUNTER_PENDING));
+}
+
+static void fa_counter_char(uint8_t *map, uint8_t c, uint32_t flags) {
+  BITFIELD_SET(map, c);
+  if (flags & FA_REGEXP_F_ICASE && isalpha(c)) {
+    BITFIELD_SET(map, toupper(c));
+    BITFIELD_SET(map, tolower(c));
+  }
+}
+
+// chars of a single char sub expression, returns 0 if not single char
+static int fa_counter_single(fa_regexp_node_t *node, uint32_t flags,
+                             uint8_t *map) {
+  while (node->type == RE_SUB)
+    node = node->value.sub.sub;
+
+  memset(map, 0, FA_COUNTER_MAP_N);
+  if (node->type == RE_STRING && node->value.string.len == 1) {
+    fa_counter_char(map, node->value.string.str[0], flags);
+    return 1;
+  } else if (node->type == RE_CLASS) {
+    fa_regexp_class_map(node->value.class_.class_, node->value.class_.neg,
+                        flags & FA_REGEXP_F_ICASE, map);
+    return 1;
+  }
+
+  return 0;
+}
+
+static int fa_counter_map_empty(uint8_t *map) {
+  int i;
+
+  for (i = 0; i < FA_COUNTER_MAP_N; i++)
+    if (map[i])
+      return 0;
+
+  return 1;
+}
+
+static void fa_counter_binary(fa_counter_build_t *b, fa_t *fa,
+                              fa_counter_frag_t *f) {
+  uint8_t map[FA_COUNTER_MAP_N];
+  fa_state_t *fs;
+  fa_trans_t *ft;
+  uint32_t from;
+  int c;
+
+  // number states in opaque_temp
+  LIST_FOREACH(fs, &fa->states, link)
+    fs->opaque_temp = (void *)(uintptr_t)fa_counter_state(b);
+
+  LIST_FOREACH(fs, &fa->states, link) {
+    from = (uintptr_t)fs->opaque_temp;
+
+    LIST_FOREACH(ft, &fs->trans, link) {
+      if (ft->symfrom == FA_SYMBOL_E) {
+        fa_counter_edge(b, from, FA_COUNTER_EDGE_EPSILON,
+                        (uintptr_t)ft->state->opaque_temp);
+        continue;
+      }
+
+      memset(map, 0, sizeof(map));
+      for (c = ft->symfrom; c <= ft->symto; c++)
+        BITFIELD_SET(map, c);
+      fa_counter_edge(b, from, fa_counter_map(b, map),
+                      (uintptr_t)ft->state->opaque_temp);
+    }
+
+    if (fs->flags & FA_STATE_F_ACCEPTING)
+      fa_counter_out(f, fa_counter_edge(b, from, FA_COUNTER_EDGE_EPSILON,
+                                        FA_COUNTER_PENDING));
+  }
+
+  f->start = (uintptr_t)fa->start->opaque_temp;
+}
+
+static int fa_counter_node(fa_counter_build_t *b, fa_regexp_node_t *node,
+                           uint32_t *flags, fa_counter_frag_t *f);
+
+// min copies of sub followed by max - min optional copies or a loop
+static int fa_counter_repeat(fa_counter_build_t *b, fa_regexp_node_t *node,
+                             uint32_t *flags, fa_counter_frag_t *f) {
+  uint8_t map[FA_COUNTER_MAP_N];
+  fa_counter_frag_t sf;
+  fa_counter_counter_t *cc;
+  fa_regexp_node_t *sub;
+  uint32_t start_flags, sub_flags;
+  uint32_t s, last;
+  int min, max;
+  int i, k;
+
+  sub = node->value.repeat.sub;
+  min = node->value.repeat.min;
+  max = node->value.repeat.onlymin ? min : node->value.repeat.max;
+  k = MMAX(min, max);
+  start_flags = *flags;
+
+  if (node->value.repeat.onlymin && min == 0) {
+    fa_counter_empty(b, f);
+    return 0;
+  }
+
+  if (max != 0 && min > max) {
+    *b->errpos = node->pos;
+    *b->errstr = "min repeat must be less or equal to max repeat";
+    return -1;
+  }
+
+  if (k >= 2 && fa_counter_single(sub, start_flags, map)) {
+    fa_counter_t *fc = b->fc;
+
+    if (fa_counter_map_empty(map)) {
+      *b->errpos = node->pos;
+      *b->errstr = "character class does not match any characters";
+      return -1;
+    }
+
+    if (fc->counters_n == b->counters_alloc_n) {
+      b->counters_alloc_n = MMAX(8, b->counters_alloc_n * 2);
+      fc->counters = realloc(fc->counters,
+                             sizeof(fc->counters[0]) * b->counters_alloc_n);
+    }
+
+    f->start = fa_counter_state(b);
+    fc->states[f->start].counter = fc->counters_n;
+    cc = &fc->counters[fc->counters_n++];
+    cc->map = fa_counter_map(b, map);
+    cc->min = min;
+    cc->max = max;
+    cc->exit = fa_counter_edge(b, f->start, FA_COUNTER_EDGE_EXIT,
+                               FA_COUNTER_PENDING);
+    fa_counter_out(f, cc->exit);
+
+    return 0;
+  }
+
+  // sub is built once for each copy with the flags at the repeat
+  f->start = FA_COUNTER_PENDING;
+  f->outs = NULL;
+  f->outs_n = 0;
+  last = FA_COUNTER_PENDING;
+  for (i = 0; i < (MMAX(min, 1)); i++) {
+    sub_flags = start_flags;
+    if (fa_counter_node(b, sub, i == 0 ? flags : &sub_flags, &sf) == -1)
+      goto error;
+    if (f->start == FA_COUNTER_PENDING)
+      f->start = sf.start;
+    else
+      fa_counter_patch(b, f, sf.start);
+    last = sf.start;
+    fa_counter_outs(f, &sf);
+  }
+
+  if (max == 0) {
+    // loop back to last copy, a* is a loop that can skip the copy
+    s = fa_counter_state(b);
+    fa_counter_patch(b, f, s);
+    fa_counter_edge(b, s, FA_COUNTER_EDGE_EPSILON, last);
+    fa_counter_out(f, fa_counter_edge(b, s, FA_COUNTER_EDGE_EPSILON,
+                                      FA_COUNTER_PENDING));
+    if (min == 0)
+      f->start = s;
+
+    return 0;
+  }
+
+  if (min == 0) {
+    // a? same as optional copy below but first
+    s = fa_counter_state(b);
+    fa_counter_edge(b, s, FA_COUNTER_EDGE_EPSILON, f->start);
+    fa_counter_out(f, fa_counter_edge(b, s, FA_COUNTER_EDGE_EPSILON,
+                                      FA_COUNTER_PENDING));
+    f->start = s;
+    min = 1;
+  }
+
+  for (i = min; i < max; i++) {
+    fa_counter_frag_t skip;
+
+    sub_flags = start_flags;
+    if (fa_counter_node(b, sub, &sub_flags, &sf) == -1)
+      goto error;
+    s = fa_counter_state(b);
+    fa_counter_patch(b, f, s);
+    fa_counter_edge(b, s, FA_COUNTER_EDGE_EPSILON, sf.start);
+    skip.outs = NULL;
+    skip.outs_n = 0;
+    fa_counter_out(&skip, fa_counter_edge(b, s, FA_COUNTER_EDGE_EPSILON,
+                                          FA_COUNTER_PENDING));
+    fa_counter_outs(f, &sf);
+    fa_counter_outs(f, &skip);
+  }
+
+  return 0;
+
+error:
+  free(f->outs);
+  f->outs = NULL;
+  return -1;
+}
+
+// flags is the options scope like when lowering in fa_regexp_node_fa
+static int fa_counter_node(fa_counter_build_t *b, fa_regexp_node_t *node,
+                           uint32_t *flags, fa_counter_frag_t *f) {
+  uint8_t map[FA_COUNTER_MAP_N];
+  fa_counter_frag_t sf;
+  uint32_t sub_flags;
+  uint32_t s;
+  fa_t *fa;
+  int i;
+
+  f->outs = NULL;
+  f->outs_n = 0;
+
+  switch (node->type) {
+    case RE_SUB:
+      sub_flags = *flags;
+      return fa_counter_node(b, node->value.sub.sub, &sub_flags, f);
+    case RE_OPTIONS:
+      *flags =
+        (*flags & ~node->value.options.flags) |
+        (node->value.options.neg ? 0 : node->value.options.flags);
+      return fa_counter_node(b, node->value.options.sub, flags, f);
+    case RE_CONCAT:
+      for (i = 0; i < node->value.concat.n; i++) {
+        if (fa_counter_node(b, node->value.concat.subs[i], flags, &sf) == -1)
+          goto error;
+        if (i == 0)
+          f->start = sf.start;
+        else
+          fa_counter_patch(b, f, sf.start);
+        fa_counter_outs(f, &sf);
+      }
+      break;
+    case RE_UNION:
+      f->start = fa_counter_state(b);
+      for (i = 0; i < node->value.union_.n; i++) {
+        if (fa_counter_node(b, node->value.union_.subs[i], flags, &sf) == -1)
+          goto error;
+        fa_counter_edge(b, f->start, FA_COUNTER_EDGE_EPSILON, sf.start);
+        fa_counter_outs(f, &sf);
+      }
+      break;
+    case RE_REPEAT:
+      return fa_counter_repeat(b, node, flags, f);
+    case RE_STRING:
+      if (node->value.string.len == 0) {
+        fa_counter_empty(b, f);
+        break;
+      }
+
+      for (i = 0; i < node->value.string.len; i++) {
+        s = fa_counter_state(b);
+        if (i == 0)
+          f->start = s;
+        else
+          fa_counter_patch(b, f, s);
+        memset(map, 0, sizeof(map));
+        fa_counter_char(map, node->value.string.str[i], *flags);
+        fa_counter_out(f, fa_counter_edge(b, s, fa_counter_map(b, map),
+                                          FA_COUNTER_PENDING));
+      }
+      break;
+    case RE_CLASS:
+      fa_regexp_class_map(node->value.class_.class_, node->value.class_.neg,
+                          *flags & FA_REGEXP_F_ICASE, map);
+      // [^\x00-\xff] matches nothing
+      if (fa_counter_map_empty(map)) {
+        *b->errstr = "character class does not match any characters";
+        *b->errpos = node->pos;
+        return -1;
+      }
+
+      f->start = fa_counter_state(b);
+      fa_counter_out(f, fa_counter_edge(b, f->start, fa_counter_map(b, map),
+                                        FA_COUNTER_PENDING));
+      break;
+    case RE_BINARY:
+      if (fa_regexp_bin_bitlen(node->value.binary) % 8 != 0) {
+        *b->errstr = "binary is not byte aligned";
+        *b->errpos = node->pos;
+        return -1;
+      }
+
+      fa = fa_regexp_bin_fa(node->value.binary);
+      fa_counter_binary(b, fa, f);
+      fa_destroy(fa);
+      break;
+  }
+
+  return 0;
+
+error:
+  free(f->outs);
+  f->outs = NULL;
+  return -1;
+}
+
+// sort edges by from state
+static void fa_counter_finish(fa_counter_build_t *b) {
+  fa_counter_t *fc = b->fc;
+  uint32_t *exits;
+  uint32_t i, j;
+
+  for (i = 0; i < b->edges_n; i++)
+    fc->states[b->edges[i].from].edges_n++;
+  j = 0;
+  for (i = 0; i < fc->states_n; i++) {
+    fc->states[i].edges = j;
+    j += fc->states[i].edges_n;
+    fc->states[i].edges_n = 0;
+  }
+
+  // exit edges are referenced by counters, remap them
+  exits = malloc(sizeof(exits[0]) * (MMAX(b->edges_n, 1)));
+  fc->edges = malloc(sizeof(fc->edges[0]) * (MMAX(b->edges_n, 1)));
+  fc->edges_n = b->edges_n;
+  for (i = 0; i < b->edges_n; i++) {
+    fa_counter_state_t *s = &fc->states[b->edges[i].from];
+
+    exits[i] = s->edges + s->edges_n++;
+    fc->edges[exits[i]] = b->edges[i].edge;
+  }
+  for (i = 0; i < fc->counters_n; i++)
+    fc->counters[i].exit = exits[fc->counters[i].exit];
+
+  free(exits);
+}
+
+fa_counter_t *fa_counter_regexp(char *str, int dot_all, char **errstr,
+                                int *errpos) {
+  fa_counter_build_t b;
+  fa_counter_frag_t f;
+  fa_regexp_node_t *root;
+  fa_counter_t *fc;
+  uint32_t flags;
+  uint32_t accept;
+  char *s;
+  int len;
+  int r;
+
+  *errstr = NULL;
+  *errpos = 0;
+  s = str;
+  len = strlen(str);
+
+  fc = calloc(1, sizeof(*fc));
+
+  if (s[0] == '^') {
+    fc->start_anchor = 1;
+    s++;
+    len--;
+  }
+
+  // if ends with "$" and its not escaped
+  if (len > 0 && s[len-1] == '$' &&
+      (len == 1 || (len > 1 && s[len-2] != '\\'))) {
+    fc->end_anchor = 1;
+    len--;
+  }
+
+  root = fa_regexp_yacc_parse(s, len, dot_all, errstr, errpos);
+  if (*errstr)
+    goto error;
+
+  memset(&b, 0, sizeof(b));
+  b.fc = fc;
+  b.errstr = errstr;
+  b.errpos = errpos;
+  flags = 0;
+
+  fa_regexp_node_flatten(root);
+  fa_regexp_node_simplify(root);
+  r = fa_counter_node(&b, root, &flags, &f);
+  fa_regexp_node_free(root);
+  if (r == -1) {
+    free(b.edges);
+    goto error;
+  }
+
+  accept = fa_counter_state(&b);
+  fc->states[accept].accepting = 1;
+  fa_counter_patch(&b, &f, accept);
+  fc->start = f.start;
+
+  fa_counter_finish(&b);
+  free(b.edges);
+
+  return fc;
+
+error:
+  if (*errpos > 0 && fc->start_anchor)
+    (*errpos)++; // ^ was removed
+  fa_counter_destroy(fc);
+
+  return NULL;
+}
+
+void fa_counter_destroy(fa_counter_t *fc) {
+  free(fc->states);
+  free(fc->edges);
+  free(fc->maps);
+  free(fc->counters);
+  free(fc);
+}
+
+fa_counter_run_t *fa_counter_run_create(fa_counter_t *fc) {
+  fa_counter_run_t *run;
+  uint32_t i;
+
+  run = calloc(1, sizeof(*run));
+  run->fc = fc;
+  run->mark = calloc(fc->states_n, sizeof(run->mark[0]));
+  run->cur = malloc(sizeof(run->cur[0]) * fc->states_n);
+  run->next = malloc(sizeof(run->next[0]) * fc->states_n);
+  run->stack = malloc(sizeof(run->stack[0]) * fc->states_n);
+  run->sets = calloc(MMAX(fc->counters_n, 1), sizeof(run->sets[0]));
+  for (i = 0; i < fc->counters_n; i++) {
+    fa_counter_counter_t *cc = &fc->counters[i];
+
+    // values in range are distinct and at most max, or below min
+    run->sets[i].size = (cc->max ? cc->max : cc->min) + 1;
+    run->sets[i].times = malloc(sizeof(run->sets[i].times[0]) *
+                                run->sets[i].size);
+  }
+
+  fa_counter_run_init(run);
+
+  return run;
+}
+
+void fa_counter_run_destroy(fa_counter_run_t *run) {
+  uint32_t i;
+
+  for (i = 0; i < run->fc->counters_n; i++)
+    free(run->sets[i].times);
+  free(run->sets);
+  free(run->mark);
+  free(run->cur);
+  free(run->next);
+  free(run->stack);
+  free(run);
+}
+
+// add state and its epsilon closure to next
+static void fa_counter_add(fa_counter_run_t *run, uint32_t state) {
+  fa_counter_t *fc = run->fc;
+  uint32_t stack_n;
+  uint32_t i;
+
+  if (run->mark[state] == run->gen)
+    return;
+  run->mark[state] = run->gen;
+  run->stack[0] = state;
+  stack_n = 1;
+
+  while (stack_n > 0) {
+    fa_counter_state_t *s = &fc->states[run->stack[--stack_n]];
+
+    run->next[run->next_n++] = s - fc->states;
+    if (s->accepting)
+      run->accepting = 1;
+
+    for (i = s->edges; i < s->edges + s->edges_n; i++) {
+      fa_counter_edge_t *e = &fc->edges[i];
+
+      if (e->map >= 0 ||
+          (e->map == FA_COUNTER_EDGE_EXIT &&
+           fc->counters[s->counter].min > 0) ||
+          run->mark[e->next] == run->gen)
+        continue;
+
+      run->mark[e->next] = run->gen;
+      run->stack[stack_n++] = e->next;
+    }
+  }
+}
+
+static void fa_counter_swap(fa_counter_run_t *run) {
+  uint32_t *t;
+
+  t = run->cur;
+  run->cur = run->next;
+  run->cur_n = run->next_n;
+  run->next = t;
+  run->next_n = 0;
+  run->gen++;
+  // wrapped, marks may be from an earlier lap
+  if (run->gen == 0) {
+    memset(run->mark, 0, sizeof(run->mark[0]) * run->fc->states_n);
+    run->gen = 1;
+  }
+}
+
+void fa_counter_run_init(fa_counter_run_t *run) {
+  uint32_t i;
+
+  for (i = 0; i < run->fc->counters_n; i++) {
+    run->sets[i].head = 0;
+    run->sets[i].n = 0;
+    run->sets[i].sat = 0;
+  }
+  run->t = 0;
+  run->gen = 1;
+  memset(run->mark, 0, sizeof(run->mark[0]) * run->fc->states_n);
+  run->next_n = 0;
+  run->accepting = 0;
+  fa_counter_add(run, run->fc->start);
+  run->accepted = run->accepting;
+  fa_counter_swap(run);
+}
+
+static void fa_counter_step(fa_counter_run_t *run, uint8_t c) {
+  fa_counter_t *fc = run->fc;
+  fa_counter_set_t *set;
+  fa_counter_counter_t *cc;
+  uint32_t i, j;
+
+  run->accepting = 0;
+
+  for (i = 0; i < fc->counters_n; i++)
+    if (!BITFIELD_TEST(fc->maps[fc->counters[i].map], c)) {
+      run->sets[i].n = 0;
+      run->sets[i].sat = 0;
+    }
+
+  for (i = 0; i < run->cur_n; i++) {
+    fa_counter_state_t *s = &fc->states[run->cur[i]];
+
+    if (s->counter >= 0) {
+      set = &run->sets[s->counter];
+      cc = &fc->counters[s->counter];
+      if (!BITFIELD_TEST(fc->maps[cc->map], c))
+        continue;
+
+      // same start from more than one path is counted once
+      if (set->n > 0 &&
+          set->times[(set->head + set->n - 1) % set->size] == run->t)
+        continue;
+      set->times[(set->head + set->n) % set->size] = run->t;
+      set->n++;
+      continue;
+    }
+
+    for (j = s->edges; j < s->edges + s->edges_n; j++) {
+      fa_counter_edge_t *e = &fc->edges[j];
+
+      if (e->map >= 0 && BITFIELD_TEST(fc->maps[e->map], c))
+        fa_counter_add(run, e->next);
+    }
+  }
+
+  run->t++;
+
+  for (i = 0; i < fc->counters_n; i++) {
+    set = &run->sets[i];
+    cc = &fc->counters[i];
+
+    // oldest start first so has the largest value
+    while (set->n > 0) {
+      uint64_t value = run->t - set->times[set->head];
+
+      if (cc->max ? value <= cc->max : value < cc->min)
+        break;
+      if (!cc->max)
+        set->sat = 1;
+      set->head = (set->head + 1) % set->size;
+      set->n--;
+    }
+
+    if (cc->max ?
+        set->n > 0 && run->t - set->times[set->head] >= cc->min :
+        set->sat)
+      fa_counter_add(run, fc->edges[cc->exit].next);
+  }
+
+  if (!fc->start_anchor)
+    fa_counter_add(run, fc->start);
+
+  fa_counter_swap(run);
+  if (run->accepting)
+    run->accepted = 1;
+}
+
+// no states and no running counters
+static int fa_counter_dead(fa_counter_run_t *run) {
+  uint32_t i;
+
+  if (run->cur_n > 0)
+    return 0;
+  for (i = 0; i < run->fc->counters_n; i++)
+    if (run->sets[i].n > 0 || run->sets[i].sat)
+      return 0;
+
+  return 1;
+}
+
+int fa_counter_run(fa_counter_run_t *run, uint8_t *bytes, int len) {
+  int i;
+
+  for (i = 0; i < len; i++) {
+    if (!run->fc->end_anchor && run->accepted)
+      return FA_SIM_RUN_ACCEPT;
+    if (fa_counter_dead(run))
+      return FA_SIM_RUN_REJECT;
+
+    fa_counter_step(run, bytes[i]);
+  }
+
+  if (run->fc->end_anchor ? run->accepting : run->accepted)
+    return FA_SIM_RUN_ACCEPT;
+  if (fa_counter_dead(run))
+    return FA_SIM_RUN_REJECT;
+
+  return FA_SIM_RUN_MORE;
+}
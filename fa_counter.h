@@ -0,0 +1,94 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_COUNTER_H__
+#define __FA_COUNTER_H__
+
+#include <inttypes.h>
+
+#include "fa.h"
+
+// nfa with bounded counters for regexps with large counted repeats. a
+// repeat of a single char class like [0-9a-f]{1,4096} is one counter state
+// instead of thousands of cloned states. the matcher simulates the nfa one
+// byte at a time keeping the set of counter values for each counter state,
+// so time is linear in input length and memory does not depend on it.
+// other repeats are expanded like fa_repeat does
+
+typedef struct fa_counter_edge_s {
+  uint32_t next;
+#define FA_COUNTER_EDGE_EPSILON -1
+#define FA_COUNTER_EDGE_EXIT -2 // leave counter when value is in range
+  int32_t map; // index in maps or FA_COUNTER_EDGE_*
+} fa_counter_edge_t;
+
+typedef struct fa_counter_state_s {
+  uint32_t edges; // first edge
+  uint32_t edges_n;
+  int32_t counter; // index in counters or -1
+  uint8_t accepting;
+} fa_counter_state_t;
+
+typedef struct fa_counter_counter_s {
+  int32_t map; // chars counted
+  uint32_t min;
+  uint32_t max; // 0 is no max
+  uint32_t exit; // exit edge
+} fa_counter_counter_t;
+
+typedef struct fa_counter_s {
+  uint32_t start;
+  int start_anchor;
+  int end_anchor;
+  fa_counter_state_t *states;
+  uint32_t states_n;
+  fa_counter_edge_t *edges;
+  uint32_t edges_n;
+  uint8_t (*maps)[256 / 8];
+  uint32_t maps_n;
+  fa_counter_counter_t *counters;
+  uint32_t counters_n;
+} fa_counter_t;
+
+// values of one counter, entry times in a ring buffer
+typedef struct fa_counter_set_s {
+  uint64_t *times;
+  uint32_t size;
+  uint32_t head;
+  uint32_t n;
+  int sat; // some value reached min, only used without max
+} fa_counter_set_t;
+
+typedef struct fa_counter_run_s {
+  fa_counter_t *fc;
+  uint64_t t; // bytes run
+  uint32_t gen;
+  uint32_t *mark; // gen per state when in next
+  uint32_t *cur;
+  uint32_t cur_n;
+  uint32_t *next;
+  uint32_t next_n;
+  uint32_t *stack;
+  fa_counter_set_t *sets;
+  int accepting; // current states has accepting state
+  int accepted; // accepted before, used without end anchor
+} fa_counter_run_t;
+
+// same syntax and anchoring as fa_regexp_fa_ex
+fa_counter_t *fa_counter_regexp(char *str, int dot_all, char **errstr,
+                                int *errpos);
+void fa_counter_destroy(fa_counter_t *fc);
+
+fa_counter_run_t *fa_counter_run_create(fa_counter_t *fc);
+void fa_counter_run_destroy(fa_counter_run_t *run);
+void fa_counter_run_init(fa_counter_run_t *run);
+// returns FA_SIM_RUN_* like fa_sim_run, can be called many times to run
+// input in parts
+int fa_counter_run(fa_counter_run_t *run, uint8_t *bytes, int len);
+
+#endif
@@ -0,0 +1,1660 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+// compact index based fa representation. states are 32 bit ids and each
+// state has a contiguous sorted range of transitions (compressed sparse
+// row layout). determinize and minimize work directly on it without
+// chasing list pointers.
+//
+// memory per state is index + flags + opaque and 8 bytes per transition
+// range, compared to fa_state_t/fa_trans_t list nodes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/queue.h>
+
+#include "fa.h"
+#include "fa_misc.h"
+#include "fa_csr.h"
+#include "fa_sim.h"
+#include "fa_thread.h"
+
+typedef struct fa_csr_build_s {
+  fa_csr_t *csr;
+  uint32_t states_alloc_n;
+  uint32_t trans_alloc_n;
+} fa_csr_build_t;
+
+// where the minimize signature of state i starts, room for the class and
+// (symfrom, symto, class) per transition of the states before it
+#define FA_CSR_SIG_OFF(csr, i) ((i) + (csr)->index[i] * 3)
+
+// arrays of fa_csr_sets_t that can be backed by files
+#define FA_CSR_SETS_POOL 0
+#define FA_CSR_SETS_OFF 1
+#define FA_CSR_SETS_LEN 2
+#define FA_CSR_SETS_HASH 3
+#define FA_CSR_SETS_TABLE 4
+#define FA_CSR_SETS_FILES 5
+
+// pool of sorted state id sets with hash lookup, one set per dfa state
+typedef struct fa_csr_sets_s {
+  uint32_t *pool;
+  size_t pool_n;
+  size_t pool_alloc_n;
+  size_t *off;
+  uint32_t *len;
+  uint32_t *hash;
+  uint32_t n;
+  uint32_t alloc_n;
+  uint32_t *table; // set id + 1, 0 is empty
+  uint32_t table_size; // power of 2
+  int fds[FA_CSR_SETS_FILES]; // -1 if in memory
+  size_t sizes[FA_CSR_SETS_FILES]; // mapped bytes of file backed arrays
+} fa_csr_sets_t;
+
+
+fa_csr_t *fa_csr_create(fa_t *fa) {
+  fa_csr_t *csr;
+  fa_state_t *fs;
+  fa_trans_t *ft;
+  uint32_t i, t;
+
+  csr = calloc(1, sizeof(*csr));
+
+  i = 0;
+  LIST_FOREACH(fs, &fa->states, link)
+    fs->opaque_temp = (void *)(uintptr_t)i++;
+
+  csr->states_n = i;
+  csr->trans_n = fa->trans_n;
+  csr->start = (uintptr_t)fa->start->opaque_temp;
+  csr->index = malloc(sizeof(csr->index[0]) * (csr->states_n + 1));
+  csr->trans = malloc(sizeof(csr->trans[0]) * (csr->trans_n + 1));
+  csr->flags = malloc(sizeof(csr->flags[0]) * (csr->states_n + 1));
+  csr->opaque = malloc(sizeof(csr->opaque[0]) * (csr->states_n + 1));
+
+  i = 0;
+  t = 0;
+  LIST_FOREACH(fs, &fa->states, link) {
+    csr->index[i] = t;
+    csr->flags[i] = fs->flags & FA_STATE_F_ACCEPTING;
+    csr->opaque[i] = fs->opaque;
+
+    // state transition list is already sorted on symfrom, epsilon first
+    LIST_FOREACH(ft, &fs->trans, link) {
+      csr->trans[t].symfrom = ft->symfrom;
+      csr->trans[t].symto = ft->symto;
+      csr->trans[t].state = (uintptr_t)ft->state->opaque_temp;
+      t++;
+    }
+
+    i++;
+  }
+  csr->index[i] = t;
+
+  return csr;
+}
+
+void fa_csr_destroy(fa_csr_t *csr) {
+  free(csr->index);
+  free(csr->trans);
+  free(csr->flags);
+  free(csr->opaque);
+  free(csr);
+}
+
+fa_t *fa_csr_fa(fa_csr_t *csr) {
+  fa_t *fa;
+  fa_state_t **states;
+  uint32_t i;
+  int t;
+
+  fa = fa_create();
+  states = malloc(sizeof(states[0]) * (csr->states_n + 1));
+
+  // created in reverse so that fa->states list is in csr order
+  for (i = csr->states_n; i > 0; i--)
+    states[i - 1] = fa_state_create(fa);
+
+  for (i = 0; i < csr->states_n; i++) {
+    fa_state_accepting(states[i], csr->flags[i] & FA_STATE_F_ACCEPTING);
+    states[i]->opaque = csr->opaque[i];
+
+    // insert in reverse to always insert at head of the sorted list
+    for (t = csr->index[i + 1] - 1; t >= (int)csr->index[i]; t--)
+      fa_trans_create_range(states[i],
+                            csr->trans[t].symfrom,
+                            csr->trans[t].symto,
+                            states[csr->trans[t].state]);
+  }
+
+  fa->start = states[csr->start];
+  free(states);
+
+  return fa;
+}
+
+static void fa_csr_build_init(fa_csr_build_t *b) {
+  b->csr = calloc(1, sizeof(*b->csr));
+  b->states_alloc_n = 0;
+  b->trans_alloc_n = 0;
+}
+
+static uint32_t fa_csr_build_state(fa_csr_build_t *b,
+                                   uint8_t flags, void *opaque) {
+  fa_csr_t *csr = b->csr;
+
+  if (csr->states_n + 1 >= b->states_alloc_n) {
+    b->states_alloc_n = b->states_alloc_n ? b->states_alloc_n * 2 : 64;
+    csr->index = realloc(csr->index,
+                         sizeof(csr->index[0]) * b->states_alloc_n);
+    csr->flags = realloc(csr->flags,
+                         sizeof(csr->flags[0]) * b->states_alloc_n);
+    csr->opaque = realloc(csr->opaque,
+                          sizeof(csr->opaque[0]) * b->states_alloc_n);
+  }
+
+  csr->flags[csr->states_n] = flags;
+  csr->opaque[csr->states_n] = opaque;
+
+  return csr->states_n++;
+}
+
+// states must have their transitions added in state id order
+static void fa_csr_build_trans_begin(fa_csr_build_t *b, uint32_t state) {
+  b->csr->index[state] = b->csr->trans_n;
+}
+
+// add transition to current state, merges with previous range if possible
+static void fa_csr_build_trans(fa_csr_build_t *b,
+                               fa_symbol_t symfrom, fa_symbol_t symto,
+                               uint32_t dest, uint32_t state) {
+  fa_csr_t *csr = b->csr;
+  fa_csr_trans_t *prev;
+
+  if (csr->trans_n > csr->index[state]) {
+    prev = &csr->trans[csr->trans_n - 1];
+    if (prev->state == dest && symfrom != FA_SYMBOL_E &&
+       prev->symto + 1 == symfrom) {
+      prev->symto = symto;
+      return;
+    }
+  }
+
+  if (csr->trans_n == b->trans_alloc_n) {
+    b->trans_alloc_n = b->trans_alloc_n ? b->trans_alloc_n * 2 : 256;
+    csr->trans = realloc(csr->trans,
+                         sizeof(csr->trans[0]) * b->trans_alloc_n);
+  }
+
+  csr->trans[csr->trans_n].symfrom = symfrom;
+  csr->trans[csr->trans_n].symto = symto;
+  csr->trans[csr->trans_n].state = dest;
+  csr->trans_n++;
+}
+
+static fa_csr_t *fa_csr_build_finish(fa_csr_build_t *b) {
+  fa_csr_t *csr = b->csr;
+
+  // fa_csr_build_state always leaves room for the end offset
+  csr->index[csr->states_n] = csr->trans_n;
+
+  return csr;
+}
+
+static uint32_t fa_csr_hash_ids(uint32_t *ids, uint32_t n) {
+  uint32_t h = 2166136261u;
+  uint32_t i;
+
+  for (i = 0; i < n; i++) {
+    h ^= ids[i];
+    h *= 16777619u;
+  }
+
+  return h;
+}
+
+// resize file and reserve blocks for the grown part so a full file system
+// is an error here instead of SIGBUS when writing through a mapping.
+// returns -1 on error
+static int fa_csr_file_resize(int fd, size_t old_size, size_t size) {
+  int r;
+
+  if (ftruncate(fd, size) == -1)
+    return -1;
+  if (size <= old_size)
+    return 0;
+
+  r = posix_fallocate(fd, old_size, size - old_size);
+  // file systems without support can only be trusted on ftruncate
+  return r == 0 || r == EINVAL || r == EOPNOTSUPP ? 0 : -1;
+}
+
+// grow or, with zero, replace array a. file backed arrays are mapped
+// shared from an unlinked file so the kernel can write them out when
+// memory is short. returns NULL if a file backed array could not be
+// resized, p is then still mapped
+static void *fa_csr_sets_alloc(fa_csr_sets_t *sets, int a, void *p,
+                               size_t old_size, size_t size, int zero) {
+  int fd = sets->fds[a];
+  void *q;
+
+  if (fd == -1) {
+    if (!zero)
+      return realloc(p, size);
+    free(p);
+    return calloc(1, size);
+  }
+
+  if (zero && ftruncate(fd, 0) == -1)
+    return NULL;
+  if (fa_csr_file_resize(fd, zero ? 0 : old_size, size) == -1)
+    return NULL;
+  // map new before unmapping old so a failure keeps p
+  q = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (q == MAP_FAILED)
+    return NULL;
+  if (p)
+    munmap(p, old_size);
+  sets->sizes[a] = size;
+
+  return q;
+}
+
+static void fa_csr_sets_init(fa_csr_sets_t *sets) {
+  int a;
+
+  memset(sets, 0, sizeof(*sets));
+  for (a = 0; a < FA_CSR_SETS_FILES; a++)
+    sets->fds[a] = -1;
+  sets->table_size = 256;
+  sets->table = calloc(sets->table_size, sizeof(sets->table[0]));
+}
+
+// same as fa_csr_sets_init but with arrays in temporary files in dir,
+// returns -1 if files can not be created
+static int fa_csr_sets_init_file(fa_csr_sets_t *sets, char *dir) {
+  char *path;
+  int a;
+
+  memset(sets, 0, sizeof(*sets));
+  path = malloc(strlen(dir) + sizeof("/fa_csr_XXXXXX"));
+  if (!path)
+    return -1;
+  for (a = 0; a < FA_CSR_SETS_FILES; a++) {
+    sprintf(path, "%s/fa_csr_XXXXXX", dir);
+    sets->fds[a] = mkstemp(path);
+    if (sets->fds[a] == -1)
+      break;
+    unlink(path);
+  }
+  free(path);
+
+  if (a < FA_CSR_SETS_FILES) {
+    while (a-- > 0)
+      close(sets->fds[a]);
+    return -1;
+  }
+
+  sets->table_size = 256;
+  sets->table = fa_csr_sets_alloc(sets, FA_CSR_SETS_TABLE, NULL, 0,
+                                  sizeof(sets->table[0]) * sets->table_size,
+                                  1);
+  if (!sets->table) {
+    for (a = 0; a < FA_CSR_SETS_FILES; a++)
+      close(sets->fds[a]);
+    return -1;
+  }
+
+  return 0;
+}
+
+static void fa_csr_sets_free(fa_csr_sets_t *sets) {
+  int a;
+
+  if (sets->fds[0] == -1) {
+    free(sets->pool);
+    free(sets->off);
+    free(sets->len);
+    free(sets->hash);
+    free(sets->table);
+    return;
+  }
+
+  // sizes as arrays may be left partly grown by a failed add
+  if (sets->pool)
+    munmap(sets->pool, sets->sizes[FA_CSR_SETS_POOL]);
+  if (sets->off)
+    munmap(sets->off, sets->sizes[FA_CSR_SETS_OFF]);
+  if (sets->len)
+    munmap(sets->len, sets->sizes[FA_CSR_SETS_LEN]);
+  if (sets->hash)
+    munmap(sets->hash, sets->sizes[FA_CSR_SETS_HASH]);
+  munmap(sets->table, sets->sizes[FA_CSR_SETS_TABLE]);
+  for (a = 0; a < FA_CSR_SETS_FILES; a++)
+    close(sets->fds[a]);
+}
+
+// returns -1 if a file backed table could not be grown
+static int fa_csr_sets_rehash(fa_csr_sets_t *sets) {
+  uint32_t i, j, mask;
+  uint32_t *table;
+
+  table = fa_csr_sets_alloc(sets, FA_CSR_SETS_TABLE, sets->table,
+                            sizeof(sets->table[0]) * sets->table_size,
+                            sizeof(sets->table[0]) * sets->table_size * 2,
+                            1);
+  if (!table)
+    return -1;
+  sets->table = table;
+  sets->table_size *= 2;
+  mask = sets->table_size - 1;
+
+  for (i = 0; i < sets->n; i++) {
+    for (j = sets->hash[i] & mask; sets->table[j]; j = (j + 1) & mask)
+      ;
+    sets->table[j] = i + 1;
+  }
+
+  return 0;
+}
+
+// find set with hash h, returns set id or UINT32_MAX and the table slot
+// where it would be inserted. does not modify sets
+static uint32_t fa_csr_sets_find(fa_csr_sets_t *sets, uint32_t *ids,
+                                 uint32_t n, uint32_t h, uint32_t *slot) {
+  uint32_t j, mask, id;
+
+  mask = sets->table_size - 1;
+
+  for (j = h & mask; sets->table[j]; j = (j + 1) & mask) {
+    id = sets->table[j] - 1;
+    if (sets->hash[id] == h && sets->len[id] == n &&
+       memcmp(&sets->pool[sets->off[id]], ids, sizeof(ids[0]) * n) == 0)
+      return id;
+  }
+
+  *slot = j;
+  return UINT32_MAX;
+}
+
+// find set or add it, returns set id and sets *added if new. returns
+// UINT32_MAX if file backed arrays could not be grown, sets can then only
+// be freed
+static uint32_t fa_csr_sets_add_hash(fa_csr_sets_t *sets,
+                                     uint32_t *ids, uint32_t n, uint32_t h,
+                                     int *added) {
+  uint32_t j, id;
+  void *p;
+
+  *added = 0;
+  id = fa_csr_sets_find(sets, ids, n, h, &j);
+  if (id != UINT32_MAX)
+    return id;
+
+  if (sets->n == sets->alloc_n) {
+    uint32_t alloc_n = sets->alloc_n ? sets->alloc_n * 2 : 64;
+
+    p = fa_csr_sets_alloc(sets, FA_CSR_SETS_OFF, sets->off,
+                          sizeof(sets->off[0]) * sets->alloc_n,
+                          sizeof(sets->off[0]) * alloc_n, 0);
+    if (!p)
+      return UINT32_MAX;
+    sets->off = p;
+    p = fa_csr_sets_alloc(sets, FA_CSR_SETS_LEN, sets->len,
+                          sizeof(sets->len[0]) * sets->alloc_n,
+                          sizeof(sets->len[0]) * alloc_n, 0);
+    if (!p)
+      return UINT32_MAX;
+    sets->len = p;
+    p = fa_csr_sets_alloc(sets, FA_CSR_SETS_HASH, sets->hash,
+                          sizeof(sets->hash[0]) * sets->alloc_n,
+                          sizeof(sets->hash[0]) * alloc_n, 0);
+    if (!p)
+      return UINT32_MAX;
+    sets->hash = p;
+    sets->alloc_n = alloc_n;
+  }
+  if (sets->pool_n + n > sets->pool_alloc_n) {
+    size_t pool_alloc_n = MMAX(sets->pool_alloc_n * 2, sets->pool_n + n);
+
+    p = fa_csr_sets_alloc(sets, FA_CSR_SETS_POOL, sets->pool,
+                          sizeof(sets->pool[0]) * sets->pool_alloc_n,
+                          sizeof(sets->pool[0]) * pool_alloc_n, 0);
+    if (!p)
+      return UINT32_MAX;
+    sets->pool = p;
+    sets->pool_alloc_n = pool_alloc_n;
+  }
+
+  id = sets->n++;
+  sets->off[id] = sets->pool_n;
+  sets->len[id] = n;
+  sets->hash[id] = h;
+  memcpy(&sets->pool[sets->pool_n], ids, sizeof(ids[0]) * n);
+  sets->pool_n += n;
+  sets->table[j] = id + 1;
+
+  // keep load factor below 1/2
+  if (sets->n * 2 > sets->table_size && fa_csr_sets_rehash(sets) == -1)
+    return UINT32_MAX;
+
+  *added = 1;
+  return id;
+}
+
+static uint32_t fa_csr_sets_add(fa_csr_sets_t *sets,
+                                uint32_t *ids, uint32_t n, int *added) {
+  return fa_csr_sets_add_hash(sets, ids, n, fa_csr_hash_ids(ids, n), added);
+}
+
+static int fa_csr_id_cmp(const void *a, const void *b) {
+  uint32_t ia = *(uint32_t *)a;
+  uint32_t ib = *(uint32_t *)b;
+
+  return ia < ib ? -1 : ia > ib;
+}
+
+typedef struct fa_csr_eclosure_s {
+  fa_csr_t *csr;
+  int eps; // csr has epsilon transitions, without only sort and dedup
+  uint32_t *mark; // generation stamp per state
+  uint32_t gen;
+  uint32_t *stack;
+  uint32_t *set;
+  uint32_t set_n;
+} fa_csr_eclosure_t;
+
+static int fa_csr_has_eps(fa_csr_t *csr) {
+  uint32_t i;
+
+  for (i = 0; i < csr->trans_n; i++)
+    if (csr->trans[i].symfrom == FA_SYMBOL_E)
+      return 1;
+
+  return 0;
+}
+
+// set of states reachable from ids using epsilon transitions, result is
+// sorted in e->set
+static void fa_csr_eclosure(fa_csr_eclosure_t *e, uint32_t *ids, uint32_t n) {
+  fa_csr_t *csr = e->csr;
+  uint32_t sp, i, t, s;
+
+  e->gen++;
+  e->set_n = 0;
+  sp = 0;
+
+  for (i = 0; i < n; i++) {
+    if (e->mark[ids[i]] == e->gen)
+      continue;
+    e->mark[ids[i]] = e->gen;
+    e->set[e->set_n++] = ids[i];
+    if (e->eps)
+      e->stack[sp++] = ids[i];
+  }
+
+  while (sp > 0) {
+    s = e->stack[--sp];
+
+    // epsilon transitions are sorted first
+    for (t = csr->index[s];
+         t < csr->index[s + 1] && csr->trans[t].symfrom == FA_SYMBOL_E;
+         t++) {
+      uint32_t d = csr->trans[t].state;
+
+      if (e->mark[d] == e->gen)
+        continue;
+      e->mark[d] = e->gen;
+      e->set[e->set_n++] = d;
+      e->stack[sp++] = d;
+    }
+  }
+
+  qsort(e->set, e->set_n, sizeof(e->set[0]), fa_csr_id_cmp);
+}
+
+// accepting flag and opaque for a new dfa state from its nfa state set
+static void fa_csr_set_accepting(fa_csr_t *csr, uint32_t *set, uint32_t n,
+                                 fa_state_pri_f pri_cb,
+                                 uint8_t *flags, void **opaque) {
+  void **opaques;
+  uint32_t i;
+  int an, one;
+
+  *flags = 0;
+  *opaque = NULL;
+
+  an = 0;
+  one = 1;
+  for (i = 0; i < n; i++) {
+    if (!(csr->flags[set[i]] & FA_STATE_F_ACCEPTING))
+      continue;
+
+    if (an == 0)
+      *opaque = csr->opaque[set[i]];
+    else if (*opaque != csr->opaque[set[i]])
+      one = 0;
+    an++;
+  }
+
+  if (an == 0)
+    return;
+
+  *flags = FA_STATE_F_ACCEPTING;
+
+  if (!pri_cb) {
+    *opaque = NULL;
+    return;
+  }
+
+  if (one)
+    return;
+
+  // more than one unique opaque, ask callback
+  opaques = malloc(sizeof(opaques[0]) * an);
+  an = 0;
+  for (i = 0; i < n; i++)
+    if (csr->flags[set[i]] & FA_STATE_F_ACCEPTING)
+      opaques[an++] = csr->opaque[set[i]];
+
+  an = fa_unique_array(opaques, an, sizeof(opaques[0]));
+  *opaque = pri_cb(opaques, an);
+  free(opaques);
+}
+
+// called for each part of the symbol space with the sorted eclosure set
+// reached by it
+typedef void (fa_csr_split_f)(void *ctx, int symfrom, int symto,
+                              uint32_t *set, uint32_t set_n);
+
+// split the symbol space at every transition range boundary of the nfa
+// states in cur and follow each part by an eclosure. parts reaching no
+// states are skipped
+static void fa_csr_split(fa_csr_eclosure_t *e, uint32_t *cur, uint32_t cur_n,
+                         uint32_t *reach, fa_csr_split_f *cb, void *ctx) {
+  fa_csr_t *csr = e->csr;
+  uint8_t bounds[257 / 8 + 1];
+  uint32_t i, t, reach_n;
+  int lo, hi;
+
+  memset(bounds, 0, sizeof(bounds));
+  for (i = 0; i < cur_n; i++)
+    for (t = csr->index[cur[i]]; t < csr->index[cur[i] + 1]; t++) {
+      if (csr->trans[t].symfrom == FA_SYMBOL_E)
+        continue;
+      BITFIELD_SET(bounds, csr->trans[t].symfrom);
+      BITFIELD_SET(bounds, csr->trans[t].symto + 1);
+    }
+
+  for (lo = 0; lo < 256; lo = hi) {
+    for (hi = lo + 1; hi < 256 && !BITFIELD_TEST(bounds, hi); hi++)
+      ;
+
+    // states reachable with any symbol in [lo, hi - 1]
+    reach_n = 0;
+    for (i = 0; i < cur_n; i++)
+      for (t = csr->index[cur[i]]; t < csr->index[cur[i] + 1]; t++)
+        if (csr->trans[t].symfrom <= lo && csr->trans[t].symto >= lo)
+          reach[reach_n++] = csr->trans[t].state;
+
+    if (reach_n == 0)
+      continue;
+
+    fa_csr_eclosure(e, reach, reach_n);
+    cb(ctx, lo, hi - 1, e->set, e->set_n);
+  }
+}
+
+struct fa_csr_determinize_s {
+  fa_csr_t *csr;
+  fa_csr_build_t b;
+  fa_csr_sets_t sets;
+  fa_state_pri_f *pri_cb;
+  uint32_t d; // current dfa state
+  fa_csr_eclosure_t e;
+  uint32_t *cur;
+  uint32_t *reach;
+};
+
+static void fa_csr_determinize_part(void *ctx, int symfrom, int symto,
+                                    uint32_t *set, uint32_t set_n) {
+  fa_csr_determinize_t *det = ctx;
+  uint8_t flags;
+  void *opaque;
+  uint32_t u;
+  int added;
+
+  u = fa_csr_sets_add(&det->sets, set, set_n, &added);
+  if (added) {
+    fa_csr_set_accepting(det->csr, set, set_n, det->pri_cb, &flags, &opaque);
+    fa_csr_build_state(&det->b, flags, opaque);
+  }
+
+  fa_csr_build_trans(&det->b, symfrom, symto, u, det->d);
+}
+
+// determinize using power set construction
+//
+// dfa states are processed in the order they are created so transitions
+// can be appended directly to the resulting csr. for each dfa state the
+// symbol space is split at every transition range boundary of its nfa
+// states and each part is followed by an eclosure.
+//
+fa_csr_t *fa_csr_determinize(fa_csr_t *csr) {
+  return fa_csr_determinize_ex(csr, NULL, NULL, NULL);
+}
+
+fa_csr_t *fa_csr_determinize_ex(fa_csr_t *csr, fa_state_pri_f pri_cb,
+                                fa_limit_t *limit, int *timeout) {
+  fa_csr_determinize_t *det;
+  fa_csr_progress_t p;
+  int cancel;
+
+  cancel = 0;
+  det = fa_csr_determinize_begin(csr, pri_cb);
+
+  while (!cancel && !fa_csr_determinize_step(det, 1)) {
+    fa_csr_determinize_progress(det, &p);
+    if ((timeout && *timeout) ||
+       (limit && (p.states_n > limit->states || p.trans_n > limit->trans)))
+      cancel = 1;
+  }
+
+  if (cancel) {
+    fa_csr_determinize_destroy(det);
+    return NULL;
+  }
+
+  return fa_csr_determinize_end(det);
+}
+
+fa_csr_determinize_t *fa_csr_determinize_begin(fa_csr_t *csr,
+                                               fa_state_pri_f pri_cb) {
+  fa_csr_determinize_t *det;
+  uint8_t flags;
+  void *opaque;
+  int added;
+
+  det = malloc(sizeof(*det));
+  det->csr = csr;
+  det->pri_cb = pri_cb;
+  det->d = 0;
+  fa_csr_build_init(&det->b);
+  fa_csr_sets_init(&det->sets);
+
+  det->e.csr = csr;
+  det->e.eps = fa_csr_has_eps(csr);
+  det->e.mark = calloc(csr->states_n, sizeof(det->e.mark[0]));
+  det->e.gen = 0;
+  det->e.stack = malloc(sizeof(det->e.stack[0]) * csr->states_n);
+  det->e.set = malloc(sizeof(det->e.set[0]) * csr->states_n);
+  det->cur = malloc(sizeof(det->cur[0]) * csr->states_n);
+  det->reach = malloc(sizeof(det->reach[0]) * (csr->trans_n + 1));
+
+  fa_csr_eclosure(&det->e, &csr->start, 1);
+  fa_csr_sets_add(&det->sets, det->e.set, det->e.set_n, &added);
+  fa_csr_set_accepting(csr, det->e.set, det->e.set_n, pri_cb,
+                       &flags, &opaque);
+  det->b.csr->start = fa_csr_build_state(&det->b, flags, opaque);
+
+  return det;
+}
+
+int fa_csr_determinize_step(fa_csr_determinize_t *det, uint32_t steps) {
+  uint32_t cur_n;
+
+  for (; steps > 0 && det->d < det->b.csr->states_n; steps--, det->d++) {
+    // copy, sets pool might be reallocated when adding
+    cur_n = det->sets.len[det->d];
+    memcpy(det->cur, &det->sets.pool[det->sets.off[det->d]],
+           sizeof(det->cur[0]) * cur_n);
+
+    fa_csr_build_trans_begin(&det->b, det->d);
+    fa_csr_split(&det->e, det->cur, cur_n, det->reach,
+                 fa_csr_determinize_part, det);
+  }
+
+  return det->d == det->b.csr->states_n;
+}
+
+void fa_csr_determinize_progress(fa_csr_determinize_t *det,
+                                 fa_csr_progress_t *p) {
+  fa_csr_sets_t *sets = &det->sets;
+
+  p->states_n = det->b.csr->states_n;
+  p->trans_n = det->b.csr->trans_n;
+  p->worklist_n = det->b.csr->states_n - det->d;
+  p->mem =
+    det->b.states_alloc_n * (sizeof(det->b.csr->index[0]) +
+                             sizeof(det->b.csr->flags[0]) +
+                             sizeof(det->b.csr->opaque[0])) +
+    det->b.trans_alloc_n * sizeof(det->b.csr->trans[0]) +
+    sets->pool_alloc_n * sizeof(sets->pool[0]) +
+    sets->alloc_n * (sizeof(sets->off[0]) + sizeof(sets->len[0]) +
+                     sizeof(sets->hash[0])) +
+    sets->table_size * sizeof(sets->table[0]) +
+    det->csr->states_n * sizeof(uint32_t) * 4 +
+    (det->csr->trans_n + 1) * sizeof(det->reach[0]);
+}
+
+static void fa_csr_determinize_free(fa_csr_determinize_t *det) {
+  free(det->e.mark);
+  free(det->e.stack);
+  free(det->e.set);
+  free(det->cur);
+  free(det->reach);
+  fa_csr_sets_free(&det->sets);
+  free(det);
+}
+
+fa_csr_t *fa_csr_determinize_end(fa_csr_determinize_t *det) {
+  fa_csr_t *csr;
+
+  csr = fa_csr_build_finish(&det->b);
+  fa_csr_determinize_free(det);
+
+  return csr;
+}
+
+void fa_csr_determinize_destroy(fa_csr_determinize_t *det) {
+  fa_csr_destroy(det->b.csr);
+  fa_csr_determinize_free(det);
+}
+
+// out of core determinize writes a fa_sim_t image instead of a csr
+typedef struct fa_csr_simfile_s {
+  fa_csr_t *csr;
+  fa_csr_sets_t sets;
+  fa_state_pri_f *pri_cb;
+  int fd;
+  fa_sim_t *sim; // mapped from fd
+  uint32_t nodes_alloc_n;
+  uint32_t d; // current dfa state, node d + 1
+  uint32_t trans_n; // transition ranges as a csr would have
+  uint32_t last; // node and end symbol of last range in current state
+  int last_symto;
+  int failed; // sim or sets file could not be grown
+} fa_csr_simfile_t;
+
+#define FA_CSR_SIMFILE_SIZE(nodes_n) \
+  (sizeof(fa_sim_t) + sizeof(fa_sim_node_t) * (size_t)(nodes_n))
+
+// add node for a new dfa state, new parts of the file read as zero so all
+// symbols go to node 0 until the state is processed. returns -1 if the
+// file could not be grown, the old mapping is then kept
+static int fa_csr_simfile_node(fa_csr_simfile_t *sf, uint8_t flags,
+                               void *opaque) {
+  fa_sim_node_t *node;
+  uint32_t alloc_n;
+  fa_sim_t *sim;
+
+  if (sf->sim->nodes_n == sf->nodes_alloc_n) {
+    alloc_n = sf->nodes_alloc_n * 2;
+    if (fa_csr_file_resize(sf->fd, FA_CSR_SIMFILE_SIZE(sf->nodes_alloc_n),
+                           FA_CSR_SIMFILE_SIZE(alloc_n)) == -1)
+      return -1;
+    sim = mmap(NULL, FA_CSR_SIMFILE_SIZE(alloc_n),
+               PROT_READ | PROT_WRITE, MAP_SHARED, sf->fd, 0);
+    if (sim == MAP_FAILED)
+      return -1;
+    munmap(sf->sim, FA_CSR_SIMFILE_SIZE(sf->nodes_alloc_n));
+    sf->sim = sim;
+    sf->nodes_alloc_n = alloc_n;
+  }
+
+  node = &sf->sim->nodes[sf->sim->nodes_n++];
+  if (flags & FA_STATE_F_ACCEPTING)
+    node->flags |= FA_SIM_NODE_F_ACCEPTING;
+  node->opaque = opaque;
+
+  return 0;
+}
+
+static void fa_csr_simfile_part(void *ctx, int symfrom, int symto,
+                                uint32_t *set, uint32_t set_n) {
+  fa_csr_simfile_t *sf = ctx;
+  fa_sim_node_t *node;
+  uint8_t flags;
+  void *opaque;
+  uint32_t u;
+  int added;
+  int j;
+
+  if (sf->failed)
+    return;
+
+  u = fa_csr_sets_add(&sf->sets, set, set_n, &added);
+  if (u == UINT32_MAX) {
+    sf->failed = 1;
+    return;
+  }
+  if (added) {
+    fa_csr_set_accepting(sf->csr, set, set_n, sf->pri_cb, &flags, &opaque);
+    if (fa_csr_simfile_node(sf, flags, opaque) == -1) {
+      sf->failed = 1;
+      return;
+    }
+  }
+
+  node = &sf->sim->nodes[sf->d + 1];
+  for (j = symfrom; j <= symto; j++)
+    node->table[j] = u + 1;
+
+  if (!(sf->last == u + 1 && sf->last_symto + 1 == symfrom))
+    sf->trans_n++;
+  sf->last = u + 1;
+  sf->last_symto = symto;
+}
+
+// determinize into a fa_sim_t image in file path, see fa_sim_mmap
+//
+// same power set construction as fa_csr_determinize_ex but the subset
+// tables are mapped from unlinked temporary files in tmpdir and each dfa
+// state is written to the mapped sim file when processed, so the kernel
+// can page both out. memory use is then mostly the eclosure scratch which
+// is linear in the nfa size
+//
+int fa_csr_determinize_sim_file(fa_csr_t *csr, fa_state_pri_f pri_cb,
+                                fa_limit_t *limit, int *timeout,
+                                char *path, char *tmpdir) {
+  fa_csr_simfile_t sf;
+  fa_csr_eclosure_t e;
+  uint32_t *cur, *reach;
+  uint32_t cur_n;
+  size_t size;
+  uint8_t flags;
+  void *opaque;
+  int added;
+  int cancel;
+
+  if (fa_csr_sets_init_file(&sf.sets, tmpdir) == -1)
+    return -1;
+  sf.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (sf.fd == -1) {
+    fa_csr_sets_free(&sf.sets);
+    return -1;
+  }
+
+  sf.csr = csr;
+  sf.pri_cb = pri_cb;
+  sf.nodes_alloc_n = 64;
+  sf.sim = MAP_FAILED;
+  if (fa_csr_file_resize(sf.fd, 0,
+                         FA_CSR_SIMFILE_SIZE(sf.nodes_alloc_n)) == 0)
+    sf.sim = mmap(NULL, FA_CSR_SIMFILE_SIZE(sf.nodes_alloc_n),
+                  PROT_READ | PROT_WRITE, MAP_SHARED, sf.fd, 0);
+  if (sf.sim == MAP_FAILED) {
+    fa_csr_sets_free(&sf.sets);
+    close(sf.fd);
+    unlink(path);
+    return -1;
+  }
+  sf.sim->nodes_n = 1; // 0 reserved for no match state
+  sf.trans_n = 0;
+  sf.failed = 0;
+
+  e.csr = csr;
+  e.eps = fa_csr_has_eps(csr);
+  e.mark = calloc(csr->states_n, sizeof(e.mark[0]));
+  e.gen = 0;
+  e.stack = malloc(sizeof(e.stack[0]) * csr->states_n);
+  e.set = malloc(sizeof(e.set[0]) * csr->states_n);
+  cur = malloc(sizeof(cur[0]) * csr->states_n);
+  reach = malloc(sizeof(reach[0]) * (csr->trans_n + 1));
+
+  fa_csr_eclosure(&e, &csr->start, 1);
+  // node 1 fits in the initial size but the sets may have to grow
+  if (fa_csr_sets_add(&sf.sets, e.set, e.set_n, &added) == UINT32_MAX) {
+    sf.failed = 1;
+  } else {
+    fa_csr_set_accepting(csr, e.set, e.set_n, pri_cb, &flags, &opaque);
+    fa_csr_simfile_node(&sf, flags, opaque);
+  }
+  sf.sim->start = 1;
+
+  cancel = sf.failed;
+  for (sf.d = 0; !cancel && sf.d + 1 < sf.sim->nodes_n; sf.d++) {
+    // copy, sets pool might be remapped when adding
+    cur_n = sf.sets.len[sf.d];
+    memcpy(cur, &sf.sets.pool[sf.sets.off[sf.d]], sizeof(cur[0]) * cur_n);
+
+    sf.last = 0;
+    fa_csr_split(&e, cur, cur_n, reach, fa_csr_simfile_part, &sf);
+
+    if (sf.failed || (timeout && *timeout) ||
+       (limit && (sf.sim->nodes_n - 1 > limit->states ||
+                  sf.trans_n > limit->trans)))
+      cancel = 1;
+  }
+
+  free(e.mark);
+  free(e.stack);
+  free(e.set);
+  free(cur);
+  free(reach);
+  fa_csr_sets_free(&sf.sets);
+
+  size = FA_CSR_SIMFILE_SIZE(sf.sim->nodes_n);
+  // size field is 32 bit, fa_sim_mmap uses nodes_n
+  sf.sim->size = size > UINT32_MAX ? UINT32_MAX : size;
+  munmap(sf.sim, FA_CSR_SIMFILE_SIZE(sf.nodes_alloc_n));
+  if (!cancel && ftruncate(sf.fd, size) == -1)
+    cancel = 1;
+  close(sf.fd);
+
+  if (cancel) {
+    unlink(path);
+    return -1;
+  }
+
+  return 0;
+}
+
+// dfa states taken at a time by a determinize thread
+#define FA_CSR_PDET_CHUNK 64
+
+// part of the symbol space of a frontier state
+typedef struct fa_csr_pdet_part_s {
+  int16_t symfrom;
+  int16_t symto;
+  uint32_t set; // set id or UINT32_MAX if not seen before this level
+  uint32_t hash;
+  uint32_t len;
+  size_t off; // into thread ids if new
+} fa_csr_pdet_part_t;
+
+typedef struct fa_csr_pdet_thread_s {
+  fa_csr_eclosure_t e;
+  uint32_t *cur;
+  uint32_t *reach;
+  fa_csr_pdet_part_t *parts;
+  size_t parts_n;
+  size_t parts_alloc_n;
+  uint32_t *ids; // new sets
+  size_t ids_n;
+  size_t ids_alloc_n;
+  struct fa_csr_pdet_s *pdet;
+} fa_csr_pdet_thread_t;
+
+typedef struct fa_csr_pdet_s {
+  fa_csr_t *csr;
+  fa_csr_sets_t *sets; // read only while threads run
+  uint32_t lo; // current level is dfa states lo..hi-1
+  uint32_t hi;
+  uint32_t next; // next frontier state, protected by lock
+  pthread_mutex_t lock;
+  // per frontier state, which thread and parts
+  uint32_t *state_thread;
+  size_t *state_part;
+  uint32_t *state_part_n;
+  fa_csr_pdet_thread_t *threads;
+} fa_csr_pdet_t;
+
+static void fa_csr_pdet_part(void *ctx, int symfrom, int symto,
+                             uint32_t *set, uint32_t set_n) {
+  fa_csr_pdet_thread_t *t = ctx;
+  fa_csr_pdet_part_t *p;
+  uint32_t slot;
+
+  if (t->parts_n == t->parts_alloc_n) {
+    t->parts_alloc_n = t->parts_alloc_n ? t->parts_alloc_n * 2 : 256;
+    t->parts = realloc(t->parts, sizeof(t->parts[0]) * t->parts_alloc_n);
+  }
+
+  p = &t->parts[t->parts_n++];
+  p->symfrom = symfrom;
+  p->symto = symto;
+  p->hash = fa_csr_hash_ids(set, set_n);
+  p->len = set_n;
+  p->set = fa_csr_sets_find(t->pdet->sets, set, set_n, p->hash, &slot);
+  if (p->set != UINT32_MAX)
+    return;
+
+  if (t->ids_n + set_n > t->ids_alloc_n) {
+    t->ids_alloc_n = MMAX(t->ids_alloc_n * 2, t->ids_n + set_n);
+    t->ids = realloc(t->ids, sizeof(t->ids[0]) * t->ids_alloc_n);
+  }
+  p->off = t->ids_n;
+  memcpy(&t->ids[t->ids_n], set, sizeof(set[0]) * set_n);
+  t->ids_n += set_n;
+}
+
+// split frontier states taken in chunks from the shared counter so that
+// threads with cheap states take more of them
+static void fa_csr_pdet_worker(void *arg, int thread) {
+  fa_csr_pdet_t *pdet = arg;
+  fa_csr_pdet_thread_t *t = &pdet->threads[thread];
+  fa_csr_sets_t *sets = pdet->sets;
+  uint32_t d, from, to, cur_n;
+
+  t->parts_n = 0;
+  t->ids_n = 0;
+
+  while (1) {
+    pthread_mutex_lock(&pdet->lock);
+    from = pdet->next;
+    pdet->next = MMIN(pdet->hi, from + FA_CSR_PDET_CHUNK);
+    to = pdet->next;
+    pthread_mutex_unlock(&pdet->lock);
+
+    if (from == to)
+      break;
+
+    for (d = from; d < to; d++) {
+      cur_n = sets->len[d];
+      memcpy(t->cur, &sets->pool[sets->off[d]], sizeof(t->cur[0]) * cur_n);
+
+      pdet->state_thread[d - pdet->lo] = thread;
+      pdet->state_part[d - pdet->lo] = t->parts_n;
+      fa_csr_split(&t->e, t->cur, cur_n, t->reach, fa_csr_pdet_part, t);
+      pdet->state_part_n[d - pdet->lo] =
+        t->parts_n - pdet->state_part[d - pdet->lo];
+    }
+  }
+}
+
+// parallel determinize, see fa_csr_determinize_ex
+//
+// dfa states are processed one breadth first level at a time. threads
+// split the states of a level and look up the reached sets among the ones
+// already known. the calling thread then adds transitions and new sets in
+// state and symbol order, which numbers the dfa states exactly as
+// fa_csr_determinize_ex does. pri_cb is only called from the calling
+// thread
+//
+fa_csr_t *fa_csr_determinize_parallel(fa_csr_t *csr, fa_state_pri_f pri_cb,
+                                      fa_limit_t *limit, int *timeout,
+                                      int threads) {
+  fa_thread_pool_t *pool;
+  fa_csr_build_t b;
+  fa_csr_sets_t sets;
+  fa_csr_pdet_t pdet;
+  fa_csr_pdet_thread_t *t;
+  fa_csr_pdet_part_t *p;
+  uint32_t d, level_alloc_n, u;
+  size_t i;
+  uint8_t flags;
+  void *opaque;
+  int added;
+  int cancel;
+  int eps;
+  int k;
+
+  threads = threads > 1 ? threads : 1;
+  eps = fa_csr_has_eps(csr);
+  pool = fa_thread_pool_create(threads);
+  fa_csr_build_init(&b);
+  fa_csr_sets_init(&sets);
+
+  memset(&pdet, 0, sizeof(pdet));
+  pdet.csr = csr;
+  pdet.sets = &sets;
+  pthread_mutex_init(&pdet.lock, NULL);
+  pdet.threads = calloc(threads, sizeof(pdet.threads[0]));
+  for (k = 0; k < threads; k++) {
+    t = &pdet.threads[k];
+    t->pdet = &pdet;
+    t->e.csr = csr;
+    t->e.eps = eps;
+    t->e.mark = calloc(csr->states_n, sizeof(t->e.mark[0]));
+    t->e.stack = malloc(sizeof(t->e.stack[0]) * csr->states_n);
+    t->e.set = malloc(sizeof(t->e.set[0]) * csr->states_n);
+    t->cur = malloc(sizeof(t->cur[0]) * csr->states_n);
+    t->reach = malloc(sizeof(t->reach[0]) * (csr->trans_n + 1));
+  }
+  level_alloc_n = 0;
+
+  t = &pdet.threads[0];
+  fa_csr_eclosure(&t->e, &csr->start, 1);
+  fa_csr_sets_add(&sets, t->e.set, t->e.set_n, &added);
+  fa_csr_set_accepting(csr, t->e.set, t->e.set_n, pri_cb, &flags, &opaque);
+  b.csr->start = fa_csr_build_state(&b, flags, opaque);
+
+  cancel = 0;
+  pdet.hi = 0;
+  while (!cancel && pdet.hi < b.csr->states_n) {
+    pdet.lo = pdet.hi;
+    pdet.hi = b.csr->states_n;
+    pdet.next = pdet.lo;
+
+    if (pdet.hi - pdet.lo > level_alloc_n) {
+      level_alloc_n = pdet.hi - pdet.lo;
+      pdet.state_thread = realloc(pdet.state_thread,
+                                  sizeof(pdet.state_thread[0]) *
+                                  level_alloc_n);
+      pdet.state_part = realloc(pdet.state_part,
+                                sizeof(pdet.state_part[0]) * level_alloc_n);
+      pdet.state_part_n = realloc(pdet.state_part_n,
+                                  sizeof(pdet.state_part_n[0]) *
+                                  level_alloc_n);
+    }
+
+    // small levels are not worth waking the other threads for
+    if (pdet.hi - pdet.lo <= FA_CSR_PDET_CHUNK)
+      fa_csr_pdet_worker(&pdet, 0);
+    else
+      fa_thread_pool_run(pool, fa_csr_pdet_worker, &pdet);
+
+    for (d = pdet.lo; d < pdet.hi; d++) {
+      t = &pdet.threads[pdet.state_thread[d - pdet.lo]];
+
+      fa_csr_build_trans_begin(&b, d);
+      for (i = 0; i < pdet.state_part_n[d - pdet.lo]; i++) {
+        p = &t->parts[pdet.state_part[d - pdet.lo] + i];
+
+        u = p->set;
+        if (u == UINT32_MAX) {
+          u = fa_csr_sets_add_hash(&sets, &t->ids[p->off], p->len, p->hash,
+                                   &added);
+          if (added) {
+            fa_csr_set_accepting(csr, &t->ids[p->off], p->len, pri_cb,
+                                 &flags, &opaque);
+            fa_csr_build_state(&b, flags, opaque);
+          }
+        }
+
+        fa_csr_build_trans(&b, p->symfrom, p->symto, u, d);
+      }
+    }
+
+    if ((timeout && *timeout) ||
+       (limit && (b.csr->states_n > limit->states ||
+                  b.csr->trans_n > limit->trans)))
+      cancel = 1;
+  }
+
+  fa_thread_pool_destroy(pool);
+  for (k = 0; k < threads; k++) {
+    t = &pdet.threads[k];
+    free(t->e.mark);
+    free(t->e.stack);
+    free(t->e.set);
+    free(t->cur);
+    free(t->reach);
+    free(t->parts);
+    free(t->ids);
+  }
+  free(pdet.threads);
+  free(pdet.state_thread);
+  free(pdet.state_part);
+  free(pdet.state_part_n);
+  pthread_mutex_destroy(&pdet.lock);
+  fa_csr_sets_free(&sets);
+
+  if (cancel) {
+    fa_csr_destroy(b.csr);
+    return NULL;
+  }
+
+  return fa_csr_build_finish(&b);
+}
+
+// initial partition, accepting and non-accepting states are distinguishable
+// and so are states cmp_cb say are distinguishable. opaques already seen
+// are looked up in a pointer hash to not call cmp_cb for each state
+static uint32_t fa_csr_minimize_initial(fa_csr_t *csr, fa_state_cmp_f cmp_cb,
+                                        uint32_t *class) {
+  uint32_t *table;
+  uint32_t size, mask;
+  uint32_t *reps;
+  uint32_t classes_n;
+  uint32_t i, j, c;
+
+  for (size = 64; size < csr->states_n * 2; size *= 2)
+    ;
+  mask = size - 1;
+  table = calloc(size, sizeof(table[0])); // state id + 1
+  reps = malloc(sizeof(reps[0]) * (csr->states_n + 1));
+  classes_n = 0;
+
+  for (i = 0; i < csr->states_n; i++) {
+    uint32_t h = (uint32_t)((uintptr_t)csr->opaque[i] * 2654435761u) ^
+      (csr->flags[i] & FA_STATE_F_ACCEPTING);
+
+    for (j = h & mask; table[j]; j = (j + 1) & mask) {
+      uint32_t s = table[j] - 1;
+
+      if (csr->opaque[s] == csr->opaque[i] &&
+         (csr->flags[s] & FA_STATE_F_ACCEPTING) ==
+         (csr->flags[i] & FA_STATE_F_ACCEPTING))
+        break;
+    }
+
+    if (table[j]) {
+      class[i] = class[table[j] - 1];
+      continue;
+    }
+
+    // new opaque, compare with class representatives
+    for (c = 0; c < classes_n; c++) {
+      uint32_t r = reps[c];
+
+      if ((csr->flags[r] & FA_STATE_F_ACCEPTING) !=
+         (csr->flags[i] & FA_STATE_F_ACCEPTING))
+        continue;
+
+      if (cmp_cb && cmp_cb(csr->opaque[r], csr->opaque[i]))
+        continue;
+
+      break;
+    }
+
+    if (c == classes_n)
+      reps[classes_n++] = i;
+
+    class[i] = c;
+    table[j] = i + 1;
+  }
+
+  free(table);
+  free(reps);
+
+  return classes_n;
+}
+
+// signature of state i into s, returns length. s has room for
+// 1 + 3 * transitions
+static uint32_t fa_csr_minimize_sig(fa_csr_t *csr, uint32_t *class,
+                                    uint32_t i, uint32_t *s) {
+  uint32_t l = 0;
+  uint32_t t;
+
+  s[l++] = class[i];
+  for (t = csr->index[i]; t < csr->index[i + 1]; t++) {
+    fa_csr_trans_t *ft = &csr->trans[t];
+
+    if (l > 1 &&
+       s[l - 1] == class[ft->state] &&
+       s[l - 2] + 1 == (uint32_t)ft->symfrom) {
+      s[l - 2] = ft->symto;
+      continue;
+    }
+
+    s[l++] = ft->symfrom;
+    s[l++] = ft->symto;
+    s[l++] = class[ft->state];
+  }
+
+  return l;
+}
+
+// class ids are assigned in state order so first state with a new class id
+// is the representative for that class
+static fa_csr_t *fa_csr_minimize_build(fa_csr_t *csr, uint32_t *class) {
+  fa_csr_build_t b;
+  uint32_t i, t, c;
+
+  fa_csr_build_init(&b);
+  for (i = 0, c = 0; i < csr->states_n; i++) {
+    if (class[i] != c)
+      continue;
+
+    fa_csr_build_state(&b, csr->flags[i], csr->opaque[i]);
+    fa_csr_build_trans_begin(&b, c);
+    for (t = csr->index[i]; t < csr->index[i + 1]; t++)
+      fa_csr_build_trans(&b, csr->trans[t].symfrom, csr->trans[t].symto,
+                         class[csr->trans[t].state], c);
+    c++;
+  }
+  b.csr->start = class[csr->start];
+
+  return fa_csr_build_finish(&b);
+}
+
+// minimize dfa using signature refinement
+//
+// signature of a state is its current class followed by its transition
+// ranges with destination replaced by destination class, adjacent ranges
+// going to same class are merged. states with equal signature get the same
+// new class. repeat until number of classes does not change
+//
+// if given cmp_cb use it for indistinguishable to force them to be
+// seen as distinguishable
+//
+fa_csr_t *fa_csr_minimize(fa_csr_t *csr) {
+  return fa_csr_minimize_ex(csr, NULL, NULL);
+}
+
+fa_csr_t *fa_csr_minimize_ex(fa_csr_t *csr, fa_state_cmp_f cmp_cb,
+                             int *timeout) {
+  fa_csr_minimize_t *m;
+
+  m = fa_csr_minimize_begin(csr, cmp_cb);
+
+  // a round is one signature and one grouping step per state
+  while (!fa_csr_minimize_step(m, csr->states_n * 2)) {
+    if (timeout && *timeout)
+      break;
+  }
+
+  if (timeout && *timeout) {
+    fa_csr_minimize_destroy(m);
+    return NULL;
+  }
+
+  return fa_csr_minimize_end(m);
+}
+
+struct fa_csr_minimize_s {
+  fa_csr_t *csr;
+  uint32_t *class;
+  uint32_t *nclass;
+  uint32_t *sig;
+  uint32_t *sig_len;
+  uint32_t *sig_hash;
+  uint32_t *table; // state id + 1
+  uint32_t size; // power of 2
+  uint32_t classes_n;
+  uint32_t nclasses_n;
+  int pass; // 0 signatures, 1 grouping
+  uint32_t i; // next state in pass
+  int done;
+};
+
+fa_csr_minimize_t *fa_csr_minimize_begin(fa_csr_t *csr,
+                                         fa_state_cmp_f cmp_cb) {
+  fa_csr_minimize_t *m;
+
+  m = calloc(1, sizeof(*m));
+  m->csr = csr;
+  m->class = malloc(sizeof(m->class[0]) * (csr->states_n + 1));
+  m->nclass = malloc(sizeof(m->nclass[0]) * (csr->states_n + 1));
+  // class + (symfrom, symto, class) per transition, state i starts at
+  // i + index[i] * 3
+  m->sig = malloc(sizeof(m->sig[0]) * (csr->states_n + csr->trans_n * 3 + 1));
+  m->sig_len = malloc(sizeof(m->sig_len[0]) * (csr->states_n + 1));
+  m->sig_hash = malloc(sizeof(m->sig_hash[0]) * (csr->states_n + 1));
+  for (m->size = 64; m->size < csr->states_n * 2; m->size *= 2)
+    ;
+  m->table = malloc(sizeof(m->table[0]) * m->size);
+
+  m->classes_n = fa_csr_minimize_initial(csr, cmp_cb, m->class);
+
+  return m;
+}
+
+// group state i with earlier states with the same signature
+static void fa_csr_minimize_group(fa_csr_minimize_t *m, uint32_t i) {
+  fa_csr_t *csr = m->csr;
+  uint32_t *table = m->table;
+  uint32_t *sig = m->sig;
+  uint32_t *sig_len = m->sig_len;
+  uint32_t *sig_hash = m->sig_hash;
+  uint32_t j, mask;
+
+  mask = m->size - 1;
+  for (j = sig_hash[i] & mask; table[j]; j = (j + 1) & mask) {
+    uint32_t s = table[j] - 1;
+
+    if (sig_hash[s] == sig_hash[i] && sig_len[s] == sig_len[i] &&
+       memcmp(&sig[FA_CSR_SIG_OFF(csr, s)], &sig[FA_CSR_SIG_OFF(csr, i)],
+              sizeof(sig[0]) * sig_len[i]) == 0)
+      break;
+  }
+
+  if (table[j]) {
+    m->nclass[i] = m->nclass[table[j] - 1];
+  } else {
+    table[j] = i + 1;
+    m->nclass[i] = m->nclasses_n++;
+  }
+}
+
+int fa_csr_minimize_step(fa_csr_minimize_t *m, uint32_t steps) {
+  fa_csr_t *csr = m->csr;
+  uint32_t *tmp;
+  uint32_t *s;
+
+  for (; steps > 0 && !m->done; steps--) {
+    if (m->pass == 0) {
+      s = &m->sig[FA_CSR_SIG_OFF(csr, m->i)];
+      m->sig_len[m->i] = fa_csr_minimize_sig(csr, m->class, m->i, s);
+      m->sig_hash[m->i] = fa_csr_hash_ids(s, m->sig_len[m->i]);
+
+      if (++m->i == csr->states_n) {
+        memset(m->table, 0, sizeof(m->table[0]) * m->size);
+        m->nclasses_n = 0;
+        m->pass = 1;
+        m->i = 0;
+      }
+    } else {
+      fa_csr_minimize_group(m, m->i);
+
+      if (++m->i == csr->states_n) {
+        tmp = m->class;
+        m->class = m->nclass;
+        m->nclass = tmp;
+
+        // refinement only splits classes, same count means stable
+        if (m->nclasses_n == m->classes_n)
+          m->done = 1;
+        m->classes_n = m->nclasses_n;
+        m->pass = 0;
+        m->i = 0;
+      }
+    }
+  }
+
+  return m->done;
+}
+
+void fa_csr_minimize_progress(fa_csr_minimize_t *m, fa_csr_progress_t *p) {
+  fa_csr_t *csr = m->csr;
+
+  p->states_n = m->classes_n;
+  p->trans_n = 0;
+  p->worklist_n = csr->states_n - m->i;
+  p->mem =
+    (csr->states_n + 1) * sizeof(uint32_t) * 4 +
+    (csr->states_n + csr->trans_n * 3 + 1) * sizeof(m->sig[0]) +
+    m->size * sizeof(m->table[0]);
+}
+
+static void fa_csr_minimize_free(fa_csr_minimize_t *m) {
+  free(m->class);
+  free(m->nclass);
+  free(m->sig);
+  free(m->sig_len);
+  free(m->sig_hash);
+  free(m->table);
+  free(m);
+}
+
+fa_csr_t *fa_csr_minimize_end(fa_csr_minimize_t *m) {
+  fa_csr_t *mcsr;
+
+  mcsr = fa_csr_minimize_build(m->csr, m->class);
+  fa_csr_minimize_free(m);
+
+  return mcsr;
+}
+
+void fa_csr_minimize_destroy(fa_csr_minimize_t *m) {
+  fa_csr_minimize_free(m);
+}
+
+// states taken at a time by a minimize thread
+#define FA_CSR_PMIN_CHUNK 1024
+
+typedef struct fa_csr_pmin_thread_s {
+  uint32_t *table; // state id + 1
+  uint32_t size; // power of 2
+} fa_csr_pmin_thread_t;
+
+typedef struct fa_csr_pmin_s {
+  fa_csr_t *csr;
+  uint32_t *class;
+  uint32_t *sig;
+  uint32_t *sig_len;
+  uint32_t *sig_hash;
+  uint32_t *rep; // first state with same signature
+  uint32_t next; // next state chunk, protected by lock
+  pthread_mutex_t lock;
+  int threads;
+  fa_csr_pmin_thread_t *pthreads;
+} fa_csr_pmin_t;
+
+// signatures for chunks of states taken from the shared counter
+static void fa_csr_pmin_sig(void *arg, int thread) {
+  fa_csr_pmin_t *pmin = arg;
+  fa_csr_t *csr = pmin->csr;
+  uint32_t i, from, to;
+
+  while (1) {
+    pthread_mutex_lock(&pmin->lock);
+    from = pmin->next;
+    pmin->next = MMIN(csr->states_n, from + FA_CSR_PMIN_CHUNK);
+    to = pmin->next;
+    pthread_mutex_unlock(&pmin->lock);
+
+    if (from == to)
+      break;
+
+    for (i = from; i < to; i++) {
+      uint32_t *s = &pmin->sig[FA_CSR_SIG_OFF(csr, i)];
+
+      pmin->sig_len[i] = fa_csr_minimize_sig(csr, pmin->class, i, s);
+      pmin->sig_hash[i] = fa_csr_hash_ids(s, pmin->sig_len[i]);
+    }
+  }
+}
+
+// which thread owns a signature hash, uses high bits as low bits index the
+// table
+#define FA_CSR_PMIN_OWNER(h, threads) \
+  ((uint32_t)(((uint64_t)(h) * (uint64_t)(threads)) >> 32))
+
+// each thread groups the states with hashes it owns, in state order so rep
+// is the lowest numbered state with the same signature
+static void fa_csr_pmin_group(void *arg, int thread) {
+  fa_csr_pmin_t *pmin = arg;
+  fa_csr_pmin_thread_t *t = &pmin->pthreads[thread];
+  fa_csr_t *csr = pmin->csr;
+  uint32_t *sig = pmin->sig;
+  uint32_t *sig_len = pmin->sig_len;
+  uint32_t *sig_hash = pmin->sig_hash;
+  uint32_t i, j, n, size, mask;
+
+  for (i = 0, n = 0; i < csr->states_n; i++)
+    if (FA_CSR_PMIN_OWNER(sig_hash[i], pmin->threads) == thread)
+      n++;
+
+  for (size = 64; size < n * 2; size *= 2)
+    ;
+  if (size > t->size) {
+    free(t->table);
+    t->table = malloc(sizeof(t->table[0]) * size);
+    t->size = size;
+  }
+  mask = size - 1;
+  memset(t->table, 0, sizeof(t->table[0]) * size);
+
+  for (i = 0; i < csr->states_n; i++) {
+    if (FA_CSR_PMIN_OWNER(sig_hash[i], pmin->threads) != thread)
+      continue;
+
+    for (j = sig_hash[i] & mask; t->table[j]; j = (j + 1) & mask) {
+      uint32_t s = t->table[j] - 1;
+
+      if (sig_hash[s] == sig_hash[i] && sig_len[s] == sig_len[i] &&
+         memcmp(&sig[FA_CSR_SIG_OFF(csr, s)], &sig[FA_CSR_SIG_OFF(csr, i)],
+                sizeof(sig[0]) * sig_len[i]) == 0)
+        break;
+    }
+
+    if (t->table[j]) {
+      pmin->rep[i] = t->table[j] - 1;
+    } else {
+      t->table[j] = i + 1;
+      pmin->rep[i] = i;
+    }
+  }
+}
+
+// parallel minimize, see fa_csr_minimize_ex
+//
+// signatures are computed by threads taking chunks of states. states are
+// then grouped in parallel by hash, each thread owning a part of the hash
+// space, and renumbered in state order so the result is the same as
+// fa_csr_minimize_ex. cmp_cb is only called from the calling thread
+//
+fa_csr_t *fa_csr_minimize_parallel(fa_csr_t *csr, fa_state_cmp_f cmp_cb,
+                                   int *timeout, int threads) {
+  fa_thread_pool_t *pool;
+  fa_csr_pmin_t pmin;
+  fa_csr_t *mcsr;
+  uint32_t *nclass, *tmp;
+  uint32_t classes_n, nclasses_n;
+  uint32_t i;
+  int k;
+
+  threads = threads > 1 ? threads : 1;
+  pool = fa_thread_pool_create(threads);
+
+  pmin.csr = csr;
+  pmin.class = malloc(sizeof(pmin.class[0]) * (csr->states_n + 1));
+  nclass = malloc(sizeof(nclass[0]) * (csr->states_n + 1));
+  pmin.sig = malloc(sizeof(pmin.sig[0]) *
+                    (csr->states_n + csr->trans_n * 3 + 1));
+  pmin.sig_len = malloc(sizeof(pmin.sig_len[0]) * (csr->states_n + 1));
+  pmin.sig_hash = malloc(sizeof(pmin.sig_hash[0]) * (csr->states_n + 1));
+  pmin.rep = malloc(sizeof(pmin.rep[0]) * (csr->states_n + 1));
+  pthread_mutex_init(&pmin.lock, NULL);
+  pmin.threads = threads;
+  pmin.pthreads = calloc(threads, sizeof(pmin.pthreads[0]));
+
+  classes_n = fa_csr_minimize_initial(csr, cmp_cb, pmin.class);
+
+  for (;;) {
+    pmin.next = 0;
+    fa_thread_pool_run(pool, fa_csr_pmin_sig, &pmin);
+    fa_thread_pool_run(pool, fa_csr_pmin_group, &pmin);
+
+    // rep is always a lower state so is already numbered
+    nclasses_n = 0;
+    for (i = 0; i < csr->states_n; i++)
+      nclass[i] = pmin.rep[i] == i ? nclasses_n++ : nclass[pmin.rep[i]];
+
+    tmp = pmin.class;
+    pmin.class = nclass;
+    nclass = tmp;
+
+    // refinement only splits classes, same count means stable
+    if (nclasses_n == classes_n)
+      break;
+    classes_n = nclasses_n;
+
+    if (timeout && *timeout)
+      break;
+  }
+
+  mcsr = NULL;
+  if (!(timeout && *timeout))
+    mcsr = fa_csr_minimize_build(csr, pmin.class);
+
+  fa_thread_pool_destroy(pool);
+  for (k = 0; k < threads; k++)
+    free(pmin.pthreads[k].table);
+  free(pmin.pthreads);
+  pthread_mutex_destroy(&pmin.lock);
+  free(pmin.class);
+  free(nclass);
+  free(pmin.sig);
+  free(pmin.sig_len);
+  free(pmin.sig_hash);
+  free(pmin.rep);
+
+  return mcsr;
+}
@@ -0,0 +1,94 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_CSR_H__
+#define __FA_CSR_H__
+
+#include <inttypes.h>
+
+#include "fa.h"
+
+// compact index based fa, states are numbered 0..states_n-1 and the
+// transitions for state i are trans[index[i]] up to trans[index[i+1]]
+// sorted on symfrom with epsilon transitions first
+
+typedef struct fa_csr_trans_s {
+  int16_t symfrom;
+  int16_t symto;
+  uint32_t state;
+} fa_csr_trans_t;
+
+typedef struct fa_csr_s {
+  uint32_t start;
+  uint32_t states_n;
+  uint32_t trans_n;
+  uint32_t *index; // states_n + 1 offsets into trans
+  fa_csr_trans_t *trans;
+  uint8_t *flags; // FA_STATE_F_* per state
+  void **opaque; // user opaque per state
+} fa_csr_t;
+
+// work done so far by an incremental determinize or minimize
+typedef struct fa_csr_progress_s {
+  uint32_t states_n; // dfa states, or classes when minimizing
+  uint32_t trans_n;
+  uint32_t worklist_n; // states created but not yet processed
+  size_t mem; // bytes allocated
+} fa_csr_progress_t;
+
+typedef struct fa_csr_determinize_s fa_csr_determinize_t;
+typedef struct fa_csr_minimize_s fa_csr_minimize_t;
+
+
+fa_csr_t *fa_csr_create(fa_t *fa);
+void fa_csr_destroy(fa_csr_t *csr);
+fa_t *fa_csr_fa(fa_csr_t *csr);
+
+// returns new csr, input csr need to be freed
+fa_csr_t *fa_csr_determinize(fa_csr_t *csr);
+fa_csr_t *fa_csr_determinize_ex(fa_csr_t *csr, fa_state_pri_f pri_cb,
+                                fa_limit_t *limit, int *timeout);
+// incremental determinize, same result as fa_csr_determinize_ex. step
+// processes at most steps dfa states and returns 1 when done, end then
+// returns the result. destroy throws away an unfinished determinize. csr
+// must be kept until end or destroy
+fa_csr_determinize_t *fa_csr_determinize_begin(fa_csr_t *csr,
+                                               fa_state_pri_f pri_cb);
+int fa_csr_determinize_step(fa_csr_determinize_t *det, uint32_t steps);
+void fa_csr_determinize_progress(fa_csr_determinize_t *det,
+                                 fa_csr_progress_t *p);
+fa_csr_t *fa_csr_determinize_end(fa_csr_determinize_t *det);
+void fa_csr_determinize_destroy(fa_csr_determinize_t *det);
+// determinize into a fa_sim_t image in file path for dfas larger than
+// memory, temporary files are created in tmpdir. opaques are stored as is
+// so are only valid in the same process unless they are plain numbers.
+// returns 0 on success and -1 on file errors, limit or timeout
+int fa_csr_determinize_sim_file(fa_csr_t *csr, fa_state_pri_f pri_cb,
+                                fa_limit_t *limit, int *timeout,
+                                char *path, char *tmpdir);
+// same result as fa_csr_determinize_ex using threads threads
+fa_csr_t *fa_csr_determinize_parallel(fa_csr_t *csr, fa_state_pri_f pri_cb,
+                                      fa_limit_t *limit, int *timeout,
+                                      int threads);
+fa_csr_t *fa_csr_minimize(fa_csr_t *csr);
+fa_csr_t *fa_csr_minimize_ex(fa_csr_t *csr, fa_state_cmp_f cmp_cb,
+                             int *timeout);
+// incremental minimize, same result as fa_csr_minimize_ex. a step is one
+// state in a refinement pass, a round is states_n * 2 steps. used the same
+// way as the incremental determinize
+fa_csr_minimize_t *fa_csr_minimize_begin(fa_csr_t *csr,
+                                         fa_state_cmp_f cmp_cb);
+int fa_csr_minimize_step(fa_csr_minimize_t *m, uint32_t steps);
+void fa_csr_minimize_progress(fa_csr_minimize_t *m, fa_csr_progress_t *p);
+fa_csr_t *fa_csr_minimize_end(fa_csr_minimize_t *m);
+void fa_csr_minimize_destroy(fa_csr_minimize_t *m);
+// same result as fa_csr_minimize_ex using threads threads
+fa_csr_t *fa_csr_minimize_parallel(fa_csr_t *csr, fa_state_cmp_f cmp_cb,
+                                   int *timeout, int threads);
+
+#endif
@@ -0,0 +1,132 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "fa.h"
+#include "fa_csr.h"
+#include "fa_regexp.h"
+#include "fa_regexp_class.h"
+#include "fa_glushkov.h"
+#include "fa_deriv.h"
+#include "fa_ctx.h"
+
+typedef struct fa_ctx_list_s {
+  fa_ctx_t *ctx;
+  char **strs;
+  int n;
+  fa_t **fas;
+  char **errstrs;
+  int *errposs;
+  int failed;
+  int next; // next regexp, protected by lock
+  pthread_mutex_t lock;
+} fa_ctx_list_t;
+
+
+void fa_ctx_init(fa_ctx_t *ctx) {
+  ctx->dot_all = fa_regexp_class_dot_all;
+  ctx->limit = NULL;
+  ctx->threads = 0;
+  ctx->cache = NULL;
+  ctx->flags = 0;
+}
+
+fa_t *fa_ctx_regexp_fa(fa_ctx_t *ctx, char *str, char **errstr, int *errpos) {
+  fa_csr_t *csr, *tcsr;
+  fa_deriv_t *d;
+  fa_t *fa;
+
+  if (ctx->flags & FA_CTX_F_DERIV) {
+    d = fa_deriv_regexp(str, ctx->dot_all, errstr, errpos);
+    if (!d)
+      return NULL;
+    fa = fa_deriv_fa(d, ctx->limit, NULL);
+    fa_deriv_destroy(d);
+    if (!fa) {
+      *errstr = "determinization generated too many states or transitions";
+      *errpos = 0;
+      return NULL;
+    }
+  } else if (ctx->flags & FA_CTX_F_GLUSHKOV)
+    fa = fa_glushkov_regexp(str, ctx->dot_all, ctx->limit, errstr, errpos);
+  else
+    fa = fa_regexp_fa_cache(str, errstr, errpos, ctx->limit, ctx->dot_all,
+                            ctx->cache);
+  if (!fa || !(ctx->flags & FA_CTX_F_MIN))
+    return fa;
+
+  csr = fa_csr_create(fa);
+  fa_destroy(fa);
+  tcsr = fa_csr_determinize(csr);
+  fa_csr_destroy(csr);
+  csr = fa_csr_minimize(tcsr);
+  fa_csr_destroy(tcsr);
+  fa = fa_csr_fa(csr);
+  fa_csr_destroy(csr);
+
+  return fa;
+}
+
+static void *fa_ctx_list_worker(void *arg) {
+  fa_ctx_list_t *l = arg;
+  fa_t *fa;
+  int i;
+
+  while (1) {
+    pthread_mutex_lock(&l->lock);
+    i = l->next++;
+    pthread_mutex_unlock(&l->lock);
+
+    if (i >= l->n)
+      break;
+
+    fa = fa_ctx_regexp_fa(l->ctx, l->strs[i], &l->errstrs[i], &l->errposs[i]);
+    l->fas[i] = fa;
+    if (!fa) {
+      pthread_mutex_lock(&l->lock);
+      l->failed++;
+      pthread_mutex_unlock(&l->lock);
+    }
+  }
+
+  return NULL;
+}
+
+int fa_ctx_regexp_fa_list(fa_ctx_t *ctx, char **strs, int n, fa_t **fas,
+                          char **errstrs, int *errposs) {
+  fa_ctx_list_t l;
+  pthread_t *tids;
+  int i, threads;
+
+  l.ctx = ctx;
+  l.strs = strs;
+  l.n = n;
+  l.fas = fas;
+  l.errstrs = errstrs;
+  l.errposs = errposs;
+  l.failed = 0;
+  l.next = 0;
+  pthread_mutex_init(&l.lock, NULL);
+
+  threads = ctx->threads < n ? ctx->threads : n;
+  // calling thread is one of the workers
+  threads = threads > 1 ? threads - 1 : 0;
+  tids = malloc(sizeof(tids[0]) * (threads > 0 ? threads : 1));
+  for (i = 0; i < threads; i++)
+    pthread_create(&tids[i], NULL, fa_ctx_list_worker, &l);
+  fa_ctx_list_worker(&l);
+  for (i = 0; i < threads; i++)
+    pthread_join(tids[i], NULL);
+  free(tids);
+
+  pthread_mutex_destroy(&l.lock);
+
+  return l.failed;
+}
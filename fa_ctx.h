@@ -0,0 +1,39 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_CTX_H__
+#define __FA_CTX_H__
+
+#include <inttypes.h>
+
+#include "fa.h"
+#include "fa_regexp_cache.h"
+
+// regexp compile options. parsing keeps all its state per call so any
+// number of threads can compile at the same time, each with its own or a
+// shared read only context. fa_t memory is still allocated using the
+// global fa_mempool callbacks, the malloc based defaults are thread safe
+typedef struct fa_ctx_s {
+  int dot_all; // . matches \n too
+  fa_limit_t *limit; // repeat limits, can be NULL
+  int threads; // worker threads for fa_ctx_regexp_fa_list, 0 or 1 is none
+  fa_regexp_cache_t *cache; // shares sub expressions, can be NULL
+#define FA_CTX_F_MIN (1 << 0) // determinize and minimize each fa
+#define FA_CTX_F_GLUSHKOV (1 << 1) // epsilon free fa_glushkov_regexp, no cache
+#define FA_CTX_F_DERIV (1 << 2) // dfa from fa_deriv_regexp, no cache
+  uint32_t flags;
+} fa_ctx_t;
+
+void fa_ctx_init(fa_ctx_t *ctx);
+fa_t *fa_ctx_regexp_fa(fa_ctx_t *ctx, char *str, char **errstr, int *errpos);
+// compile n independent regexps, fas[i] is NULL and errstrs[i] and
+// errposs[i] is set if strs[i] fails. returns number of failed regexps
+int fa_ctx_regexp_fa_list(fa_ctx_t *ctx, char **strs, int n, fa_t **fas,
+                          char **errstrs, int *errposs);
+
+#endif
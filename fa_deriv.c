@@ -0,0 +1,752 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+// brzozowski derivatives. the derivative of a term by a byte matches the
+// rest of the strings the term matches starting with the byte, each
+// distinct derivative is a dfa state. terms are built only with the smart
+// constructors below so that equal terms are the same id: cat is right
+// associated and drops empty and eps, or is flattened, drops empty, merges
+// sets into one and has its subs sorted and unique. this keeps the number
+// of derivatives finite and usually close to the minimal dfa
+//
+// a state is expanded by splitting the bytes into classes that are in the
+// same sets of all sets that can match first, one derivative per class.
+// counted repeats are kept as repeat terms, r{n,m} derives to d(r)r{n-1,m-1}
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "fa.h"
+#include "fa_misc.h"
+#include "fa_regexp.h"
+#include "fa_regexp_class.h"
+#include "fa_regexp_bin.h"
+#include "fa_deriv.h"
+
+#define FA_DERIV_MAP_N (256 / 8)
+// created first in fa_deriv_regexp
+#define FA_DERIV_T_EMPTY 0
+#define FA_DERIV_T_EPS 1
+
+typedef struct fa_deriv_list_s {
+  uint32_t *ids;
+  int n;
+  int alloc_n;
+} fa_deriv_list_t;
+
+
+static void fa_deriv_list_add(fa_deriv_list_t *l, uint32_t id) {
+  if (l->n == l->alloc_n) {
+    l->alloc_n = MMAX(16, l->alloc_n * 2);
+    l->ids = realloc(l->ids, sizeof(l->ids[0]) * l->alloc_n);
+  }
+  l->ids[l->n++] = id;
+}
+
+static uint32_t fa_deriv_hash(int type, uint32_t a, uint32_t b, int min,
+                              int max, uint8_t *map, uint32_t *ors) {
+  uint32_t h = 2166136261u;
+  uint32_t i;
+
+  h = (h ^ type) * 16777619u;
+  if (type == FA_DERIV_SET) {
+    for (i = 0; i < FA_DERIV_MAP_N; i++)
+      h = (h ^ map[i]) * 16777619u;
+  } else if (type == FA_DERIV_OR) {
+    for (i = 0; i < b; i++)
+      h = (h ^ ors[i]) * 16777619u;
+  } else {
+    h = (h ^ a) * 16777619u;
+    h = (h ^ b) * 16777619u;
+    h = (h ^ (uint32_t)min) * 16777619u;
+    h = (h ^ (uint32_t)max) * 16777619u;
+  }
+
+  return h;
+}
+
+static int fa_deriv_equal(fa_deriv_t *d, fa_deriv_term_t *t, int type,
+                          uint32_t a, uint32_t b, int min, int max,
+                          uint8_t *map, uint32_t *ors) {
+  if (t->type != type)
+    return 0;
+
+  switch (type) {
+    case FA_DERIV_SET:
+      return memcmp(d->maps[t->a], map, FA_DERIV_MAP_N) == 0;
+    case FA_DERIV_OR:
+      return t->b == b &&
+        memcmp(&d->ors[t->a], ors, sizeof(ors[0]) * b) == 0;
+    default:
+      return t->a == a && t->b == b && t->min == min && t->max == max;
+  }
+}
+
+static void fa_deriv_rehash(fa_deriv_t *d) {
+  uint32_t i, j, mask;
+
+  free(d->table);
+  d->table_size *= 2;
+  d->table = calloc(d->table_size, sizeof(d->table[0]));
+  mask = d->table_size - 1;
+
+  for (i = 0; i < d->terms_n; i++) {
+    j = d->terms[i].hash & mask;
+    for (; d->table[j]; j = (j + 1) & mask)
+      ;
+    d->table[j] = i + 1;
+  }
+}
+
+// find or create term, for or b is the number of subs in ors
+static uint32_t fa_deriv_term(fa_deriv_t *d, int type, uint32_t a, uint32_t b,
+                              int min, int max, uint8_t *map, uint32_t *ors) {
+  fa_deriv_term_t *t;
+  uint32_t h, i, j, mask;
+
+  h = fa_deriv_hash(type, a, b, min, max, map, ors);
+  mask = d->table_size - 1;
+  for (j = h & mask; d->table[j]; j = (j + 1) & mask) {
+    t = &d->terms[d->table[j] - 1];
+    if (t->hash == h && fa_deriv_equal(d, t, type, a, b, min, max, map, ors))
+      return d->table[j] - 1;
+  }
+
+  if (d->terms_n == d->terms_alloc_n) {
+    d->terms_alloc_n = MMAX(64, d->terms_alloc_n * 2);
+    d->terms = realloc(d->terms, sizeof(d->terms[0]) * d->terms_alloc_n);
+  }
+
+  t = &d->terms[d->terms_n];
+  t->type = type;
+  t->a = a;
+  t->b = b;
+  t->min = min;
+  t->max = max;
+  t->hash = h;
+
+  switch (type) {
+    case FA_DERIV_SET:
+      if (d->maps_n == d->maps_alloc_n) {
+        d->maps_alloc_n = MMAX(64, d->maps_alloc_n * 2);
+        d->maps = realloc(d->maps, sizeof(d->maps[0]) * d->maps_alloc_n);
+      }
+      memcpy(d->maps[d->maps_n], map, FA_DERIV_MAP_N);
+      t->a = d->maps_n++;
+      t->nullable = 0;
+      break;
+    case FA_DERIV_OR:
+      if (d->ors_n + b > d->ors_alloc_n) {
+        d->ors_alloc_n = MMAX(256, (d->ors_n + b) * 2);
+        d->ors = realloc(d->ors, sizeof(d->ors[0]) * d->ors_alloc_n);
+      }
+      memcpy(&d->ors[d->ors_n], ors, sizeof(ors[0]) * b);
+      t->a = d->ors_n;
+      d->ors_n += b;
+      t->nullable = 0;
+      for (i = 0; i < b; i++)
+        t->nullable |= d->terms[ors[i]].nullable;
+      break;
+    case FA_DERIV_CAT:
+      t->nullable = d->terms[a].nullable && d->terms[b].nullable;
+      break;
+    case FA_DERIV_REPEAT:
+      t->nullable = min == 0 || d->terms[a].nullable;
+      break;
+    default:
+      t->nullable = type == FA_DERIV_EPS || type == FA_DERIV_STAR;
+      break;
+  }
+
+  d->table[j] = ++d->terms_n;
+  // keep load factor below 1/2
+  if (d->terms_n * 2 > d->table_size)
+    fa_deriv_rehash(d);
+
+  return d->terms_n - 1;
+}
+
+static uint32_t fa_deriv_set(fa_deriv_t *d, uint8_t *map) {
+  return fa_deriv_term(d, FA_DERIV_SET, 0, 0, 0, 0, map, NULL);
+}
+
+static uint32_t fa_deriv_cat(fa_deriv_t *d, uint32_t a, uint32_t b) {
+  if (a == FA_DERIV_T_EMPTY || b == FA_DERIV_T_EMPTY)
+    return FA_DERIV_T_EMPTY;
+  if (a == FA_DERIV_T_EPS)
+    return b;
+  if (b == FA_DERIV_T_EPS)
+    return a;
+  // r*r* is r*
+  if (d->terms[a].type == FA_DERIV_STAR &&
+      (b == a || (d->terms[b].type == FA_DERIV_CAT && d->terms[b].a == a)))
+    return b;
+  if (d->terms[a].type == FA_DERIV_CAT)
+    return fa_deriv_cat(d, d->terms[a].a,
+                        fa_deriv_cat(d, d->terms[a].b, b));
+
+  return fa_deriv_term(d, FA_DERIV_CAT, a, b, 0, 0, NULL, NULL);
+}
+
+static int fa_deriv_id_cmp(const void *a, const void *b) {
+  uint32_t ia = *(uint32_t *)a;
+  uint32_t ib = *(uint32_t *)b;
+
+  return ia < ib ? -1 : ia > ib;
+}
+
+static uint32_t fa_deriv_or(fa_deriv_t *d, uint32_t *subs, int n) {
+  uint8_t map[FA_DERIV_MAP_N];
+  fa_deriv_list_t l = {NULL, 0, 0};
+  fa_deriv_term_t *t;
+  uint32_t id;
+  int sets, eps, nullable;
+  int i, j, k, m;
+
+  memset(map, 0, sizeof(map));
+  sets = eps = nullable = 0;
+
+  for (i = 0; i < n; i++) {
+    t = &d->terms[subs[i]];
+    // or subs are already flat
+    k = t->type == FA_DERIV_OR ? t->b : 1;
+    for (j = 0; j < k; j++) {
+      id = t->type == FA_DERIV_OR ? d->ors[t->a + j] : subs[i];
+      // matches all strings so nothing else is needed
+      if (d->any && id == d->any) {
+        free(l.ids);
+        return id;
+      }
+
+      switch (d->terms[id].type) {
+        case FA_DERIV_EMPTY:
+          break;
+        case FA_DERIV_EPS:
+          eps = 1;
+          break;
+        case FA_DERIV_SET:
+          for (m = 0; m < FA_DERIV_MAP_N; m++)
+            map[m] |= d->maps[d->terms[id].a][m];
+          sets = 1;
+          break;
+        default:
+          nullable |= d->terms[id].nullable;
+          fa_deriv_list_add(&l, id);
+          break;
+      }
+    }
+  }
+
+  if (sets)
+    fa_deriv_list_add(&l, fa_deriv_set(d, map));
+  // eps is only needed if nothing else matches the empty string
+  if (eps && !nullable)
+    fa_deriv_list_add(&l, FA_DERIV_T_EPS);
+
+  if (l.n > 1)
+    qsort(l.ids, l.n, sizeof(l.ids[0]), fa_deriv_id_cmp);
+  for (i = 0, j = 0; i < l.n; i++)
+    if (j == 0 || l.ids[j - 1] != l.ids[i])
+      l.ids[j++] = l.ids[i];
+  l.n = j;
+
+  if (l.n == 0)
+    id = FA_DERIV_T_EMPTY;
+  else if (l.n == 1)
+    id = l.ids[0];
+  else
+    id = fa_deriv_term(d, FA_DERIV_OR, 0, l.n, 0, 0, NULL, l.ids);
+  free(l.ids);
+
+  return id;
+}
+
+static uint32_t fa_deriv_or2(fa_deriv_t *d, uint32_t a, uint32_t b) {
+  return fa_deriv_or(d, (uint32_t []){a, b}, 2);
+}
+
+static uint32_t fa_deriv_star(fa_deriv_t *d, uint32_t a) {
+  if (a == FA_DERIV_T_EMPTY || a == FA_DERIV_T_EPS)
+    return FA_DERIV_T_EPS;
+  if (d->terms[a].type == FA_DERIV_STAR)
+    return a;
+
+  return fa_deriv_term(d, FA_DERIV_STAR, a, 0, 0, 0, NULL, NULL);
+}
+
+static uint32_t fa_deriv_repeat(fa_deriv_t *d, uint32_t a, int min, int max) {
+  if (max == 0)
+    return FA_DERIV_T_EPS;
+  if (min == 0 && max == -1)
+    return fa_deriv_star(d, a);
+  if (min == 1 && max == 1)
+    return a;
+  if (a == FA_DERIV_T_EMPTY)
+    return min == 0 ? FA_DERIV_T_EPS : FA_DERIV_T_EMPTY;
+  if (a == FA_DERIV_T_EPS)
+    return FA_DERIV_T_EPS;
+
+  return fa_deriv_term(d, FA_DERIV_REPEAT, a, 0, min, max, NULL, NULL);
+}
+
+// derivative of term by byte c
+static uint32_t fa_deriv_d(fa_deriv_t *d, uint32_t id, uint8_t c) {
+  fa_deriv_term_t t = d->terms[id]; // terms may be reallocated
+  uint32_t *subs;
+  uint32_t r;
+  uint32_t i;
+
+  switch (t.type) {
+    case FA_DERIV_SET:
+      return BITFIELD_TEST(d->maps[t.a], c) ?
+        FA_DERIV_T_EPS : FA_DERIV_T_EMPTY;
+    case FA_DERIV_CAT:
+      r = fa_deriv_cat(d, fa_deriv_d(d, t.a, c), t.b);
+      if (d->terms[t.a].nullable)
+        r = fa_deriv_or2(d, r, fa_deriv_d(d, t.b, c));
+      return r;
+    case FA_DERIV_OR:
+      subs = malloc(sizeof(subs[0]) * t.b);
+      memcpy(subs, &d->ors[t.a], sizeof(subs[0]) * t.b);
+      for (i = 0; i < t.b; i++)
+        subs[i] = fa_deriv_d(d, subs[i], c);
+      r = fa_deriv_or(d, subs, t.b);
+      free(subs);
+      return r;
+    case FA_DERIV_STAR:
+      return fa_deriv_cat(d, fa_deriv_d(d, t.a, c), id);
+    case FA_DERIV_REPEAT:
+      return fa_deriv_cat(d, fa_deriv_d(d, t.a, c),
+                          fa_deriv_repeat(d, t.a, MMAX(t.min - 1, 0),
+                                          t.max == -1 ? -1 : t.max - 1));
+    default:
+      return FA_DERIV_T_EMPTY;
+  }
+}
+
+// sets that can match the first byte of term
+static void fa_deriv_first_sets(fa_deriv_t *d, uint32_t id,
+                                fa_deriv_list_t *sets) {
+  fa_deriv_term_t *t = &d->terms[id];
+  uint32_t i;
+
+  switch (t->type) {
+    case FA_DERIV_SET:
+      fa_deriv_list_add(sets, t->a);
+      break;
+    case FA_DERIV_CAT:
+      fa_deriv_first_sets(d, t->a, sets);
+      if (d->terms[t->a].nullable)
+        fa_deriv_first_sets(d, t->b, sets);
+      break;
+    case FA_DERIV_OR:
+      for (i = 0; i < t->b; i++)
+        fa_deriv_first_sets(d, d->ors[t->a + i], sets);
+      break;
+    case FA_DERIV_STAR:
+    case FA_DERIV_REPEAT:
+      fa_deriv_first_sets(d, t->a, sets);
+      break;
+    default:
+      break;
+  }
+}
+
+// state for term, created if new
+static int32_t fa_deriv_state(fa_deriv_t *d, uint32_t id) {
+  fa_deriv_state_t *s;
+  uint32_t n;
+
+  if (id == FA_DERIV_T_EMPTY)
+    return FA_DERIV_DEAD;
+
+  if (id >= d->term_state_alloc_n) {
+    n = d->term_state_alloc_n;
+    d->term_state_alloc_n = MMAX(64, d->terms_alloc_n);
+    d->term_state = realloc(d->term_state, sizeof(d->term_state[0]) *
+                            d->term_state_alloc_n);
+    memset(&d->term_state[n], 0, sizeof(d->term_state[0]) *
+           (d->term_state_alloc_n - n));
+  }
+  if (d->term_state[id])
+    return d->term_state[id] - 1;
+
+  if (d->states_n == d->states_alloc_n) {
+    d->states_alloc_n = MMAX(16, d->states_alloc_n * 2);
+    d->states = realloc(d->states, sizeof(d->states[0]) * d->states_alloc_n);
+  }
+  s = &d->states[d->states_n];
+  s->term = id;
+  s->expanded = 0;
+  d->term_state[id] = ++d->states_n;
+
+  return d->states_n - 1;
+}
+
+// one derivative per class of bytes that are in the same first sets
+static void fa_deriv_expand(fa_deriv_t *d, int32_t state) {
+  fa_deriv_list_t sets = {NULL, 0, 0};
+  int16_t remap[512];
+  int32_t next[256];
+  uint8_t cls[256];
+  uint32_t term;
+  int cls_n, n;
+  int i, c;
+
+  term = d->states[state].term;
+  fa_deriv_first_sets(d, term, &sets);
+
+  memset(cls, 0, sizeof(cls));
+  cls_n = 1;
+  for (i = 0; i < sets.n && cls_n < 256; i++) {
+    memset(remap, 0xff, sizeof(remap[0]) * cls_n * 2);
+    n = 0;
+    for (c = 0; c < 256; c++) {
+      int k = cls[c] * 2 + !!BITFIELD_TEST(d->maps[sets.ids[i]], c);
+
+      if (remap[k] == -1)
+        remap[k] = n++;
+      cls[c] = remap[k];
+    }
+    cls_n = n;
+  }
+  free(sets.ids);
+
+  for (i = 0; i < cls_n; i++)
+    next[i] = -2;
+  for (c = 0; c < 256; c++)
+    if (next[cls[c]] == -2)
+      next[cls[c]] = fa_deriv_state(d, fa_deriv_d(d, term, c));
+
+  // states may be reallocated
+  for (c = 0; c < 256; c++)
+    d->states[state].trans[c] = next[cls[c]];
+  d->states[state].expanded = 1;
+}
+
+int32_t fa_deriv_next(fa_deriv_t *d, int32_t state, uint8_t c) {
+  if (state == FA_DERIV_DEAD)
+    return FA_DERIV_DEAD;
+  if (!d->states[state].expanded)
+    fa_deriv_expand(d, state);
+
+  return d->states[state].trans[c];
+}
+
+int fa_deriv_accepting(fa_deriv_t *d, int32_t state) {
+  return state != FA_DERIV_DEAD && d->terms[d->states[state].term].nullable;
+}
+
+fa_t *fa_deriv_fa(fa_deriv_t *d, fa_limit_t *limit, int *timeout) {
+  fa_trans_range_t ranges[256];
+  fa_state_t **fss;
+  fa_t *fa;
+  int32_t *trans;
+  uint32_t i;
+  int ranges_n;
+  int c;
+
+  for (i = 0; i < d->states_n; i++) {
+    if (!d->states[i].expanded)
+      fa_deriv_expand(d, i);
+    if ((timeout && *timeout) || (limit && (int)d->states_n > limit->states))
+      return NULL;
+  }
+
+  fa = fa_create();
+  fss = malloc(sizeof(fss[0]) * d->states_n);
+  for (i = 0; i < d->states_n; i++) {
+    fss[i] = fa_state_create(fa);
+    fa_state_accepting(fss[i], d->terms[d->states[i].term].nullable);
+    // so fa_union can merge it like for fa_regexp_fa_ex
+    if (d->states[i].term == d->any)
+      fss[i]->flags |= FA_STATE_F_ANY_END;
+    if (i == 0)
+      fa->start = fss[i];
+  }
+
+  for (i = 0; i < d->states_n; i++) {
+    trans = d->states[i].trans;
+    ranges_n = 0;
+    for (c = 0; c < 256; c++) {
+      if (trans[c] == FA_DERIV_DEAD)
+        continue;
+
+      if (ranges_n > 0 &&
+          ranges[ranges_n - 1].state == fss[trans[c]] &&
+          ranges[ranges_n - 1].symto == c - 1) {
+        ranges[ranges_n - 1].symto = c;
+      } else {
+        ranges[ranges_n].symfrom = c;
+        ranges[ranges_n].symto = c;
+        ranges[ranges_n].state = fss[trans[c]];
+        ranges_n++;
+      }
+    }
+    fa_trans_create_list(fss[i], ranges, ranges_n);
+  }
+  free(fss);
+
+  if (limit && fa->trans_n > limit->trans) {
+    fa_destroy(fa);
+    return NULL;
+  }
+
+  return fa;
+}
+
+static void fa_deriv_char(uint8_t *map, uint8_t c, uint32_t flags) {
+  BITFIELD_SET(map, c);
+  if (flags & FA_REGEXP_F_ICASE && isalpha(c)) {
+    BITFIELD_SET(map, toupper(c));
+    BITFIELD_SET(map, tolower(c));
+  }
+}
+
+static int fa_deriv_map_empty(uint8_t *map) {
+  int i;
+
+  for (i = 0; i < FA_DERIV_MAP_N; i++)
+    if (map[i])
+      return 0;
+
+  return 1;
+}
+
+// cat of terms right to left so cat does not need to reassociate
+static uint32_t fa_deriv_cat_list(fa_deriv_t *d, uint32_t *ids, int n) {
+  uint32_t r = FA_DERIV_T_EPS;
+  int i;
+
+  for (i = n - 1; i >= 0; i--)
+    r = fa_deriv_cat(d, ids[i], r);
+
+  return r;
+}
+
+// fa_regexp_bin_fa gives a chain of states, one set per byte
+static uint32_t fa_deriv_binary(fa_deriv_t *d, fa_t *fa) {
+  uint8_t map[FA_DERIV_MAP_N];
+  fa_deriv_list_t l = {NULL, 0, 0};
+  fa_state_t *fs;
+  fa_trans_t *ft;
+  uint32_t r;
+  int c;
+
+  for (fs = fa->start; !LIST_EMPTY(&fs->trans);
+       fs = LIST_FIRST(&fs->trans)->state) {
+    memset(map, 0, sizeof(map));
+    LIST_FOREACH(ft, &fs->trans, link)
+      for (c = ft->symfrom; c <= ft->symto; c++)
+        BITFIELD_SET(map, c);
+    fa_deriv_list_add(&l, fa_deriv_set(d, map));
+  }
+
+  r = fa_deriv_cat_list(d, l.ids, l.n);
+  free(l.ids);
+
+  return r;
+}
+
+// flags is the options scope like when lowering in fa_regexp_node_fa
+static int fa_deriv_node(fa_deriv_t *d, fa_regexp_node_t *node,
+                         uint32_t *flags, uint32_t *id,
+                         char **errstr, int *errpos) {
+  uint8_t map[FA_DERIV_MAP_N];
+  fa_deriv_list_t l = {NULL, 0, 0};
+  uint32_t sub_flags;
+  uint32_t sub;
+  int min, max;
+  fa_t *fa;
+  int i;
+
+  *id = FA_DERIV_T_EPS;
+
+  switch (node->type) {
+    case RE_SUB:
+      sub_flags = *flags;
+      return fa_deriv_node(d, node->value.sub.sub, &sub_flags, id,
+                           errstr, errpos);
+    case RE_OPTIONS:
+      *flags =
+        (*flags & ~node->value.options.flags) |
+        (node->value.options.neg ? 0 : node->value.options.flags);
+      if (!node->value.options.sub)
+        break;
+      return fa_deriv_node(d, node->value.options.sub, flags, id,
+                           errstr, errpos);
+    case RE_CONCAT:
+      for (i = 0; i < node->value.concat.n; i++) {
+        if (fa_deriv_node(d, node->value.concat.subs[i], flags, &sub,
+                          errstr, errpos) == -1)
+          goto error;
+        fa_deriv_list_add(&l, sub);
+      }
+      *id = fa_deriv_cat_list(d, l.ids, l.n);
+      free(l.ids);
+      break;
+    case RE_UNION:
+      for (i = 0; i < node->value.union_.n; i++) {
+        if (fa_deriv_node(d, node->value.union_.subs[i], flags, &sub,
+                          errstr, errpos) == -1)
+          goto error;
+        fa_deriv_list_add(&l, sub);
+      }
+      *id = fa_deriv_or(d, l.ids, l.n);
+      free(l.ids);
+      break;
+    case RE_REPEAT:
+      min = node->value.repeat.min;
+      max = node->value.repeat.max;
+      if (node->value.repeat.onlymin)
+        max = min;
+      else if (max == 0)
+        max = -1;
+
+      // a{0} case
+      if (max == 0)
+        break;
+
+      if (max != -1 && min > max) {
+        *errpos = node->pos;
+        *errstr = "min repeat must be less or equal to max repeat";
+        return -1;
+      }
+
+      if (fa_deriv_node(d, node->value.repeat.sub, flags, &sub,
+                        errstr, errpos) == -1)
+        return -1;
+      *id = fa_deriv_repeat(d, sub, min, max);
+      break;
+    case RE_STRING:
+      for (i = 0; i < node->value.string.len; i++) {
+        memset(map, 0, sizeof(map));
+        fa_deriv_char(map, node->value.string.str[i], *flags);
+        fa_deriv_list_add(&l, fa_deriv_set(d, map));
+      }
+      *id = fa_deriv_cat_list(d, l.ids, l.n);
+      free(l.ids);
+      break;
+    case RE_CLASS:
+      fa_regexp_class_map(node->value.class_.class_, node->value.class_.neg,
+                          *flags & FA_REGEXP_F_ICASE, map);
+      // [^\x00-\xff] matches nothing
+      if (fa_deriv_map_empty(map)) {
+        *errstr = "character class does not match any characters";
+        *errpos = node->pos;
+        return -1;
+      }
+      *id = fa_deriv_set(d, map);
+      break;
+    case RE_BINARY:
+      if (fa_regexp_bin_bitlen(node->value.binary) % 8 != 0) {
+        *errstr = "binary is not byte aligned";
+        *errpos = node->pos;
+        return -1;
+      }
+
+      fa = fa_regexp_bin_fa(node->value.binary);
+      *id = fa_deriv_binary(d, fa);
+      fa_destroy(fa);
+      break;
+  }
+
+  return 0;
+
+error:
+  free(l.ids);
+  return -1;
+}
+
+fa_deriv_t *fa_deriv_regexp(char *str, int dot_all, char **errstr,
+                            int *errpos) {
+  fa_regexp_node_t *root;
+  uint8_t map[FA_DERIV_MAP_N];
+  fa_deriv_t *d;
+  uint32_t flags;
+  uint32_t id, any;
+  int start_anchor = 0;
+  int end_anchor = 0;
+  char *s;
+  int len;
+  int r;
+
+  *errstr = NULL;
+  *errpos = 0;
+  s = str;
+  len = strlen(str);
+
+  if (s[0] == '^') {
+    start_anchor = 1;
+    s++;
+    len--;
+  }
+
+  // if ends with "$" and its not escaped
+  if (len > 0 && s[len-1] == '$' &&
+      (len == 1 || (len > 1 && s[len-2] != '\\'))) {
+    end_anchor = 1;
+    len--;
+  }
+
+  root = fa_regexp_yacc_parse(s, len, dot_all, errstr, errpos);
+  if (*errstr) {
+    if (*errpos > 0 && start_anchor)
+      (*errpos)++; // ^ was removed
+    return NULL;
+  }
+
+  d = calloc(1, sizeof(*d));
+  d->table_size = 256;
+  d->table = calloc(d->table_size, sizeof(d->table[0]));
+  fa_deriv_term(d, FA_DERIV_EMPTY, 0, 0, 0, 0, NULL, NULL);
+  fa_deriv_term(d, FA_DERIV_EPS, 0, 0, 0, 0, NULL, NULL);
+
+  flags = 0;
+  fa_regexp_node_flatten(root);
+  fa_regexp_node_simplify(root);
+  r = fa_deriv_node(d, root, &flags, &id, errstr, errpos);
+  fa_regexp_node_free(root);
+  if (r == -1) {
+    if (*errpos > 0 && start_anchor)
+      (*errpos)++;
+    fa_deriv_destroy(d);
+    return NULL;
+  }
+
+  memset(map, 0xff, sizeof(map));
+  any = fa_deriv_star(d, fa_deriv_set(d, map));
+  d->any = any;
+  if (!start_anchor)
+    id = fa_deriv_cat(d, any, id);
+  if (!end_anchor)
+    id = fa_deriv_cat(d, id, any);
+
+  // start is always state 0, also if it matches nothing
+  if (id == FA_DERIV_T_EMPTY) {
+    d->states = calloc(1, sizeof(d->states[0]));
+    d->states_n = d->states_alloc_n = 1;
+    memset(d->states[0].trans, 0xff, sizeof(d->states[0].trans));
+    d->states[0].expanded = 1;
+  } else {
+    fa_deriv_state(d, id);
+  }
+
+  return d;
+}
+
+void fa_deriv_destroy(fa_deriv_t *d) {
+  free(d->terms);
+  free(d->table);
+  free(d->ors);
+  free(d->maps);
+  free(d->states);
+  free(d->term_state);
+  free(d);
+}
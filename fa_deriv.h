@@ -0,0 +1,77 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_DERIV_H__
+#define __FA_DERIV_H__
+
+#include <inttypes.h>
+
+#include "fa.h"
+
+#define FA_DERIV_DEAD -1 // state after a byte that can never match
+
+// regexp term, subs are term ids. or terms keep a sorted list of unique
+// subs in ors and set terms index a 256 bit map in maps
+typedef struct fa_deriv_term_s {
+#define FA_DERIV_EMPTY 0 // matches nothing
+#define FA_DERIV_EPS 1 // matches the empty string
+#define FA_DERIV_SET 2
+#define FA_DERIV_CAT 3
+#define FA_DERIV_OR 4
+#define FA_DERIV_STAR 5
+#define FA_DERIV_REPEAT 6
+  int type;
+  uint32_t a; // sub, set map or offset into ors
+  uint32_t b; // second cat sub or number of or subs
+  int min;
+  int max; // -1 for no max
+  int nullable;
+  uint32_t hash;
+} fa_deriv_term_t;
+
+// dfa state, trans is FA_DERIV_DEAD or a state index per byte. trans is
+// filled in when first stepped from
+typedef struct fa_deriv_state_s {
+  uint32_t term;
+  int expanded;
+  int32_t trans[256];
+} fa_deriv_state_t;
+
+typedef struct fa_deriv_s {
+  fa_deriv_term_t *terms;
+  uint32_t terms_n;
+  uint32_t terms_alloc_n;
+  uint32_t *table; // term id + 1, 0 is empty
+  uint32_t table_size; // power of 2
+  uint32_t *ors;
+  uint32_t ors_n;
+  uint32_t ors_alloc_n;
+  uint8_t (*maps)[256 / 8];
+  uint32_t maps_n;
+  uint32_t maps_alloc_n;
+  fa_deriv_state_t *states; // 0 is start
+  uint32_t states_n;
+  uint32_t states_alloc_n;
+  uint32_t *term_state; // state index + 1 per term id, 0 if none
+  uint32_t term_state_alloc_n;
+  uint32_t any; // star of all bytes, or with it is it
+} fa_deriv_t;
+
+// derivatives of regexp, states are created lazily by fa_deriv_next or all
+// at once by fa_deriv_fa. same language and anchoring as fa_regexp_fa_ex
+fa_deriv_t *fa_deriv_regexp(char *str, int dot_all, char **errstr,
+                            int *errpos);
+void fa_deriv_destroy(fa_deriv_t *d);
+// state after byte c from state, FA_DERIV_DEAD if no string can match
+int32_t fa_deriv_next(fa_deriv_t *d, int32_t state, uint8_t c);
+int fa_deriv_accepting(fa_deriv_t *d, int32_t state);
+// dfa with all states reachable from start, not minimized but usually not
+// far from it. returns NULL if limit is reached or on timeout
+fa_t *fa_deriv_fa(fa_deriv_t *d, fa_limit_t *limit, int *timeout);
+
+#endif
@@ -0,0 +1,276 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+// product automaton of two DFAs. states are pairs of input states where
+// index 0 is the implicit dead state for missing transitions. pairs are
+// created when first reached and processed in creation order, transitions
+// are built by walking the sorted ranges of both states in parallel so no
+// per symbol work is done
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fa.h"
+#include "fa_dfa.h"
+
+#define FA_DFA_OP_UNION 0
+#define FA_DFA_OP_INTERSECT 1
+#define FA_DFA_OP_DIFFERENCE 2
+
+typedef struct fa_dfa_pair_s {
+  uint32_t a; // state index + 1, 0 is dead
+  uint32_t b;
+  fa_state_t *fs;
+} fa_dfa_pair_t;
+
+typedef struct fa_dfa_product_s {
+  int op;
+  fa_t *dfa;
+  fa_state_t **as; // index to state
+  fa_state_t **bs;
+  fa_dfa_pair_t *pairs;
+  uint32_t pairs_n;
+  uint32_t pairs_alloc_n;
+  uint32_t *table; // pair index + 1, 0 is empty
+  uint32_t table_size; // power of 2
+} fa_dfa_product_t;
+
+
+// number states in opaque_temp, works also if a and b is the same fa
+static fa_state_t **fa_dfa_index(fa_t *fa) {
+  fa_state_t **fss;
+  fa_state_t *fs;
+  uintptr_t i;
+
+  fss = malloc(sizeof(fss[0]) * (fa->states_n > 0 ? fa->states_n : 1));
+  i = 0;
+  LIST_FOREACH(fs, &fa->states, link) {
+    fss[i++] = fs;
+    fs->opaque_temp = (void *)i;
+  }
+
+  return fss;
+}
+
+static uint32_t fa_dfa_hash(uint32_t a, uint32_t b) {
+  return (a * 2654435761u) ^ (b * 2246822519u);
+}
+
+static void fa_dfa_rehash(fa_dfa_product_t *p) {
+  uint32_t i, j, mask;
+
+  free(p->table);
+  p->table_size *= 2;
+  p->table = calloc(p->table_size, sizeof(p->table[0]));
+  mask = p->table_size - 1;
+
+  for (i = 0; i < p->pairs_n; i++) {
+    j = fa_dfa_hash(p->pairs[i].a, p->pairs[i].b) & mask;
+    for (; p->table[j]; j = (j + 1) & mask)
+      ;
+    p->table[j] = i + 1;
+  }
+}
+
+// is a pair with these states accepting
+static int fa_dfa_accepting(int op, fa_state_t *a, fa_state_t *b) {
+  int aa = a && a->flags & FA_STATE_F_ACCEPTING;
+  int ba = b && b->flags & FA_STATE_F_ACCEPTING;
+
+  switch (op) {
+  case FA_DFA_OP_UNION: return aa || ba;
+  case FA_DFA_OP_INTERSECT: return aa && ba;
+  default: return aa && !ba;
+  }
+}
+
+// can a pair with these states ever become accepting
+static int fa_dfa_live(int op, uint32_t a, uint32_t b) {
+  switch (op) {
+  case FA_DFA_OP_UNION: return a || b;
+  case FA_DFA_OP_INTERSECT: return a && b;
+  default: return a != 0;
+  }
+}
+
+// find or create state for pair
+static fa_state_t *fa_dfa_pair(fa_dfa_product_t *p, uint32_t a, uint32_t b,
+                               fa_state_pri_f pri_cb) {
+  fa_dfa_pair_t *pair;
+  fa_state_t *as, *bs;
+  uint32_t j, mask;
+
+  mask = p->table_size - 1;
+  for (j = fa_dfa_hash(a, b) & mask; p->table[j]; j = (j + 1) & mask) {
+    pair = &p->pairs[p->table[j] - 1];
+    if (pair->a == a && pair->b == b)
+      return pair->fs;
+  }
+
+  if (p->pairs_n == p->pairs_alloc_n) {
+    p->pairs_alloc_n = p->pairs_alloc_n ? p->pairs_alloc_n * 2 : 64;
+    p->pairs = realloc(p->pairs, sizeof(p->pairs[0]) * p->pairs_alloc_n);
+  }
+
+  pair = &p->pairs[p->pairs_n++];
+  pair->a = a;
+  pair->b = b;
+  pair->fs = fa_state_create(p->dfa);
+  p->table[j] = p->pairs_n;
+
+  as = a ? p->as[a - 1] : NULL;
+  bs = b ? p->bs[b - 1] : NULL;
+  if (fa_dfa_accepting(p->op, as, bs)) {
+    fa_state_accepting(pair->fs, 1);
+
+    if (!(as && as->flags & FA_STATE_F_ACCEPTING))
+      pair->fs->opaque = bs->opaque;
+    else if (p->op == FA_DFA_OP_DIFFERENCE ||
+             !(bs && bs->flags & FA_STATE_F_ACCEPTING) ||
+             as->opaque == bs->opaque ||
+             !pri_cb)
+      pair->fs->opaque = as->opaque;
+    else
+      pair->fs->opaque = pri_cb((void *[]){as->opaque, bs->opaque}, 2);
+  }
+
+  // keep load factor below 1/2
+  if (p->pairs_n * 2 > p->table_size)
+    fa_dfa_rehash(p);
+
+  return pair->fs;
+}
+
+// skip transitions ending before symbol, epsilon ends at -1 so is skipped
+// too. sets dest to state index for symbol and returns last symbol with the
+// same dest
+static int fa_dfa_range(fa_trans_t **ft, int symbol, uint32_t *dest) {
+  while (*ft && (*ft)->symto < symbol)
+    *ft = LIST_NEXT(*ft, link);
+
+  if (!*ft) {
+    *dest = 0;
+    return 255;
+  }
+  if ((*ft)->symfrom > symbol) {
+    *dest = 0;
+    return (*ft)->symfrom - 1;
+  }
+
+  *dest = (uintptr_t)(*ft)->state->opaque_temp;
+  return (*ft)->symto;
+}
+
+static fa_t *fa_dfa_product(int op, fa_t *a, fa_t *b, fa_state_pri_f pri_cb,
+                            fa_limit_t *limit, int *timeout) {
+  fa_trans_range_t ranges[256];
+  fa_dfa_product_t p;
+  fa_t *dfa;
+  uint32_t i;
+  int cancel;
+
+  memset(&p, 0, sizeof(p));
+  p.op = op;
+  p.dfa = fa_create();
+  p.as = fa_dfa_index(a);
+  p.bs = fa_dfa_index(b);
+  p.table_size = 256;
+  p.table = calloc(p.table_size, sizeof(p.table[0]));
+
+  p.dfa->start = fa_dfa_pair(&p,
+                             (uintptr_t)a->start->opaque_temp,
+                             (uintptr_t)b->start->opaque_temp,
+                             pri_cb);
+
+  cancel = 0;
+  for (i = 0; !cancel && i < p.pairs_n; i++) {
+    uint32_t pa = p.pairs[i].a;
+    uint32_t pb = p.pairs[i].b;
+    fa_trans_t *ta = pa ? LIST_FIRST(&p.as[pa - 1]->trans) : NULL;
+    fa_trans_t *tb = pb ? LIST_FIRST(&p.bs[pb - 1]->trans) : NULL;
+    int ranges_n = 0;
+    int symbol, end, end_b;
+
+    for (symbol = 0; symbol < 256; symbol = end + 1) {
+      uint32_t da, db;
+      fa_state_t *u;
+
+      end = fa_dfa_range(&ta, symbol, &da);
+      end_b = fa_dfa_range(&tb, symbol, &db);
+      if (end_b < end)
+        end = end_b;
+
+      if (!fa_dfa_live(op, da, db))
+        continue;
+
+      // pairs may be reallocated
+      u = fa_dfa_pair(&p, da, db, pri_cb);
+
+      if (ranges_n > 0 &&
+          ranges[ranges_n - 1].state == u &&
+          ranges[ranges_n - 1].symto == symbol - 1) {
+        ranges[ranges_n - 1].symto = end;
+      } else {
+        ranges[ranges_n].symfrom = symbol;
+        ranges[ranges_n].symto = end;
+        ranges[ranges_n].state = u;
+        ranges_n++;
+      }
+    }
+
+    fa_trans_create_list(p.pairs[i].fs, ranges, ranges_n);
+
+    if ((timeout && *timeout) ||
+        (limit && (p.dfa->states_n > limit->states ||
+                   p.dfa->trans_n > limit->trans)))
+      cancel = 1;
+  }
+
+  dfa = p.dfa;
+  if (cancel) {
+    fa_destroy(dfa);
+    dfa = NULL;
+  }
+
+  free(p.as);
+  free(p.bs);
+  free(p.pairs);
+  free(p.table);
+
+  return dfa;
+}
+
+fa_t *fa_dfa_union(fa_t *a, fa_t *b, fa_state_pri_f pri_cb,
+                   fa_limit_t *limit, int *timeout) {
+  return fa_dfa_product(FA_DFA_OP_UNION, a, b, pri_cb, limit, timeout);
+}
+
+fa_t *fa_dfa_intersect(fa_t *a, fa_t *b, fa_state_pri_f pri_cb,
+                       fa_limit_t *limit, int *timeout) {
+  return fa_dfa_product(FA_DFA_OP_INTERSECT, a, b, pri_cb, limit, timeout);
+}
+
+fa_t *fa_dfa_difference(fa_t *a, fa_t *b, fa_limit_t *limit, int *timeout) {
+  return fa_dfa_product(FA_DFA_OP_DIFFERENCE, a, b, NULL, limit, timeout);
+}
+
+// difference between a one state FA matching everything and fa
+fa_t *fa_dfa_complement(fa_t *fa, void *opaque) {
+  fa_t *all, *cfa;
+
+  all = fa_create();
+  all->start = fa_state_create(all);
+  fa_state_accepting(all->start, 1);
+  all->start->opaque = opaque;
+  fa_trans_create_range(all->start, 0, 255, all->start);
+
+  cfa = fa_dfa_difference(all, fa, NULL, NULL);
+  fa_destroy(all);
+
+  return cfa;
+}
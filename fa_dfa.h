@@ -0,0 +1,32 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_DFA_H__
+#define __FA_DFA_H__
+
+#include "fa.h"
+
+// product construction on DFAs, inputs must be deterministic (no epsilon
+// and no overlapping transitions) and are not freed. only pairs of states
+// reachable from the start pair are created. results are deterministic but
+// not minimized
+//
+// if both states of a pair are accepting with different opaques pri_cb is
+// used to choose, without pri_cb the opaque from a is used. returns NULL if
+// limit is reached or timeout is set
+
+fa_t *fa_dfa_union(fa_t *a, fa_t *b, fa_state_pri_f pri_cb,
+                   fa_limit_t *limit, int *timeout);
+fa_t *fa_dfa_intersect(fa_t *a, fa_t *b, fa_state_pri_f pri_cb,
+                       fa_limit_t *limit, int *timeout);
+// matched by a but not by b, opaques are from a
+fa_t *fa_dfa_difference(fa_t *a, fa_t *b, fa_limit_t *limit, int *timeout);
+// matches everything fa does not match, accepting states get opaque
+fa_t *fa_dfa_complement(fa_t *fa, void *opaque);
+
+#endif
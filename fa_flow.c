@@ -0,0 +1,266 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+// flows are kept in a linear probing table of 16 byte entries, removal
+// shifts following entries back so there are no tombstones. a batch is
+// sorted on flow id so each flow is looked up once, then FA_FLOW_LANES
+// flows are stepped together one byte each in turn so that the node table
+// loads of different flows overlap instead of waiting on each other
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fa_misc.h"
+#include "fa_sim.h"
+#include "fa_flow.h"
+
+#define FA_FLOW_LANES 4
+
+typedef struct fa_flow_seg_ref_s {
+  uint64_t flow;
+  int i; // index in segs, keeps segment order within a flow
+} fa_flow_seg_ref_t;
+
+typedef struct fa_flow_lane_s {
+  uint32_t node;
+  uint8_t *p;
+  uint32_t left; // bytes left in current segment
+  int ref; // current segment in refs
+  int ref_end;
+  int group;
+  uint32_t entry;
+} fa_flow_lane_t;
+
+
+static uint32_t fa_flow_hash(fa_flow_table_t *ft, uint64_t flow) {
+  return (uint32_t)((flow * 0x9e3779b97f4a7c15ull) >> (64 - ft->bits));
+}
+
+// slot with flow or empty slot to insert it in
+static uint32_t fa_flow_find(fa_flow_table_t *ft, uint64_t flow) {
+  uint32_t mask = ft->size - 1;
+  uint32_t j;
+
+  for (j = fa_flow_hash(ft, flow); ft->entries[j].node; j = (j + 1) & mask)
+    if (ft->entries[j].flow == flow)
+      break;
+
+  return j;
+}
+
+static void fa_flow_resize(fa_flow_table_t *ft, int bits) {
+  fa_flow_entry_t *old = ft->entries;
+  uint32_t old_size = ft->size;
+  uint32_t i, j;
+
+  ft->bits = bits;
+  ft->size = 1u << bits;
+  ft->entries = calloc(ft->size, sizeof(ft->entries[0]));
+
+  for (i = 0; i < old_size; i++) {
+    if (!old[i].node)
+      continue;
+    j = fa_flow_find(ft, old[i].flow);
+    ft->entries[j] = old[i];
+  }
+  free(old);
+}
+
+fa_flow_table_t *fa_flow_table_create(fa_sim_t *sim, uint32_t size) {
+  fa_flow_table_t *ft = calloc(1, sizeof(*ft));
+  uint32_t i;
+  int bits, c;
+
+  ft->sim = sim;
+  ft->final = calloc(sim->nodes_n, 1);
+  ft->final[0] = 1;
+  for (i = 1; i < sim->nodes_n; i++) {
+    for (c = 0; c < 256 && sim->nodes[i].table[c] == i; c++)
+      ;
+    ft->final[i] = c == 256;
+  }
+
+  // keep load factor below 3/4
+  for (bits = 6; bits < 31 && (1u << bits) / 4 * 3 < size; bits++)
+    ;
+  fa_flow_resize(ft, bits);
+
+  return ft;
+}
+
+void fa_flow_table_destroy(fa_flow_table_t *ft) {
+  free(ft->final);
+  free(ft->entries);
+  free(ft);
+}
+
+// shift back entries that probed past slot j
+static void fa_flow_delete(fa_flow_table_t *ft, uint32_t j) {
+  uint32_t mask = ft->size - 1;
+  uint32_t k, h;
+
+  ft->n--;
+  for (;;) {
+    ft->entries[j].node = 0;
+    for (k = (j + 1) & mask; ft->entries[k].node; k = (k + 1) & mask) {
+      h = fa_flow_hash(ft, ft->entries[k].flow);
+      // entry can not move before its home slot h
+      if (j <= k ? (j < h && h <= k) : (j < h || h <= k))
+        continue;
+      break;
+    }
+    if (!ft->entries[k].node)
+      return;
+
+    ft->entries[j] = ft->entries[k];
+    j = k;
+  }
+}
+
+void fa_flow_table_remove(fa_flow_table_t *ft, uint64_t flow) {
+  uint32_t j = fa_flow_find(ft, flow);
+
+  if (ft->entries[j].node)
+    fa_flow_delete(ft, j);
+}
+
+static int fa_flow_seg_ref_cmp(const void *a, const void *b) {
+  const fa_flow_seg_ref_t *ra = a;
+  const fa_flow_seg_ref_t *rb = b;
+
+  if (ra->flow != rb->flow)
+    return ra->flow < rb->flow ? -1 : 1;
+
+  return ra->i - rb->i;
+}
+
+// next non-empty segment of lane flow, 0 if none
+static int fa_flow_lane_seg(fa_flow_lane_t *lane, fa_flow_segment_t *segs,
+                            fa_flow_seg_ref_t *refs) {
+  for (; lane->ref < lane->ref_end; lane->ref++) {
+    lane->p = segs[refs[lane->ref].i].data;
+    lane->left = segs[refs[lane->ref].i].len;
+    if (lane->left > 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+int fa_flow_table_run(fa_flow_table_t *ft, fa_flow_segment_t *segs,
+                      int segs_n, fa_flow_decision_t *decisions) {
+  fa_flow_lane_t lanes[FA_FLOW_LANES];
+  fa_flow_seg_ref_t *refs;
+  fa_sim_node_t *nodes = ft->sim->nodes;
+  fa_flow_decision_t *d;
+  fa_flow_lane_t *lane;
+  uint32_t *starts; // first ref of each group
+  uint64_t *expired;
+  int expired_n = 0;
+  int groups_n, next;
+  uint32_t n, i;
+  int l, k;
+
+  if (segs_n == 0)
+    return 0;
+
+  refs = malloc(sizeof(refs[0]) * segs_n);
+  starts = malloc(sizeof(starts[0]) * (segs_n + 1));
+  expired = malloc(sizeof(expired[0]) * segs_n);
+  for (l = 0; l < segs_n; l++) {
+    refs[l].flow = segs[l].flow;
+    refs[l].i = l;
+  }
+  qsort(refs, segs_n, sizeof(refs[0]), fa_flow_seg_ref_cmp);
+
+  groups_n = 0;
+  for (l = 0; l < segs_n; l++)
+    if (l == 0 || refs[l].flow != refs[l - 1].flow)
+      starts[groups_n++] = l;
+  starts[groups_n] = segs_n;
+
+  // grow before so entries do not move while lanes point at them
+  while (ft->bits < 31 && (ft->n + groups_n) > ft->size / 4 * 3)
+    fa_flow_resize(ft, ft->bits + 1);
+
+  next = 0;
+  k = 0;
+  while (k > 0 || next < groups_n) {
+    // give free lanes the next flows
+    for (; k < FA_FLOW_LANES && next < groups_n; next++) {
+      lane = &lanes[k];
+      lane->group = next;
+      lane->ref = starts[next];
+      lane->ref_end = starts[next + 1];
+      lane->entry = fa_flow_find(ft, refs[lane->ref].flow);
+      if (!ft->entries[lane->entry].node) {
+        ft->entries[lane->entry].flow = refs[lane->ref].flow;
+        ft->entries[lane->entry].node = ft->sim->start;
+        ft->n++;
+      }
+      lane->node = ft->entries[lane->entry].node;
+      // left is 0 if all segments are empty
+      fa_flow_lane_seg(lane, segs, refs);
+      k++;
+    }
+
+    n = UINT32_MAX;
+    for (l = 0; l < k; l++)
+      n = MMIN(n, lanes[l].left);
+
+    for (i = 0; i < n; i++)
+      for (l = 0; l < k; l++)
+        lanes[l].node = nodes[lanes[l].node].table[lanes[l].p[i]];
+
+    for (l = 0; l < k; l++) {
+      lanes[l].p += n;
+      lanes[l].left -= n;
+    }
+
+    for (l = 0; l < k;) {
+      lane = &lanes[l];
+      if (lane->left > 0) {
+        l++;
+        continue;
+      }
+      lane->ref++;
+      if (fa_flow_lane_seg(lane, segs, refs)) {
+        l++;
+        continue;
+      }
+
+      d = &decisions[lane->group];
+      d->flow = ft->entries[lane->entry].flow;
+      d->final = ft->final[lane->node];
+      d->opaque = NULL;
+      if (nodes[lane->node].flags & FA_SIM_NODE_F_ACCEPTING) {
+        d->result = FA_SIM_RUN_ACCEPT;
+        d->opaque = nodes[lane->node].opaque;
+      } else {
+        d->result = d->final ? FA_SIM_RUN_REJECT : FA_SIM_RUN_MORE;
+      }
+
+      // removed after the batch so entries do not move
+      if (d->final)
+        expired[expired_n++] = d->flow;
+      else
+        ft->entries[lane->entry].node = lane->node;
+
+      lanes[l] = lanes[--k];
+    }
+  }
+
+  for (l = 0; l < expired_n; l++)
+    fa_flow_table_remove(ft, expired[l]);
+
+  free(refs);
+  free(starts);
+  free(expired);
+
+  return groups_n;
+}
@@ -0,0 +1,61 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_FLOW_H__
+#define __FA_FLOW_H__
+
+#include <inttypes.h>
+
+#include "fa_sim.h"
+
+// sim state of many concurrent streams keyed by flow id. a flow is only
+// its id and sim node in an open addressing table, opaques are read from
+// the sim node when a decision is reported. flows are created by their
+// first segment and removed when their result can not change anymore, that
+// is when rejected or in an accepting node that loops to itself on all
+// bytes. segments of a removed flow start it over again
+
+typedef struct fa_flow_segment_s {
+  uint64_t flow;
+  uint8_t *data;
+  uint32_t len;
+} fa_flow_segment_t;
+
+typedef struct fa_flow_decision_s {
+  uint64_t flow;
+  int result; // FA_SIM_RUN_ACCEPT, FA_SIM_RUN_REJECT or FA_SIM_RUN_MORE
+  void *opaque; // of the accepting node
+  int final; // flow was removed
+} fa_flow_decision_t;
+
+typedef struct fa_flow_entry_s {
+  uint64_t flow;
+  uint32_t node; // 0 is an empty slot, node 0 is never kept
+} fa_flow_entry_t;
+
+typedef struct fa_flow_table_s {
+  fa_sim_t *sim;
+  uint8_t *final; // per node, result can not change by stepping
+  fa_flow_entry_t *entries;
+  uint32_t size; // power of 2
+  uint32_t n;
+  int bits;
+} fa_flow_table_t;
+
+// sim has to be kept until destroy, size is a hint of number of flows
+fa_flow_table_t *fa_flow_table_create(fa_sim_t *sim, uint32_t size);
+void fa_flow_table_destroy(fa_flow_table_t *ft);
+// remove a flow that ended before a final decision
+void fa_flow_table_remove(fa_flow_table_t *ft, uint64_t flow);
+// step segments of each flow in the order given. decisions gets one entry
+// per flow in segs sorted on flow id and needs room for segs_n entries.
+// returns number of decisions
+int fa_flow_table_run(fa_flow_table_t *ft, fa_flow_segment_t *segs,
+                      int segs_n, fa_flow_decision_t *decisions);
+
+#endif
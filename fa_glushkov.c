@@ -0,0 +1,530 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+// each sub expression gives the positions it can start and end with and if
+// it matches the empty string. concat adds follow edges from the end
+// positions of the left side to the start positions of the right side and
+// a loop adds them from its end to its start positions. when done every
+// follow edge from p to q is a transition on the chars of q, the start
+// state is a position with edges to the start positions of the regexp
+//
+// repeats are expanded, optional copies are nested like (x(x)?)? so that
+// each copy only follows the one before it
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "fa.h"
+#include "fa_misc.h"
+#include "fa_regexp.h"
+#include "fa_regexp_class.h"
+#include "fa_regexp_bin.h"
+#include "fa_glushkov.h"
+
+#define FA_GLUSHKOV_MAP_N (256 / 8)
+
+typedef struct fa_glushkov_set_s {
+  uint32_t *pos;
+  uint32_t n;
+  uint32_t alloc_n;
+} fa_glushkov_set_t;
+
+// sub expression, positions it can start and end with
+typedef struct fa_glushkov_frag_s {
+  fa_glushkov_set_t first;
+  fa_glushkov_set_t last;
+  int nullable;
+} fa_glushkov_frag_t;
+
+typedef struct fa_glushkov_follow_s {
+  uint32_t from;
+  uint32_t to;
+} fa_glushkov_follow_t;
+
+typedef struct fa_glushkov_build_s {
+  uint8_t (*maps)[FA_GLUSHKOV_MAP_N]; // chars per position, 0 is start
+  uint32_t maps_n;
+  uint32_t maps_alloc_n;
+  fa_glushkov_follow_t *follows;
+  uint32_t follows_n;
+  uint32_t follows_alloc_n;
+  fa_limit_t *limit;
+  char **errstr;
+  int *errpos;
+} fa_glushkov_build_t;
+
+
+static void fa_glushkov_set_add(fa_glushkov_set_t *s, uint32_t p) {
+  if (s->n == s->alloc_n) {
+    s->alloc_n = MMAX(8, s->alloc_n * 2);
+    s->pos = realloc(s->pos, sizeof(s->pos[0]) * s->alloc_n);
+  }
+  s->pos[s->n++] = p;
+}
+
+// union src into dst, positions are never in both. the smaller set is
+// appended to the larger so long chains of optional copies stay linear
+static void fa_glushkov_set_move(fa_glushkov_set_t *dst,
+                                 fa_glushkov_set_t *src) {
+  fa_glushkov_set_t t;
+  uint32_t i;
+
+  if (src->n > dst->n) {
+    t = *dst;
+    *dst = *src;
+    *src = t;
+  }
+  for (i = 0; i < src->n; i++)
+    fa_glushkov_set_add(dst, src->pos[i]);
+  free(src->pos);
+  memset(src, 0, sizeof(*src));
+}
+
+static void fa_glushkov_frag_free(fa_glushkov_frag_t *f) {
+  free(f->first.pos);
+  free(f->last.pos);
+  memset(f, 0, sizeof(*f));
+}
+
+static void fa_glushkov_empty(fa_glushkov_frag_t *f) {
+  memset(f, 0, sizeof(*f));
+  f->nullable = 1;
+}
+
+static void fa_glushkov_position(fa_glushkov_build_t *b, uint8_t *map,
+                                 fa_glushkov_frag_t *f) {
+  if (b->maps_n == b->maps_alloc_n) {
+    b->maps_alloc_n = MMAX(64, b->maps_alloc_n * 2);
+    b->maps = realloc(b->maps, sizeof(b->maps[0]) * b->maps_alloc_n);
+  }
+  memcpy(b->maps[b->maps_n], map, FA_GLUSHKOV_MAP_N);
+
+  memset(f, 0, sizeof(*f));
+  fa_glushkov_set_add(&f->first, b->maps_n);
+  fa_glushkov_set_add(&f->last, b->maps_n);
+  b->maps_n++;
+}
+
+static void fa_glushkov_follow(fa_glushkov_build_t *b,
+                               fa_glushkov_set_t *from,
+                               fa_glushkov_set_t *to) {
+  uint32_t i, j;
+
+  for (i = 0; i < from->n; i++) {
+    for (j = 0; j < to->n; j++) {
+      if (b->follows_n == b->follows_alloc_n) {
+        b->follows_alloc_n = MMAX(64, b->follows_alloc_n * 2);
+        b->follows = realloc(b->follows,
+                             sizeof(b->follows[0]) * b->follows_alloc_n);
+      }
+      b->follows[b->follows_n].from = from->pos[i];
+      b->follows[b->follows_n].to = to->pos[j];
+      b->follows_n++;
+    }
+  }
+}
+
+// a is a followed by c, c is freed
+static void fa_glushkov_concat(fa_glushkov_build_t *b, fa_glushkov_frag_t *a,
+                               fa_glushkov_frag_t *c) {
+  fa_glushkov_follow(b, &a->last, &c->first);
+
+  if (a->nullable)
+    fa_glushkov_set_move(&a->first, &c->first);
+  if (c->nullable) {
+    fa_glushkov_set_move(&a->last, &c->last);
+  } else {
+    free(a->last.pos);
+    a->last = c->last;
+    memset(&c->last, 0, sizeof(c->last));
+  }
+  a->nullable = a->nullable && c->nullable;
+
+  fa_glushkov_frag_free(c);
+}
+
+static int fa_glushkov_limit(fa_glushkov_build_t *b, fa_regexp_node_t *node) {
+  if (!b->limit ||
+      (b->maps_n <= b->limit->states && b->follows_n <= b->limit->trans))
+    return 0;
+
+  *b->errpos = node->pos;
+  *b->errstr = "repeat will generates too many states or transitions";
+  return -1;
+}
+
+static void fa_glushkov_char(uint8_t *map, uint8_t c, uint32_t flags) {
+  BITFIELD_SET(map, c);
+  if (flags & FA_REGEXP_F_ICASE && isalpha(c)) {
+    BITFIELD_SET(map, toupper(c));
+    BITFIELD_SET(map, tolower(c));
+  }
+}
+
+static int fa_glushkov_map_empty(uint8_t *map) {
+  int i;
+
+  for (i = 0; i < FA_GLUSHKOV_MAP_N; i++)
+    if (map[i])
+      return 0;
+
+  return 1;
+}
+
+// fa_regexp_bin_fa gives a chain of states, one position per byte
+static void fa_glushkov_binary(fa_glushkov_build_t *b, fa_t *fa,
+                               fa_glushkov_frag_t *f) {
+  uint8_t map[FA_GLUSHKOV_MAP_N];
+  fa_glushkov_frag_t sf;
+  fa_state_t *fs;
+  fa_trans_t *ft;
+  int c;
+
+  fa_glushkov_empty(f);
+
+  for (fs = fa->start; !LIST_EMPTY(&fs->trans);
+       fs = LIST_FIRST(&fs->trans)->state) {
+    memset(map, 0, sizeof(map));
+    LIST_FOREACH(ft, &fs->trans, link)
+      for (c = ft->symfrom; c <= ft->symto; c++)
+        BITFIELD_SET(map, c);
+    fa_glushkov_position(b, map, &sf);
+    fa_glushkov_concat(b, f, &sf);
+  }
+}
+
+static int fa_glushkov_node(fa_glushkov_build_t *b, fa_regexp_node_t *node,
+                            uint32_t *flags, fa_glushkov_frag_t *f);
+
+// min copies of sub, the last one looped without max, followed by max - min
+// nested optional copies
+static int fa_glushkov_repeat(fa_glushkov_build_t *b, fa_regexp_node_t *node,
+                              uint32_t *flags, fa_glushkov_frag_t *f) {
+  fa_glushkov_frag_t *copies = NULL;
+  fa_glushkov_frag_t sf;
+  fa_regexp_node_t *sub;
+  uint32_t start_flags, sub_flags;
+  int min, max, n;
+  int i, j;
+
+  sub = node->value.repeat.sub;
+  min = node->value.repeat.min;
+  max = node->value.repeat.onlymin ? min : node->value.repeat.max;
+  start_flags = *flags;
+
+  fa_glushkov_empty(f);
+
+  if (node->value.repeat.onlymin && min == 0)
+    return 0;
+
+  if (max != 0 && min > max) {
+    *b->errpos = node->pos;
+    *b->errstr = "min repeat must be less or equal to max repeat";
+    return -1;
+  }
+
+  // sub is built once for each copy with the flags at the repeat, options
+  // in the first copy apply after the repeat like when lowering
+  n = max == 0 ? (MMAX(min, 1)) : min;
+  for (i = 0; i < n; i++) {
+    sub_flags = start_flags;
+    if (fa_glushkov_node(b, sub, i == 0 ? flags : &sub_flags, &sf) == -1)
+      goto error;
+    if (max == 0 && i == n - 1) {
+      fa_glushkov_follow(b, &sf.last, &sf.first);
+      if (min == 0)
+        sf.nullable = 1;
+    }
+    fa_glushkov_concat(b, f, &sf);
+    if (fa_glushkov_limit(b, node) == -1)
+      goto error;
+  }
+
+  if (max <= min)
+    return 0;
+
+  copies = calloc(max - min, sizeof(copies[0]));
+  for (i = 0; i < max - min; i++) {
+    sub_flags = start_flags;
+    if (fa_glushkov_node(b, sub, n == 0 && i == 0 ? flags : &sub_flags,
+                         &copies[i]) == -1 ||
+        fa_glushkov_limit(b, node) == -1) {
+      for (j = 0; j <= i; j++)
+        fa_glushkov_frag_free(&copies[j]);
+      free(copies);
+      goto error;
+    }
+  }
+
+  for (i = max - min - 1; i > 0; i--) {
+    copies[i].nullable = 1;
+    fa_glushkov_concat(b, &copies[i - 1], &copies[i]);
+  }
+  copies[0].nullable = 1;
+  fa_glushkov_concat(b, f, &copies[0]);
+  free(copies);
+
+  return 0;
+
+error:
+  fa_glushkov_frag_free(f);
+  return -1;
+}
+
+// flags is the options scope like when lowering in fa_regexp_node_fa
+static int fa_glushkov_node(fa_glushkov_build_t *b, fa_regexp_node_t *node,
+                            uint32_t *flags, fa_glushkov_frag_t *f) {
+  uint8_t map[FA_GLUSHKOV_MAP_N];
+  fa_glushkov_frag_t sf;
+  uint32_t sub_flags;
+  fa_t *fa;
+  int i;
+
+  fa_glushkov_empty(f);
+
+  switch (node->type) {
+    case RE_SUB:
+      sub_flags = *flags;
+      return fa_glushkov_node(b, node->value.sub.sub, &sub_flags, f);
+    case RE_OPTIONS:
+      *flags =
+        (*flags & ~node->value.options.flags) |
+        (node->value.options.neg ? 0 : node->value.options.flags);
+      if (!node->value.options.sub)
+        break;
+      return fa_glushkov_node(b, node->value.options.sub, flags, f);
+    case RE_CONCAT:
+      for (i = 0; i < node->value.concat.n; i++) {
+        if (fa_glushkov_node(b, node->value.concat.subs[i], flags, &sf) == -1)
+          goto error;
+        fa_glushkov_concat(b, f, &sf);
+      }
+      break;
+    case RE_UNION:
+      f->nullable = 0;
+      for (i = 0; i < node->value.union_.n; i++) {
+        if (fa_glushkov_node(b, node->value.union_.subs[i], flags, &sf) == -1)
+          goto error;
+        fa_glushkov_set_move(&f->first, &sf.first);
+        fa_glushkov_set_move(&f->last, &sf.last);
+        f->nullable = f->nullable || sf.nullable;
+      }
+      break;
+    case RE_REPEAT:
+      return fa_glushkov_repeat(b, node, flags, f);
+    case RE_STRING:
+      for (i = 0; i < node->value.string.len; i++) {
+        memset(map, 0, sizeof(map));
+        fa_glushkov_char(map, node->value.string.str[i], *flags);
+        fa_glushkov_position(b, map, &sf);
+        fa_glushkov_concat(b, f, &sf);
+      }
+      break;
+    case RE_CLASS:
+      fa_regexp_class_map(node->value.class_.class_, node->value.class_.neg,
+                          *flags & FA_REGEXP_F_ICASE, map);
+      // [^\x00-\xff] matches nothing
+      if (fa_glushkov_map_empty(map)) {
+        *b->errstr = "character class does not match any characters";
+        *b->errpos = node->pos;
+        return -1;
+      }
+      fa_glushkov_position(b, map, f);
+      break;
+    case RE_BINARY:
+      if (fa_regexp_bin_bitlen(node->value.binary) % 8 != 0) {
+        *b->errstr = "binary is not byte aligned";
+        *b->errpos = node->pos;
+        return -1;
+      }
+
+      fa = fa_regexp_bin_fa(node->value.binary);
+      fa_glushkov_binary(b, fa, f);
+      fa_destroy(fa);
+      break;
+  }
+
+  return 0;
+
+error:
+  fa_glushkov_frag_free(f);
+  return -1;
+}
+
+static int fa_glushkov_follow_cmp(const void *a, const void *b) {
+  const fa_glushkov_follow_t *fa = a;
+  const fa_glushkov_follow_t *fb = b;
+
+  if (fa->from != fb->from)
+    return fa->from < fb->from ? -1 : 1;
+  return fa->to < fb->to ? -1 : fa->to > fb->to;
+}
+
+static int fa_glushkov_range_cmp(const void *a, const void *b) {
+  const fa_trans_range_t *ra = a;
+  const fa_trans_range_t *rb = b;
+
+  return ra->symfrom - rb->symfrom;
+}
+
+static void fa_glushkov_range_add(fa_trans_range_t **ranges, int *n,
+                                  int *alloc_n, int symfrom, int symto,
+                                  fa_state_t *dest) {
+  if (*n == *alloc_n) {
+    *alloc_n = MMAX(64, *alloc_n * 2);
+    *ranges = realloc(*ranges, sizeof((*ranges)[0]) * *alloc_n);
+  }
+  (*ranges)[*n].symfrom = symfrom;
+  (*ranges)[*n].symto = symto;
+  (*ranges)[*n].state = dest;
+  (*n)++;
+}
+
+// transitions of each position are inserted in one go sorted on symfrom,
+// unanchored start loops on any char and accepting positions go to an
+// accepting any state when not end anchored
+static fa_t *fa_glushkov_fa(fa_glushkov_build_t *b, fa_glushkov_frag_t *f,
+                            int start_anchor, int end_anchor) {
+  fa_trans_range_t *ranges = NULL;
+  int ranges_n, ranges_alloc_n = 0;
+  fa_state_t **states;
+  fa_state_t *any = NULL;
+  fa_t *fa;
+  uint32_t i, k, p;
+  int c, from;
+
+  fa = fa_create();
+  states = malloc(sizeof(states[0]) * b->maps_n);
+  for (p = 0; p < b->maps_n; p++)
+    states[p] = fa_state_create(fa);
+  fa->start = states[0];
+
+  if (!end_anchor) {
+    any = fa_state_create(fa);
+    fa_trans_create_list(any, (fa_trans_range_t []){{0, 255, any}}, 1);
+    fa_state_accepting(any, 1);
+    any->flags |= FA_STATE_F_ANY_END;
+  }
+
+  for (i = 0; i < f->last.n; i++)
+    fa_state_accepting(states[f->last.pos[i]], 1);
+  if (f->nullable)
+    fa_state_accepting(states[0], 1);
+
+  fa_glushkov_follow(b, &(fa_glushkov_set_t){(uint32_t []){0}, 1, 1},
+                     &f->first);
+  if (b->follows_n > 0)
+    qsort(b->follows, b->follows_n, sizeof(b->follows[0]),
+          fa_glushkov_follow_cmp);
+
+  for (p = 0, i = 0; p < b->maps_n; p++) {
+    ranges_n = 0;
+
+    if (p == 0 && !start_anchor)
+      fa_glushkov_range_add(&ranges, &ranges_n, &ranges_alloc_n, 0, 255,
+                            states[0]);
+    if (any && states[p]->flags & FA_STATE_F_ACCEPTING)
+      fa_glushkov_range_add(&ranges, &ranges_n, &ranges_alloc_n, 0, 255,
+                            any);
+
+    for (; i < b->follows_n && b->follows[i].from == p; i++) {
+      // same edge can be added more than once
+      if (i > 0 && b->follows[i - 1].from == p &&
+          b->follows[i - 1].to == b->follows[i].to)
+        continue;
+
+      k = b->follows[i].to;
+      for (c = 0; c < 256; c++) {
+        if (!BITFIELD_TEST(b->maps[k], c))
+          continue;
+        for (from = c; c < 255 && BITFIELD_TEST(b->maps[k], c + 1); c++)
+          ;
+        fa_glushkov_range_add(&ranges, &ranges_n, &ranges_alloc_n,
+                              from, c, states[k]);
+      }
+    }
+
+    if (ranges_n == 0)
+      continue;
+    qsort(ranges, ranges_n, sizeof(ranges[0]), fa_glushkov_range_cmp);
+    fa_trans_create_list(states[p], ranges, ranges_n);
+  }
+
+  free(ranges);
+  free(states);
+
+  return fa;
+}
+
+fa_t *fa_glushkov_regexp(char *str, int dot_all, fa_limit_t *limit,
+                         char **errstr, int *errpos) {
+  fa_glushkov_build_t b;
+  fa_glushkov_frag_t f;
+  fa_regexp_node_t *root;
+  uint8_t map[FA_GLUSHKOV_MAP_N];
+  fa_t *fa = NULL;
+  uint32_t flags;
+  int start_anchor = 0;
+  int end_anchor = 0;
+  char *s;
+  int len;
+  int r;
+
+  *errstr = NULL;
+  *errpos = 0;
+  s = str;
+  len = strlen(str);
+
+  if (s[0] == '^') {
+    start_anchor = 1;
+    s++;
+    len--;
+  }
+
+  // if ends with "$" and its not escaped
+  if (len > 0 && s[len-1] == '$' &&
+      (len == 1 || (len > 1 && s[len-2] != '\\'))) {
+    end_anchor = 1;
+    len--;
+  }
+
+  root = fa_regexp_yacc_parse(s, len, dot_all, errstr, errpos);
+  if (*errstr)
+    goto error;
+
+  memset(&b, 0, sizeof(b));
+  b.limit = limit;
+  b.errstr = errstr;
+  b.errpos = errpos;
+  flags = 0;
+
+  // start state is position 0, its chars are not used
+  memset(map, 0, sizeof(map));
+  fa_glushkov_position(&b, map, &f);
+  fa_glushkov_frag_free(&f);
+
+  fa_regexp_node_flatten(root);
+  fa_regexp_node_simplify(root);
+  r = fa_glushkov_node(&b, root, &flags, &f);
+  fa_regexp_node_free(root);
+  if (r == 0) {
+    fa = fa_glushkov_fa(&b, &f, start_anchor, end_anchor);
+    fa_glushkov_frag_free(&f);
+  }
+  free(b.maps);
+  free(b.follows);
+  if (r == 0)
+    return fa;
+
+error:
+  if (*errpos > 0 && start_anchor)
+    (*errpos)++; // ^ was removed
+
+  return NULL;
+}
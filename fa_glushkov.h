@@ -0,0 +1,22 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_GLUSHKOV_H__
+#define __FA_GLUSHKOV_H__
+
+#include "fa.h"
+
+// position (glushkov) automaton for regexp, same language and anchoring as
+// fa_regexp_fa_ex. there is one state per char, class or binary byte
+// occurrence after repeats are expanded plus a start state, and no epsilon
+// transitions so determinize does not need to follow any. repeats check
+// limit against the total number of states and transitions
+fa_t *fa_glushkov_regexp(char *str, int dot_all, fa_limit_t *limit,
+                         char **errstr, int *errpos);
+
+#endif
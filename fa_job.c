@@ -0,0 +1,227 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+// compile job on top of the incremental csr determinize and minimize. the
+// partial csr lives in the job between runs so nothing is lost when a run
+// stops
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "fa.h"
+#include "fa_csr.h"
+#include "fa_job.h"
+
+// steps run between deadline checks, determinize steps are expensive
+// enough to check every time
+#define FA_JOB_MIN_BATCH 1024
+
+struct fa_job_s {
+  int phase;
+  uint32_t flags;
+  fa_limit_t limit;
+  int has_limit;
+  fa_state_cmp_f *cmp_cb;
+  fa_csr_t *csr; // input to current phase
+  fa_csr_determinize_t *det;
+  fa_csr_minimize_t *min;
+  fa_csr_t *result;
+  uint64_t steps;
+  uint64_t deadline;
+  fa_job_progress_f *progress_cb;
+  void *progress_opaque;
+  uint32_t progress_interval;
+  uint64_t progress_next;
+  int limited; // limit was reached
+};
+
+
+uint64_t fa_job_clock(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+fa_job_t *fa_job_create(fa_t *fa, fa_state_pri_f pri_cb,
+                        fa_state_cmp_f cmp_cb, fa_limit_t *limit,
+                        uint32_t flags) {
+  fa_job_t *job;
+
+  job = calloc(1, sizeof(*job));
+  job->phase = FA_JOB_PHASE_DETERMINIZE;
+  job->flags = flags;
+  if (limit) {
+    job->limit = *limit;
+    job->has_limit = 1;
+  }
+  job->cmp_cb = cmp_cb;
+  job->progress_next = UINT64_MAX;
+  job->csr = fa_csr_create(fa);
+  job->det = fa_csr_determinize_begin(job->csr, pri_cb);
+
+  return job;
+}
+
+void fa_job_destroy(fa_job_t *job) {
+  if (job->det)
+    fa_csr_determinize_destroy(job->det);
+  if (job->min)
+    fa_csr_minimize_destroy(job->min);
+  if (job->csr)
+    fa_csr_destroy(job->csr);
+  if (job->result)
+    fa_csr_destroy(job->result);
+  free(job);
+}
+
+void fa_job_deadline(fa_job_t *job, uint64_t deadline) {
+  job->deadline = deadline;
+}
+
+void fa_job_progress(fa_job_t *job, fa_job_progress_f cb, void *opaque,
+                     uint32_t interval) {
+  job->progress_cb = cb;
+  job->progress_opaque = opaque;
+  job->progress_interval = interval;
+  job->progress_next = interval ? job->steps + interval : UINT64_MAX;
+}
+
+static void fa_job_report(fa_job_t *job) {
+  fa_job_progress_t p;
+  fa_csr_progress_t cp;
+
+  if (!job->progress_cb)
+    return;
+
+  cp.states_n = 0;
+  cp.trans_n = 0;
+  cp.worklist_n = 0;
+  cp.mem = 0;
+  if (job->det)
+    fa_csr_determinize_progress(job->det, &cp);
+  else if (job->min)
+    fa_csr_minimize_progress(job->min, &cp);
+  else if (job->result) {
+    cp.states_n = job->result->states_n;
+    cp.trans_n = job->result->trans_n;
+  }
+
+  p.phase = job->phase;
+  p.steps = job->steps;
+  p.states_n = cp.states_n;
+  p.trans_n = cp.trans_n;
+  p.worklist_n = cp.worklist_n;
+  p.mem = cp.mem;
+  job->progress_cb(job, &p, job->progress_opaque);
+
+  if (job->progress_interval)
+    job->progress_next = job->steps + job->progress_interval;
+}
+
+// run one batch of at most n steps in current phase, returns steps run or
+// 0 and a run result when the job can not continue
+static uint64_t fa_job_batch(fa_job_t *job, uint64_t n, int *r) {
+  fa_csr_progress_t cp;
+  fa_csr_t *csr;
+  int done;
+
+  *r = FA_JOB_DONE;
+
+  switch (job->phase) {
+  case FA_JOB_PHASE_DETERMINIZE:
+    n = 1;
+    done = fa_csr_determinize_step(job->det, n);
+    fa_csr_determinize_progress(job->det, &cp);
+    if (job->has_limit &&
+       (cp.states_n > job->limit.states || cp.trans_n > job->limit.trans)) {
+      job->limited = 1;
+      *r = FA_JOB_LIMIT;
+      return 0;
+    }
+    if (!done)
+      return n;
+
+    csr = fa_csr_determinize_end(job->det);
+    job->det = NULL;
+    fa_csr_destroy(job->csr);
+    job->csr = NULL;
+    if (job->flags & FA_JOB_F_MIN) {
+      job->csr = csr;
+      job->min = fa_csr_minimize_begin(csr, job->cmp_cb);
+      job->phase = FA_JOB_PHASE_MINIMIZE;
+    } else {
+      job->result = csr;
+      job->phase = FA_JOB_PHASE_DONE;
+    }
+    fa_job_report(job);
+
+    return n;
+  case FA_JOB_PHASE_MINIMIZE:
+    n = n < FA_JOB_MIN_BATCH ? n : FA_JOB_MIN_BATCH;
+    if (!fa_csr_minimize_step(job->min, n))
+      return n;
+
+    job->result = fa_csr_minimize_end(job->min);
+    job->min = NULL;
+    fa_csr_destroy(job->csr);
+    job->csr = NULL;
+    job->phase = FA_JOB_PHASE_DONE;
+    fa_job_report(job);
+
+    return n;
+  default:
+    return 0;
+  }
+}
+
+int fa_job_run(fa_job_t *job, uint64_t steps) {
+  uint64_t left, n;
+  int r;
+
+  if (job->limited)
+    return FA_JOB_LIMIT;
+
+  left = steps ? steps : UINT64_MAX;
+
+  while (job->phase != FA_JOB_PHASE_DONE) {
+    if (left == 0) {
+      fa_job_report(job);
+      return FA_JOB_SUSPENDED;
+    }
+    if (job->deadline && fa_job_clock() >= job->deadline) {
+      fa_job_report(job);
+      return FA_JOB_DEADLINE;
+    }
+
+    n = fa_job_batch(job, left, &r);
+    if (n == 0)
+      return r;
+    job->steps += n;
+    left -= n;
+
+    if (job->steps >= job->progress_next)
+      fa_job_report(job);
+  }
+
+  return FA_JOB_DONE;
+}
+
+fa_t *fa_job_result(fa_job_t *job) {
+  fa_t *fa;
+
+  if (!job->result)
+    return NULL;
+
+  fa = fa_csr_fa(job->result);
+  fa_csr_destroy(job->result);
+  job->result = NULL;
+
+  return fa;
+}
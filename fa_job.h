@@ -0,0 +1,66 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_JOB_H__
+#define __FA_JOB_H__
+
+#include <inttypes.h>
+
+#include "fa.h"
+
+// resumable compile of an fa into a dfa, optionally minimized. the job runs
+// in steps, a step is one dfa state when determinizing and one state of a
+// refinement pass when minimizing. fa_job_run can stop after a number of
+// steps or at a deadline and a later fa_job_run continues where it stopped,
+// so a large compile can be spread over event loop ticks
+
+#define FA_JOB_PHASE_DETERMINIZE 0
+#define FA_JOB_PHASE_MINIMIZE 1
+#define FA_JOB_PHASE_DONE 2
+
+// fa_job_run results
+#define FA_JOB_DONE 0
+#define FA_JOB_SUSPENDED 1 // steps used up, can be resumed
+#define FA_JOB_DEADLINE 2 // deadline passed, can be resumed
+#define FA_JOB_LIMIT 3 // limit reached, can not be resumed
+
+#define FA_JOB_F_MIN (1 << 0) // minimize after determinize
+
+typedef struct fa_job_s fa_job_t;
+
+typedef struct fa_job_progress_s {
+  int phase; // FA_JOB_PHASE_*
+  uint64_t steps; // steps run so far
+  uint32_t states_n; // dfa states, or classes when minimizing
+  uint32_t trans_n;
+  uint32_t worklist_n; // states left to process in phase or pass
+  size_t mem; // bytes allocated by the job
+} fa_job_progress_t;
+
+typedef void (fa_job_progress_f)(fa_job_t *job, fa_job_progress_t *p,
+                                 void *opaque);
+
+// fa is not freed and can be destroyed after create. limit applies to the
+// determinized dfa and can be NULL
+fa_job_t *fa_job_create(fa_t *fa, fa_state_pri_f pri_cb,
+                        fa_state_cmp_f cmp_cb, fa_limit_t *limit,
+                        uint32_t flags);
+void fa_job_destroy(fa_job_t *job);
+// monotonic clock in nanoseconds used for deadlines
+uint64_t fa_job_clock(void);
+// stop running at fa_job_clock() time deadline, 0 is no deadline
+void fa_job_deadline(fa_job_t *job, uint64_t deadline);
+// call cb every interval steps, when a phase ends and when run stops
+void fa_job_progress(fa_job_t *job, fa_job_progress_f cb, void *opaque,
+                     uint32_t interval);
+// run at most steps steps, 0 runs until done, deadline or limit
+int fa_job_run(fa_job_t *job, uint64_t steps);
+// result when done, caller owns it and later calls return NULL
+fa_t *fa_job_result(fa_job_t *job);
+
+#endif
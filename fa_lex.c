@@ -0,0 +1,131 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+// bytes are stepped once until the dfa dies, then the longest match is
+// emitted and stepping restarts where it ended. bytes after the longest
+// match are stepped again for the next token, those from earlier calls are
+// read from the tail
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fa_misc.h"
+#include "fa_sim.h"
+#include "fa_lex.h"
+
+
+void fa_lex_run_init(fa_sim_t *sim, fa_lex_run_t *run) {
+  memset(run, 0, sizeof(*run));
+  run->current = sim->start;
+}
+
+void fa_lex_run_free(fa_lex_run_t *run) {
+  free(run->tail);
+  run->tail = NULL;
+}
+
+// token ends at the longest match or is the first byte if none, stepping
+// restarts after it
+static void fa_lex_emit(fa_sim_t *sim, fa_lex_run_t *run,
+                        fa_lex_token_t *token) {
+  token->start = run->start;
+  if (run->accepted) {
+    token->opaque = run->accept_opaque;
+    token->end = run->accept_end;
+    token->matched = 1;
+  } else {
+    token->opaque = NULL;
+    token->end = run->start + 1;
+    token->matched = 0;
+  }
+
+  run->start = token->end;
+  run->pos = token->end;
+  run->current = sim->start;
+  run->accepted = 0;
+}
+
+// buf holds the bytes from offset to offset + len, earlier ones are in tail
+static int fa_lex_step(fa_sim_t *sim, fa_lex_run_t *run, uint8_t *buf,
+                       size_t len, int eof, fa_lex_token_t *tokens,
+                       int tokens_n) {
+  size_t tail_off = run->offset - run->tail_n;
+  size_t end = run->offset + len;
+  size_t keep;
+  uint32_t current = run->current;
+  size_t pos = run->pos;
+  int n = 0;
+  uint8_t c;
+
+  while (n < tokens_n) {
+    if (pos == end) {
+      // nothing more can match at end of stream
+      if (!eof || run->start == end)
+        break;
+      run->current = current;
+      fa_lex_emit(sim, run, &tokens[n++]);
+      current = run->current;
+      pos = run->pos;
+      continue;
+    }
+
+    c = pos < run->offset ? run->tail[pos - tail_off] :
+      buf[pos - run->offset];
+    current = sim->nodes[current].table[c];
+    pos++;
+
+    if (current == 0) {
+      fa_lex_emit(sim, run, &tokens[n++]);
+      current = run->current;
+      pos = run->pos;
+      continue;
+    }
+
+    if (sim->nodes[current].flags & FA_SIM_NODE_F_ACCEPTING) {
+      run->accepted = 1;
+      run->accept_end = pos;
+      run->accept_opaque = sim->nodes[current].opaque;
+    }
+  }
+
+  run->current = current;
+  run->pos = pos;
+
+  // keep bytes that may be stepped again and those not stepped yet
+  keep = run->accepted ? run->accept_end : (MMIN(run->start + 1, pos));
+  if (keep < run->offset) {
+    memmove(run->tail, run->tail + (keep - tail_off), run->offset - keep);
+    run->tail_n = run->offset - keep;
+  } else {
+    run->tail_n = 0;
+  }
+  if (end > keep) {
+    if (end - keep > run->tail_alloc_n) {
+      run->tail_alloc_n = MMAX(256, (end - keep) * 2);
+      run->tail = realloc(run->tail, run->tail_alloc_n);
+    }
+    if (keep > run->offset)
+      memcpy(run->tail, buf + (keep - run->offset), end - keep);
+    else if (len > 0)
+      memcpy(run->tail + run->tail_n, buf, len);
+    run->tail_n = end - keep;
+  }
+  run->offset = end;
+
+  return n;
+}
+
+int fa_lex(fa_sim_t *sim, fa_lex_run_t *run, uint8_t *buf, size_t len,
+           fa_lex_token_t *tokens, int tokens_n) {
+  return fa_lex_step(sim, run, buf, len, 0, tokens, tokens_n);
+}
+
+int fa_lex_end(fa_sim_t *sim, fa_lex_run_t *run,
+               fa_lex_token_t *tokens, int tokens_n) {
+  return fa_lex_step(sim, run, NULL, 0, 1, tokens, tokens_n);
+}
@@ -0,0 +1,57 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_LEX_H__
+#define __FA_LEX_H__
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "fa_sim.h"
+
+// longest match tokenizer. the sim should be a dfa of the token regexps
+// anchored at both ends, the opaque of an accepting state is the token and
+// overlapping tokens are prioritized by the pri_cb used to determinize.
+// each token is the longest match from where the previous one ended, bytes
+// no token starts with are given as one byte tokens with matched 0
+
+typedef struct fa_lex_token_s {
+  void *opaque;
+  size_t start; // stream offsets, end is just after the last byte
+  size_t end;
+  int matched;
+} fa_lex_token_t;
+
+typedef struct fa_lex_run_s {
+  uint32_t current;
+  size_t start; // of token being matched
+  size_t pos; // next byte to step
+  size_t accept_end; // end of longest match so far if accepted
+  void *accept_opaque;
+  int accepted;
+  // bytes from where the current token may be restarted to offset, kept
+  // between calls as they can be stepped again
+  uint8_t *tail;
+  size_t tail_n;
+  size_t tail_alloc_n;
+  size_t offset; // end of bytes given so far
+} fa_lex_run_t;
+
+void fa_lex_run_init(fa_sim_t *sim, fa_lex_run_t *run);
+void fa_lex_run_free(fa_lex_run_t *run);
+// step bytes and write up to tokens_n tokens, returns number written. all
+// bytes are taken, if tokens is filled call again with len 0 until less
+// than tokens_n is returned. the last token can not be known until more
+// bytes or the end is given
+int fa_lex(fa_sim_t *sim, fa_lex_run_t *run, uint8_t *buf, size_t len,
+           fa_lex_token_t *tokens, int tokens_n);
+// end of stream, same as fa_lex for the remaining tokens
+int fa_lex_end(fa_sim_t *sim, fa_lex_run_t *run,
+               fa_lex_token_t *tokens, int tokens_n);
+
+#endif
@@ -0,0 +1,182 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+// sets are found using an open addressing table of set indexes keyed on
+// the sorted ids. each set is its own allocation so pointers stay valid
+// when the set list grows
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fa.h"
+#include "fa_misc.h"
+#include "fa_matchset.h"
+
+
+fa_matchset_t *fa_matchset_create(void) {
+  fa_matchset_t *ms = calloc(1, sizeof(*ms));
+
+  ms->table_size = 256;
+  ms->table = calloc(ms->table_size, sizeof(ms->table[0]));
+  pthread_mutex_init(&ms->lock, NULL);
+
+  return ms;
+}
+
+void fa_matchset_destroy(fa_matchset_t *ms) {
+  uint32_t i;
+
+  for (i = 0; i < ms->sets_n; i++)
+    free(ms->sets[i]);
+
+  pthread_mutex_destroy(&ms->lock);
+  free(ms->sets);
+  free(ms->table);
+  free(ms);
+}
+
+static uint32_t fa_matchset_hash(uint32_t *ids, int n) {
+  uint32_t h = 2166136261u;
+  int i;
+
+  for (i = 0; i < n; i++)
+    h = (h ^ ids[i]) * 16777619u;
+
+  return h;
+}
+
+static int fa_matchset_id_cmp(const void *a, const void *b) {
+  uint32_t ia = *(uint32_t *)a;
+  uint32_t ib = *(uint32_t *)b;
+
+  return ia < ib ? -1 : ia > ib;
+}
+
+static void fa_matchset_rehash(fa_matchset_t *ms) {
+  uint32_t i, j, mask;
+
+  free(ms->table);
+  ms->table_size *= 2;
+  ms->table = calloc(ms->table_size, sizeof(ms->table[0]));
+  mask = ms->table_size - 1;
+
+  for (i = 0; i < ms->sets_n; i++) {
+    j = ms->sets[i]->hash & mask;
+    for (; ms->table[j]; j = (j + 1) & mask)
+      ;
+    ms->table[j] = i + 1;
+  }
+}
+
+// ids are sorted and unique, called with lock held
+static fa_matchset_set_t *fa_matchset_lookup(fa_matchset_t *ms,
+                                             uint32_t *ids, int n) {
+  fa_matchset_set_t *s;
+  uint32_t h, j, mask;
+
+  h = fa_matchset_hash(ids, n);
+  mask = ms->table_size - 1;
+  for (j = h & mask; ms->table[j]; j = (j + 1) & mask) {
+    s = ms->sets[ms->table[j] - 1];
+    if (s->hash == h && s->n == n &&
+        memcmp(s->ids, ids, sizeof(ids[0]) * n) == 0)
+      return s;
+  }
+
+  s = malloc(sizeof(*s) + sizeof(s->ids[0]) * n);
+  s->ms = ms;
+  s->hash = h;
+  s->n = n;
+  memcpy(s->ids, ids, sizeof(ids[0]) * n);
+
+  if (ms->sets_n == ms->sets_alloc_n) {
+    ms->sets_alloc_n = MMAX(64, ms->sets_alloc_n * 2);
+    ms->sets = realloc(ms->sets, sizeof(ms->sets[0]) * ms->sets_alloc_n);
+  }
+  ms->sets[ms->sets_n] = s;
+  ms->table[j] = ++ms->sets_n;
+  // keep load factor below 1/2
+  if (ms->sets_n * 2 > ms->table_size)
+    fa_matchset_rehash(ms);
+
+  return s;
+}
+
+// sorts and removes duplicates from ids in place
+static fa_matchset_set_t *fa_matchset_get_ids(fa_matchset_t *ms,
+                                              uint32_t *ids, int n) {
+  fa_matchset_set_t *s;
+  int i, j;
+
+  if (n > 1)
+    qsort(ids, n, sizeof(ids[0]), fa_matchset_id_cmp);
+  for (i = 0, j = 0; i < n; i++)
+    if (j == 0 || ids[j - 1] != ids[i])
+      ids[j++] = ids[i];
+
+  pthread_mutex_lock(&ms->lock);
+  s = fa_matchset_lookup(ms, ids, j);
+  pthread_mutex_unlock(&ms->lock);
+
+  return s;
+}
+
+fa_matchset_set_t *fa_matchset_get(fa_matchset_t *ms, uint32_t *ids, int n) {
+  fa_matchset_set_t *s;
+  uint32_t *t;
+
+  t = malloc(sizeof(t[0]) * (MMAX(n, 1)));
+  memcpy(t, ids, sizeof(t[0]) * n);
+  s = fa_matchset_get_ids(ms, t, n);
+  free(t);
+
+  return s;
+}
+
+void fa_matchset_set_accepting(fa_matchset_t *ms, fa_t *fa, uint32_t id) {
+  fa_set_accepting_opaque(fa, fa_matchset_get(ms, &id, 1));
+}
+
+void *fa_matchset_pri(void **opaques, int opaques_n) {
+  fa_matchset_set_t **sets = (fa_matchset_set_t **)opaques;
+  fa_matchset_set_t *s;
+  fa_matchset_t *ms = NULL;
+  uint32_t *ids;
+  int i, n;
+
+  n = 0;
+  for (i = 0; i < opaques_n; i++) {
+    if (!sets[i])
+      continue;
+    ms = sets[i]->ms;
+    n += sets[i]->n;
+  }
+  if (!ms)
+    return NULL;
+
+  ids = malloc(sizeof(ids[0]) * (MMAX(n, 1)));
+  n = 0;
+  for (i = 0; i < opaques_n; i++) {
+    if (!sets[i])
+      continue;
+    memcpy(&ids[n], sets[i]->ids, sizeof(ids[0]) * sets[i]->n);
+    n += sets[i]->n;
+  }
+  s = fa_matchset_get_ids(ms, ids, n);
+  free(ids);
+
+  return s;
+}
+
+int fa_matchset_cmp(void *a, void *b) {
+  return a != b;
+}
+
+fa_matchset_set_t *fa_matchset_of(void *opaque) {
+  return opaque;
+}
@@ -0,0 +1,53 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_MATCHSET_H__
+#define __FA_MATCHSET_H__
+
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "fa.h"
+
+// sets of match ids used as accepting state opaques to know all patterns
+// that match instead of only the prioritized one. sets are interned so
+// equal sets are the same pointer and can be shared between states and
+// compared as opaques. all functions lock so that fa_matchset_pri can be
+// used from threads
+typedef struct fa_matchset_set_s {
+  struct fa_matchset_s *ms;
+  uint32_t hash;
+  uint32_t n;
+  uint32_t ids[0]; // sorted and unique
+} fa_matchset_set_t;
+
+typedef struct fa_matchset_s {
+  fa_matchset_set_t **sets;
+  uint32_t sets_n;
+  uint32_t sets_alloc_n;
+  uint32_t *table; // set index + 1, 0 is empty
+  uint32_t table_size; // power of 2
+  pthread_mutex_t lock;
+} fa_matchset_t;
+
+fa_matchset_t *fa_matchset_create(void);
+// frees all sets, dfas using them as opaques can not be run after this
+void fa_matchset_destroy(fa_matchset_t *ms);
+// set with ids in any order and with duplicates
+fa_matchset_set_t *fa_matchset_get(fa_matchset_t *ms, uint32_t *ids, int n);
+// set opaque of all accepting states to the set with only id
+void fa_matchset_set_accepting(fa_matchset_t *ms, fa_t *fa, uint32_t id);
+// fa_state_pri_f giving the union of the sets, NULL opaques are empty sets
+void *fa_matchset_pri(void **opaques, int opaques_n);
+// fa_state_cmp_f, states with different sets are distinguishable
+int fa_matchset_cmp(void *a, void *b);
+// set of an accepting state or sim run opaque, only valid if the dfa was
+// built with fa_matchset_pri and fa_matchset_cmp from fa_matchset sets
+fa_matchset_set_t *fa_matchset_of(void *opaque);
+
+#endif
@@ -6,7 +6,6 @@
 // of the NetBSD license.  See the LICENSE file for details.
 //
 
-// TODO: fa_regexp_yacc.y, recursion depth a problem?
 // TODO: a{3,0} not allowed..
 // TODO: a{0,0} skip
 // TODO: per union element anchoring end/start null flags? fa_regexp_ctx?
@@ -22,6 +21,7 @@
 #include "fa_regexp.h"
 #include "fa_regexp_bin.h"
 #include "fa_regexp_class.h"
+#include "fa_regexp_cache.h"
 #include "fa_regexp_yacc.h"
 
 
@@ -34,6 +34,21 @@ static fa_regexp_node_t *fa_regexp_node(fa_regexp_type_t type, int pos) {
   return frn;
 }
 
+static fa_regexp_node_t *fa_regexp_node_pair(fa_regexp_type_t type,
+                                             fa_regexp_node_t *sub1,
+                                             fa_regexp_node_t *sub2,
+                                             int pos) {
+  fa_regexp_node_t *frn = fa_regexp_node(type, pos);
+
+  // concat and union share layout
+  frn->value.concat.n = 2;
+  frn->value.concat.subs = malloc(sizeof(frn->value.concat.subs[0]) * 2);
+  frn->value.concat.subs[0] = sub1;
+  frn->value.concat.subs[1] = sub2;
+
+  return frn;
+}
+
 fa_regexp_node_t *fa_regexp_node_sub(fa_regexp_node_t *sub, int pos) {
   fa_regexp_node_t *frn;
 
@@ -92,9 +107,7 @@ fa_regexp_node_t *fa_regexp_node_concat(fa_regexp_node_t *sub1,
     fa_regexp_node_free(sub2);
     free(s);
   } else {
-    frn = fa_regexp_node(RE_CONCAT, pos);
-    frn->value.concat.sub1 = sub1;
-    frn->value.concat.sub2 = sub2;
+    frn = fa_regexp_node_pair(RE_CONCAT, sub1, sub2, pos);
   }
 
   return frn;
@@ -102,8 +115,6 @@ fa_regexp_node_t *fa_regexp_node_concat(fa_regexp_node_t *sub1,
 
 fa_regexp_node_t *fa_regexp_node_union(fa_regexp_node_t *sub1,
                                        fa_regexp_node_t *sub2, int pos) {
-  fa_regexp_node_t *frn;
-
   if (sub1 == NULL || sub2 == NULL) {
     if (sub1)
       fa_regexp_node_free(sub1);
@@ -113,11 +124,7 @@ fa_regexp_node_t *fa_regexp_node_union(fa_regexp_node_t *sub1,
     return NULL;
   }
 
-  frn = fa_regexp_node(RE_UNION, pos);
-  frn->value.union_.sub1 = sub1;
-  frn->value.union_.sub2 = sub2;
-
-  return frn;
+  return fa_regexp_node_pair(RE_UNION, sub1, sub2, pos);
 }
 
 fa_regexp_node_t *fa_regexp_node_repeat(fa_regexp_node_t *sub, int onlymin,
@@ -164,49 +171,669 @@ fa_regexp_node_t *fa_regexp_node_binary(fa_regexp_bin_t *bin, int pos) {
   return frn;
 }
 
+// nodes to visit are kept on an explicit stack so that deep trees can not
+// overflow the call stack
+typedef struct fa_regexp_node_stack_s {
+  fa_regexp_node_t **nodes;
+  int n;
+  int alloc_n;
+} fa_regexp_node_stack_t;
+
+static void fa_regexp_node_stack_push(fa_regexp_node_stack_t *stack,
+                                      fa_regexp_node_t *node) {
+  if (node == NULL)
+    return;
+
+  if (stack->n == stack->alloc_n) {
+    stack->alloc_n = MMAX(16, stack->alloc_n * 2);
+    stack->nodes = realloc(stack->nodes,
+                           sizeof(stack->nodes[0]) * stack->alloc_n);
+  }
+  stack->nodes[stack->n++] = node;
+}
+
+// push subs in reverse so that they are popped in order
+static void fa_regexp_node_stack_push_subs(fa_regexp_node_stack_t *stack,
+                                           fa_regexp_node_t **subs, int n) {
+  int i;
+
+  for (i = n - 1; i >= 0; i--)
+    fa_regexp_node_stack_push(stack, subs[i]);
+}
+
 void fa_regexp_node_free(fa_regexp_node_t *node) {
+  fa_regexp_node_stack_t stack = {NULL, 0, 0};
+
+  fa_regexp_node_stack_push(&stack, node);
+
+  while (stack.n > 0) {
+    node = stack.nodes[--stack.n];
+
+    switch (node->type) {
+      case RE_SUB:
+        fa_regexp_node_stack_push(&stack, node->value.sub.sub);
+        break;
+      case RE_OPTIONS:
+        fa_regexp_node_stack_push(&stack, node->value.options.sub);
+        break;
+      case RE_CONCAT:
+      case RE_UNION:
+        fa_regexp_node_stack_push_subs(&stack, node->value.concat.subs,
+                                       node->value.concat.n);
+        free(node->value.concat.subs);
+        break;
+      case RE_REPEAT:
+        fa_regexp_node_stack_push(&stack, node->value.repeat.sub);
+        break;
+      case RE_STRING:
+        if (node->value.string.str)
+          free(node->value.string.str);
+        break;
+      case RE_CLASS:
+        if (node->value.class_.class_)
+          fa_regexp_class_destroy(node->value.class_.class_);
+        break;
+      case RE_BINARY:
+        if (node->value.binary)
+          fa_regexp_bin_destroy(node->value.binary);
+        break;
+      default:
+        assert(0);
+    }
+
+    free(node);
+  }
+
+  free(stack.nodes);
+}
+
+// collect subs of node and of nested nodes of the same type in order,
+// adjacent concatenated strings are joined
+static void fa_regexp_node_flatten_subs(fa_regexp_node_t *node,
+                                        fa_regexp_node_stack_t *work,
+                                        fa_regexp_node_stack_t *subs) {
+  fa_regexp_node_t *sub;
+  fa_regexp_node_t *last;
+
+  work->n = 0;
+  fa_regexp_node_stack_push_subs(work, node->value.concat.subs,
+                                 node->value.concat.n);
+  free(node->value.concat.subs);
+
+  subs->n = 0;
+  while (work->n > 0) {
+    sub = work->nodes[--work->n];
+
+    if (sub->type == node->type) {
+      fa_regexp_node_stack_push_subs(work, sub->value.concat.subs,
+                                     sub->value.concat.n);
+      free(sub->value.concat.subs);
+      free(sub);
+      continue;
+    }
+
+    last = subs->n > 0 ? subs->nodes[subs->n - 1] : NULL;
+    if (node->type == RE_CONCAT && sub->type == RE_STRING &&
+        last && last->type == RE_STRING) {
+      if (sub->value.string.len > 0) {
+        last->value.string.str = realloc(last->value.string.str,
+                                         last->value.string.len +
+                                         sub->value.string.len);
+        memcpy(last->value.string.str + last->value.string.len,
+               sub->value.string.str, sub->value.string.len);
+        last->value.string.len += sub->value.string.len;
+      }
+      fa_regexp_node_free(sub);
+      continue;
+    }
+
+    fa_regexp_node_stack_push(subs, sub);
+  }
+
+  if (subs->n == 1) {
+    // all subs joined into one string
+    sub = subs->nodes[0];
+    *node = *sub;
+    free(sub);
+    return;
+  }
+
+  node->value.concat.n = subs->n;
+  node->value.concat.subs = malloc(sizeof(node->value.concat.subs[0]) *
+                                   subs->n);
+  memcpy(node->value.concat.subs, subs->nodes,
+         sizeof(node->value.concat.subs[0]) * subs->n);
+}
+
+void fa_regexp_node_flatten(fa_regexp_node_t *node) {
+  fa_regexp_node_stack_t stack = {NULL, 0, 0};
+  fa_regexp_node_stack_t work = {NULL, 0, 0};
+  fa_regexp_node_stack_t subs = {NULL, 0, 0};
+
+  fa_regexp_node_stack_push(&stack, node);
+
+  while (stack.n > 0) {
+    node = stack.nodes[--stack.n];
+
+    switch (node->type) {
+      case RE_SUB:
+        fa_regexp_node_stack_push(&stack, node->value.sub.sub);
+        break;
+      case RE_OPTIONS:
+        fa_regexp_node_stack_push(&stack, node->value.options.sub);
+        break;
+      case RE_CONCAT:
+      case RE_UNION:
+        fa_regexp_node_flatten_subs(node, &work, &subs);
+        if (node->type == RE_CONCAT || node->type == RE_UNION)
+          fa_regexp_node_stack_push_subs(&stack, node->value.concat.subs,
+                                         node->value.concat.n);
+        else
+          fa_regexp_node_stack_push(&stack, node); // replaced by its sub
+        break;
+      case RE_REPEAT:
+        fa_regexp_node_stack_push(&stack, node->value.repeat.sub);
+        break;
+      default:
+        break;
+    }
+  }
+
+  free(stack.nodes);
+  free(work.nodes);
+  free(subs.nodes);
+}
+
+// options in a concat or union also applies to the following subs, in a
+// sub they only applies inside it
+static int fa_regexp_node_has_options(fa_regexp_node_t *node) {
+  fa_regexp_node_stack_t stack = {NULL, 0, 0};
+  int r = 0;
+
+  fa_regexp_node_stack_push(&stack, node);
+
+  while (!r && stack.n > 0) {
+    node = stack.nodes[--stack.n];
+
+    switch (node->type) {
+      case RE_OPTIONS:
+        r = 1;
+        break;
+      case RE_CONCAT:
+      case RE_UNION:
+        fa_regexp_node_stack_push_subs(&stack, node->value.concat.subs,
+                                       node->value.concat.n);
+        break;
+      case RE_REPEAT:
+        fa_regexp_node_stack_push(&stack, node->value.repeat.sub);
+        break;
+      default:
+        break;
+    }
+  }
+
+  free(stack.nodes);
+
+  return r;
+}
+
+static int fa_regexp_node_is_empty(fa_regexp_node_t *node) {
+  return node->type == RE_STRING && node->value.string.len == 0;
+}
+
+// replace node with other and free old node, subs of node still used by
+// other has to be detached first
+static void fa_regexp_node_set(fa_regexp_node_t *node,
+                               fa_regexp_node_t *other) {
+  fa_regexp_node_t *old = malloc(sizeof(*old));
+
+  *old = *node;
+  *node = *other;
+  free(other);
+  fa_regexp_node_free(old);
+}
+
+static void fa_regexp_node_simplify_node(fa_regexp_node_t *node);
+
+// concat or union of subs, for zero subs an empty string
+static fa_regexp_node_t *fa_regexp_node_subs(fa_regexp_type_t type,
+                                             fa_regexp_node_t **subs, int n,
+                                             int pos) {
+  fa_regexp_node_t *frn;
+
+  if (n <= 0)
+    return fa_regexp_node_string("", 0, pos);
+  if (n == 1)
+    return subs[0];
+
+  frn = fa_regexp_node(type, pos);
+  frn->value.concat.n = n;
+  frn->value.concat.subs = malloc(sizeof(frn->value.concat.subs[0]) * n);
+  memcpy(frn->value.concat.subs, subs, sizeof(frn->value.concat.subs[0]) * n);
+
+  return frn;
+}
+
+// same as fa_regexp_node_subs for subs that are not simplified together
+static fa_regexp_node_t *fa_regexp_node_list(fa_regexp_type_t type,
+                                             fa_regexp_node_t **subs, int n,
+                                             int pos) {
+  fa_regexp_node_t *frn;
+
+  frn = fa_regexp_node_subs(type, subs, n, pos);
+  if (n > 1)
+    fa_regexp_node_simplify_node(frn);
+
+  return frn;
+}
+
+// set subs of concat or union node, node is replaced by the sub if only one
+static void fa_regexp_node_set_subs(fa_regexp_node_t *node,
+                                    fa_regexp_node_stack_t *subs) {
+  free(node->value.concat.subs);
+
+  if (subs->n <= 1) {
+    node->value.concat.n = 0;
+    node->value.concat.subs = NULL;
+    fa_regexp_node_set(node, subs->n == 0 ?
+                       fa_regexp_node_string("", 0, node->pos) :
+                       subs->nodes[0]);
+    return;
+  }
+
+  node->value.concat.n = subs->n;
+  node->value.concat.subs = malloc(sizeof(node->value.concat.subs[0]) *
+                                   subs->n);
+  memcpy(node->value.concat.subs, subs->nodes,
+         sizeof(node->value.concat.subs[0]) * subs->n);
+}
+
+// append to concat subs skipping empty strings and joining strings
+static void fa_regexp_node_concat_add(fa_regexp_node_stack_t *subs,
+                                      fa_regexp_node_t *sub) {
+  fa_regexp_node_t *last;
+
+  if (fa_regexp_node_is_empty(sub)) {
+    fa_regexp_node_free(sub);
+    return;
+  }
+
+  last = subs->n > 0 ? subs->nodes[subs->n - 1] : NULL;
+  if (last && last->type == RE_STRING && sub->type == RE_STRING) {
+    last->value.string.str = realloc(last->value.string.str,
+                                     last->value.string.len +
+                                     sub->value.string.len);
+    memcpy(last->value.string.str + last->value.string.len,
+           sub->value.string.str, sub->value.string.len);
+    last->value.string.len += sub->value.string.len;
+    fa_regexp_node_free(sub);
+    return;
+  }
+
+  fa_regexp_node_stack_push(subs, sub);
+}
+
+static void fa_regexp_node_simplify_concat(fa_regexp_node_t *node) {
+  fa_regexp_node_stack_t subs = {NULL, 0, 0};
+  fa_regexp_node_t *sub;
+  int i, j;
+
+  for (i = 0; i < node->value.concat.n; i++) {
+    sub = node->value.concat.subs[i];
+
+    if (sub->type == RE_CONCAT) {
+      for (j = 0; j < sub->value.concat.n; j++)
+        fa_regexp_node_concat_add(&subs, sub->value.concat.subs[j]);
+      free(sub->value.concat.subs);
+      free(sub);
+      continue;
+    }
+
+    fa_regexp_node_concat_add(&subs, sub);
+  }
+
+  fa_regexp_node_set_subs(node, &subs);
+  free(subs.nodes);
+}
+
+// string at start or end of branch, NULL if none
+static fa_regexp_node_t *fa_regexp_node_edge(fa_regexp_node_t *node,
+                                             int front) {
+  if (node->type == RE_CONCAT)
+    node = node->value.concat.subs[front ? 0 : node->value.concat.n - 1];
+
+  if (node->type != RE_STRING || node->value.string.len == 0)
+    return NULL;
+
+  return node;
+}
+
+// char at offset i from start or end of string
+static uint8_t fa_regexp_node_edge_char(fa_regexp_node_t *s, int front,
+                                        int i) {
+  return s->value.string.str[front ? i : s->value.string.len - 1 - i];
+}
+
+// remove len chars from start or end of branch
+static void fa_regexp_node_trim(fa_regexp_node_t *node, int front, int len) {
+  fa_regexp_node_t *s;
+
+  s = fa_regexp_node_edge(node, front);
+  if (front)
+    memmove(s->value.string.str, s->value.string.str + len,
+            s->value.string.len - len);
+  s->value.string.len -= len;
+
+  if (node->type == RE_CONCAT)
+    fa_regexp_node_simplify_concat(node);
+}
+
+// ab|ac to a(b|c) for front and ba|ca to (b|c)a otherwise. branches are
+// grouped by the first or last char so each group is one pass over subs
+static void fa_regexp_node_factor(fa_regexp_node_stack_t *subs, int front,
+                                  int pos) {
+  fa_regexp_node_stack_t rests = {NULL, 0, 0};
+  fa_regexp_node_t *parts[2];
+  fa_regexp_node_t *s, *t;
+  int count[256];
+  int first, len;
+  int c, i, k;
+
+  memset(count, 0, sizeof(count));
+  for (i = 0; i < subs->n; i++)
+    if ((s = fa_regexp_node_edge(subs->nodes[i], front)))
+      count[fa_regexp_node_edge_char(s, front, 0)]++;
+
+  for (c = 0; c < 256; c++) {
+    if (count[c] < 2)
+      continue;
+
+    // longest common prefix or suffix of the group
+    s = NULL;
+    first = 0;
+    len = 0;
+    rests.n = 0;
+    for (i = 0; i < subs->n; i++) {
+      if (!subs->nodes[i] ||
+          !(t = fa_regexp_node_edge(subs->nodes[i], front)) ||
+          fa_regexp_node_edge_char(t, front, 0) != c)
+        continue;
+
+      fa_regexp_node_stack_push(&rests, subs->nodes[i]);
+      if (!s) {
+        s = t;
+        first = i;
+        len = t->value.string.len;
+        continue;
+      }
+
+      len = MMIN(len, t->value.string.len);
+      for (k = 1; k < len; k++)
+        if (fa_regexp_node_edge_char(s, front, k) !=
+            fa_regexp_node_edge_char(t, front, k))
+          break;
+      len = k;
+      subs->nodes[i] = NULL;
+    }
+
+    parts[front ? 0 : 1] = fa_regexp_node_string(
+      s->value.string.str + (front ? 0 : s->value.string.len - len), len,
+      s->pos);
+    for (i = 0; i < rests.n; i++)
+      fa_regexp_node_trim(rests.nodes[i], front, len);
+    parts[front ? 1 : 0] = fa_regexp_node_list(RE_UNION, rests.nodes,
+                                               rests.n, pos);
+    subs->nodes[first] = fa_regexp_node_list(RE_CONCAT, parts, 2, pos);
+  }
+
+  for (i = 0, k = 0; i < subs->n; i++)
+    if (subs->nodes[i])
+      subs->nodes[k++] = subs->nodes[i];
+  subs->n = k;
+
+  free(rests.nodes);
+}
+
+// classes that match no chars are left as is so that lowering reports them
+static int fa_regexp_node_class_has_chars(fa_regexp_class_t *rc) {
+  uint8_t map[256 / 8];
+  int icase, i;
+
+  for (icase = 0; icase < 2; icase++) {
+    fa_regexp_class_map(rc, 0, icase, map);
+    for (i = 0; i < ARRAYSIZEOF(map) && !map[i]; i++)
+      ;
+    if (i == ARRAYSIZEOF(map))
+      return 0;
+  }
+
+  return 1;
+}
+
+// a|[bc] to [abc], class chars is a union so non negated classes can be
+// merged as is
+static void fa_regexp_node_merge_chars(fa_regexp_node_stack_t *subs) {
+  fa_regexp_class_t *rc, *merged;
+  fa_regexp_node_t *sub;
+  int first, n;
+  int i, j;
+
+  first = -1;
+  n = 0;
+  for (i = 0; i < subs->n; i++) {
+    sub = subs->nodes[i];
+    if ((sub->type == RE_STRING && sub->value.string.len == 1) ||
+        (sub->type == RE_CLASS && !sub->value.class_.neg &&
+         fa_regexp_node_class_has_chars(sub->value.class_.class_))) {
+      if (first == -1)
+        first = i;
+      n++;
+    }
+  }
+  if (n < 2)
+    return;
+
+  merged = NULL;
+  for (i = first, j = first; i < subs->n; i++) {
+    sub = subs->nodes[i];
+
+    if (sub->type == RE_STRING && sub->value.string.len == 1) {
+      rc = fa_regexp_class_list(sub->value.string.str, 1);
+    } else if (sub->type == RE_CLASS && !sub->value.class_.neg &&
+               fa_regexp_node_class_has_chars(sub->value.class_.class_)) {
+      rc = sub->value.class_.class_;
+      sub->value.class_.class_ = NULL;
+    } else {
+      subs->nodes[j++] = sub;
+      continue;
+    }
+
+    merged = merged ? fa_regexp_class_merge(merged, rc) : rc;
+    if (i == first)
+      j++;
+    else
+      fa_regexp_node_free(sub);
+  }
+  subs->n = j;
+
+  sub = subs->nodes[first];
+  subs->nodes[first] = fa_regexp_node_class(0, merged, sub->pos);
+  fa_regexp_node_free(sub);
+}
+
+static void fa_regexp_node_simplify_union(fa_regexp_node_t *node) {
+  fa_regexp_node_stack_t subs = {NULL, 0, 0};
+  fa_regexp_node_t *sub;
+  int empty;
+  int i, j;
+
+  for (i = 0; i < node->value.union_.n; i++) {
+    sub = node->value.union_.subs[i];
+
+    if (sub->type == RE_UNION) {
+      for (j = 0; j < sub->value.union_.n; j++)
+        fa_regexp_node_stack_push(&subs, sub->value.union_.subs[j]);
+      free(sub->value.union_.subs);
+      free(sub);
+      continue;
+    }
+
+    fa_regexp_node_stack_push(&subs, sub);
+  }
+
+  for (i = 0; i < subs.n; i++)
+    if (fa_regexp_node_has_options(subs.nodes[i]))
+      break;
+  if (i < subs.n) {
+    // options changes flags for the branches that follows
+    fa_regexp_node_set_subs(node, &subs);
+    free(subs.nodes);
+    return;
+  }
+
+  empty = 0;
+  for (i = 0, j = 0; i < subs.n; i++) {
+    if (fa_regexp_node_is_empty(subs.nodes[i])) {
+      fa_regexp_node_free(subs.nodes[i]);
+      empty = 1;
+    } else
+      subs.nodes[j++] = subs.nodes[i];
+  }
+  subs.n = j;
+
+  fa_regexp_node_factor(&subs, 1, node->pos);
+  fa_regexp_node_factor(&subs, 0, node->pos);
+  fa_regexp_node_merge_chars(&subs);
+
+  // one empty branch is enough
+  if (empty)
+    fa_regexp_node_stack_push(&subs,
+                              fa_regexp_node_string("", 0, node->pos));
+
+  fa_regexp_node_set_subs(node, &subs);
+  free(subs.nodes);
+}
+
+// (a*)* to a*, (a+)? to a*, (a{1,2}){3} to a{3,6} etc. an inner repeat
+// with min 0 or 1 can make any count between the products of the bounds
+static void fa_regexp_node_simplify_repeat(fa_regexp_node_t *node) {
+  fa_regexp_node_t *sub;
+  int64_t min, max, imin, imax;
+
+  while (1) {
+    sub = node->value.repeat.sub;
+
+    // a{0}, also skipped when lowering
+    if (node->value.repeat.onlymin && node->value.repeat.min == 0) {
+      fa_regexp_node_set(node, fa_regexp_node_string("", 0, node->pos));
+      return;
+    }
+
+    // left for lowering to report
+    if (node->value.repeat.max != 0 &&
+        node->value.repeat.min > node->value.repeat.max)
+      return;
+
+    if (fa_regexp_node_is_empty(sub)) {
+      fa_regexp_node_set(node, fa_regexp_node_string("", 0, node->pos));
+      return;
+    }
+
+    min = node->value.repeat.min;
+    // -1 is no max
+    max = node->value.repeat.onlymin ? min :
+      node->value.repeat.max == 0 ? -1 : node->value.repeat.max;
+
+    if (min == 1 && max == 1) {
+      node->value.repeat.sub = NULL;
+      fa_regexp_node_set(node, sub);
+      return;
+    }
+
+    if (sub->type != RE_REPEAT ||
+        (sub->value.repeat.onlymin && sub->value.repeat.min == 0) ||
+        (sub->value.repeat.max != 0 &&
+         sub->value.repeat.min > sub->value.repeat.max) ||
+        sub->value.repeat.min > 1)
+      return;
+
+    imin = sub->value.repeat.min;
+    imax = sub->value.repeat.onlymin ? imin :
+      sub->value.repeat.max == 0 ? -1 : sub->value.repeat.max;
+    if (max * imax > INT32_MAX)
+      return;
+
+    node->value.repeat.onlymin = 0;
+    node->value.repeat.min = min * imin;
+    node->value.repeat.max = max == -1 || imax == -1 ? 0 : max * imax;
+    node->value.repeat.sub = sub->value.repeat.sub;
+    sub->value.repeat.sub = NULL;
+    fa_regexp_node_free(sub);
+  }
+}
+
+static void fa_regexp_node_simplify_node(fa_regexp_node_t *node) {
+  fa_regexp_node_t *sub;
+
   switch (node->type) {
     case RE_SUB:
-      if (node->value.sub.sub)
-        fa_regexp_node_free(node->value.sub.sub);
-      break;
-    case RE_OPTIONS:
-      if (node->value.options.sub)
-        fa_regexp_node_free(node->value.options.sub);
+      sub = node->value.sub.sub;
+      if (!fa_regexp_node_has_options(sub)) {
+        *node = *sub;
+        free(sub);
+      }
       break;
     case RE_CONCAT:
-      if (node->value.concat.sub1)
-        fa_regexp_node_free(node->value.concat.sub1);
-      if (node->value.concat.sub2)
-        fa_regexp_node_free(node->value.concat.sub2);
+      fa_regexp_node_simplify_concat(node);
       break;
     case RE_UNION:
-      if (node->value.union_.sub1)
-        fa_regexp_node_free(node->value.union_.sub1);
-      if (node->value.union_.sub2)
-        fa_regexp_node_free(node->value.union_.sub2);
+      fa_regexp_node_simplify_union(node);
       break;
     case RE_REPEAT:
-      if (node->value.repeat.sub)
-        fa_regexp_node_free(node->value.repeat.sub);
-      break;
-    case RE_STRING:
-      if (node->value.string.str)
-        free(node->value.string.str);
-      break;
-    case RE_CLASS:
-      if (node->value.class_.class_)
-        fa_regexp_class_destroy(node->value.class_.class_);
-      break;
-    case RE_BINARY:
-      if (node->value.binary)
-        fa_regexp_bin_destroy(node->value.binary);
+      fa_regexp_node_simplify_repeat(node);
       break;
     default:
-      assert(0);
+      break;
+  }
+}
+
+void fa_regexp_node_simplify(fa_regexp_node_t *node) {
+  fa_regexp_node_stack_t stack = {NULL, 0, 0};
+  fa_regexp_node_stack_t order = {NULL, 0, 0};
+  int i;
+
+  fa_regexp_node_stack_push(&stack, node);
+
+  while (stack.n > 0) {
+    node = stack.nodes[--stack.n];
+    fa_regexp_node_stack_push(&order, node);
+
+    switch (node->type) {
+      case RE_SUB:
+        fa_regexp_node_stack_push(&stack, node->value.sub.sub);
+        break;
+      case RE_OPTIONS:
+        fa_regexp_node_stack_push(&stack, node->value.options.sub);
+        break;
+      case RE_CONCAT:
+      case RE_UNION:
+        fa_regexp_node_stack_push_subs(&stack, node->value.concat.subs,
+                                       node->value.concat.n);
+        break;
+      case RE_REPEAT:
+        fa_regexp_node_stack_push(&stack, node->value.repeat.sub);
+        break;
+      default:
+        break;
+    }
   }
 
-  free(node);
+  // subs are simplified before their parent
+  for (i = order.n - 1; i >= 0; i--)
+    fa_regexp_node_simplify_node(order.nodes[i]);
+
+  free(stack.nodes);
+  free(order.nodes);
 }
 
 #if 0
@@ -259,16 +886,9 @@ static void fa_regexp_node_dump_ex(int indent, fa_regexp_node_t *node) {
         fa_regexp_node_dump_ex(indent+1, node->value.options.sub);
       break;
     case RE_CONCAT:
-      if (node->value.concat.sub1)
-        fa_regexp_node_dump_ex(indent+1, node->value.concat.sub1);
-      if (node->value.concat.sub2)
-        fa_regexp_node_dump_ex(indent+1, node->value.concat.sub2);
-      break;
     case RE_UNION:
-      if (node->value.union_.sub1)
-        fa_regexp_node_dump_ex(indent+1, node->value.union_.sub1);
-      if (node->value.union_.sub2)
-        fa_regexp_node_dump_ex(indent+1, node->value.union_.sub2);
+      for (i = 0; i < node->value.concat.n; i++)
+        fa_regexp_node_dump_ex(indent+1, node->value.concat.subs[i]);
       break;
     case RE_REPEAT:
       for (i = 0; i < indent; i++)
@@ -326,18 +946,10 @@ static void fa_regexp_node_dump_pgf_ex(int indent, fa_regexp_node_t *node) {
         fa_regexp_node_dump_pgf_ex(indent+1, node->value.options.sub);
       break;
     case RE_CONCAT:
-      fprintf(stderr, "}\n");
-      if (node->value.concat.sub1)
-        fa_regexp_node_dump_pgf_ex(indent+1, node->value.concat.sub1);
-      if (node->value.concat.sub2)
-        fa_regexp_node_dump_pgf_ex(indent+1, node->value.concat.sub2);
-      break;
     case RE_UNION:
       fprintf(stderr, "}\n");
-      if (node->value.union_.sub1)
-        fa_regexp_node_dump_pgf_ex(indent+1, node->value.union_.sub1);
-      if (node->value.union_.sub2)
-        fa_regexp_node_dump_pgf_ex(indent+1, node->value.union_.sub2);
+      for (i = 0; i < node->value.concat.n; i++)
+        fa_regexp_node_dump_pgf_ex(indent+1, node->value.concat.subs[i]);
       break;
     case RE_REPEAT:
       fprintf(stderr, " %d,%d}\n",
@@ -376,122 +988,198 @@ void fa_regexp_node_dump_pgf(fa_regexp_node_t *node) {
 }
 #endif
 
-static fa_t *fa_regexp_node_fa(fa_regexp_node_t *node,
+// lowering state for one node on the explicit stack
+typedef struct fa_regexp_frame_s {
+  fa_regexp_node_t *node;
+  uint32_t *flags;
+  int i; // number of subs lowered or being lowered
+  fa_t **fas; // lowered concat and union subs
+} fa_regexp_frame_t;
+
+// lower tree to NFA. walks the tree with an explicit stack and builds
+// concat and union nodes with one fa_concat_list/fa_union_list call.
+// subs are lowered in order and share the flags pointer of their scope so
+// that options affect following nodes in the same sub expression. with a
+// cache sub trees lowered before are cloned instead
+static fa_t *fa_regexp_node_fa(fa_regexp_node_t *root,
                                char **errstr, int *errpos,
                                uint32_t *flags,
-                               fa_limit_t *limit) {
-  fa_t *sub1;
-  fa_t *sub2;
+                               fa_limit_t *limit,
+                               fa_regexp_cache_t *cache) {
+  fa_regexp_frame_t *frames = NULL;
+  int frames_n = 0;
+  int frames_alloc_n = 0;
+  fa_regexp_frame_t *f;
+  fa_regexp_node_t *node;
+  fa_regexp_node_t *sub;
+  uint32_t *sub_flags;
+  fa_t *ret = NULL;
   int n;
+  int i;
 
-  switch (node->type) {
-    case RE_SUB:
-      node->value.sub.flags = *flags;
-      return fa_regexp_node_fa(node->value.sub.sub, errstr, errpos,
-                               &node->value.sub.flags, limit);
-      break;
-    case RE_OPTIONS:
-      *flags =
-        (*flags & ~node->value.options.flags) |
-        (node->value.options.neg ? 0 : node->value.options.flags);
-      return fa_regexp_node_fa(node->value.options.sub, errstr, errpos,
-                               flags, limit);
-      break;
-    case RE_CONCAT:
-      sub1 = fa_regexp_node_fa(node->value.concat.sub1, errstr, errpos,
-                               flags, limit);
-      if (!sub1)
-        return NULL;
-      sub2 = fa_regexp_node_fa(node->value.concat.sub2, errstr, errpos,
-                               flags, limit);
-      if (!sub2) {
-        fa_destroy(sub1);
-        return NULL;
-      }
-      return fa_concat(sub1, sub2);
-      break;
-    case RE_UNION:
-      sub1 = fa_regexp_node_fa(node->value.union_.sub1, errstr, errpos,
-                               flags, limit);
-      if (!sub1)
-        return NULL;
-      sub2 = fa_regexp_node_fa(node->value.union_.sub2, errstr, errpos,
-                               flags, limit);
-      if (!sub2) {
-        fa_destroy(sub1);
-        return NULL;
+  sub = root;
+  sub_flags = flags;
+
+  while (1) {
+    if (sub) {
+      if (frames_n == frames_alloc_n) {
+        frames_alloc_n = MMAX(16, frames_alloc_n * 2);
+        frames = realloc(frames, sizeof(frames[0]) * frames_alloc_n);
       }
-      return fa_union(sub1, sub2);
+      f = &frames[frames_n++];
+      f->node = sub;
+      f->flags = sub_flags;
+      f->i = 0;
+      f->fas = NULL;
+      sub = NULL;
+    } else if (frames_n == 0) {
       break;
-    case RE_REPEAT:
-      // a{0} case
-      if (node->value.repeat.onlymin &&
-         node->value.repeat.min == 0) {
-        return fa_string((uint8_t*)"", 0);
-      }
+    }
 
-      if (node->value.repeat.max != 0 &&
-         node->value.repeat.min > node->value.repeat.max) {
-        *errpos = node->pos;
-        *errstr = "min repeat must be less or equal to max repeat";
-        return NULL;
-      }
+    f = &frames[frames_n - 1];
+    node = f->node;
 
-      sub1 = fa_regexp_node_fa(node->value.repeat.sub, errstr, errpos,
-                               flags, limit);
-      if (!sub1)
-        return NULL;
-
-      n = MMAX(node->value.repeat.min, node->value.repeat.max);
-      if (limit && (sub1->states_n * n > limit->states ||
-                   sub1->trans_n * n > limit->trans)) {
-        fa_destroy(sub1);
-        *errpos = node->pos;
-        *errstr = "repeat will generates too many states or transitions";
-        return NULL;
-      }
+    // ret is the result of the last lowered sub
+    if (f->i > 0 && ret == NULL)
+      goto error;
 
-      return fa_repeat(sub1, node->value.repeat.min, node->value.repeat.max);
-      break;
-    case RE_STRING:
-      return fa_string_ex((uint8_t*)node->value.string.str,
-                          node->value.string.len,
-                          *flags & FA_REGEXP_F_ICASE);
-      break;
-    case RE_CLASS:
-      sub1 = fa_regexp_class_fa(node->value.class_.class_,
-                                node->value.class_.neg,
-                                *flags & FA_REGEXP_F_ICASE);
-      // [^\x00-\xff] matches nothing
-      if (sub1 == NULL) {
-        *errstr = "character class does not match any characters";
-        *errpos = node->pos;
-        return NULL;
+    if (cache && f->i == 0) {
+      ret = fa_regexp_cache_get(cache, node, *f->flags & FA_REGEXP_F_ICASE);
+      if (ret) {
+        frames_n--;
+        continue;
       }
+    }
 
-      return sub1;
-      break;
-    case RE_BINARY:
-      if (fa_regexp_bin_bitlen(node->value.binary) % 8 != 0) {
-        *errstr = "binary is not byte aligned";
-        *errpos = node->pos;
-        return NULL;
-      }
+    switch (node->type) {
+      case RE_SUB:
+        if (f->i++ == 0) {
+          node->value.sub.flags = *f->flags;
+          sub = node->value.sub.sub;
+          sub_flags = &node->value.sub.flags;
+          continue;
+        }
+        break;
+      case RE_OPTIONS:
+        if (f->i++ == 0) {
+          *f->flags =
+            (*f->flags & ~node->value.options.flags) |
+            (node->value.options.neg ? 0 : node->value.options.flags);
+          sub = node->value.options.sub;
+          sub_flags = f->flags;
+          continue;
+        }
+        break;
+      case RE_CONCAT:
+      case RE_UNION:
+        n = node->value.concat.n;
+        if (f->i == 0)
+          f->fas = malloc(sizeof(f->fas[0]) * n);
+        else
+          f->fas[f->i - 1] = ret;
+
+        if (f->i < n) {
+          sub = node->value.concat.subs[f->i++];
+          sub_flags = f->flags;
+          continue;
+        }
+
+        if (node->type == RE_CONCAT)
+          ret = fa_concat_list(f->fas, n);
+        else
+          ret = fa_union_list(f->fas, n);
+        free(f->fas);
+        break;
+      case RE_REPEAT:
+        if (f->i++ == 0) {
+          // a{0} case
+          if (node->value.repeat.onlymin &&
+             node->value.repeat.min == 0) {
+            ret = fa_string((uint8_t*)"", 0);
+            break;
+          }
+
+          if (node->value.repeat.max != 0 &&
+             node->value.repeat.min > node->value.repeat.max) {
+            *errpos = node->pos;
+            *errstr = "min repeat must be less or equal to max repeat";
+            goto error;
+          }
+
+          sub = node->value.repeat.sub;
+          sub_flags = f->flags;
+          continue;
+        }
+
+        n = MMAX(node->value.repeat.min, node->value.repeat.max);
+        if (limit && (ret->states_n * n > limit->states ||
+                     ret->trans_n * n > limit->trans)) {
+          fa_destroy(ret);
+          ret = NULL;
+          *errpos = node->pos;
+          *errstr = "repeat will generates too many states or transitions";
+          goto error;
+        }
+
+        ret = fa_repeat(ret, node->value.repeat.min, node->value.repeat.max);
+        break;
+      case RE_STRING:
+        ret = fa_string_ex((uint8_t*)node->value.string.str,
+                           node->value.string.len,
+                           *f->flags & FA_REGEXP_F_ICASE);
+        break;
+      case RE_CLASS:
+        ret = fa_regexp_class_fa(node->value.class_.class_,
+                                 node->value.class_.neg,
+                                 *f->flags & FA_REGEXP_F_ICASE);
+        // [^\x00-\xff] matches nothing
+        if (ret == NULL) {
+          *errstr = "character class does not match any characters";
+          *errpos = node->pos;
+          goto error;
+        }
+        break;
+      case RE_BINARY:
+        if (fa_regexp_bin_bitlen(node->value.binary) % 8 != 0) {
+          *errstr = "binary is not byte aligned";
+          *errpos = node->pos;
+          goto error;
+        }
+
+        ret = fa_regexp_bin_fa(node->value.binary);
+        break;
+      default:
+        assert(0);
+    }
 
-      return fa_regexp_bin_fa(node->value.binary);
-      break;
-    default:
-      assert(0);
+    // node done, ret is passed to parent
+    if (cache)
+      fa_regexp_cache_put(cache, node, *f->flags & FA_REGEXP_F_ICASE, ret);
+    frames_n--;
   }
 
+  free(frames);
+
+  return ret;
+
+error:
+  // destroy subs lowered so far, the failing sub has already cleaned up
+  for (; frames_n > 0; frames_n--) {
+    f = &frames[frames_n - 1];
+    if (!f->fas)
+      continue;
+
+    for (i = 0; i < f->i - 1; i++)
+      fa_destroy(f->fas[i]);
+    free(f->fas);
+  }
+  free(frames);
+
   return NULL;
 }
 
 static void fa_regexp_state_any(fa_state_t *fs) {
-  int i;
-
-  for (i = 0; i < 256; i++)
-    fa_trans_create(fs, i, fs);
+  fa_trans_create_list(fs, (fa_trans_range_t []){{0, 255, fs}}, 1);
 }
 
 static fa_t *fa_regexp_start_unanchor(fa_t *fa) {
@@ -499,6 +1187,8 @@ static fa_t *fa_regexp_start_unanchor(fa_t *fa) {
 
   any = fa_state_create(fa);
   fa_regexp_state_any(any);
+  // lets fa_union_list share it with other unanchored FAs
+  any->flags |= FA_STATE_F_ANY_START;
 
   fa_trans_create(any, FA_SYMBOL_E, fa->start);
   fa->start = any;
@@ -511,21 +1201,32 @@ static fa_t *fa_regexp_end_unanchor(fa_t *fa) {
   fa_state_t *any;
 
   any = fa_state_create(fa);
-  any->flags |= FA_STATE_F_ACCEPTING;
   fa_regexp_state_any(any);
 
-  LIST_FOREACH(fs, &fa->states, link) {
-    if (fs == any || !(fs->flags & FA_STATE_F_ACCEPTING))
-      continue;
-
-    fs->flags &= ~FA_STATE_F_ACCEPTING;
+  while (!LIST_EMPTY(&fa->accepting)) {
+    fs = LIST_FIRST(&fa->accepting);
+    fa_state_accepting(fs, 0);
     fa_trans_create(fs, FA_SYMBOL_E, any);
   }
 
+  fa_state_accepting(any, 1);
+  any->flags |= FA_STATE_F_ANY_END;
+
   return fa;
 }
 
 fa_t *fa_regexp_fa(char *str, char **errstr, int *errpos, fa_limit_t *limit) {
+  return fa_regexp_fa_ex(str, errstr, errpos, limit, fa_regexp_class_dot_all);
+}
+
+fa_t *fa_regexp_fa_ex(char *str, char **errstr, int *errpos,
+                      fa_limit_t *limit, int dot_all) {
+  return fa_regexp_fa_cache(str, errstr, errpos, limit, dot_all, NULL);
+}
+
+fa_t *fa_regexp_fa_cache(char *str, char **errstr, int *errpos,
+                         fa_limit_t *limit, int dot_all,
+                         fa_regexp_cache_t *cache) {
   fa_regexp_node_t *root;
   fa_t *fa;
   char *s;
@@ -550,11 +1251,15 @@ fa_t *fa_regexp_fa(char *str, char **errstr, int *errpos, fa_limit_t *limit) {
     len--;
   }
 
-  root = fa_regexp_yacc_parse(s, len, errstr, errpos);
+  root = fa_regexp_yacc_parse(s, len, dot_all, errstr, errpos);
   if (!*errstr) {
     uint32_t flags = 0;
 
-    fa = fa_regexp_node_fa(root, errstr, errpos, &flags, limit);
+    fa_regexp_node_flatten(root);
+    fa_regexp_node_simplify(root);
+    if (cache)
+      fa_regexp_cache_intern(cache, root);
+    fa = fa_regexp_node_fa(root, errstr, errpos, &flags, limit, cache);
     fa_regexp_node_free(root);
     if (!*errstr) {
       if (!start_anchor)
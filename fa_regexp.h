@@ -41,12 +41,12 @@ typedef struct fa_regexp_node_s {
       struct fa_regexp_node_s *sub;
     } options;
     struct {
-      struct fa_regexp_node_s *sub1;
-      struct fa_regexp_node_s *sub2;
+      int n;
+      struct fa_regexp_node_s **subs;
     } concat;
     struct {
-      struct fa_regexp_node_s *sub1;
-      struct fa_regexp_node_s *sub2;
+      int n;
+      struct fa_regexp_node_s **subs;
     } union_;
     struct {
       struct fa_regexp_node_s *sub;
@@ -65,6 +65,7 @@ typedef struct fa_regexp_node_s {
     fa_regexp_bin_t *binary;
   } value;
   int pos;
+  uint32_t id; // set by fa_regexp_cache_intern, 0 if not interned
 } fa_regexp_node_t;
 
 
@@ -81,6 +82,13 @@ fa_regexp_node_t *fa_regexp_node_string(char *str, int len, int pos);
 fa_regexp_node_t *fa_regexp_node_class(int neg, fa_regexp_class_t *class_,
                                        int pos);
 fa_regexp_node_t *fa_regexp_node_binary(fa_regexp_bin_t *bin, int pos);
+// flatten nested concat and union nodes into n-ary nodes
+void fa_regexp_node_flatten(fa_regexp_node_t *node);
+// rewrite flattened tree to a smaller one matching the same, factors common
+// prefixes and suffixes of union branches, merges single char branches into
+// a class, collapses nested repeats and removes empty strings and subs
+// without options
+void fa_regexp_node_simplify(fa_regexp_node_t *node);
 
 #if 0
 // dump tree
@@ -89,17 +97,37 @@ void fa_regexp_node_dump(fa_regexp_node_t *node);
 void fa_regexp_node_dump_pgf(fa_regexp_node_t *node);
 #endif
 
+// state of one parse, shared by the reentrant parser and lexer
+typedef struct fa_regexp_parse_s {
+  void *scanner; // lexer yyscan_t
+  int pos; // lexer position
+  int dot_all;
+  fa_regexp_node_t *root;
+  char **errstr;
+  int *errpos;
+} fa_regexp_parse_t;
+
 // in fa_regexp_yacc.y
-fa_regexp_node_t *fa_regexp_yacc_parse(char *str, int len,
+fa_regexp_node_t *fa_regexp_yacc_parse(char *str, int len, int dot_all,
                                        char **errstr, int *errpos);
 
 // in fa_regexp_lex.l
-void fa_regexp_lex_start(char *str, int len);
-void fa_regexp_lex_stop(void);
-int fa_regexp_lex_pos(void);
-int yylex(void);
+void fa_regexp_lex_start(fa_regexp_parse_t *parse, char *str, int len);
+void fa_regexp_lex_stop(fa_regexp_parse_t *parse);
 
 void fa_regexp_node_free(fa_regexp_node_t *node);
+// uses fa_regexp_class_dot_all
 fa_t *fa_regexp_fa(char *str, char **errstr, int *errpos, fa_limit_t *limit);
+// reentrant, dot_all makes . match \n too
+fa_t *fa_regexp_fa_ex(char *str, char **errstr, int *errpos,
+                      fa_limit_t *limit, int dot_all);
+struct fa_regexp_cache_s;
+// same as fa_regexp_fa_ex but sub expressions are shared with other regexps
+// compiled using the same cache, see fa_regexp_cache.h. repeats found in the
+// cache are not checked against limit again so use the same limit for all
+// regexps sharing a cache
+fa_t *fa_regexp_fa_cache(char *str, char **errstr, int *errpos,
+                         fa_limit_t *limit, int dot_all,
+                         struct fa_regexp_cache_s *cache);
 
 #endif
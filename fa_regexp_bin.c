@@ -176,6 +176,7 @@ static int fa_regexp_bin_flatten(fa_regexp_bin_t *bin,
 
 fa_t *fa_regexp_bin_fa(fa_regexp_bin_t *bin) {
   uint8_t permbuf[256];
+  uint8_t map[256 / 8];
   uint8_t *valuebuf, *maskbuf;
   fa_t *fa;
   fa_state_t *fs, *prev;
@@ -193,13 +194,15 @@ fa_t *fa_regexp_bin_fa(fa_regexp_bin_t *bin) {
     fs = fa_state_create(fa);
 
     m = permute_byte(valuebuf[i], maskbuf[i], permbuf);
+    memset(map, 0, sizeof(map));
     for (j = 0; j < m; j++)
-      fa_trans_create(prev, permbuf[j], fs);
+      BITFIELD_SET(map, permbuf[j]);
+    fa_trans_create_map(prev, map, fs);
 
     prev = fs;
   }
 
-  prev->flags |= FA_STATE_F_ACCEPTING;
+  fa_state_accepting(prev, 1);
 
   free(valuebuf);
   free(maskbuf);
@@ -0,0 +1,308 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+// a node key is its type and fields with subs replaced by their ids, so
+// trees are interned bottom up with one lookup per node. keys are found
+// using an open addressing table of entry indexes
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fa.h"
+#include "fa_misc.h"
+#include "fa_regexp.h"
+#include "fa_regexp_bin.h"
+#include "fa_regexp_class.h"
+#include "fa_regexp_cache.h"
+
+typedef struct fa_regexp_cache_key_s {
+  uint8_t *buf;
+  int n;
+  int alloc_n;
+} fa_regexp_cache_key_t;
+
+
+fa_regexp_cache_t *fa_regexp_cache_create(void) {
+  fa_regexp_cache_t *cache = calloc(1, sizeof(*cache));
+
+  cache->table_size = 256;
+  cache->table = calloc(cache->table_size, sizeof(cache->table[0]));
+  pthread_mutex_init(&cache->lock, NULL);
+
+  return cache;
+}
+
+void fa_regexp_cache_destroy(fa_regexp_cache_t *cache) {
+  fa_regexp_cache_entry_t *e;
+  uint32_t i;
+
+  for (i = 0; i < cache->entries_n; i++) {
+    e = &cache->entries[i];
+    free(e->key);
+    if (e->fas[0])
+      fa_destroy(e->fas[0]);
+    if (e->fas[1])
+      fa_destroy(e->fas[1]);
+  }
+
+  pthread_mutex_destroy(&cache->lock);
+  free(cache->entries);
+  free(cache->table);
+  free(cache);
+}
+
+static void fa_regexp_cache_key_add(fa_regexp_cache_key_t *key,
+                                    void *p, int len) {
+  if (key->n + len > key->alloc_n) {
+    key->alloc_n = MMAX(64, (key->n + len) * 2);
+    key->buf = realloc(key->buf, key->alloc_n);
+  }
+  memcpy(key->buf + key->n, p, len);
+  key->n += len;
+}
+
+static void fa_regexp_cache_key_int(fa_regexp_cache_key_t *key, uint32_t v) {
+  fa_regexp_cache_key_add(key, &v, sizeof(v));
+}
+
+static uint32_t fa_regexp_cache_hash(uint8_t *p, int len) {
+  uint32_t h = 2166136261u;
+  int i;
+
+  for (i = 0; i < len; i++)
+    h = (h ^ p[i]) * 16777619u;
+
+  return h;
+}
+
+static void fa_regexp_cache_rehash(fa_regexp_cache_t *cache) {
+  uint32_t i, j, mask;
+
+  free(cache->table);
+  cache->table_size *= 2;
+  cache->table = calloc(cache->table_size, sizeof(cache->table[0]));
+  mask = cache->table_size - 1;
+
+  for (i = 0; i < cache->entries_n; i++) {
+    j = cache->entries[i].hash & mask;
+    for (; cache->table[j]; j = (j + 1) & mask)
+      ;
+    cache->table[j] = i + 1;
+  }
+}
+
+// find or create entry for key, returns id
+static uint32_t fa_regexp_cache_id(fa_regexp_cache_t *cache,
+                                   fa_regexp_cache_key_t *key, int leaks) {
+  fa_regexp_cache_entry_t *e;
+  uint32_t h, j, mask;
+
+  h = fa_regexp_cache_hash(key->buf, key->n);
+  mask = cache->table_size - 1;
+  for (j = h & mask; cache->table[j]; j = (j + 1) & mask) {
+    e = &cache->entries[cache->table[j] - 1];
+    if (e->hash == h && e->key_len == key->n &&
+        memcmp(e->key, key->buf, key->n) == 0) {
+      e->refs++;
+      return cache->table[j];
+    }
+  }
+
+  if (cache->entries_n == cache->entries_alloc_n) {
+    cache->entries_alloc_n = MMAX(64, cache->entries_alloc_n * 2);
+    cache->entries = realloc(cache->entries,
+                             sizeof(cache->entries[0]) *
+                             cache->entries_alloc_n);
+  }
+
+  e = &cache->entries[cache->entries_n++];
+  e->hash = h;
+  e->key_len = key->n;
+  e->key = malloc(key->n);
+  memcpy(e->key, key->buf, key->n);
+  e->refs = 1;
+  e->leaks = leaks;
+  e->fas[0] = NULL;
+  e->fas[1] = NULL;
+  cache->table[j] = cache->entries_n;
+
+  // keep load factor below 1/2
+  if (cache->entries_n * 2 > cache->table_size)
+    fa_regexp_cache_rehash(cache);
+
+  return cache->entries_n;
+}
+
+// key of node, subs has to be interned already. sets leaks if the node has
+// options that apply after it
+static void fa_regexp_cache_node_key(fa_regexp_cache_t *cache,
+                                     fa_regexp_node_t *node,
+                                     fa_regexp_cache_key_t *key, int *leaks) {
+  fa_regexp_class_chars_t *rcc;
+  fa_regexp_bin_part_t *bp;
+  fa_regexp_node_t *sub;
+  int i;
+
+  key->n = 0;
+  *leaks = 0;
+  fa_regexp_cache_key_int(key, node->type);
+
+  switch (node->type) {
+    case RE_SUB:
+      // sub scopes options
+      fa_regexp_cache_key_int(key, node->value.sub.sub->id);
+      break;
+    case RE_OPTIONS:
+      sub = node->value.options.sub;
+      fa_regexp_cache_key_int(key, node->value.options.neg);
+      fa_regexp_cache_key_int(key, node->value.options.flags);
+      fa_regexp_cache_key_int(key, sub ? sub->id : 0);
+      *leaks = 1;
+      break;
+    case RE_CONCAT:
+    case RE_UNION:
+      fa_regexp_cache_key_int(key, node->value.concat.n);
+      for (i = 0; i < node->value.concat.n; i++) {
+        sub = node->value.concat.subs[i];
+        fa_regexp_cache_key_int(key, sub->id);
+        *leaks |= cache->entries[sub->id - 1].leaks;
+      }
+      break;
+    case RE_REPEAT:
+      sub = node->value.repeat.sub;
+      fa_regexp_cache_key_int(key, node->value.repeat.onlymin);
+      fa_regexp_cache_key_int(key, node->value.repeat.min);
+      fa_regexp_cache_key_int(key, node->value.repeat.max);
+      fa_regexp_cache_key_int(key, sub->id);
+      *leaks = cache->entries[sub->id - 1].leaks;
+      break;
+    case RE_STRING:
+      fa_regexp_cache_key_int(key, node->value.string.len);
+      fa_regexp_cache_key_add(key, node->value.string.str,
+                              node->value.string.len);
+      break;
+    case RE_CLASS:
+      // entries as is, flattening to one map costs more than it finds
+      fa_regexp_cache_key_int(key, node->value.class_.neg);
+      LIST_FOREACH(rcc, &node->value.class_.class_->head, link) {
+        fa_regexp_cache_key_int(key, rcc->neg);
+        fa_regexp_cache_key_add(key, rcc->map, sizeof(rcc->map));
+      }
+      break;
+    case RE_BINARY:
+      TAILQ_FOREACH(bp, &node->value.binary->head, link) {
+        fa_regexp_cache_key_int(key, bp->bits);
+        fa_regexp_cache_key_int(key, bp->buf != NULL);
+        if (bp->buf)
+          fa_regexp_cache_key_add(key, bp->buf, bp->bytes);
+      }
+      break;
+  }
+}
+
+void fa_regexp_cache_intern(fa_regexp_cache_t *cache, fa_regexp_node_t *root) {
+  fa_regexp_cache_key_t key = {NULL, 0, 0};
+  fa_regexp_node_t **order = NULL;
+  int order_n = 0;
+  int order_alloc_n = 0;
+  fa_regexp_node_t *node;
+  int leaks;
+  int i, j;
+
+  // breadth first list of nodes, subs are appended after their parent
+  for (i = -1; i < order_n; i++) {
+    fa_regexp_node_t *subs[1];
+    fa_regexp_node_t **s = subs;
+    int n = 0;
+
+    if (i == -1) {
+      subs[n++] = root;
+    } else {
+      node = order[i];
+      switch (node->type) {
+        case RE_SUB:
+          subs[n++] = node->value.sub.sub;
+          break;
+        case RE_OPTIONS:
+          if (node->value.options.sub)
+            subs[n++] = node->value.options.sub;
+          break;
+        case RE_CONCAT:
+        case RE_UNION:
+          s = node->value.concat.subs;
+          n = node->value.concat.n;
+          break;
+        case RE_REPEAT:
+          subs[n++] = node->value.repeat.sub;
+          break;
+        default:
+          break;
+      }
+    }
+
+    if (order_n + n > order_alloc_n) {
+      order_alloc_n = MMAX(64, (order_n + n) * 2);
+      order = realloc(order, sizeof(order[0]) * order_alloc_n);
+    }
+    for (j = 0; j < n; j++)
+      order[order_n++] = s[j];
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  // subs are interned before their parent
+  for (i = order_n - 1; i >= 0; i--) {
+    fa_regexp_cache_node_key(cache, order[i], &key, &leaks);
+    order[i]->id = fa_regexp_cache_id(cache, &key, leaks);
+  }
+  pthread_mutex_unlock(&cache->lock);
+
+  free(key.buf);
+  free(order);
+}
+
+// strings are cheaper to build than to clone
+static fa_regexp_cache_entry_t *fa_regexp_cache_entry(fa_regexp_cache_t *c,
+                                                      fa_regexp_node_t *node) {
+  fa_regexp_cache_entry_t *e;
+
+  if (node->id == 0 || node->type == RE_STRING)
+    return NULL;
+  e = &c->entries[node->id - 1];
+  if (e->leaks || e->refs < 2)
+    return NULL;
+
+  return e;
+}
+
+fa_t *fa_regexp_cache_get(fa_regexp_cache_t *cache, fa_regexp_node_t *node,
+                          int icase) {
+  fa_regexp_cache_entry_t *e;
+  fa_t *fa = NULL;
+
+  pthread_mutex_lock(&cache->lock);
+  e = fa_regexp_cache_entry(cache, node);
+  // fa_clone uses opaque_temp of the kept fa
+  if (e && e->fas[icase]) {
+    fa = fa_clone(e->fas[icase]);
+    cache->hits++;
+  }
+  pthread_mutex_unlock(&cache->lock);
+
+  return fa;
+}
+
+void fa_regexp_cache_put(fa_regexp_cache_t *cache, fa_regexp_node_t *node,
+                         int icase, fa_t *fa) {
+  fa_regexp_cache_entry_t *e;
+
+  pthread_mutex_lock(&cache->lock);
+  e = fa_regexp_cache_entry(cache, node);
+  if (e && !e->fas[icase])
+    e->fas[icase] = fa_clone(fa);
+  pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,55 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_REGEXP_CACHE_H__
+#define __FA_REGEXP_CACHE_H__
+
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "fa.h"
+#include "fa_regexp.h"
+
+// hash consing of regexp trees shared by all regexps compiled in a session.
+// each distinct sub tree gets an id, nodes with the same id match the same
+// strings. sub trees seen more than once have their lowered fa kept so that
+// later occurrences are cloned instead of lowered again. all functions lock
+// the cache so it can be shared between threads
+typedef struct fa_regexp_cache_entry_s {
+  uint32_t hash;
+  int key_len;
+  uint8_t *key; // type, fields and sub ids
+  int refs; // times seen in interned trees
+  int leaks; // options that apply to following nodes outside the sub tree
+  fa_t *fas[2]; // lowered without and with icase, NULL if not kept yet
+} fa_regexp_cache_entry_t;
+
+typedef struct fa_regexp_cache_s {
+  fa_regexp_cache_entry_t *entries; // id - 1 to entry
+  uint32_t entries_n;
+  uint32_t entries_alloc_n;
+  uint32_t *table; // entry index + 1, 0 is empty
+  uint32_t table_size; // power of 2
+  uint64_t hits; // lowerings replaced by a clone
+  pthread_mutex_t lock;
+} fa_regexp_cache_t;
+
+fa_regexp_cache_t *fa_regexp_cache_create(void);
+void fa_regexp_cache_destroy(fa_regexp_cache_t *cache);
+// set id of root and all nodes below it, tree should be flattened and
+// simplified so that equal sub trees look the same
+void fa_regexp_cache_intern(fa_regexp_cache_t *cache, fa_regexp_node_t *root);
+// clone of fa kept for node lowered with icase or NULL
+fa_t *fa_regexp_cache_get(fa_regexp_cache_t *cache, fa_regexp_node_t *node,
+                          int icase);
+// keep a clone of fa lowered from node if the sub tree is seen more than once
+// and has no options that apply to nodes after it
+void fa_regexp_cache_put(fa_regexp_cache_t *cache, fa_regexp_node_t *node,
+                         int icase, fa_t *fa);
+
+#endif
@@ -137,12 +137,12 @@ static fa_regexp_class_chars_t *fa_regexp_class_flatten(fa_regexp_class_t *rc,
   return f;
 }
 
-fa_regexp_class_t *fa_regexp_class_named(char *name) {
+fa_regexp_class_t *fa_regexp_class_named(char *name, int dot_all) {
   fa_regexp_class_t *rc = NULL;
   fa_regexp_class_chars_t *rcc;
 
   if (strcmp(name, ".") == 0) {
-    if (fa_regexp_class_dot_all)
+    if (dot_all)
       rc = fa_regexp_class_range((int[]){0, 255}, 1);
     else
       rc = fa_regexp_class_range((int[]){0, 9, 11, 255}, 2);
@@ -236,6 +236,15 @@ fa_regexp_class_t *fa_regexp_class_list(char *chars, int len) {
   return rc;
 }
 
+void fa_regexp_class_map(fa_regexp_class_t *rc, int neg, int icase,
+                         uint8_t *map) {
+  fa_regexp_class_chars_t *rcc;
+
+  rcc = fa_regexp_class_flatten(rc, neg, icase);
+  memcpy(map, rcc->map, sizeof(rcc->map));
+  fa_regexp_class_chars_destroy(rcc);
+}
+
 fa_t *fa_regexp_class_fa(fa_regexp_class_t *rc, int neg, int icase) {
   fa_t *fa;
   fa_regexp_class_chars_t *rcc;
@@ -244,16 +253,13 @@ fa_t *fa_regexp_class_fa(fa_regexp_class_t *rc, int neg, int icase) {
   rcc = fa_regexp_class_flatten(rc, neg, icase);
   if (!fa_regexp_class_chars_is_empty(rcc)) {
     fa_state_t *end;
-    int i;
 
     fa = fa_create();
     fa->start = fa_state_create(fa);
     end = fa_state_create(fa);
-    end->flags |= FA_STATE_F_ACCEPTING;
+    fa_state_accepting(end, 1);
 
-    for (i = 0; i < 256; i++)
-      if (BITFIELD_TEST(rcc->map, i))
-        fa_trans_create(fa->start, i, end);
+    fa_trans_create_map(fa->start, rcc->map, end);
   }
 
   fa_regexp_class_chars_destroy(rcc);
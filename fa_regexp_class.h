@@ -26,16 +26,20 @@ typedef struct fa_regexp_class_chars_s {
   uint8_t map[256 / 8];
 } fa_regexp_class_chars_t;
 
+// default for . matching \n, see fa_regexp_fa_ex for a per call option
 extern int fa_regexp_class_dot_all;
 
 void fa_regexp_class_destroy(fa_regexp_class_t *rc);
 fa_regexp_class_t *fa_regexp_class_clone(fa_regexp_class_t *c);
 fa_regexp_class_t *fa_regexp_class_merge(fa_regexp_class_t *a,
 					                               fa_regexp_class_t *b);
-fa_regexp_class_t *fa_regexp_class_named(char *name);
+fa_regexp_class_t *fa_regexp_class_named(char *name, int dot_all);
 fa_regexp_class_t *fa_regexp_class_range(int *pairs, int pairs_n);
 fa_regexp_class_t *fa_regexp_class_list(char *chars, int len);
 int fa_regexp_class_has_chars(fa_regexp_class_t *rc);
+// chars matched by class as a 256 bit map
+void fa_regexp_class_map(fa_regexp_class_t *rc, int neg, int icase,
+                         uint8_t *map);
 fa_t *fa_regexp_class_fa(fa_regexp_class_t *rc, int neg, int icase);
 
 #endif
@@ -0,0 +1,381 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+// walks the tree in match order keeping two char sets. loop is the chars
+// of unbounded repeats, or the implicit .* of an unanchored start, that
+// can still be running. start is the chars a match following the last loop
+// begins with. a later position with class R is ambiguous if the loop can
+// start a new match there and R matches both start and other chars, then
+// the dfa has to remember which such positions some match has passed
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "fa.h"
+#include "fa_misc.h"
+#include "fa_regexp.h"
+#include "fa_regexp_class.h"
+#include "fa_regexp_risk.h"
+
+#define FA_REGEXP_RISK_MAP_N (256 / 8)
+// max bits for one sub expression and nfa positions before saturating
+#define FA_REGEXP_RISK_BITS_MAX 64
+#define FA_REGEXP_RISK_NPOS_MAX ((uint64_t)1 << 40)
+
+typedef struct fa_regexp_risk_info_s {
+  uint8_t chars[FA_REGEXP_RISK_MAP_N]; // chars matched anywhere
+  uint8_t first[FA_REGEXP_RISK_MAP_N]; // chars that can start a match
+  uint8_t loops[FA_REGEXP_RISK_MAP_N]; // chars of unbounded repeats inside
+  uint64_t minlen;
+  uint64_t npos; // nfa positions
+} fa_regexp_risk_info_t;
+
+// where in the regexp the walk is
+typedef struct fa_regexp_risk_scan_s {
+  uint8_t loop[FA_REGEXP_RISK_MAP_N]; // chars of loops still running
+  uint8_t start[FA_REGEXP_RISK_MAP_N]; // chars a match after a loop starts
+  int pending; // start not complete yet, nullable subs after the loop
+  uint64_t start_len; // min length of the sub expression setting start
+} fa_regexp_risk_scan_t;
+
+typedef struct fa_regexp_risk_walk_s {
+  fa_regexp_risk_t *risks;
+  int risks_max;
+  int risks_n;
+} fa_regexp_risk_walk_t;
+
+
+static void fa_regexp_risk_or(uint8_t *a, uint8_t *b) {
+  int i;
+
+  for (i = 0; i < FA_REGEXP_RISK_MAP_N; i++)
+    a[i] |= b[i];
+}
+
+static int fa_regexp_risk_overlap(uint8_t *a, uint8_t *b) {
+  int i;
+
+  for (i = 0; i < FA_REGEXP_RISK_MAP_N; i++)
+    if (a[i] & b[i])
+      return 1;
+
+  return 0;
+}
+
+static int fa_regexp_risk_subset(uint8_t *a, uint8_t *b) {
+  int i;
+
+  for (i = 0; i < FA_REGEXP_RISK_MAP_N; i++)
+    if (a[i] & ~b[i])
+      return 0;
+
+  return 1;
+}
+
+static uint64_t fa_regexp_risk_mul(uint64_t a, uint64_t b) {
+  if (b != 0 && a > FA_REGEXP_RISK_NPOS_MAX / b)
+    return FA_REGEXP_RISK_NPOS_MAX;
+
+  return a * b;
+}
+
+static void fa_regexp_risk_char(uint8_t *map, uint8_t c, uint32_t flags) {
+  BITFIELD_SET(map, c);
+  if (flags & FA_REGEXP_F_ICASE && isalpha(c)) {
+    BITFIELD_SET(map, toupper(c));
+    BITFIELD_SET(map, tolower(c));
+  }
+}
+
+// flags is the options scope like when lowering in fa_regexp_node_fa
+static void fa_regexp_risk_info(fa_regexp_node_t *node, uint32_t *flags,
+                                fa_regexp_risk_info_t *info) {
+  fa_regexp_risk_info_t sinfo;
+  uint32_t sub_flags;
+  uint64_t k;
+  int first;
+  int i;
+
+  memset(info, 0, sizeof(*info));
+
+  switch (node->type) {
+    case RE_SUB:
+      sub_flags = *flags;
+      fa_regexp_risk_info(node->value.sub.sub, &sub_flags, info);
+      break;
+    case RE_OPTIONS:
+      *flags =
+        (*flags & ~node->value.options.flags) |
+        (node->value.options.neg ? 0 : node->value.options.flags);
+      fa_regexp_risk_info(node->value.options.sub, flags, info);
+      break;
+    case RE_CONCAT:
+    case RE_UNION:
+      first = 1;
+      for (i = 0; i < node->value.concat.n; i++) {
+        fa_regexp_risk_info(node->value.concat.subs[i], flags, &sinfo);
+        fa_regexp_risk_or(info->chars, sinfo.chars);
+        fa_regexp_risk_or(info->loops, sinfo.loops);
+        if (first)
+          fa_regexp_risk_or(info->first, sinfo.first);
+        info->npos = MMIN(info->npos + sinfo.npos, FA_REGEXP_RISK_NPOS_MAX);
+
+        if (node->type == RE_CONCAT) {
+          info->minlen += sinfo.minlen;
+          if (sinfo.minlen > 0)
+            first = 0;
+        } else if (i == 0 || sinfo.minlen < info->minlen)
+          info->minlen = sinfo.minlen;
+      }
+      break;
+    case RE_REPEAT:
+      // a{0}
+      if (node->value.repeat.onlymin && node->value.repeat.min == 0)
+        break;
+
+      fa_regexp_risk_info(node->value.repeat.sub, flags, &sinfo);
+      memcpy(info->chars, sinfo.chars, sizeof(info->chars));
+      memcpy(info->first, sinfo.first, sizeof(info->first));
+      memcpy(info->loops, sinfo.loops, sizeof(info->loops));
+      if (!node->value.repeat.onlymin && node->value.repeat.max == 0)
+        fa_regexp_risk_or(info->loops, sinfo.chars);
+
+      k = MMAX(node->value.repeat.min, node->value.repeat.max);
+      info->minlen = fa_regexp_risk_mul(sinfo.minlen, node->value.repeat.min);
+      info->npos = fa_regexp_risk_mul(sinfo.npos, MMAX(k, 1));
+      break;
+    case RE_STRING:
+      for (i = 0; i < node->value.string.len; i++)
+        fa_regexp_risk_char(info->chars, node->value.string.str[i], *flags);
+      if (node->value.string.len > 0)
+        fa_regexp_risk_char(info->first, node->value.string.str[0], *flags);
+      info->minlen = node->value.string.len;
+      info->npos = node->value.string.len;
+      break;
+    case RE_CLASS:
+      fa_regexp_class_map(node->value.class_.class_, node->value.class_.neg,
+                          *flags & FA_REGEXP_F_ICASE, info->chars);
+      memcpy(info->first, info->chars, sizeof(info->first));
+      info->minlen = 1;
+      info->npos = 1;
+      break;
+    case RE_BINARY:
+      memset(info->chars, 0xff, sizeof(info->chars));
+      memset(info->first, 0xff, sizeof(info->first));
+      info->minlen = fa_regexp_bin_bitlen(node->value.binary) / 8;
+      info->npos = info->minlen;
+      break;
+  }
+}
+
+static void fa_regexp_risk_add(fa_regexp_risk_walk_t *w, int pos, int bits,
+                               char *reason) {
+  if (w->risks_n == w->risks_max)
+    return;
+
+  w->risks[w->risks_n].pos = pos;
+  w->risks[w->risks_n].bits = bits;
+  w->risks[w->risks_n].reason = reason;
+  w->risks_n++;
+}
+
+// can a loop start a new match that overlaps a position matching chars
+static int fa_regexp_risk_ambiguous(fa_regexp_risk_scan_t *sc,
+                                    uint8_t *chars) {
+  return
+    !sc->pending &&
+    fa_regexp_risk_overlap(sc->loop, sc->start) &&
+    fa_regexp_risk_overlap(sc->start, chars) &&
+    !fa_regexp_risk_subset(chars, sc->start);
+}
+
+// update scan state after passing a sub expression
+static void fa_regexp_risk_pass(fa_regexp_risk_scan_t *sc,
+                                fa_regexp_risk_info_t *info) {
+  if (sc->pending) {
+    fa_regexp_risk_or(sc->start, info->first);
+    sc->pending = info->minlen == 0;
+    sc->start_len = info->minlen;
+  }
+
+  // loops not matching any of the chars can not keep running
+  if (info->minlen > 0 && !fa_regexp_risk_overlap(sc->loop, info->chars))
+    memset(sc->loop, 0, sizeof(sc->loop));
+}
+
+// returns bits added by node
+static int fa_regexp_risk_node(fa_regexp_risk_walk_t *w,
+                               fa_regexp_node_t *node, uint32_t *flags,
+                               fa_regexp_risk_scan_t *sc) {
+  fa_regexp_risk_info_t info;
+  fa_regexp_risk_scan_t bsc, usc;
+  fa_regexp_node_t *sub;
+  uint32_t sub_flags;
+  int bits, b, k;
+  int i;
+
+  bits = 0;
+
+  switch (node->type) {
+    case RE_SUB:
+      sub_flags = *flags;
+      bits = fa_regexp_risk_node(w, node->value.sub.sub, &sub_flags, sc);
+      break;
+    case RE_OPTIONS:
+      *flags =
+        (*flags & ~node->value.options.flags) |
+        (node->value.options.neg ? 0 : node->value.options.flags);
+      bits = fa_regexp_risk_node(w, node->value.options.sub, flags, sc);
+      break;
+    case RE_CONCAT:
+      for (i = 0; i < node->value.concat.n; i++)
+        bits += fa_regexp_risk_node(w, node->value.concat.subs[i], flags,
+                                    sc);
+      break;
+    case RE_UNION:
+      memset(&usc, 0, sizeof(usc));
+      for (i = 0; i < node->value.union_.n; i++) {
+        bsc = *sc;
+        b = fa_regexp_risk_node(w, node->value.union_.subs[i], flags, &bsc);
+        bits = MMAX(bits, b);
+        fa_regexp_risk_or(usc.loop, bsc.loop);
+        fa_regexp_risk_or(usc.start, bsc.start);
+        usc.pending |= bsc.pending;
+        usc.start_len = i == 0 ? bsc.start_len :
+          MMIN(usc.start_len, bsc.start_len);
+      }
+      *sc = usc;
+      break;
+    case RE_REPEAT:
+      sub = node->value.repeat.sub;
+      if (node->value.repeat.onlymin && node->value.repeat.min == 0)
+        break;
+
+      sub_flags = *flags;
+      fa_regexp_risk_info(sub, &sub_flags, &info);
+
+      if (!node->value.repeat.onlymin && node->value.repeat.max == 0) {
+        if (fa_regexp_risk_overlap(info.loops, info.first)) {
+          bits++;
+          fa_regexp_risk_add(w, node->pos, 1,
+                             "nested unbounded repeats can match the same "
+                             "input");
+        }
+
+        bsc = *sc;
+        fa_regexp_risk_or(bsc.loop, info.chars);
+        bits += fa_regexp_risk_node(w, sub, flags, &bsc);
+
+        // new matches can start after the loop
+        fa_regexp_risk_or(sc->loop, info.chars);
+        memset(sc->start, 0, sizeof(sc->start));
+        sc->pending = 1;
+        break;
+      }
+
+      k = node->value.repeat.onlymin ?
+        node->value.repeat.min : node->value.repeat.max;
+
+      bsc = *sc;
+      bits += fa_regexp_risk_node(w, sub, flags, &bsc);
+
+      if (k > 1 && fa_regexp_risk_ambiguous(sc, info.chars) &&
+         (uint64_t)k * (MMAX(info.minlen, 1)) >= sc->start_len) {
+        // a longer start can not begin at every position
+        b = MMIN((uint64_t)k * (MMAX(info.minlen, 1)) / sc->start_len,
+                 FA_REGEXP_RISK_BITS_MAX);
+        bits += b;
+        fa_regexp_risk_add(w, node->pos, b,
+                           "counted repeat overlaps a looping or "
+                           "unanchored prefix");
+      }
+
+      info.minlen *= node->value.repeat.min;
+      fa_regexp_risk_pass(sc, &info);
+      fa_regexp_risk_or(sc->loop, info.loops);
+      break;
+    case RE_STRING:
+    case RE_CLASS:
+    case RE_BINARY:
+      sub_flags = *flags;
+      fa_regexp_risk_info(node, &sub_flags, &info);
+
+      if (node->type == RE_CLASS && fa_regexp_risk_ambiguous(sc, info.chars))
+        bits++;
+
+      fa_regexp_risk_pass(sc, &info);
+      break;
+  }
+
+  return MMIN(bits, FA_REGEXP_RISK_BITS_MAX);
+}
+
+int fa_regexp_risk(char *str, int dot_all, fa_regexp_risk_t *risks,
+                   int *risks_n, char **errstr, int *errpos) {
+  fa_regexp_risk_walk_t w;
+  fa_regexp_risk_info_t info;
+  fa_regexp_risk_scan_t sc;
+  fa_regexp_node_t *root;
+  uint32_t flags;
+  char *s;
+  int len;
+  int start_anchor = 0;
+  int score;
+  int i;
+
+  *errstr = NULL;
+  *errpos = 0;
+  s = str;
+  len = strlen(str);
+
+  if (s[0] == '^') {
+    start_anchor = 1;
+    s++;
+    len--;
+  }
+
+  // same as fa_regexp_fa_ex, end anchor does not matter here
+  if (len > 0 && s[len-1] == '$' &&
+      (len == 1 || (len > 1 && s[len-2] != '\\')))
+    len--;
+
+  root = fa_regexp_yacc_parse(s, len, dot_all, errstr, errpos);
+  if (*errstr) {
+    if (*errpos > 0 && start_anchor)
+      (*errpos)++; // ^ was removed
+    return -1;
+  }
+  fa_regexp_node_flatten(root);
+
+  w.risks = risks;
+  w.risks_max = *risks_n;
+  w.risks_n = 0;
+
+  // unanchored start is an implicit .* before the regexp
+  memset(&sc, 0, sizeof(sc));
+  if (!start_anchor)
+    memset(sc.loop, 0xff, sizeof(sc.loop));
+  sc.pending = 1;
+
+  flags = 0;
+  score = fa_regexp_risk_node(&w, root, &flags, &sc);
+  flags = 0;
+  fa_regexp_risk_info(root, &flags, &info);
+  for (; info.npos > 1; info.npos = (info.npos + 1) / 2)
+    score++;
+
+  fa_regexp_node_free(root);
+
+  if (start_anchor)
+    for (i = 0; i < w.risks_n; i++)
+      risks[i].pos++;
+  *risks_n = w.risks_n;
+
+  return score;
+}
@@ -0,0 +1,36 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_REGEXP_RISK_H__
+#define __FA_REGEXP_RISK_H__
+
+// estimate how large the dfa for a regexp can get without building it.
+// the score is roughly log2 of the number of dfa states, it is the number
+// of nfa positions plus one bit for every position the dfa has to remember
+// because a looping or unanchored prefix can start a new match in the
+// middle of it. shapes found:
+//
+// counted repeat or class after a prefix it overlaps, like .*a[ab]{20}
+// nested unbounded repeats that can match the same input, like (a*b?)*
+//
+// the estimate is meant for rejecting hostile patterns quickly, it can be
+// both too high and too low
+
+typedef struct fa_regexp_risk_s {
+  int pos; // same as errpos for fa_regexp_fa
+  int bits; // estimated log2 dfa states added
+  char *reason;
+} fa_regexp_risk_t;
+
+// returns score or -1 and sets errstr and errpos on parse error. at most
+// *risks_n offending sub expressions are stored in risks, *risks_n is set
+// to the number stored
+int fa_regexp_risk(char *str, int dot_all, fa_regexp_risk_t *risks,
+                   int *risks_n, char **errstr, int *errpos);
+
+#endif
@@ -11,6 +11,7 @@
 %{
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "fa_regexp.h"
@@ -18,21 +19,22 @@
 #include "fa_regexp_bin.h"
 
 
-void yyerror(const char *s);
-void fa_regexp_error(const char *str, int pos);
-
 #define err(str, pos) \
-  fa_regexp_error(str, pos);
-
-static int *errorpos;
-static char **errorstr;
+  fa_regexp_error(parse, str, pos);
 
-static fa_regexp_node_t *root;
+// concatenations are right recursive and grow the parser stack
+#define YYMAXDEPTH 1000000
 
 %}
 
 %defines
 %error-verbose
+/* all parse state is in parse and the lexer scanner so that regexps can be
+   parsed concurrently */
+%define api.pure full
+%locations
+%param {void *scanner}
+%parse-param {fa_regexp_parse_t *parse}
 
 %token CHAR
 %token PIPE STAR PLUS QMARK
@@ -44,6 +46,10 @@ static fa_regexp_node_t *root;
 %token CLASS
 %token LPARENQ MINUS
 
+/* reduce unions as they are parsed so that long alternations don't grow
+   the parser stack, fa_regexp_node_flatten joins them later */
+%left PIPE
+
 %union {
   struct {
     int pos;
@@ -59,6 +65,18 @@ static fa_regexp_node_t *root;
   unsigned int uint;
 };
 
+%code requires {
+#include "fa_regexp.h"
+}
+
+%code {
+int yylex(YYSTYPE *lvalp, YYLTYPE *llocp, void *scanner);
+void yyerror(YYLTYPE *llocp, void *scanner, fa_regexp_parse_t *parse,
+             const char *str);
+static void fa_regexp_error(fa_regexp_parse_t *parse, const char *str,
+                            int pos);
+}
+
 %type <token> CHAR NUMBER CLASS LPAREN RPAREN STAR QMARK PLUS LPARENQB GT
 %type <token> PIPE COMMA LCBRACKET LSBRACKET LPARENQ MINUS
 %type <regexp> start
@@ -69,23 +87,23 @@ static fa_regexp_node_t *root;
 %type <uint> options option
 
 %destructor {
-  if(*errorstr && $$)
+  if(*parse->errstr && $$)
     fa_regexp_node_free($$);
 } start regexp regexp2 regexp3 regexp4 group symbol binary class
 
 %destructor {
-  if(*errorstr && $$)
+  if(*parse->errstr && $$)
     fa_regexp_bin_destroy($$);
 } binexps binexp
 
 %destructor {
-  if(*errorstr && $$)
+  if(*parse->errstr && $$)
     fa_regexp_class_destroy($$);
 } classexps classexp
 
 %%
 
-start: regexp { $$ = root = $1; }
+start: regexp { $$ = parse->root = $1; }
 
 
 regexp:
@@ -147,7 +165,7 @@ class
 
 class:
 CLASS {
-  $$ = fa_regexp_node_class(0, fa_regexp_class_named($1.v.s), $1.pos);
+  $$ = fa_regexp_node_class(0, fa_regexp_class_named($1.v.s, parse->dot_all), $1.pos);
 } |
 LSBRACKET classexps RSBRACKET {
   $$ = fa_regexp_node_class(0, $2, $1.pos);
@@ -164,7 +182,7 @@ classexps classexp {
 
 classexp:
 CLASS {
-  $$ = fa_regexp_class_named($1.v.s);
+  $$ = fa_regexp_class_named($1.v.s, parse->dot_all);
 } |
 CHAR {
   char b[] = {$1.v.c};
@@ -260,32 +278,37 @@ CHAR {
 
 %%
 
-void yyerror(const char *str) {
-  fa_regexp_error(str, yylloc.first_column);
+void yyerror(YYLTYPE *llocp, void *scanner, fa_regexp_parse_t *parse,
+             const char *str) {
+  fa_regexp_error(parse, str, llocp->first_column);
 }
 
-void fa_regexp_error(const char *str, int pos) {
-  if (*errorstr)
-    free(*errorstr);
-  *errorpos = pos;
-  *errorstr = strdup(str);
+static void fa_regexp_error(fa_regexp_parse_t *parse, const char *str,
+                            int pos) {
+  if (*parse->errstr)
+    free(*parse->errstr);
+  *parse->errpos = pos;
+  *parse->errstr = strdup(str);
 }
 
-fa_regexp_node_t *fa_regexp_yacc_parse(char *str, int len,
+fa_regexp_node_t *fa_regexp_yacc_parse(char *str, int len, int dot_all,
                                        char **errstr, int *errpos) {
+  fa_regexp_parse_t parse;
   int r;
 
-  errorpos = errpos;
-  errorstr = errstr;
-  *errorpos = 0;
-  *errorstr = NULL;
+  parse.root = NULL;
+  parse.errstr = errstr;
+  parse.errpos = errpos;
+  parse.dot_all = dot_all;
+  *errpos = 0;
+  *errstr = NULL;
 
-  fa_regexp_lex_start(str, len);
-  r = yyparse();
-  fa_regexp_lex_stop();
+  fa_regexp_lex_start(&parse, str, len);
+  r = yyparse(parse.scanner, &parse);
+  fa_regexp_lex_stop(&parse);
 
   if (r == 0)
-    return root;
+    return parse.root;
 
   return NULL;
 }
@@ -0,0 +1,124 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#include <stdlib.h>
+
+#include "fa_misc.h"
+#include "fa_sim.h"
+#include "fa_matchset.h"
+#include "fa_scan.h"
+
+
+void fa_scan_run_init(fa_sim_t *sim, fa_scan_run_t *run,
+                      uint32_t *flags, uint32_t flags_n) {
+  fa_sim_run_init(sim, &run->fsr);
+  run->fsr.opaque = NULL;
+  run->offset = 0;
+  run->flags = flags;
+  run->flags_n = flags ? flags_n : 0;
+  run->reported = calloc((run->flags_n + 7) / 8 + 1, 1);
+  run->halted = 0;
+}
+
+void fa_scan_run_free(fa_scan_run_t *run) {
+  free(run->reported);
+  run->reported = NULL;
+}
+
+// returns non-zero to halt
+static int fa_scan_report(fa_scan_run_t *run, fa_matchset_set_t *set,
+                          size_t offset, fa_scan_match_f *cb, void *ctx) {
+  uint32_t flags;
+  uint32_t i, id;
+
+  for (i = 0; i < set->n; i++) {
+    id = set->ids[i];
+    flags = id < run->flags_n ? run->flags[id] : FA_SCAN_F_ALL;
+
+    if (flags & FA_SCAN_F_ONCE) {
+      if (BITFIELD_TEST(run->reported, id))
+        continue;
+      BITFIELD_SET(run->reported, id);
+    }
+
+    if (cb(id, offset, ctx) || flags & FA_SCAN_F_HALT)
+      return 1;
+  }
+
+  return 0;
+}
+
+// steps one buffer from current, returns number of bytes stepped. stops
+// early on a dead node or when halted
+static size_t fa_scan_buf(fa_sim_t *sim, fa_scan_run_t *run,
+                          uint32_t *currentp, uint8_t *buf, size_t len,
+                          fa_scan_match_f *cb, void *ctx) {
+  uint32_t current = *currentp;
+  fa_sim_node_t *node;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    current = sim->nodes[current].table[buf[i]];
+    node = &sim->nodes[current];
+    if (!(node->flags & FA_SIM_NODE_F_ACCEPTING)) {
+      // node 0 has no way out
+      if (current == 0) {
+        i++;
+        break;
+      }
+      continue;
+    }
+
+    run->fsr.opaque = node->opaque;
+    if (node->opaque &&
+        fa_scan_report(run, fa_matchset_of(node->opaque),
+                       run->offset + i + 1, cb, ctx)) {
+      run->halted = 1;
+      i++;
+      break;
+    }
+  }
+
+  *currentp = current;
+
+  return i;
+}
+
+int fa_scan(fa_sim_t *sim, fa_scan_run_t *run, uint8_t *buf, int len,
+            fa_scan_match_f *cb, void *ctx) {
+  uint32_t current = run->fsr.current;
+
+  if (run->halted || current == 0)
+    return FA_SIM_RUN_REJECT;
+
+  run->offset += fa_scan_buf(sim, run, &current, buf, len, cb, ctx);
+  run->fsr.current = current;
+
+  return run->halted || current == 0 ? FA_SIM_RUN_REJECT : FA_SIM_RUN_MORE;
+}
+
+int fa_scanv(fa_sim_t *sim, fa_scan_run_t *run,
+             const struct iovec *iov, int iovcnt,
+             fa_scan_match_f *cb, void *ctx) {
+  uint32_t current = run->fsr.current;
+  int i;
+
+  if (run->halted || current == 0)
+    return FA_SIM_RUN_REJECT;
+
+  for (i = 0; i < iovcnt && !run->halted && current != 0; i++) {
+    if (i + 1 < iovcnt)
+      __builtin_prefetch(iov[i + 1].iov_base);
+    // offsets continue over segments as if they were one buffer
+    run->offset += fa_scan_buf(sim, run, &current, iov[i].iov_base,
+                               iov[i].iov_len, cb, ctx);
+  }
+  run->fsr.current = current;
+
+  return run->halted || current == 0 ? FA_SIM_RUN_REJECT : FA_SIM_RUN_MORE;
+}
@@ -0,0 +1,54 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_SCAN_H__
+#define __FA_SCAN_H__
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "fa_sim.h"
+#include "fa_matchset.h"
+
+// stream a sim whose accepting states have fa_matchset sets and report each
+// id in the set every time an accepting state is entered. patterns should
+// end with "$" to be reported only at the offset they end at, an unanchored
+// end stays accepting and is reported after every following byte
+
+#define FA_SCAN_F_ALL 0 // report every end offset
+#define FA_SCAN_F_ONCE (1 << 0) // report only the first end offset
+#define FA_SCAN_F_HALT (1 << 1) // stop the scan after reporting
+
+typedef struct fa_scan_run_s {
+  fa_sim_run_t fsr; // current node
+  size_t offset; // stream offset of the next byte
+  uint32_t *flags; // FA_SCAN_F_* per id, ids outside are FA_SCAN_F_ALL
+  uint32_t flags_n;
+  uint8_t *reported; // bit per id with FA_SCAN_F_ONCE already reported
+  int halted;
+} fa_scan_run_t;
+
+// offset is the stream offset just after the last byte of the match, return
+// non-zero to stop the scan
+typedef int (fa_scan_match_f)(uint32_t id, size_t offset, void *ctx);
+
+// flags is used as is and has to be kept until fa_scan_run_free, can be NULL
+void fa_scan_run_init(fa_sim_t *sim, fa_scan_run_t *run,
+                      uint32_t *flags, uint32_t flags_n);
+void fa_scan_run_free(fa_scan_run_t *run);
+// continues where the last call stopped. returns FA_SIM_RUN_REJECT once
+// halted or when no more matches are possible, else FA_SIM_RUN_MORE
+int fa_scan(fa_sim_t *sim, fa_scan_run_t *run, uint8_t *buf, int len,
+            fa_scan_match_f *cb, void *ctx);
+// same as fa_scan over the segments one after another, offsets are stream
+// offsets over all segments
+int fa_scanv(fa_sim_t *sim, fa_scan_run_t *run,
+             const struct iovec *iov, int iovcnt,
+             fa_scan_match_f *cb, void *ctx);
+
+#endif
@@ -9,8 +9,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "fa.h"
+#include "fa_csr.h"
 #include "fa_sim.h"
 
 
@@ -48,10 +53,70 @@ fa_sim_t *fa_sim_create(fa_t *fa) {
   return sim;
 }
 
+fa_sim_t *fa_sim_create_csr(fa_csr_t *csr) {
+  fa_sim_t *sim;
+  uint32_t i, t;
+  int s, j;
+
+  // 0 reserved for no match state, csr state i is node i + 1
+  s = sizeof(*sim) + sizeof(sim->nodes[0]) * (csr->states_n + 1);
+  sim = calloc(1, s);
+  sim->size = s;
+
+  sim->start = csr->start + 1;
+  sim->nodes_n = csr->states_n + 1;
+
+  for (i = 0; i < csr->states_n; i++) {
+    fa_sim_node_t *node = &sim->nodes[i + 1];
+
+    if (csr->flags[i] & FA_STATE_F_ACCEPTING)
+      node->flags |= FA_SIM_NODE_F_ACCEPTING;
+    node->opaque = csr->opaque[i];
+
+    // unused symbols relies on calloc to be transitions to state 0
+    for (t = csr->index[i]; t < csr->index[i + 1]; t++)
+      for (j = csr->trans[t].symfrom; j <= csr->trans[t].symto; j++)
+        node->table[j] = csr->trans[t].state + 1;
+  }
+
+  return sim;
+}
+
 void fa_sim_destroy(fa_sim_t *sim) {
   free(sim);
 }
 
+fa_sim_t *fa_sim_mmap(char *path) {
+  fa_sim_t *sim;
+  struct stat st;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return NULL;
+
+  sim = NULL;
+  if (fstat(fd, &st) == 0 && st.st_size >= sizeof(*sim)) {
+    sim = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (sim == MAP_FAILED)
+      sim = NULL;
+  }
+  close(fd);
+
+  // truncated file
+  if (sim && sizeof(*sim) + sizeof(sim->nodes[0]) * (size_t)sim->nodes_n >
+     (size_t)st.st_size) {
+    munmap(sim, st.st_size);
+    sim = NULL;
+  }
+
+  return sim;
+}
+
+void fa_sim_munmap(fa_sim_t *sim) {
+  munmap(sim, sizeof(*sim) + sizeof(sim->nodes[0]) * (size_t)sim->nodes_n);
+}
+
 void fa_sim_run_init(fa_sim_t *sim, fa_sim_run_t *fsr) {
   fsr->current = sim->start;
 }
@@ -72,3 +137,35 @@ int fa_sim_run(fa_sim_t *sim, fa_sim_run_t *fsr, uint8_t *bytes, int len) {
 
   return FA_SIM_RUN_MORE;
 }
+
+int fa_sim_runv(fa_sim_t *sim, fa_sim_run_t *fsr,
+                const struct iovec *iov, int iovcnt) {
+  uint32_t current = fsr->current;
+  uint8_t *bytes;
+  size_t len, j;
+  int i;
+
+  for (i = 0; i < iovcnt; i++) {
+    // next segment is usually another packet buffer
+    if (i + 1 < iovcnt)
+      __builtin_prefetch(iov[i + 1].iov_base);
+
+    bytes = iov[i].iov_base;
+    len = iov[i].iov_len;
+    for (j = 0; j < len; j++) {
+      current = sim->nodes[current].table[bytes[j]];
+      if (current == 0) {
+        fsr->current = current;
+        return FA_SIM_RUN_REJECT;
+      }
+    }
+  }
+
+  fsr->current = current;
+  if (sim->nodes[current].flags & FA_SIM_NODE_F_ACCEPTING) {
+    fsr->opaque = sim->nodes[current].opaque;
+    return FA_SIM_RUN_ACCEPT;
+  }
+
+  return FA_SIM_RUN_MORE;
+}
@@ -9,7 +9,10 @@
 #ifndef __FA_SIM_H__
 #define __FA_SIM_H__
 
+#include <sys/uio.h>
+
 #include "fa.h"
+#include "fa_csr.h"
 
 
 typedef struct fa_sim_node_s {
@@ -33,12 +36,20 @@ typedef struct fa_sim_run_s {
 
 
 fa_sim_t *fa_sim_create(fa_t *fa);
+fa_sim_t *fa_sim_create_csr(fa_csr_t *csr);
 void fa_sim_destroy(fa_sim_t *sim);
+// map sim image written by fa_csr_determinize_sim_file read only, returns
+// NULL on error. free with fa_sim_munmap
+fa_sim_t *fa_sim_mmap(char *path);
+void fa_sim_munmap(fa_sim_t *sim);
 #define FA_SIM_RUN_ACCEPT 1
 #define FA_SIM_RUN_REJECT 2
 #define FA_SIM_RUN_MORE	  3
 void fa_sim_run_init(fa_sim_t *sim, fa_sim_run_t *fsr);
 int fa_sim_run(fa_sim_t *sim, fa_sim_run_t *fsr,
                uint8_t *bytes, int len);
+// same as fa_sim_run over the segments one after another without copying
+int fa_sim_runv(fa_sim_t *sim, fa_sim_run_t *fsr,
+                const struct iovec *iov, int iovcnt);
 
 #endif
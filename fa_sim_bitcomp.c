@@ -173,3 +173,37 @@ int fa_sim_bitcomp_run(fa_sim_bitcomp_t *fsb, fa_sim_run_t *fsr,
 
   return FA_SIM_RUN_MORE;
 }
+
+int fa_sim_bitcomp_runv(fa_sim_bitcomp_t *fsb, fa_sim_run_t *fsr,
+                        const struct iovec *iov, int iovcnt) {
+  uint32_t current = fsr->current;
+  fa_sim_bitcomp_node_t *node =
+    (fa_sim_bitcomp_node_t*)&fsb->nodes[current];
+  uint8_t *data;
+  size_t len, j;
+  int i;
+
+  for (i = 0; i < iovcnt; i++) {
+    if (i + 1 < iovcnt)
+      __builtin_prefetch(iov[i + 1].iov_base);
+
+    data = iov[i].iov_base;
+    len = iov[i].iov_len;
+    for (j = 0; j < len; j++) {
+      current = node->table[popcount_bitmap(node->bitmap, data[j])];
+      node = (fa_sim_bitcomp_node_t*)&fsb->nodes[current];
+
+      if (current == 0)
+        return FA_SIM_RUN_REJECT;
+    }
+  }
+
+  if (BITFIELD64_TEST(node->bitmap, 0)) {
+    fsr->opaque = node->opaque;
+    return FA_SIM_RUN_ACCEPT;
+  }
+
+  fsr->current = current;
+
+  return FA_SIM_RUN_MORE;
+}
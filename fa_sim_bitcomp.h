@@ -28,5 +28,8 @@ void fa_sim_bitcomp_destroy(fa_sim_bitcomp_t *fsb);
 void fa_sim_bitcomp_run_init(fa_sim_bitcomp_t *fsb, fa_sim_run_t *fsr);
 int fa_sim_bitcomp_run(fa_sim_bitcomp_t *fsb, fa_sim_run_t *fsr,
                        uint8_t *data, int len);
+// same as fa_sim_bitcomp_run over the segments one after another
+int fa_sim_bitcomp_runv(fa_sim_bitcomp_t *fsb, fa_sim_run_t *fsr,
+                        const struct iovec *iov, int iovcnt);
 
 #endif
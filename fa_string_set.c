@@ -0,0 +1,344 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+// minimal acyclic DFA built incrementally from sorted strings, see
+// Daciuk, Mihov, Watson and Watson, "Incremental Construction of Minimal
+// Acyclic Finite-State Automata". only states on the path of the last
+// added string can change. states leaving the path are frozen and replaced
+// by an equivalent already frozen state if there is one, so the automaton
+// is minimal all the time and no NFA or determinization is needed.
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "fa.h"
+#include "fa_misc.h"
+#include "fa_string_set.h"
+
+typedef struct fa_string_set_trans_s {
+  uint32_t symbol;
+  uint32_t state;
+} fa_string_set_trans_t;
+
+// frozen state
+typedef struct fa_string_set_state_s {
+  size_t trans; // offset into build trans
+  uint32_t trans_n;
+  uint32_t hash;
+  int accepting;
+  void *opaque;
+} fa_string_set_state_t;
+
+// not yet frozen state on the path of the last added string
+typedef struct fa_string_set_path_s {
+  fa_string_set_trans_t *trans;
+  uint32_t trans_n;
+  uint32_t trans_alloc_n;
+  int accepting;
+  void *opaque;
+} fa_string_set_path_t;
+
+typedef struct fa_string_set_build_s {
+  fa_string_set_state_t *states;
+  uint32_t states_n;
+  uint32_t states_alloc_n;
+  fa_string_set_trans_t *trans;
+  size_t trans_n;
+  size_t trans_alloc_n;
+  uint32_t *table; // state id + 1, 0 is empty
+  uint32_t table_size; // power of 2
+  fa_string_set_path_t *path; // index is depth
+} fa_string_set_build_t;
+
+typedef struct fa_string_set_str_s {
+  uint8_t *str;
+  int len;
+  int i; // input index, keeps sort stable for duplicates
+} fa_string_set_str_t;
+
+
+static int fa_string_set_str_cmp(const void *a, const void *b) {
+  const fa_string_set_str_t *sa = a;
+  const fa_string_set_str_t *sb = b;
+  int r;
+
+  r = memcmp(sa->str, sb->str, MMIN(sa->len, sb->len));
+  if (r != 0)
+    return r;
+  if (sa->len != sb->len)
+    return sa->len < sb->len ? -1 : 1;
+
+  return sa->i < sb->i ? -1 : sa->i > sb->i;
+}
+
+static int fa_string_set_str_icase_cmp(const void *a, const void *b) {
+  const fa_string_set_str_t *sa = a;
+  const fa_string_set_str_t *sb = b;
+  int i, l;
+
+  l = MMIN(sa->len, sb->len);
+  for (i = 0; i < l; i++) {
+    int ca = tolower(sa->str[i]);
+    int cb = tolower(sb->str[i]);
+
+    if (ca != cb)
+      return ca < cb ? -1 : 1;
+  }
+  if (sa->len != sb->len)
+    return sa->len < sb->len ? -1 : 1;
+
+  return sa->i < sb->i ? -1 : sa->i > sb->i;
+}
+
+static uint32_t fa_string_set_hash(fa_string_set_path_t *p) {
+  uint32_t h = 2166136261u;
+  uint32_t i;
+
+  for (i = 0; i < p->trans_n; i++) {
+    h ^= p->trans[i].symbol;
+    h *= 16777619u;
+    h ^= p->trans[i].state;
+    h *= 16777619u;
+  }
+  h ^= p->accepting;
+  h *= 16777619u;
+  h ^= (uint32_t)(uintptr_t)p->opaque;
+  h *= 16777619u;
+
+  return h;
+}
+
+static void fa_string_set_path_trans(fa_string_set_path_t *p,
+                                     uint32_t symbol, uint32_t state) {
+  if (p->trans_n == p->trans_alloc_n) {
+    p->trans_alloc_n = p->trans_alloc_n ? p->trans_alloc_n * 2 : 4;
+    p->trans = realloc(p->trans, sizeof(p->trans[0]) * p->trans_alloc_n);
+  }
+  p->trans[p->trans_n].symbol = symbol;
+  p->trans[p->trans_n].state = state;
+  p->trans_n++;
+}
+
+static void fa_string_set_rehash(fa_string_set_build_t *b) {
+  uint32_t i, j, mask;
+
+  free(b->table);
+  b->table_size *= 2;
+  b->table = calloc(b->table_size, sizeof(b->table[0]));
+  mask = b->table_size - 1;
+
+  for (i = 0; i < b->states_n; i++) {
+    for (j = b->states[i].hash & mask; b->table[j]; j = (j + 1) & mask)
+      ;
+    b->table[j] = i + 1;
+  }
+}
+
+// replace path state with equivalent frozen state or freeze it, returns
+// state id and resets path state
+static uint32_t fa_string_set_freeze(fa_string_set_build_t *b,
+                                     fa_string_set_path_t *p) {
+  fa_string_set_state_t *s;
+  uint32_t h, j, mask, id;
+
+  h = fa_string_set_hash(p);
+  mask = b->table_size - 1;
+
+  for (j = h & mask; b->table[j]; j = (j + 1) & mask) {
+    id = b->table[j] - 1;
+    s = &b->states[id];
+    if (s->hash == h &&
+        s->accepting == p->accepting &&
+        s->opaque == p->opaque &&
+        s->trans_n == p->trans_n &&
+        (p->trans_n == 0 ||
+         memcmp(&b->trans[s->trans], p->trans,
+                sizeof(p->trans[0]) * p->trans_n) == 0))
+      goto done;
+  }
+
+  if (b->states_n == b->states_alloc_n) {
+    b->states_alloc_n = b->states_alloc_n ? b->states_alloc_n * 2 : 64;
+    b->states = realloc(b->states, sizeof(b->states[0]) * b->states_alloc_n);
+  }
+  if (b->trans_n + p->trans_n > b->trans_alloc_n) {
+    b->trans_alloc_n = MMAX(b->trans_alloc_n * 2, b->trans_n + p->trans_n);
+    b->trans = realloc(b->trans, sizeof(b->trans[0]) * b->trans_alloc_n);
+  }
+
+  id = b->states_n++;
+  s = &b->states[id];
+  s->trans = b->trans_n;
+  s->trans_n = p->trans_n;
+  s->hash = h;
+  s->accepting = p->accepting;
+  s->opaque = p->opaque;
+  if (p->trans_n > 0)
+    memcpy(&b->trans[b->trans_n], p->trans,
+           sizeof(p->trans[0]) * p->trans_n);
+  b->trans_n += p->trans_n;
+  b->table[j] = id + 1;
+
+  // keep load factor below 1/2
+  if (b->states_n * 2 > b->table_size)
+    fa_string_set_rehash(b);
+
+done:
+  p->trans_n = 0;
+  p->accepting = 0;
+  p->opaque = NULL;
+
+  return id;
+}
+
+// freeze path states deeper than depth, str is the string the path
+// currently follows
+static void fa_string_set_freeze_path(fa_string_set_build_t *b,
+                                      fa_string_set_str_t *str,
+                                      int depth, int icase) {
+  uint32_t id;
+  int d;
+
+  for (d = str->len; d > depth; d--) {
+    id = fa_string_set_freeze(b, &b->path[d]);
+    fa_string_set_path_trans(&b->path[d - 1],
+                             icase ? tolower(str->str[d - 1]) :
+                             str->str[d - 1],
+                             id);
+  }
+}
+
+static fa_t *fa_string_set_fa(fa_string_set_build_t *b, uint32_t start,
+                              int icase) {
+  fa_trans_range_t ranges[512];
+  fa_string_set_state_t *s;
+  fa_state_t **fss;
+  fa_t *fa;
+  uint32_t i, j;
+  int n, k;
+
+  fa = fa_create();
+  fss = malloc(sizeof(fss[0]) * b->states_n);
+
+  for (i = 0; i < b->states_n; i++) {
+    fss[i] = fa_state_create(fa);
+    if (b->states[i].accepting) {
+      fa_state_accepting(fss[i], 1);
+      fss[i]->opaque = b->states[i].opaque;
+    }
+    if (i == start)
+      fa->start = fss[i];
+  }
+
+  for (i = 0; i < b->states_n; i++) {
+    s = &b->states[i];
+
+    n = 0;
+    for (j = 0; j < s->trans_n; j++) {
+      fa_string_set_trans_t *t = &b->trans[s->trans + j];
+
+      ranges[n].symfrom = t->symbol;
+      ranges[n].symto = t->symbol;
+      ranges[n].state = fss[t->state];
+      n++;
+      if (icase && islower(t->symbol)) {
+        ranges[n] = ranges[n - 1];
+        ranges[n].symfrom = ranges[n].symto = toupper(t->symbol);
+        n++;
+      }
+    }
+
+    // upper case variants are out of order, few so insertion sort is fine
+    if (icase) {
+      for (j = 1; j < (uint32_t)n; j++) {
+        fa_trans_range_t r = ranges[j];
+
+        for (k = j - 1; k >= 0 && ranges[k].symfrom > r.symfrom; k--)
+          ranges[k + 1] = ranges[k];
+        ranges[k + 1] = r;
+      }
+    }
+
+    fa_trans_create_list(fss[i], ranges, n);
+  }
+
+  free(fss);
+
+  return fa;
+}
+
+fa_t *fa_string_set(uint8_t **strs, int *lens, int n, void **opaques,
+                    uint32_t flags) {
+  fa_string_set_build_t b;
+  fa_string_set_str_t *sorted;
+  fa_string_set_str_t *prev;
+  fa_t *fa;
+  int icase = flags & FA_STRING_SET_F_ICASE;
+  int max_len;
+  int i, p;
+
+  sorted = malloc(sizeof(sorted[0]) * (n > 0 ? n : 1));
+  max_len = 0;
+  for (i = 0; i < n; i++) {
+    sorted[i].str = strs[i];
+    sorted[i].len = lens ? lens[i] : (int)strlen((char *)strs[i]);
+    sorted[i].i = i;
+    max_len = MMAX(max_len, sorted[i].len);
+  }
+  qsort(sorted, n, sizeof(sorted[0]),
+        icase ? fa_string_set_str_icase_cmp : fa_string_set_str_cmp);
+
+  memset(&b, 0, sizeof(b));
+  b.table_size = 256;
+  b.table = calloc(b.table_size, sizeof(b.table[0]));
+  b.path = calloc(max_len + 1, sizeof(b.path[0]));
+
+  prev = NULL;
+  for (i = 0; i < n; i++) {
+    fa_string_set_str_t *s = &sorted[i];
+
+    // common prefix with previous string
+    p = 0;
+    if (prev) {
+      if (icase) {
+        while (p < prev->len && p < s->len &&
+               tolower(prev->str[p]) == tolower(s->str[p]))
+          p++;
+      } else {
+        while (p < prev->len && p < s->len && prev->str[p] == s->str[p])
+          p++;
+      }
+
+      // duplicate, first one wins
+      if (p == prev->len && p == s->len)
+        continue;
+
+      fa_string_set_freeze_path(&b, prev, p, icase);
+    }
+
+    b.path[s->len].accepting = 1;
+    b.path[s->len].opaque = opaques ? opaques[s->i] : NULL;
+    prev = s;
+  }
+
+  if (prev)
+    fa_string_set_freeze_path(&b, prev, 0, icase);
+
+  fa = fa_string_set_fa(&b, fa_string_set_freeze(&b, &b.path[0]), icase);
+
+  for (i = 0; i <= max_len; i++)
+    free(b.path[i].trans);
+  free(b.path);
+  free(b.states);
+  free(b.trans);
+  free(b.table);
+  free(sorted);
+
+  return fa;
+}
@@ -0,0 +1,25 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_STRING_SET_H__
+#define __FA_STRING_SET_H__
+
+#include <inttypes.h>
+
+#include "fa.h"
+
+#define FA_STRING_SET_F_ICASE (1 << 0)
+
+// build minimal DFA matching any of the strings, without building a NFA
+// first. lens can be NULL for nul terminated strings. accepting states get
+// the opaque of their string, opaques can be NULL. if a string occurs more
+// than once the opaque of the first one is used
+fa_t *fa_string_set(uint8_t **strs, int *lens, int n, void **opaques,
+                    uint32_t flags);
+
+#endif
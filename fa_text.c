@@ -105,7 +105,7 @@ static fa_t *fa_text_input_ex(FILE *s) {
       if (strchr(delim, 's'))
         fa->start = current;
       else if (strchr(delim, 't'))
-        current->flags |= FA_STATE_F_ACCEPTING;
+        fa_state_accepting(current, 1);
     }
   }
 
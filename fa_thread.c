@@ -0,0 +1,107 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#include <stdlib.h>
+
+#include "fa_thread.h"
+
+typedef struct fa_thread_worker_s {
+  fa_thread_pool_t *pool;
+  int thread;
+} fa_thread_worker_t;
+
+
+static void *fa_thread_worker(void *arg) {
+  fa_thread_worker_t *w = arg;
+  fa_thread_pool_t *pool = w->pool;
+  uint32_t generation = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (1) {
+    while (!pool->quit && pool->generation == generation)
+      pthread_cond_wait(&pool->work, &pool->lock);
+    if (pool->quit)
+      break;
+    generation = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    pool->fn(pool->arg, w->thread);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->running == 0)
+      pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  free(w);
+
+  return NULL;
+}
+
+fa_thread_pool_t *fa_thread_pool_create(int threads) {
+  fa_thread_pool_t *pool;
+  fa_thread_worker_t *w;
+  int i;
+
+  pool = calloc(1, sizeof(*pool));
+  pool->threads = threads > 1 ? threads : 1;
+  pool->tids = malloc(sizeof(pool->tids[0]) * pool->threads);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  // calling thread is thread 0
+  for (i = 1; i < pool->threads; i++) {
+    w = malloc(sizeof(*w));
+    w->pool = pool;
+    w->thread = i;
+    pthread_create(&pool->tids[i], NULL, fa_thread_worker, w);
+  }
+
+  return pool;
+}
+
+void fa_thread_pool_destroy(fa_thread_pool_t *pool) {
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 1; i < pool->threads; i++)
+    pthread_join(pool->tids[i], NULL);
+
+  pthread_cond_destroy(&pool->work);
+  pthread_cond_destroy(&pool->done);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->tids);
+  free(pool);
+}
+
+void fa_thread_pool_run(fa_thread_pool_t *pool, fa_thread_f *fn, void *arg) {
+  if (pool->threads == 1) {
+    fn(arg, 0);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->fn = fn;
+  pool->arg = arg;
+  pool->running = pool->threads - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  fn(arg, 0);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->running > 0)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,39 @@
+//
+// Copyright (c) 2015 Waystream AB
+// All rights reserved.
+//
+// This software may be modified and distributed under the terms
+// of the NetBSD license.  See the LICENSE file for details.
+//
+
+#ifndef __FA_THREAD_H__
+#define __FA_THREAD_H__
+
+#include <inttypes.h>
+#include <pthread.h>
+
+// fn is called once per thread, thread is 0..threads-1 where 0 is the
+// calling thread
+typedef void (fa_thread_f)(void *arg, int thread);
+
+// persistent worker threads for algorithms that run many short parallel
+// phases, avoids creating threads for each phase
+typedef struct fa_thread_pool_s {
+  int threads;
+  pthread_t *tids;
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  uint32_t generation; // bumped for each run
+  int running; // workers not done with current run
+  int quit;
+  fa_thread_f *fn;
+  void *arg;
+} fa_thread_pool_t;
+
+fa_thread_pool_t *fa_thread_pool_create(int threads);
+void fa_thread_pool_destroy(fa_thread_pool_t *pool);
+// run fn on all threads and wait for all to finish
+void fa_thread_pool_run(fa_thread_pool_t *pool, fa_thread_f *fn, void *arg);
+
+#endif
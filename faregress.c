@@ -16,12 +16,29 @@
 #include <dirent.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <ctype.h>
 
 #include <pcre.h>
 
 #include "fa.h"
+#include "fa_csr.h"
 #include "fa_regexp.h"
+#include "fa_string_set.h"
+#include "fa_ac.h"
+#include "fa_dfa.h"
+#include "fa_compile.h"
+#include "fa_ctx.h"
+#include "fa_regexp_cache.h"
+#include "fa_job.h"
+#include "fa_counter.h"
+#include "fa_glushkov.h"
+#include "fa_deriv.h"
+#include "fa_matchset.h"
+#include "fa_scan.h"
+#include "fa_lex.h"
+#include "fa_flow.h"
+#include "fa_regexp_risk.h"
 #include "fa_sim.h"
 #include "fa_sim_bitcomp.h"
 
@@ -211,12 +228,43 @@ static int test_pcre_callout(pcre_callout_block *b) {
 static void dummy(void *opaque) {
 }
 
+static int test_case_check(char *name, test_t *t, test_case_t *tc,
+                           int r, fa_sim_run_t *run) {
+  test_case_t *otc = (test_case_t*)run->opaque;
+
+  if ((r == FA_SIM_RUN_ACCEPT && otc->num == tc->num) ||
+      (r == FA_SIM_RUN_MORE && tc->num == TEST_MORE) ||
+      (r == FA_SIM_RUN_REJECT && tc->num == TEST_REJECT))
+    return 0;
+
+  fprintf(stderr, "%s: %s:%d: %.*s: ",
+          name, t->file, tc->line, tc->len, tc->text);
+
+  if (r == FA_SIM_RUN_ACCEPT)
+    fprintf(stderr, "matched %d", otc->num);
+  else if (r == FA_SIM_RUN_MORE)
+    fprintf(stderr, "needs more input");
+  else if (r == FA_SIM_RUN_REJECT)
+    fprintf(stderr, "no match");
+  fprintf(stderr, ", should ");
+  if (tc->num == TEST_REJECT)
+    fprintf(stderr, "not match");
+  else if (tc->num == TEST_MORE)
+    fprintf(stderr, "need more input");
+  else
+    fprintf(stderr, "match %d", tc->num);
+  fprintf(stderr, "\n");
+
+  return 1;
+}
+
 static void test_do(test_t *t) {
   test_case_t *tc;
   test_regexp_t *tr;
   fa_t **fal;
   fa_t *fa, *tfa;
-  fa_sim_t *sim;
+  fa_csr_t *csr, *tcsr;
+  fa_sim_t *sim, *simcsr;
   fa_sim_bitcomp_t *simbitcomp;
   char *errstr = NULL;
   int errpos;
@@ -308,6 +356,9 @@ static void test_do(test_t *t) {
   fa = fa_union_list(fal, i);
   free(fal);
 
+  // same nfa determinized and minimized using csr, compared below
+  csr = fa_csr_create(fa);
+
   sigalarm_trigger = 0;
   itv.it_interval.tv_sec = test_opt_get_int(t, "dtimeout", 0) / 1000;
   itv.it_interval.tv_usec = test_opt_get_int(t, "dtimeout", 0) % 1000;
@@ -362,16 +413,33 @@ static void test_do(test_t *t) {
     }
 
     free(pcre_s);
+    fa_csr_destroy(csr);
 
     return;
   }
 
+  tcsr = fa_csr_determinize_ex(csr, state_pri, NULL, NULL);
+  fa_csr_destroy(csr);
+  csr = tcsr;
+  tcsr = fa_csr_minimize_ex(csr, state_cmp, NULL);
+  fa_csr_destroy(csr);
+  csr = tcsr;
+
   if (test_opt_get(t, "removeacceptingtrans", NULL)) {
     fa = fa_remove_accepting_trans(fa);
     tfa = fa_minimize_ex(fa, state_cmp, NULL);
     fa_destroy(fa);
     fa = tfa;
+
+    // no csr version, go thru fa_t
+    tfa = fa_csr_fa(csr);
+    tfa = fa_remove_accepting_trans(tfa);
+    simcsr = fa_sim_create(tfa);
+    fa_destroy(tfa);
+  } else {
+    simcsr = fa_sim_create_csr(csr);
   }
+  fa_csr_destroy(csr);
 
   pcre_extra.flags = PCRE_EXTRA_CALLOUT_DATA;
   pcre_extra.callout_data = &pcre_match_num;
@@ -399,63 +467,39 @@ static void test_do(test_t *t) {
 
   LIST_FOREACH(tc, &t->cases, link) {
     fa_sim_run_t run;
-    test_case_t *otc;
+    struct iovec iov[3];
     int fail;
     int r;
 
     fail = 0;
 
+    // split in three, some may be empty
+    iov[0].iov_base = tc->text;
+    iov[0].iov_len = tc->len / 3;
+    iov[1].iov_base = tc->text + tc->len / 3;
+    iov[1].iov_len = tc->len * 2 / 3 - tc->len / 3;
+    iov[2].iov_base = tc->text + tc->len * 2 / 3;
+    iov[2].iov_len = tc->len - tc->len * 2 / 3;
+
     fa_sim_run_init(sim, &run);
     r = fa_sim_run(sim, &run, (uint8_t *)tc->text, tc->len);
-    otc = (test_case_t*)run.opaque;
-    if ((r == FA_SIM_RUN_ACCEPT && otc->num != tc->num) ||
-        (r == FA_SIM_RUN_MORE && tc->num != TEST_MORE) ||
-        (r == FA_SIM_RUN_REJECT && tc->num != TEST_REJECT)) {
-      fprintf(stderr, "SIM       : %s:%d: %.*s: ",
-              t->file, tc->line, tc->len, tc->text);
-
-      if (r == FA_SIM_RUN_ACCEPT)
-        fprintf(stderr, "matched %d", otc->num);
-      else if (r == FA_SIM_RUN_MORE)
-        fprintf(stderr, "needs more input");
-      else if (r == FA_SIM_RUN_REJECT)
-        fprintf(stderr, "no match");
-      fprintf(stderr, ", should ");
-      if (tc->num == TEST_REJECT)
-        fprintf(stderr, "not match");
-      else if (tc->num == TEST_MORE)
-        fprintf(stderr, "need more input");
-      else
-        fprintf(stderr, "match %d", tc->num);
-      fprintf(stderr, "\n");
-      fail++;
-    }
+    fail += test_case_check("SIM       ", t, tc, r, &run);
 
     fa_sim_bitcomp_run_init(simbitcomp, &run);
     r = fa_sim_bitcomp_run(simbitcomp, &run, (uint8_t *)tc->text, tc->len);
-    otc = (test_case_t*)run.opaque;
-    if ((r == FA_SIM_RUN_ACCEPT && otc->num != tc->num) ||
-        (r == FA_SIM_RUN_MORE && tc->num != TEST_MORE) ||
-        (r == FA_SIM_RUN_REJECT && tc->num != TEST_REJECT)) {
-      fprintf(stderr, "SIMBITCOMP: %s:%d: %.*s: ",
-              t->file, tc->line, tc->len, tc->text);
-
-      if (r == FA_SIM_RUN_ACCEPT)
-        fprintf(stderr, "matched %d", otc->num);
-      else if (r == FA_SIM_RUN_MORE)
-        fprintf(stderr, "needs more input");
-      else if (r == FA_SIM_RUN_REJECT)
-        fprintf(stderr, "no match");
-      fprintf(stderr, ", should ");
-      if (tc->num == TEST_REJECT)
-        fprintf(stderr, "not match");
-      else if (tc->num == TEST_MORE)
-        fprintf(stderr, "need more input");
-      else
-        fprintf(stderr, "match %d", tc->num);
-      fprintf(stderr, "\n");
-      fail++;
-    }
+    fail += test_case_check("SIMBITCOMP", t, tc, r, &run);
+
+    fa_sim_run_init(sim, &run);
+    r = fa_sim_runv(sim, &run, iov, 3);
+    fail += test_case_check("SIMV      ", t, tc, r, &run);
+
+    fa_sim_bitcomp_run_init(simbitcomp, &run);
+    r = fa_sim_bitcomp_runv(simbitcomp, &run, iov, 3);
+    fail += test_case_check("SIMBITCOMPV", t, tc, r, &run);
+
+    fa_sim_run_init(simcsr, &run);
+    r = fa_sim_run(simcsr, &run, (uint8_t *)tc->text, tc->len);
+    fail += test_case_check("SIMCSR    ", t, tc, r, &run);
 
     if (!test_opt_get_int(t, "ignorepcre", 0) &&
        pcre_comp) {
@@ -496,6 +540,7 @@ static void test_do(test_t *t) {
     pcre_free(pcre_comp);
 
   fa_sim_destroy(sim);
+  fa_sim_destroy(simcsr);
   fa_sim_bitcomp_destroy(simbitcomp);
 }
 
@@ -834,6 +879,1239 @@ static void test_misc(void) {
   t = LIST_FIRST(&a->trans);
   fa_trans_destroy(t);
 
+  // bulk insert merges with existing ranges
+  fa_trans_create(a, 'c', b);
+  fa_trans_create(a, 'x', a);
+  fa_trans_create_list(a, (fa_trans_range_t []){
+      {FA_SYMBOL_E, FA_SYMBOL_E, b},
+      {'a', 'b', b},
+      {'d', 'f', b},
+      {'y', 'z', a}}, 4);
+  t = LIST_FIRST(&a->trans);
+  if (t->symfrom != FA_SYMBOL_E || t->state != b)
+    fprintf(stderr, "%d-%d\n", t->symfrom, t->symto);
+  t = LIST_NEXT(t, link);
+  if (t->symfrom != 'a' || t->symto != 'f' || t->state != b)
+    fprintf(stderr, "%c-%c\n", t->symfrom, t->symto);
+  t = LIST_NEXT(t, link);
+  if (t->symfrom != 'x' || t->symto != 'z' || t->state != a)
+    fprintf(stderr, "%c-%c\n", t->symfrom, t->symto);
+  while (!LIST_EMPTY(&a->trans))
+    fa_trans_destroy(LIST_FIRST(&a->trans));
+
+  fa_trans_create_map(a, (uint8_t [256 / 8]){[0] = 0x0e, [1] = 0x01}, b);
+  t = LIST_FIRST(&a->trans);
+  if (t->symfrom != 1 || t->symto != 3)
+    fprintf(stderr, "%d-%d\n", t->symfrom, t->symto);
+  t = LIST_NEXT(t, link);
+  if (t->symfrom != 8 || t->symto != 8)
+    fprintf(stderr, "%d-%d\n", t->symfrom, t->symto);
+  while (!LIST_EMPTY(&a->trans))
+    fa_trans_destroy(LIST_FIRST(&a->trans));
+
+  // accepting list follows flag changes and state destroy
+  fa_state_accepting(a, 1);
+  fa_state_accepting(b, 1);
+  fa_state_accepting(b, 1);
+  fa_state_accepting(a, 0);
+  if (LIST_FIRST(&fa->accepting) != b || LIST_NEXT(b, alink) != NULL)
+    fprintf(stderr, "accepting list\n");
+  fa_state_destroy(b);
+  if (!LIST_EMPTY(&fa->accepting))
+    fprintf(stderr, "accepting list not empty\n");
+
+  fa_destroy(fa);
+
+  // unanchored FAs share start and end any states in a union
+  {
+    fa_t *fas[2];
+    int errpos;
+    char *errstr;
+
+    fas[0] = fa_regexp_fa("ab", &errstr, &errpos, NULL);
+    fas[1] = fa_regexp_fa("cd", &errstr, &errpos, NULL);
+    fa = fa_union_list(fas, 2);
+    t = LIST_FIRST(&fa->start->trans);
+    if (t->symfrom != FA_SYMBOL_E ||
+        LIST_NEXT(t, link)->symfrom != FA_SYMBOL_E)
+      fprintf(stderr, "union any start\n");
+    a = LIST_FIRST(&fa->accepting);
+    if (!a || LIST_NEXT(a, alink) != NULL)
+      fprintf(stderr, "union any end\n");
+    fa_destroy(fa);
+  }
+}
+
+// string set should be the same as the minimized union of the strings
+static void test_string_set(int icase) {
+  char *strs[] = {"abc", "abd", "b", "xabd", "", "ABC", "abc", "bcd", "cd"};
+  int n = sizeof(strs) / sizeof(strs[0]);
+  fa_t *fas[n];
+  fa_t *fa, *dfa, *mfa, *sfa;
+  int i;
+
+  for (i = 0; i < n; i++)
+    fas[i] = fa_string_ex((uint8_t *)strs[i], strlen(strs[i]), icase);
+  fa = fa_union_list(fas, n);
+  dfa = fa_determinize(fa);
+  mfa = fa_minimize(dfa);
+
+  sfa = fa_string_set((uint8_t **)strs, NULL, n, NULL,
+                      icase ? FA_STRING_SET_F_ICASE : 0);
+
+  if (sfa->states_n != mfa->states_n || sfa->trans_n != mfa->trans_n)
+    fprintf(stderr, "string set icase=%d %d/%d != %d/%d\n", icase,
+            sfa->states_n, sfa->trans_n, mfa->states_n, mfa->trans_n);
+
+  fa_destroy(fa);
+  fa_destroy(dfa);
+  fa_destroy(mfa);
+  fa_destroy(sfa);
+}
+
+static void test_ac_match(size_t offset, fa_ac_match_t *match, void *ctx) {
+  char *found = ctx;
+  char b[32];
+
+  snprintf(b, sizeof(b), "%s@%d ", (char *)match->opaque, (int)offset);
+  strcat(found, b);
+}
+
+// failure link scan and sim of full DFA should find all occurrences
+static void test_ac(void) {
+  char *strs[] = {"he", "she", "his", "hers", "s"};
+  char *expected = "s@2 she@4 he@4 hers@6 s@6 ";
+  char found[256];
+  fa_ac_t *ac;
+  fa_ac_run_t run;
+  fa_sim_t *sim;
+  fa_sim_run_t fsr;
+  struct iovec iov[3];
+  fa_t *fa;
+
+  ac = fa_ac_create((uint8_t **)strs, NULL, 5, (void **)strs, 0);
+
+  found[0] = '\0';
+  fa_ac_run_init(ac, &run);
+  fa_ac_run(ac, &run, (uint8_t *)"ush", 3, test_ac_match, found);
+  fa_ac_run(ac, &run, (uint8_t *)"ers", 3, test_ac_match, found);
+  if (strcmp(found, expected) != 0)
+    fprintf(stderr, "ac run: %s\n", found);
+
+  fa = fa_ac_fa(ac);
+  sim = fa_sim_create(fa);
+  found[0] = '\0';
+  fa_sim_run_init(sim, &fsr);
+  fa_ac_sim_run(sim, &fsr, 0, (uint8_t *)"ushers", 6, test_ac_match, found);
+  if (strcmp(found, expected) != 0)
+    fprintf(stderr, "ac sim run: %s\n", found);
+
+  found[0] = '\0';
+  fa_sim_run_init(sim, &fsr);
+  iov[0].iov_base = "ush";
+  iov[0].iov_len = 3;
+  iov[1].iov_base = "";
+  iov[1].iov_len = 0;
+  iov[2].iov_base = "ers";
+  iov[2].iov_len = 3;
+  fa_ac_sim_runv(sim, &fsr, 0, iov, 3, test_ac_match, found);
+  if (strcmp(found, expected) != 0)
+    fprintf(stderr, "ac sim runv: %s\n", found);
+
+  fa_sim_destroy(sim);
+  fa_destroy(fa);
+  fa_ac_destroy(ac);
+}
+
+static fa_t *test_dfa_fa(char *regexp, intptr_t opaque) {
+  fa_t *fa, *dfa;
+  int errpos;
+  char *errstr;
+
+  fa = fa_regexp_fa(regexp, &errstr, &errpos, NULL);
+  dfa = fa_determinize(fa);
+  fa_destroy(fa);
+  fa_set_accepting_opaque(dfa, (void *)opaque);
+
+  return dfa;
+}
+
+// opaque of accepting state str ends in or 0
+static intptr_t test_dfa_run(fa_t *fa, char *str) {
+  fa_state_t *fs = fa->start;
+  fa_trans_t *ft;
+
+  for (; *str; str++) {
+    LIST_FOREACH(ft, &fs->trans, link)
+      if (ft->symfrom <= (uint8_t)*str && ft->symto >= (uint8_t)*str)
+        break;
+    if (!ft)
+      return 0;
+    fs = ft->state;
+  }
+
+  return fs->flags & FA_STATE_F_ACCEPTING ? (intptr_t)fs->opaque : 0;
+}
+
+static void *test_dfa_pri(void **opaques, int opaques_n) {
+  return (intptr_t)opaques[0] > (intptr_t)opaques[1] ? opaques[0] : opaques[1];
+}
+
+static void test_dfa(void) {
+  struct {
+    char *str;
+    intptr_t u, i, d, c;
+  } cases[] = {
+    // union, intersect, difference, complement of a
+    {"ab", 1, 0, 1, 0},
+    {"az", 2, 2, 0, 0},
+    {"bz", 2, 0, 0, 3},
+    {"b", 0, 0, 0, 3},
+    {"", 0, 0, 0, 3},
+  };
+  fa_t *a, *b, *u, *i, *d, *c;
+  int j;
+
+  a = test_dfa_fa("^a[a-z]*$", 1);
+  b = test_dfa_fa("^[a-z]*z$", 2);
+  u = fa_dfa_union(a, b, test_dfa_pri, NULL, NULL);
+  i = fa_dfa_intersect(a, b, test_dfa_pri, NULL, NULL);
+  d = fa_dfa_difference(a, b, NULL, NULL);
+  c = fa_dfa_complement(a, (void *)3);
+
+  for (j = 0; j < sizeof(cases) / sizeof(cases[0]); j++) {
+    if (test_dfa_run(u, cases[j].str) != cases[j].u ||
+        test_dfa_run(i, cases[j].str) != cases[j].i ||
+        test_dfa_run(d, cases[j].str) != cases[j].d ||
+        test_dfa_run(c, cases[j].str) != cases[j].c)
+      fprintf(stderr, "dfa product: %s\n", cases[j].str);
+  }
+
+  if (fa_dfa_union(a, b, NULL, &(fa_limit_t){.states = 2, .trans = 100},
+                   NULL) != NULL)
+    fprintf(stderr, "dfa product limit\n");
+
+  fa_destroy(a);
+  fa_destroy(b);
+  fa_destroy(u);
+  fa_destroy(i);
+  fa_destroy(d);
+  fa_destroy(c);
+}
+
+static void *test_compile_pri(void **opaques, int opaques_n) {
+  intptr_t w = (intptr_t)opaques[0];
+  int i;
+
+  for (i = 1; i < opaques_n; i++)
+    if ((intptr_t)opaques[i] < w)
+      w = (intptr_t)opaques[i];
+
+  return (void *)w;
+}
+
+// parallel compile should give same matches and priorities as
+// determinizing the union
+static void test_compile(int threads) {
+  char *regexps[] = {
+    "^a+$", "^a[a-c]*$", "^[ab]*b$", "^c+$", "^(ab)+$", "^.*c$", "a"
+  };
+  char *strs[] = {
+    "", "a", "aa", "ab", "abab", "bb", "cc", "ac", "b", "ba", "bca"
+  };
+  int n = sizeof(regexps) / sizeof(regexps[0]);
+  fa_t *fal[sizeof(regexps) / sizeof(regexps[0])];
+  fa_t *cfa, *ufa, *tfa;
+  int errpos;
+  char *errstr;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    fal[i] = fa_regexp_fa(regexps[i], &errstr, &errpos, NULL);
+    fa_set_accepting_opaque(fal[i], (void *)(intptr_t)(i + 1));
+  }
+  cfa = fa_compile_list(fal, n, test_compile_pri, state_cmp, threads, NULL);
+
+  for (i = 0; i < n; i++) {
+    fal[i] = fa_regexp_fa(regexps[i], &errstr, &errpos, NULL);
+    fa_set_accepting_opaque(fal[i], (void *)(intptr_t)(i + 1));
+  }
+  ufa = fa_union_list(fal, n);
+  tfa = fa_determinize_ex(ufa, test_compile_pri, NULL, NULL);
+  fa_destroy(ufa);
+  ufa = fa_minimize_ex(tfa, state_cmp, NULL);
+  fa_destroy(tfa);
+
+  for (i = 0; i < sizeof(strs) / sizeof(strs[0]); i++)
+    if (test_dfa_run(cfa, strs[i]) != test_dfa_run(ufa, strs[i]))
+      fprintf(stderr, "compile %d: %s: %d should be %d\n", threads, strs[i],
+              (int)test_dfa_run(cfa, strs[i]),
+              (int)test_dfa_run(ufa, strs[i]));
+  if (cfa->states_n != ufa->states_n)
+    fprintf(stderr, "compile %d: %d states should be %d\n", threads,
+            cfa->states_n, ufa->states_n);
+
+  fa_destroy(cfa);
+  fa_destroy(ufa);
+}
+
+static int test_csr_equal(fa_csr_t *a, fa_csr_t *b) {
+  uint32_t i;
+
+  if (a->states_n != b->states_n ||
+      a->trans_n != b->trans_n ||
+      a->start != b->start ||
+      memcmp(a->index, b->index, sizeof(a->index[0]) * (a->states_n + 1)) ||
+      memcmp(a->flags, b->flags, sizeof(a->flags[0]) * a->states_n) ||
+      memcmp(a->opaque, b->opaque, sizeof(a->opaque[0]) * a->states_n))
+    return 0;
+
+  for (i = 0; i < a->trans_n; i++)
+    if (a->trans[i].symfrom != b->trans[i].symfrom ||
+        a->trans[i].symto != b->trans[i].symto ||
+        a->trans[i].state != b->trans[i].state)
+      return 0;
+
+  return 1;
+}
+
+// parallel determinize and minimize number states the same as serial
+static void test_csr_parallel(int threads) {
+  char *regexps[] = {
+    "(a|b)*a(a|b){8}", "b(a|b){6}a", "[a-c]*cc", "^ab+$", "a"
+  };
+  int n = sizeof(regexps) / sizeof(regexps[0]);
+  fa_t *fal[sizeof(regexps) / sizeof(regexps[0])];
+  fa_csr_t *csr, *scsr, *pcsr, *tcsr;
+  fa_t *fa;
+  int errpos;
+  char *errstr;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    fal[i] = fa_regexp_fa(regexps[i], &errstr, &errpos, NULL);
+    fa_set_accepting_opaque(fal[i], (void *)(intptr_t)(i + 1));
+  }
+  fa = fa_union_list(fal, n);
+  csr = fa_csr_create(fa);
+  fa_destroy(fa);
+
+  scsr = fa_csr_determinize_ex(csr, test_compile_pri, NULL, NULL);
+  pcsr = fa_csr_determinize_parallel(csr, test_compile_pri, NULL, NULL,
+                                     threads);
+  fa_csr_destroy(csr);
+  if (!test_csr_equal(scsr, pcsr))
+    fprintf(stderr, "csr parallel %d: determinize differ\n", threads);
+
+  tcsr = fa_csr_minimize_parallel(scsr, state_cmp, NULL, threads);
+  fa_csr_destroy(pcsr);
+  pcsr = tcsr;
+  tcsr = fa_csr_minimize_ex(scsr, state_cmp, NULL);
+  fa_csr_destroy(scsr);
+  scsr = tcsr;
+  if (!test_csr_equal(scsr, pcsr))
+    fprintf(stderr, "csr parallel %d: minimize differ\n", threads);
+
+  fa_csr_destroy(scsr);
+  fa_csr_destroy(pcsr);
+}
+
+// concurrent parsing gives the same result as one at a time
+static void test_ctx(void) {
+  char *strs[] = {
+    "^a.b$", "^(ab|cd)+$", "^[a-z]{2,4}x$", "^a(b$", "^\\d+\\.\\d+$",
+    "^(?i)abc$", "^x{3}[^y]z*$", "^(a|b|c|d|e)*f$"
+  };
+  int n = sizeof(strs) / sizeof(strs[0]);
+  fa_t *fas[sizeof(strs) / sizeof(strs[0])];
+  char *errstrs[sizeof(strs) / sizeof(strs[0])];
+  int errposs[sizeof(strs) / sizeof(strs[0])];
+  fa_ctx_t ctx;
+  fa_t *fa;
+  char *errstr;
+  int errpos;
+  int i;
+
+  fa_ctx_init(&ctx);
+  ctx.threads = 4;
+  ctx.flags = FA_CTX_F_MIN;
+  if (fa_ctx_regexp_fa_list(&ctx, strs, n, fas, errstrs, errposs) != 1)
+    fprintf(stderr, "ctx list failed count\n");
+
+  ctx.threads = 0;
+  for (i = 0; i < n; i++) {
+    fa = fa_ctx_regexp_fa(&ctx, strs[i], &errstr, &errpos);
+    if (!fa != !fas[i] ||
+        (fa && (fa->states_n != fas[i]->states_n ||
+                fa->trans_n != fas[i]->trans_n)) ||
+        (!fa && errpos != errposs[i]))
+      fprintf(stderr, "ctx list: %s\n", strs[i]);
+    if (fa)
+      fa_destroy(fa);
+    else
+      free(errstr);
+    if (fas[i])
+      fa_destroy(fas[i]);
+    else
+      free(errstrs[i]);
+  }
+
+  // . matches \n only with dot_all
+  for (i = 0; i < 2; i++) {
+    ctx.dot_all = i;
+    fa = fa_ctx_regexp_fa(&ctx, "^.$", &errstr, &errpos);
+    fa_set_accepting_opaque(fa, (void *)1);
+    if (test_dfa_run(fa, "\n") != i || test_dfa_run(fa, "a") != 1)
+      fprintf(stderr, "ctx dot_all %d\n", i);
+    fa_destroy(fa);
+  }
+}
+
+// regexps compiled sharing sub expressions give the same minimal DFAs
+static void test_cache(void) {
+  char *strs[] = {
+    "^src=(25[0-5]|2[0-4][0-9]|1?[0-9]?[0-9])(\\.[0-9]{1,3}){3}$",
+    "^dst=(25[0-5]|2[0-4][0-9]|1?[0-9]?[0-9])(\\.[0-9]{1,3}){3}$",
+    "^(?i)via=(25[0-5]|2[0-4][0-9]|1?[0-9]?[0-9])(\\.[0-9]{1,3}){3}$",
+    "^(a(?i)b)c(a(?i)b)$", "^(a(?i)b)C$", "x([a-c]+|d{2})*y",
+    "z([a-c]+|d{2})*y", "([c-a]+|d{2})", "^[A-Z]+:[A-Za-z0-9+/]{4}*$",
+    "^X-[A-Z]+:[A-Za-z0-9+/]{4}*$"
+  };
+  int n = sizeof(strs) / sizeof(strs[0]);
+  fa_t *fas[sizeof(strs) / sizeof(strs[0])];
+  char *errstrs[sizeof(strs) / sizeof(strs[0])];
+  int errposs[sizeof(strs) / sizeof(strs[0])];
+  fa_ctx_t ctx;
+  fa_t *fa;
+  char *errstr;
+  int errpos;
+  int i;
+
+  fa_ctx_init(&ctx);
+  ctx.flags = FA_CTX_F_MIN;
+  ctx.threads = 4;
+  ctx.cache = fa_regexp_cache_create();
+  if (fa_ctx_regexp_fa_list(&ctx, strs, n, fas, errstrs, errposs) != 1)
+    fprintf(stderr, "cache list failed count\n");
+  if (ctx.cache->hits == 0)
+    fprintf(stderr, "cache no sub expressions shared\n");
+  fa_regexp_cache_destroy(ctx.cache);
+
+  ctx.cache = NULL;
+  ctx.threads = 0;
+  for (i = 0; i < n; i++) {
+    fa = fa_ctx_regexp_fa(&ctx, strs[i], &errstr, &errpos);
+    if (!fa != !fas[i] ||
+        (fa && (fa->states_n != fas[i]->states_n ||
+                fa->trans_n != fas[i]->trans_n)) ||
+        (!fa && errpos != errposs[i]))
+      fprintf(stderr, "cache: %s\n", strs[i]);
+    if (fa)
+      fa_destroy(fa);
+    else
+      free(errstr);
+    if (fas[i])
+      fa_destroy(fas[i]);
+    else
+      free(errstrs[i]);
+  }
+}
+
+// sim file written out of core is the same as a sim from the csr
+static void test_sim_file(void) {
+  char *regexps[] = {"(a|b)*a(a|b){6}", "^[a-c]+x$", "a"};
+  int n = sizeof(regexps) / sizeof(regexps[0]);
+  fa_t *fal[sizeof(regexps) / sizeof(regexps[0])];
+  char path[] = "/tmp/faregress_sim_XXXXXX";
+  fa_csr_t *csr, *dcsr;
+  fa_sim_t *sim, *msim;
+  struct rlimit rl, old_rl;
+  fa_limit_t limit;
+  fa_t *fa;
+  int errpos;
+  char *errstr;
+  int fd;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    fal[i] = fa_regexp_fa(regexps[i], &errstr, &errpos, NULL);
+    fa_set_accepting_opaque(fal[i], (void *)(intptr_t)(i + 1));
+  }
+  fa = fa_union_list(fal, n);
+  csr = fa_csr_create(fa);
+  fa_destroy(fa);
+
+  fd = mkstemp(path);
+  close(fd);
+
+  dcsr = fa_csr_determinize_ex(csr, test_compile_pri, NULL, NULL);
+  sim = fa_sim_create_csr(dcsr);
+  fa_csr_destroy(dcsr);
+
+  if (fa_csr_determinize_sim_file(csr, test_compile_pri, NULL, NULL, path,
+                                  "/tmp") != 0 ||
+     !(msim = fa_sim_mmap(path))) {
+    fprintf(stderr, "sim file: failed\n");
+  } else {
+    if (msim->start != sim->start || msim->nodes_n != sim->nodes_n ||
+       memcmp(msim->nodes, sim->nodes,
+              sizeof(sim->nodes[0]) * sim->nodes_n))
+      fprintf(stderr, "sim file: differ\n");
+    fa_sim_munmap(msim);
+  }
+  fa_sim_destroy(sim);
+
+  limit.states = 5;
+  limit.trans = 1000;
+  if (fa_csr_determinize_sim_file(csr, NULL, &limit, NULL, path,
+                                  "/tmp") != -1)
+    fprintf(stderr, "sim file: limit not reached\n");
+
+  // sim file can not grow past the file size limit
+  getrlimit(RLIMIT_FSIZE, &rl);
+  old_rl = rl;
+  rl.rlim_cur = 100000;
+  setrlimit(RLIMIT_FSIZE, &rl);
+  signal(SIGXFSZ, SIG_IGN);
+  if (fa_csr_determinize_sim_file(csr, test_compile_pri, NULL, NULL, path,
+                                  "/tmp") != -1 ||
+     access(path, F_OK) == 0)
+    fprintf(stderr, "sim file: grow error not returned\n");
+  setrlimit(RLIMIT_FSIZE, &old_rl);
+  signal(SIGXFSZ, SIG_DFL);
+
+  unlink(path);
+  fa_csr_destroy(csr);
+}
+
+// blowup shapes are found and simple patterns score low
+static void test_risk(void) {
+  struct {
+    char *re;
+    int min_score;
+    int max_score;
+    int pos; // first offender, 0 for none
+  } tests[] = {
+    {"(a|b)*a(a|b){10}$", 12, 20, 13},
+    {"a.{12}", 12, 20, 3},
+    {"^a.{12}", 0, 6, 0},
+    {"^abc$", 0, 4, 0},
+    {"[0-9]{3}-[0-9]{4}", 0, 6, 0},
+    {"^x(a*b?)*", 1, 6, 9},
+    {"", 0, 0, 0},
+    {"^", 0, 0, 0}
+  };
+  fa_regexp_risk_t risks[4];
+  int risks_n;
+  char *errstr;
+  int errpos;
+  int score;
+  int i;
+
+  for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    risks_n = sizeof(risks) / sizeof(risks[0]);
+    score = fa_regexp_risk(tests[i].re, 0, risks, &risks_n, &errstr,
+                           &errpos);
+    if (score < tests[i].min_score || score > tests[i].max_score)
+      fprintf(stderr, "risk: %s: score %d should be %d-%d\n", tests[i].re,
+              score, tests[i].min_score, tests[i].max_score);
+    if ((risks_n > 0 ? risks[0].pos : 0) != tests[i].pos)
+      fprintf(stderr, "risk: %s: offender at %d should be %d\n",
+              tests[i].re, risks_n > 0 ? risks[0].pos : 0, tests[i].pos);
+  }
+
+  risks_n = sizeof(risks) / sizeof(risks[0]);
+  if (fa_regexp_risk("a(b", 0, risks, &risks_n, &errstr, &errpos) != -1)
+    fprintf(stderr, "risk: parse error not reported\n");
+  free(errstr);
+}
+
+typedef void *(test_engine_create_f)(char *regexp);
+typedef int (test_engine_match_f)(void *engine, char *str, int len);
+typedef void (test_engine_destroy_f)(void *engine);
+
+static char *test_engine_regexps[] = {
+  "a{2,4}", "^a{2,4}$", "x.{3}b", "^(a|b){2,}$", "^[ab]{3,}x$", "^a{0,3}$",
+  "^(a*b)*$", "^$", "^(?i)A{2}b{1,3}$", "^(a{2,3}b?)+$", "(x{2}|b)*a{3}",
+  "^(a|)(b|x)?$", "^a((?i)B)x$", "^(a|b{2,}){3}x$", "^(a|b{0,2}){3}x$",
+  "^(ab){2,3}$", "^(?B0x61:8)b*$", "^(a|ab)(bx|x)$", "^(ab|a)*b{2}$"
+};
+
+// engine should match the same as a dfa of lowering for all strings over
+// "abx" up to 7 chars
+static void test_engine_vs_dfa(char *name, test_engine_create_f *create_cb,
+                               test_engine_match_f *match_cb,
+                               test_engine_destroy_f *destroy_cb) {
+  void *engine;
+  fa_t *fa, *dfa;
+  char str[8];
+  char *errstr;
+  int errpos;
+  int len, n, strs_n, v;
+  int i, j;
+
+  for (i = 0; i < sizeof(test_engine_regexps) /
+         sizeof(test_engine_regexps[0]); i++) {
+    fa = fa_regexp_fa_ex(test_engine_regexps[i], &errstr, &errpos, NULL, 1);
+    dfa = fa_determinize(fa);
+    fa_set_accepting_opaque(dfa, (void *)1);
+    fa_destroy(fa);
+    engine = create_cb(test_engine_regexps[i]);
+
+    // n is the string in base 3
+    for (len = 0, strs_n = 1; len < sizeof(str); len++, strs_n *= 3) {
+      for (n = 0; n < strs_n; n++) {
+        for (j = 0, v = n; j < len; j++, v /= 3)
+          str[j] = "abx"[v % 3];
+        str[len] = '\0';
+
+        if (match_cb(engine, str, len) != test_dfa_run(dfa, str))
+          fprintf(stderr, "%s: %s: \"%s\"\n", name, test_engine_regexps[i],
+                  str);
+      }
+    }
+
+    destroy_cb(engine);
+    fa_destroy(dfa);
+  }
+}
+
+// parse regexps into fal or exit, accepting opaques are the index as a
+// fa_matchset id in ms or index + 1 without
+static void test_regexps_fal(char **regexps, int n, fa_matchset_t *ms,
+                             fa_t **fal) {
+  char *errstr;
+  int errpos;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    fal[i] = fa_regexp_fa(regexps[i], &errstr, &errpos, NULL);
+    if (!fal[i]) {
+      fprintf(stderr, "%s: parse error at %d: %s\n", regexps[i], errpos,
+              errstr);
+      exit(1);
+    }
+    if (ms)
+      fa_matchset_set_accepting(ms, fal[i], i);
+    else
+      fa_set_accepting_opaque(fal[i], (void *)(intptr_t)(i + 1));
+  }
+}
+
+// sim of the minimized union of regexps, opaques as test_regexps_fal
+static fa_sim_t *test_regexps_sim(char **regexps, int n, fa_matchset_t *ms,
+                                  fa_state_pri_f *pri_cb,
+                                  fa_state_cmp_f *cmp_cb) {
+  fa_t **fal = malloc(sizeof(fal[0]) * n);
+  fa_sim_t *sim;
+  fa_t *fa, *tfa;
+
+  test_regexps_fal(regexps, n, ms, fal);
+  fa = fa_union_list(fal, n);
+  free(fal);
+  tfa = fa_determinize_ex(fa, pri_cb, NULL, NULL);
+  fa_destroy(fa);
+  fa = fa_minimize_ex(tfa, cmp_cb, NULL);
+  fa_destroy(tfa);
+  sim = fa_sim_create(fa);
+  fa_destroy(fa);
+
+  return sim;
+}
+
+static void *test_counter_create(char *regexp) {
+  char *errstr;
+  int errpos;
+
+  return fa_counter_regexp(regexp, 1, &errstr, &errpos);
+}
+
+static int test_counter_match(void *engine, char *str, int len) {
+  fa_counter_run_t *run;
+  int r;
+
+  // run in two parts
+  run = fa_counter_run_create(engine);
+  fa_counter_run_init(run);
+  r = fa_counter_run(run, (uint8_t *)str, len / 2);
+  if (r != FA_SIM_RUN_REJECT)
+    r = fa_counter_run(run, (uint8_t *)str + len / 2, len - len / 2);
+  fa_counter_run_destroy(run);
+
+  return r == FA_SIM_RUN_ACCEPT;
+}
+
+static void test_counter_destroy(void *engine) {
+  fa_counter_destroy(engine);
+}
+
+// counter matcher agrees with the dfa and runs repeats too large to expand
+static void test_counter(void) {
+  fa_counter_run_t *run;
+  fa_counter_t *fc;
+  uint8_t buf[5000];
+  int errpos;
+  char *errstr;
+
+  test_engine_vs_dfa("counter", test_counter_create, test_counter_match,
+                     test_counter_destroy);
+
+  fc = fa_counter_regexp("^[0-9a-f]{1,4096}$", 1, &errstr, &errpos);
+  run = fa_counter_run_create(fc);
+  memset(buf, 'a', sizeof(buf));
+  fa_counter_run_init(run);
+  if (fa_counter_run(run, buf, 4096) != FA_SIM_RUN_ACCEPT)
+    fprintf(stderr, "counter: 4096 chars not accepted\n");
+  fa_counter_run_init(run);
+  if (fa_counter_run(run, buf, 4097) == FA_SIM_RUN_ACCEPT)
+    fprintf(stderr, "counter: 4097 chars accepted\n");
+  if (fc->states_n > 4)
+    fprintf(stderr, "counter: repeat expanded to %d states\n", fc->states_n);
+  fa_counter_run_destroy(run);
+  fa_counter_destroy(fc);
+
+  fc = fa_counter_regexp("x.{500}y", 1, &errstr, &errpos);
+  run = fa_counter_run_create(fc);
+  buf[0] = 'x';
+  buf[501] = 'y';
+  if (fa_counter_run(run, buf, 502) != FA_SIM_RUN_ACCEPT)
+    fprintf(stderr, "counter: x.{500}y not accepted\n");
+  fa_counter_run_init(run);
+  if (fa_counter_run(run, buf, 501) == FA_SIM_RUN_ACCEPT)
+    fprintf(stderr, "counter: x.{499} accepted\n");
+  fa_counter_run_destroy(run);
+  fa_counter_destroy(fc);
+
+  if (fa_counter_regexp("a{3,2}", 1, &errstr, &errpos) || errpos != 2)
+    fprintf(stderr, "counter: min max error not reported\n");
+  if (fa_counter_regexp("a(b", 1, &errstr, &errpos))
+    fprintf(stderr, "counter: parse error not reported\n");
+  free(errstr);
+}
+
+static void test_simplify(void) {
+  struct {
+    char *regexp;
+    char *str;
+    int match;
+  } cases[] = {
+    {"^(a|ab|abc)$", "ab", 1},
+    {"^(a|ab|abc)$", "abcc", 0},
+    {"^(foo|foobar|bar)$", "foobar", 1},
+    {"^(foo|foobar|bar)$", "fooba", 0},
+    {"^(xa|ya|za)$", "ya", 1},
+    {"^(xa|ya|za)$", "y", 0},
+    {"^(a|b||c)$", "", 1},
+    {"^((a*)*)$", "aaa", 1},
+    {"^(a{2}){3}$", "aaaaaa", 1},
+    {"^(a{2}){3}$", "aaaa", 0},
+    {"^(a*b)*$", "a", 0},
+    {"^(a*b)*$", "aabb", 1},
+    {"^(a*b)?$", "a", 0},
+    {"^((x|cb)*|.)ab$", "xcab", 0},
+    {"^((?i)a|b)c$", "Bc", 1},
+    {"^((?i)a|b)c$", "bC", 0}
+  };
+  fa_regexp_node_t *root;
+  fa_t *dfa;
+  int errpos;
+  char *errstr;
+  int i;
+
+  for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    dfa = test_dfa_fa(cases[i].regexp, 1);
+    if (test_dfa_run(dfa, cases[i].str) != cases[i].match)
+      fprintf(stderr, "simplify: %s: \"%s\" should %smatch\n",
+              cases[i].regexp, cases[i].str, cases[i].match ? "" : "not ");
+    fa_destroy(dfa);
+  }
+
+  // single char branches end up as one class
+  root = fa_regexp_yacc_parse("a|b|[c-e]", 9, 1, &errstr, &errpos);
+  fa_regexp_node_flatten(root);
+  fa_regexp_node_simplify(root);
+  if (root->type != RE_CLASS)
+    fprintf(stderr, "simplify: a|b|[c-e] not a class\n");
+  fa_regexp_node_free(root);
+}
+
+static void *test_glushkov_create(char *regexp) {
+  fa_state_t *fs;
+  fa_trans_t *ft;
+  fa_t *gfa, *gdfa;
+  char *errstr;
+  int errpos;
+
+  gfa = fa_glushkov_regexp(regexp, 1, NULL, &errstr, &errpos);
+  LIST_FOREACH(fs, &gfa->states, link)
+    LIST_FOREACH(ft, &fs->trans, link)
+      if (ft->symfrom == FA_SYMBOL_E)
+        fprintf(stderr, "glushkov: %s: has epsilon\n", regexp);
+  gdfa = fa_determinize(gfa);
+  fa_set_accepting_opaque(gdfa, (void *)1);
+  fa_destroy(gfa);
+
+  return gdfa;
+}
+
+static int test_glushkov_match(void *engine, char *str, int len) {
+  return test_dfa_run(engine, str);
+}
+
+static void test_glushkov_destroy(void *engine) {
+  fa_destroy(engine);
+}
+
+// position automaton has no epsilons and matches the same as lowering
+static void test_glushkov(void) {
+  fa_ctx_t ctx;
+  fa_t *fa;
+  char *errstr;
+  int errpos;
+
+  test_engine_vs_dfa("glushkov", test_glushkov_create, test_glushkov_match,
+                     test_glushkov_destroy);
+
+  if (fa_glushkov_regexp("a{3,2}", 1, NULL, &errstr, &errpos) ||
+      errpos != 2)
+    fprintf(stderr, "glushkov: min max error not reported\n");
+
+  fa_ctx_init(&ctx);
+  ctx.flags = FA_CTX_F_GLUSHKOV | FA_CTX_F_MIN;
+  fa = fa_ctx_regexp_fa(&ctx, "^a[bc]{2}$", &errstr, &errpos);
+  if (fa->states_n != 4)
+    fprintf(stderr, "glushkov: ctx %d states\n", fa->states_n);
+  fa_destroy(fa);
+}
+
+static void *test_deriv_create(char *regexp) {
+  char *errstr;
+  int errpos;
+
+  return fa_deriv_regexp(regexp, 1, &errstr, &errpos);
+}
+
+static int test_deriv_match(void *engine, char *str, int len) {
+  int32_t state;
+  int i;
+
+  for (i = 0, state = 0; i < len; i++)
+    state = fa_deriv_next(engine, state, str[i]);
+
+  return fa_deriv_accepting(engine, state);
+}
+
+static void test_deriv_destroy(void *engine) {
+  fa_deriv_destroy(engine);
+}
+
+// derivative dfa matches the same as lowering, also when stepped lazily
+static void test_deriv(void) {
+  fa_limit_t limit = {.states = 10, .trans = 1000};
+  fa_ctx_t ctx;
+  fa_t *fa, *mfa;
+  char *errstr;
+  int errpos;
+
+  test_engine_vs_dfa("deriv", test_deriv_create, test_deriv_match,
+                     test_deriv_destroy);
+
+  if (fa_deriv_regexp("a{3,2}", 1, &errstr, &errpos) || errpos != 2)
+    fprintf(stderr, "deriv: min max error not reported\n");
+
+  // counted repeat gives the minimal dfa without minimizing
+  fa_ctx_init(&ctx);
+  ctx.flags = FA_CTX_F_DERIV;
+  fa = fa_ctx_regexp_fa(&ctx, "^[a-c]{3,30}x$", &errstr, &errpos);
+  ctx.flags = FA_CTX_F_DERIV | FA_CTX_F_MIN;
+  mfa = fa_ctx_regexp_fa(&ctx, "^[a-c]{3,30}x$", &errstr, &errpos);
+  if (fa->states_n != mfa->states_n)
+    fprintf(stderr, "deriv: %d states, minimal %d\n",
+            fa->states_n, mfa->states_n);
+  fa_destroy(fa);
+  fa_destroy(mfa);
+
+  ctx.limit = &limit;
+  if (fa_ctx_regexp_fa(&ctx, "^[a-c]{3,30}x$", &errstr, &errpos))
+    fprintf(stderr, "deriv: state limit not reported\n");
+}
+
+// match set of each string is all regexps matching it on their own
+static void test_matchset(void) {
+  char *regexps[] = {
+    "^a+$", "^a[a-c]*$", "^[ab]*b$", "^.*c$", "^(ab)+$", "a"
+  };
+  char *strs[] = {
+    "", "a", "aa", "ab", "abab", "bb", "cc", "ac", "b", "ba", "bca"
+  };
+  int n = sizeof(regexps) / sizeof(regexps[0]);
+  fa_t *fal[sizeof(regexps) / sizeof(regexps[0])];
+  fa_sim_t *sims[3];
+  fa_t *fa, *tfa;
+  fa_matchset_t *ms;
+  fa_matchset_set_t *set, *want;
+  fa_csr_t *csr, *tcsr;
+  fa_sim_run_t run;
+  uint32_t ids[sizeof(regexps) / sizeof(regexps[0])];
+  char *errstr;
+  int errpos;
+  int i, j, k, ids_n;
+
+  ms = fa_matchset_create();
+
+  sims[0] = test_regexps_sim(regexps, n, ms, fa_matchset_pri,
+                             fa_matchset_cmp);
+
+  test_regexps_fal(regexps, n, ms, fal);
+  fa = fa_union_list(fal, n);
+  csr = fa_csr_create(fa);
+  fa_destroy(fa);
+  tcsr = fa_csr_determinize_ex(csr, fa_matchset_pri, NULL, NULL);
+  fa_csr_destroy(csr);
+  csr = fa_csr_minimize_ex(tcsr, fa_matchset_cmp, NULL);
+  fa_csr_destroy(tcsr);
+  fa = fa_csr_fa(csr);
+  fa_csr_destroy(csr);
+  sims[1] = fa_sim_create(fa);
+  fa_destroy(fa);
+
+  test_regexps_fal(regexps, n, ms, fal);
+  fa = fa_compile_list(fal, n, fa_matchset_pri, fa_matchset_cmp, 2, NULL);
+  sims[2] = fa_sim_create(fa);
+  fa_destroy(fa);
+
+  for (i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+    ids_n = 0;
+    for (j = 0; j < n; j++) {
+      fa = fa_regexp_fa(regexps[j], &errstr, &errpos, NULL);
+      tfa = fa_determinize(fa);
+      fa_set_accepting_opaque(tfa, (void *)1);
+      if (test_dfa_run(tfa, strs[i]))
+        ids[ids_n++] = j;
+      fa_destroy(fa);
+      fa_destroy(tfa);
+    }
+    want = ids_n ? fa_matchset_get(ms, ids, ids_n) : NULL;
+
+    for (k = 0; k < 3; k++) {
+      fa_sim_run_init(sims[k], &run);
+      set = NULL;
+      if (fa_sim_run(sims[k], &run, (uint8_t *)strs[i], strlen(strs[i])) ==
+          FA_SIM_RUN_ACCEPT)
+        set = fa_matchset_of(run.opaque);
+      if (set != want)
+        fprintf(stderr, "matchset %d: %s: %d ids should be %d\n", k,
+                strs[i], set ? set->n : 0, ids_n);
+    }
+  }
+
+  for (k = 0; k < 3; k++)
+    fa_sim_destroy(sims[k]);
+
+  ids[0] = 3;
+  ids[1] = 1;
+  ids[2] = 3;
+  set = fa_matchset_get(ms, ids, 3);
+  if (set->n != 2 || set->ids[0] != 1 || set->ids[1] != 3 ||
+      set != fa_matchset_get(ms, &ids[1], 2))
+    fprintf(stderr, "matchset: set not interned\n");
+
+  fa_matchset_destroy(ms);
+}
+
+typedef struct test_scan_s {
+  uint32_t ids[16];
+  size_t offsets[16];
+  int n;
+} test_scan_t;
+
+static int test_scan_match(uint32_t id, size_t offset, void *ctx) {
+  test_scan_t *t = ctx;
+
+  if (t->n < 16) {
+    t->ids[t->n] = id;
+    t->offsets[t->n] = offset;
+  }
+  t->n++;
+
+  return 0;
+}
+
+// events across chunks with once and halt patterns
+static void test_scan(void) {
+  char *regexps[] = {"ab$", "b+$", "^x", "c$"};
+  uint32_t flags[] = {FA_SCAN_F_ALL, FA_SCAN_F_ALL, FA_SCAN_F_ONCE,
+                      FA_SCAN_F_HALT};
+  char *chunks[] = {"xa", "bbab", "cab"};
+  uint32_t ids[] = {2, 0, 1, 1, 0, 1, 3};
+  size_t offsets[] = {1, 3, 3, 4, 6, 6, 7};
+  uint32_t all_ids[] = {2, 2, 0, 1, 2};
+  size_t all_offsets[] = {1, 2, 3, 3, 3};
+  int n = sizeof(regexps) / sizeof(regexps[0]);
+  fa_matchset_t *ms;
+  struct iovec iov[sizeof(chunks) / sizeof(chunks[0])];
+  fa_scan_run_t run;
+  test_scan_t t;
+  fa_sim_t *sim;
+  int i, r;
+
+  ms = fa_matchset_create();
+  sim = test_regexps_sim(regexps, n, ms, fa_matchset_pri, fa_matchset_cmp);
+
+  memset(&t, 0, sizeof(t));
+  fa_scan_run_init(sim, &run, flags, n);
+  for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+    r = fa_scan(sim, &run, (uint8_t *)chunks[i], strlen(chunks[i]),
+                test_scan_match, &t);
+  if (r != FA_SIM_RUN_REJECT || run.offset != 7 ||
+      t.n != sizeof(ids) / sizeof(ids[0]) ||
+      memcmp(t.ids, ids, sizeof(ids)) ||
+      memcmp(t.offsets, offsets, sizeof(offsets)))
+    fprintf(stderr, "scan: %d events at offset %d\n", t.n, (int)run.offset);
+  fa_scan_run_free(&run);
+
+  // same events with chunks as segments
+  for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+    iov[i].iov_base = chunks[i];
+    iov[i].iov_len = strlen(chunks[i]);
+  }
+  memset(&t, 0, sizeof(t));
+  fa_scan_run_init(sim, &run, flags, n);
+  r = fa_scanv(sim, &run, iov, sizeof(chunks) / sizeof(chunks[0]),
+               test_scan_match, &t);
+  if (r != FA_SIM_RUN_REJECT || run.offset != 7 ||
+      t.n != sizeof(ids) / sizeof(ids[0]) ||
+      memcmp(t.ids, ids, sizeof(ids)) ||
+      memcmp(t.offsets, offsets, sizeof(offsets)))
+    fprintf(stderr, "scanv: %d events at offset %d\n", t.n, (int)run.offset);
+  fa_scan_run_free(&run);
+
+  // without flags all patterns report every offset
+  memset(&t, 0, sizeof(t));
+  fa_scan_run_init(sim, &run, NULL, 0);
+  fa_scan(sim, &run, (uint8_t *)"xab", 3, test_scan_match, &t);
+  if (t.n != sizeof(all_ids) / sizeof(all_ids[0]) ||
+      memcmp(t.ids, all_ids, sizeof(all_ids)) ||
+      memcmp(t.offsets, all_offsets, sizeof(all_offsets)))
+    fprintf(stderr, "scan: %d events without flags\n", t.n);
+  fa_scan_run_free(&run);
+
+  fa_sim_destroy(sim);
+  fa_matchset_destroy(ms);
+}
+
+// longest match with priority, same tokens however input is chunked
+static void test_lex(void) {
+  char *regexps[] = {"^if$", "^[a-z]+$", "^[0-9]+$", "^ +$", "^==?$"};
+  char *str = "if x==10 ifx\x01=a";
+  struct {
+    int opaque;
+    int start, end;
+  } want[] = {
+    {1, 0, 2}, {4, 2, 3}, {2, 3, 4}, {5, 4, 6}, {3, 6, 8}, {4, 8, 9},
+    {2, 9, 12}, {0, 12, 13}, {5, 13, 14}, {2, 14, 15}
+  };
+  int want_n = sizeof(want) / sizeof(want[0]);
+  int n = sizeof(regexps) / sizeof(regexps[0]);
+  fa_lex_token_t tokens[16];
+  int tokens_n = sizeof(tokens) / sizeof(tokens[0]);
+  fa_lex_run_t run;
+  fa_sim_t *sim;
+  int len = strlen(str);
+  int bounds[4];
+  int i, j, k, b, r, t;
+
+  sim = test_regexps_sim(regexps, n, NULL, test_compile_pri, state_cmp);
+
+  // split at i and j, k tokens at a time
+  for (i = 0; i <= len; i++) {
+    for (j = i; j <= len; j++) {
+      for (k = 1; k <= 3; k += 2) {
+        bounds[0] = 0;
+        bounds[1] = i;
+        bounds[2] = j;
+        bounds[3] = len;
+        fa_lex_run_init(sim, &run);
+        // each part then the end, call again while tokens is filled but
+        // never past the end of tokens
+        t = 0;
+        for (b = 0; b < 4 && t + k <= tokens_n; b++) {
+          if (b < 3)
+            r = fa_lex(sim, &run, (uint8_t *)str + bounds[b],
+                       bounds[b + 1] - bounds[b], &tokens[t], k);
+          else
+            r = fa_lex_end(sim, &run, &tokens[t], k);
+          t += r;
+          while (r == k && t + k <= tokens_n) {
+            if (b < 3)
+              r = fa_lex(sim, &run, NULL, 0, &tokens[t], k);
+            else
+              r = fa_lex_end(sim, &run, &tokens[t], k);
+            t += r;
+          }
+        }
+        fa_lex_run_free(&run);
+
+        if (t != want_n) {
+          fprintf(stderr, "lex %d %d %d: %d tokens\n", i, j, k, t);
+          continue;
+        }
+        for (r = 0; r < t; r++)
+          if ((intptr_t)tokens[r].opaque != want[r].opaque ||
+              tokens[r].start != want[r].start ||
+              tokens[r].end != want[r].end ||
+              tokens[r].matched != (want[r].opaque != 0))
+            fprintf(stderr, "lex %d %d %d: token %d %d-%d\n", i, j, k, r,
+                    (int)tokens[r].start, (int)tokens[r].end);
+      }
+    }
+  }
+
+  fa_sim_destroy(sim);
+}
+
+// flows stepped in interleaved batches end like one sim run over all data
+static void test_flow(void) {
+  char *datas[] = {"GET /abc", "GET /", "POST x", "XGET /a", "GE", ""};
+  int datas_n = sizeof(datas) / sizeof(datas[0]);
+  fa_flow_segment_t segs[7];
+  fa_flow_decision_t decisions[7];
+  int offsets[50];
+  int results[50];
+  int done[50];
+  fa_flow_table_t *ft;
+  fa_sim_run_t run;
+  fa_sim_t *sim;
+  fa_t *fa, *tfa;
+  char *errstr;
+  char *data;
+  int errpos;
+  int flow, open_n, segs_n, len;
+  int i, r;
+
+  fa = fa_regexp_fa("^(GET /a|POST)", &errstr, &errpos, NULL);
+  tfa = fa_determinize(fa);
+  fa_destroy(fa);
+  fa = fa_minimize(tfa);
+  fa_destroy(tfa);
+  sim = fa_sim_create(fa);
+  fa_destroy(fa);
+  ft = fa_flow_table_create(sim, 4);
+
+  memset(offsets, 0, sizeof(offsets));
+  memset(done, 0, sizeof(done));
+  flow = 0;
+  do {
+    // round robin segments of flows not done, data given in 1-3 bytes
+    segs_n = 0;
+    for (i = 0; i < 50 && segs_n < 7; i++, flow = (flow + 1) % 50) {
+      if (done[flow])
+        continue;
+      data = datas[flow % datas_n];
+      len = strlen(data) - offsets[flow];
+      if (len > flow % 3 + 1)
+        len = flow % 3 + 1;
+      segs[segs_n].flow = flow;
+      segs[segs_n].data = (uint8_t *)data + offsets[flow];
+      segs[segs_n].len = len;
+      segs_n++;
+      offsets[flow] += len;
+    }
+    if (segs_n == 0)
+      break;
+
+    r = fa_flow_table_run(ft, segs, segs_n, decisions);
+    for (i = 0; i < r; i++) {
+      results[decisions[i].flow] = decisions[i].result;
+      if (i > 0 && decisions[i].flow <= decisions[i - 1].flow)
+        fprintf(stderr, "flow: decisions not sorted\n");
+      if (decisions[i].final ||
+          offsets[decisions[i].flow] ==
+          strlen(datas[decisions[i].flow % datas_n]))
+        done[decisions[i].flow] = 1;
+    }
+  } while (1);
+
+  open_n = 0;
+  for (flow = 0; flow < 50; flow++) {
+    data = datas[flow % datas_n];
+    fa_sim_run_init(sim, &run);
+    r = fa_sim_run(sim, &run, (uint8_t *)data, strlen(data));
+    if (r != results[flow])
+      fprintf(stderr, "flow %d: %d should be %d\n", flow, results[flow], r);
+    open_n += r == FA_SIM_RUN_MORE;
+  }
+  if (ft->n != open_n)
+    fprintf(stderr, "flow: %d flows kept, %d open\n", ft->n, open_n);
+
+  fa_flow_table_destroy(ft);
+  fa_sim_destroy(sim);
+}
+
+static void test_job_progress(fa_job_t *job, fa_job_progress_t *p,
+                              void *opaque) {
+  (*(int *)opaque)++;
+}
+
+// job run in small steps gives the same dfa as running it all at once
+static void test_job(void) {
+  char *regexps[] = {"(a|b)*a(a|b){4}", "^[a-c]+x$", "a"};
+  char *strs[] = {"", "a", "abbbb", "aaaaa", "abx", "bbb", "x", "cax"};
+  int n = sizeof(regexps) / sizeof(regexps[0]);
+  fa_t *fal[sizeof(regexps) / sizeof(regexps[0])];
+  fa_limit_t limit;
+  fa_job_t *job;
+  fa_t *fa, *jfa, *ufa, *tfa;
+  int errpos;
+  char *errstr;
+  int progress;
+  int runs;
+  int r;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    fal[i] = fa_regexp_fa(regexps[i], &errstr, &errpos, NULL);
+    fa_set_accepting_opaque(fal[i], (void *)(intptr_t)(i + 1));
+  }
+  fa = fa_union_list(fal, n);
+
+  tfa = fa_determinize_ex(fa, test_compile_pri, NULL, NULL);
+  ufa = fa_minimize_ex(tfa, state_cmp, NULL);
+  fa_destroy(tfa);
+
+  job = fa_job_create(fa, test_compile_pri, state_cmp, NULL, FA_JOB_F_MIN);
+  progress = 0;
+  fa_job_progress(job, test_job_progress, &progress, 10);
+  // deadline already passed, nothing is done
+  fa_job_deadline(job, 1);
+  if (fa_job_run(job, 0) != FA_JOB_DEADLINE)
+    fprintf(stderr, "job: deadline not reached\n");
+  fa_job_deadline(job, 0);
+  for (runs = 0; (r = fa_job_run(job, 3)) == FA_JOB_SUSPENDED; runs++)
+    ;
+  if (r != FA_JOB_DONE || runs < 10 || progress < runs)
+    fprintf(stderr, "job: %d after %d runs %d progress\n", r, runs, progress);
+
+  jfa = fa_job_result(job);
+  fa_job_destroy(job);
+  for (i = 0; i < sizeof(strs) / sizeof(strs[0]); i++)
+    if (test_dfa_run(jfa, strs[i]) != test_dfa_run(ufa, strs[i]))
+      fprintf(stderr, "job: %s: %d should be %d\n", strs[i],
+              (int)test_dfa_run(jfa, strs[i]),
+              (int)test_dfa_run(ufa, strs[i]));
+  if (jfa->states_n != ufa->states_n)
+    fprintf(stderr, "job: %d states should be %d\n", jfa->states_n,
+            ufa->states_n);
+  fa_destroy(jfa);
+  fa_destroy(ufa);
+
+  limit.states = 5;
+  limit.trans = 1000;
+  job = fa_job_create(fa, NULL, NULL, &limit, 0);
+  if (fa_job_run(job, 0) != FA_JOB_LIMIT || fa_job_result(job))
+    fprintf(stderr, "job: limit not reached\n");
+  fa_job_destroy(job);
+
   fa_destroy(fa);
 }
 
@@ -845,6 +2123,27 @@ int main(int argc, char **argv) {
   fa_init();
 
   test_misc();
+  test_string_set(0);
+  test_string_set(1);
+  test_ac();
+  test_dfa();
+  test_compile(0);
+  test_compile(4);
+  test_csr_parallel(1);
+  test_csr_parallel(4);
+  test_job();
+  test_risk();
+  test_counter();
+  test_simplify();
+  test_glushkov();
+  test_deriv();
+  test_matchset();
+  test_scan();
+  test_lex();
+  test_flow();
+  test_sim_file();
+  test_ctx();
+  test_cache();
 
   while (1) {
     int c;
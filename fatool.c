@@ -11,12 +11,19 @@
 #include <string.h>
 #include <stdarg.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #include "fa.h"
+#include "fa_csr.h"
+#include "fa_compile.h"
 #include "fa_graphviz.h"
 #include "fa_graphviz_tikz.h"
 #include "fa_text.h"
 #include "fa_regexp.h"
+#include "fa_regexp_risk.h"
+#include "fa_glushkov.h"
+#include "fa_deriv.h"
+#include "fa_string_set.h"
 #include "fa_sim.h"
 #include "fa_misc.h"
 
@@ -78,9 +85,121 @@ static fa_t *fa_regexp_input(char *arg) {
   return fa;
 }
 
+static void fa_regexp_risk_report(char *arg) {
+  fa_regexp_risk_t risks[16];
+  int risks_n = ARRAYSIZEOF(risks);
+  char *errstr = NULL;
+  int errpos;
+  int score;
+  int i;
+
+  score = fa_regexp_risk(arg, fa_regexp_class_dot_all, risks, &risks_n,
+                         &errstr, &errpos);
+  // parse errors are reported by fa_regexp_input
+  if (score == -1)
+    return;
+
+  fprintf(stderr, "RISK[%s] score=%d\n", arg, score);
+  for (i = 0; i < risks_n; i++) {
+    fprintf(stderr, "%s (%d bits)\n", risks[i].reason, risks[i].bits);
+    point_out(stderr, 40, arg, risks[i].pos);
+  }
+}
+
+static fa_t *fa_glushkov_input(char *arg) {
+  fa_t *fa;
+  char *errstr = NULL;
+  int errpos;
+
+  fa = fa_glushkov_regexp(arg, fa_regexp_class_dot_all, NULL, &errstr,
+                          &errpos);
+
+  if (errstr) {
+    fprintf(stderr, "Failed, %s at position %d:\n", errstr, errpos);
+    point_out(stderr, 40, arg, errpos);
+
+    return NULL;
+  }
+
+  return fa;
+}
+
+static fa_t *fa_deriv_input(char *arg) {
+  fa_deriv_t *d;
+  fa_t *fa;
+  char *errstr = NULL;
+  int errpos;
+
+  d = fa_deriv_regexp(arg, fa_regexp_class_dot_all, &errstr, &errpos);
+
+  if (errstr) {
+    fprintf(stderr, "Failed, %s at position %d:\n", errstr, errpos);
+    point_out(stderr, 40, arg, errpos);
+
+    return NULL;
+  }
+
+  fa = fa_deriv_fa(d, NULL, NULL);
+  fa_deriv_destroy(d);
+
+  return fa;
+}
+
+// one string per line
+static fa_t *fa_strings_input(char *arg) {
+  FILE *s;
+  fa_t *fa;
+  uint8_t **strs = NULL;
+  int *lens = NULL;
+  int n = 0;
+  int alloc_n = 0;
+  char buf[4096];
+  int i;
+
+  if (strcmp(arg, "-") == 0)
+    s = stdin;
+  else {
+    s = fopen(arg, "rb");
+    if (s == NULL)
+      return NULL;
+  }
+
+  while (fgets(buf, sizeof(buf), s)) {
+    int len = strlen(buf);
+
+    if (len > 0 && buf[len - 1] == '\n')
+      len--;
+
+    if (n == alloc_n) {
+      alloc_n = alloc_n ? alloc_n * 2 : 64;
+      strs = realloc(strs, sizeof(strs[0]) * alloc_n);
+      lens = realloc(lens, sizeof(lens[0]) * alloc_n);
+    }
+    strs[n] = malloc(MMAX(len, 1));
+    memcpy(strs[n], buf, len);
+    lens[n] = len;
+    n++;
+  }
+
+  if (s != stdin)
+    fclose(s);
+
+  fa = fa_string_set(strs, lens, n, NULL, 0);
+
+  for (i = 0; i < n; i++)
+    free(strs[i]);
+  free(strs);
+  free(lens);
+
+  return fa;
+}
+
 format_t formats[] = {
   {"text:", fa_text_input, fa_text_output},
   {"re:", fa_regexp_input, NULL},
+  {"glushkov:", fa_glushkov_input, NULL},
+  {"deriv:", fa_deriv_input, NULL},
+  {"strings:", fa_strings_input, NULL},
   {"dot:", NULL, fa_graphviz_output},
   {"dottikz:", NULL, fa_graphviz_tikz_output},
   {NULL, NULL, NULL}
@@ -129,11 +248,16 @@ static void pattern_overlap(pattern_t *pat, pattern_t *o) {
   pat->overlap_n++;
 }
 
+// called from compile threads with --threads
+static pthread_mutex_t state_pri_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static void *state_pri(void **opaques, int opaques_n) {
   pattern_t **pl = (pattern_t**)opaques;
   pattern_t *w;
   int i;
 
+  pthread_mutex_lock(&state_pri_lock);
+
   w = pl[0];
   for (i = 1; i < opaques_n; i++)
     if (pl[i]->n < w->n)
@@ -143,6 +267,8 @@ static void *state_pri(void **opaques, int opaques_n) {
     if (pl[i] != w)
       pattern_overlap(pl[i], w);
 
+  pthread_mutex_unlock(&state_pri_lock);
+
   return w;
 }
 
@@ -162,6 +288,9 @@ static void count_accepting(void *opaque) {
 int main(int argc, char **argv) {
   int dfa = 0;
   int min = 0;
+  int csr = 0;
+  int threads = 0;
+  int risk = 0;
   char *label = NULL;
   char *in = NULL;
   char *out = NULL;
@@ -186,11 +315,14 @@ int main(int argc, char **argv) {
       {"label", 1, NULL, 'l'},
       {"dfa", 0, &dfa, 1},
       {"min", 0, &min, 1},
+      {"csr", 0, &csr, 1},
+      {"threads", 1, NULL, 'j'},
+      {"risk", 0, &risk, 1},
       {"test", 1, NULL, 't'},
       {0, 0, 0, 0}
     };
 
-    c = getopt_long(argc, argv, "i:o:l:dmt:", options, &index);
+    c = getopt_long(argc, argv, "i:o:l:dmt:j:", options, &index);
     if (c == -1)
       break;
 
@@ -234,6 +366,9 @@ int main(int argc, char **argv) {
       case 't':
         test = optarg;
         break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
       case '?':
         break;
       default:
@@ -248,6 +383,21 @@ int main(int argc, char **argv) {
     exit(1);
   }
 
+  if (risk) {
+    for (i = 0; i < inpat_n; i++) {
+      char *s = inpat[i]->in;
+
+      inh = get_format(&s);
+      if (inh->input == fa_regexp_input ||
+          inh->input == fa_glushkov_input ||
+          inh->input == fa_deriv_input)
+        fa_regexp_risk_report(s);
+    }
+
+    if (test == NULL && !out)
+      exit(0);
+  }
+
   if (test == NULL && !out) {
     fprintf(stderr, "please specify --out or --test %p\n", test);
     exit(1);
@@ -272,13 +422,48 @@ int main(int argc, char **argv) {
               inpat[i]->fa->trans_n);
     }
 
-    fa = fa_union_list(infa, inpat_n);
+    if (threads > 0 && min) {
+      // determinize and minimize each pattern and merge the DFAs
+      fa = fa_compile_list(infa, inpat_n, state_pri, state_cmp, threads,
+                           NULL);
+      fprintf(stderr, "MDFA: states=%d trans=%d\n",
+              fa->states_n, fa->trans_n);
+      dfa = min = 0;
+    } else {
+      fa = fa_union_list(infa, inpat_n);
+      fprintf(stderr, "NFA: states=%d trans=%d\n",
+              fa->states_n, fa->trans_n);
+    }
     free(infa);
   } else {
     fa = inpat[0]->fa;
+    fprintf(stderr, "NFA: states=%d trans=%d\n", fa->states_n, fa->trans_n);
   }
 
-  fprintf(stderr, "NFA: states=%d trans=%d\n", fa->states_n, fa->trans_n);
+  if (csr && (dfa || min)) {
+    fa_csr_t *c, *tc;
+
+    c = fa_csr_create(fa);
+    fa_destroy(fa);
+
+    if (dfa) {
+      tc = fa_csr_determinize_ex(c, state_pri, NULL, NULL);
+      fa_csr_destroy(c);
+      c = tc;
+      fprintf(stderr, "DFA: states=%d trans=%d\n", c->states_n, c->trans_n);
+    }
+
+    if (min) {
+      tc = fa_csr_minimize_ex(c, state_cmp, NULL);
+      fa_csr_destroy(c);
+      c = tc;
+      fprintf(stderr, "MDFA: states=%d trans=%d\n", c->states_n, c->trans_n);
+    }
+
+    fa = fa_csr_fa(c);
+    fa_csr_destroy(c);
+    dfa = min = 0;
+  }
 
   if (dfa) {
     tfa = fa;